@@ -9,26 +9,73 @@
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <fcntl.h>
+#include <time.h>
 #include "../src/lab.h"
+#include "../src/parse.h"
+#include "../src/exec.h"
+#include "../src/jobs.h"
+#include "../src/prompt.h"
+#include "../src/histlog.h"
+#include "../src/histsearch.h"
+#include "../src/histshare.h"
+#include "../src/histcmd.h"
+#include "../src/complete.h"
+#include "../src/source.h"
+#include "../src/func.h"
+#include "../src/util.h"
 
-static void explain_waitpid(int status)
+/*
+Keep reading continuation lines until the parser has a complete command,
+for example the body of a heredoc or the rest of a quoted string. Takes
+ownership of line and returns the parsed tree, the full text is stored
+in text for the history.
+*/
+static struct ast *read_command(char *line, char **text)
 {
-  if (!WIFEXITED(status))
+  char *buf = line;
+  int status;
+  struct ast *ast;
+  while ((ast = ast_parse(buf, &status)) && status == PARSE_INCOMPLETE)
   {
-    fprintf(stderr, "Child exited with status %d\n", WEXITSTATUS(status));
-  }
-  if (WIFSIGNALED(status))
-  {
-    fprintf(stderr, "Child exited via signal %d\n", WTERMSIG(status));
+    ast_free(ast);
+    char *more = readline("> ");
+    if (!more)
+    {
+      fprintf(stderr, "lab: syntax error: unexpected end of file\n");
+      *text = buf;
+      return NULL;
+    }
+    size_t len = strlen(buf);
+    buf = xrealloc(buf, len + strlen(more) + 2);
+    buf[len] = '\n';
+    strcpy(buf + len + 1, more);
+    free(more);
   }
-  if (WIFSTOPPED(status))
+  *text = buf;
+  if (status == PARSE_ERROR)
   {
-    fprintf(stderr, "Child stopped by %d\n", WSTOPSIG(status));
+    fprintf(stderr, "lab: %s\n", ast->error);
+    ast_free(ast);
+    return NULL;
   }
-  if (WIFCONTINUED(status))
+  return ast;
+}
+
+// The shell whose prompt is refreshed while readline waits for input
+static struct shell *prompt_shell;
+
+/*
+Called by readline while it waits for a key. Redraws the prompt when the
+worker has new values for async segments such as the git branch.
+*/
+static int prompt_refresh(void)
+{
+  if (prompt_async_update(prompt_shell->ps))
   {
-    fprintf(stderr, "Child was resumed by delivery of SIGCONT\n");
+    rl_set_prompt(prompt_shell->ps->rendered);
+    rl_forced_update_display();
   }
+  return 0;
 }
 
 // Set up signal handlers
@@ -41,77 +88,160 @@ void setup_signal_handlers(void){
 }
 
 
+// Run ~/.labrc, parsed only when it changed since the last shell
+static void run_rc(struct shell *sh)
+{
+  const char *home = getenv("HOME");
+  if (!home || !*home)
+  {
+    return;
+  }
+  char *path = xmalloc(strlen(home) + sizeof("/.labrc"));
+  strcpy(path, home);
+  strcat(path, "/.labrc");
+  source_rc(sh, path);
+  free(path);
+}
+
+/*
+lab -c command [name [arg ...]] runs the command after the rc file, the
+arguments after name are its positional parameters as for a script.
+*/
+static int run_command(struct shell *sh, char **argv)
+{
+  if (!argv[1])
+  {
+    fprintf(stderr, "lab: -c: option requires an argument\n");
+    return 2;
+  }
+  run_rc(sh);
+  if (!argv[2] || !argv[3])
+  {
+    return exec_string(sh, argv[1]);
+  }
+  int status;
+  struct ast *ast = ast_parse(argv[1], &status);
+  if (status == PARSE_OK)
+  {
+    status = func_run(sh, ast, argv + 2);
+  }
+  else
+  {
+    fprintf(stderr, "lab: %s\n", status == PARSE_ERROR ? ast->error : "syntax error: unexpected end of file");
+    sh->status = status = 2;
+  }
+  ast_free(ast);
+  return status;
+}
+
 int main(int argc, char *argv[])
 {
-  parse_args(argc, argv);
+  int script = parse_args(argc, argv);
+  if (script < argc && strcmp(argv[script], "-c") == 0)
+  {
+    struct shell sh = {0};
+    int status = run_command(&sh, argv + script);
+    sh_destroy(&sh);
+    exit(status);
+  }
+  // lab file [arg ...] runs the file without a terminal, prompt or history
+  if (script < argc)
+  {
+    struct shell sh = {0};
+    int status = source_file(&sh, argv[script], argv + script);
+    sh_destroy(&sh);
+    exit(status);
+  }
   struct shell sh;
   sh_init(&sh);
+  run_rc(&sh);
 
   // Set up signal handlers
   setup_signal_handlers();
 
   char *line = (char *)NULL;
+  prompt_shell = &sh;
+  histsearch_bind(&sh);
+  // Command names for Tab are collected in the background
+  complete_init(&sh);
+  // LINES and COLUMNS would otherwise go straight into environ, behind the
+  // back of the shell variables
+  rl_change_environment = 0;
 
-  // Set the prompt
-  while ((line = readline(sh.prompt)))
+  for (;;)
   {
+    // Report finished background jobs before the prompt
+    jobs_notify(&sh);
+    // Commands other shells ran since the last prompt
+    history_sync(&sh);
+    // Set the prompt, only the parts that changed are rendered again
+    // Off a terminal readline would spin in the hook at end of file
+    rl_event_hook = sh.shell_is_interactive ? prompt_refresh : NULL;
+    line = readline(prompt_render(&sh, sh.ps));
+    // Continuation lines have their own prompt
+    rl_event_hook = NULL;
+    if (!line)
+    {
+      break;
+    }
     // do nothing on blank lines don't save history or attempt to exec
-    line = trim_white(line);
-    if (!*line)
+    char *trimmed = trim_white(line);
+    if (!*trimmed)
     {
       free(line);
       continue;
     }
-    add_history(line);
-    // check to see if we are launching a built in command
-    char **cmd = cmd_parse(line);
-    if (!do_builtin(&sh, cmd))
+    memmove(line, trimmed, strlen(trimmed) + 1);
+    // History expansion, the result is shown before it runs
+    char *expanded;
+    int hx = hist_expand_line(&sh, line, &expanded);
+    if (hx < 0)
     {
-      pid_t pid = fork();
-      // If fork failed we are in trouble!
-      if (pid == 0)
-      {
-        /*This is the child process*/
-        pid_t child = getpid();
-        setpgid(child, child);
-        tcsetpgrp(sh.shell_terminal, child);
-        signal(SIGINT, SIG_DFL);
-        signal(SIGQUIT, SIG_DFL);
-        signal(SIGTSTP, SIG_DFL);
-        signal(SIGTTIN, SIG_DFL);
-        signal(SIGTTOU, SIG_DFL);
-        execvp(cmd[0], cmd);
-        // If execvp failed we are in trouble!
-        perror("execvp failed");
-        exit(EXIT_FAILURE);
-      }
-      else if (pid < 0)
-      {
-        // If fork failed we are in trouble!
-        perror("fork return < 0 Process creation failed!");
-        abort();
-      }
-      /*
-      This is in the parent put the child process into its own
-      process group and give it control of the terminal
-      to avoid a race condition
-      */
-      // printf("shell:%d , child%d\n",sh.shell_pgid, pid);
-      setpgid(pid, pid);
-      tcsetpgrp(sh.shell_terminal, pid);
-      int status;
-      int rval = waitpid(pid, &status, 0);
-      if (rval == -1)
-      {
-        fprintf(stderr, "Wait pid failed with -1\n");
-        explain_waitpid(status);
-      }
-
-      cmd_free(cmd);
-      // get control of the shell
-      tcsetpgrp(sh.shell_terminal, sh.shell_pgid);
+      free(line);
+      sh.status = 1;
+      continue;
+    }
+    if (hx > 0)
+    {
+      printf("%s\n", expanded);
+      free(line);
+      line = expanded;
+    }
+    // A line that ran before is not parsed again
+    char *text = line;
+    struct ast *ast = hist_ast_take(&sh, line);
+    if (!ast)
+    {
+      ast = read_command(line, &text);
+    }
+    add_history(text);
+    if (sh.hsearch)
+    {
+      histsearch_add(sh.hsearch, text, strlen(text));
+    }
+    if (ast)
+    {
+      struct timespec start, end;
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      exec_ast(&sh, ast);
+      clock_gettime(CLOCK_MONOTONIC, &end);
+      sh.duration_ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+      hist_ast_keep(&sh, text, ast);
+    }
+    else
+    {
+      sh.status = 2;
+      sh.duration_ms = 0;
+    }
+    if (sh.hist && histlog_add(sh.hist, text, sh.status, sh.duration_ms) < 0)
+    {
+      perror("history");
+    }
+    if (sh.share)
+    {
+      histshare_publish(sh.share, text);
     }
-    free(line);
+    free(text);
   }
   // Might be good to have this here :)
   sh_destroy(&sh);
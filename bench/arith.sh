@@ -0,0 +1,8 @@
+# A counter loop, every step is arithmetic
+i=0
+sum=0
+while case $((i < 20000)) in 1) true ;; *) false ;; esac; do
+  sum=$((sum + i * 2 % 7))
+  i=$((i + 1))
+done
+echo $sum
@@ -0,0 +1,17 @@
+# Function calls with positional parameters inside a loop
+pick() {
+  case $1 in
+    *[02468]) even=$1 ;;
+    *) odd=$1 ;;
+  esac
+  shift
+  last=$#
+}
+for a in 0 1 2 3 4 5 6 7 8 9; do
+  for b in 0 1 2 3 4 5 6 7 8 9; do
+    for c in 0 1 2 3 4 5 6 7 8 9; do
+      pick $a$b$c x y
+    done
+  done
+done
+echo $even $odd $last
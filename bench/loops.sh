@@ -0,0 +1,15 @@
+# Nested loops with an assignment and a case in the body
+for a in 0 1 2 3 4 5 6 7 8 9; do
+  for b in 0 1 2 3 4 5 6 7 8 9; do
+    for c in 0 1 2 3 4 5 6 7 8 9; do
+      for d in 0 1 2 3 4 5 6 7 8 9; do
+        n=$a$b$c$d
+        case $d in
+          0|5) last=$n ;;
+          *) ;;
+        esac
+      done
+    done
+  done
+done
+echo $last
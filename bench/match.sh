@@ -0,0 +1,17 @@
+# case arms with wildcards against many generated names
+hits=0
+for a in alpha beta gamma delta epsilon zeta eta theta iota kappa; do
+  for b in 0 1 2 3 4 5 6 7 8 9; do
+    for c in .c .h .txt .o .md .sh .py .rs .go .js; do
+      name=src/$a/file_$b$c
+      case $name in
+        *[!a-z]/*.md) ;;
+        src/*a*/*_[0-4].[ch]) hits=x$hits ;;
+        */*e*a/*.txt | */?eta/*) hits=y$hits ;;
+        *[[:digit:]].[!m]?) hits=z$hits ;;
+        *) ;;
+      esac
+    done
+  done
+done
+echo $hits
@@ -0,0 +1,11 @@
+# while read over a file and over a pipe
+seq 200000 | sed 's/$/ some more words/' > /tmp/lab-bench-read
+n=0
+while read -r num rest; do
+  n=$((n + 1))
+done < /tmp/lab-bench-read
+seq 50000 | while read -r num; do
+  last=$num
+done
+rm -f /tmp/lab-bench-read
+echo $n
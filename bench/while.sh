@@ -0,0 +1,11 @@
+# A while loop counting with a string until it reaches a length
+s=
+while case $s in ????????????????????????????????????????????????) false ;; *) true ;; esac; do
+  s=x$s
+  for i in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20; do
+    for j in 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20; do
+      if case $j in 1?) true ;; *) false ;; esac; then t=$i$j; else t=$j; fi
+    done
+  done
+done
+echo $s $t
@@ -0,0 +1,314 @@
+#include "alias.h"
+#include "hmap.h"
+#include "lab.h"
+#include "parse.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static struct hmap aliases;
+// Changes whenever an alias is defined or removed
+static unsigned long generation;
+
+
+static void alias_unref(void *p) {
+    struct alias *a = p;
+    if (a == NULL || --a->refs > 0) {
+        return;
+    }
+    for (size_t i = 0; i < a->nwords; i++) {
+        free(a->words[i]);
+    }
+    free(a->words);
+    free(a->text);
+    free(a);
+}
+
+
+static bool valid_alias_name(const char *name, size_t n) {
+    if (n == 0) {
+        return false;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (strchr(" \t\n;&|<>()$`\\\"'=/", name[i]) != NULL) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+static bool is_reserved_word(const char *w) {
+    static const char *words[] = {
+        "if", "then", "else", "elif", "fi", "do", "done", "case", "esac",
+        "while", "until", "for", "in", "{", "}", "!", "[[", "]]", "function",
+    };
+    for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+        if (strcmp(w, words[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/*Split the body into raw words the way the parser would. Returns false
+* when it is not a simple command: an operator, a comment, a reserved
+* word or an assignment in front, which only the parser can deal with.*/
+static bool alias_split(struct alias *a) {
+    const char *s = a->text;
+    size_t len = strlen(s);
+    struct strvec words = {0};
+    for (size_t i = 0; i < len;) {
+        if (s[i] == ' ' || s[i] == '\t') {
+            i++;
+            continue;
+        }
+        size_t end = strchr(";&|<>()\n#", s[i]) ? 0 : parse_word_end(s, i, len);
+        if (end == 0) {
+            strvec_free(&words);
+            return false;
+        }
+        char *w = xstrndup(s + i, end - i);
+        strvec_push(&words, w);
+        if (is_reserved_word(w) || (words.n == 1 && strchr(w, '=') != NULL)) {
+            strvec_free(&words);
+            return false;
+        }
+        i = end;
+    }
+    a->nwords = words.n;
+    a->words = words.v ? words.v : xcalloc(1, sizeof(char *));
+    return true;
+}
+
+
+static void alias_define(const char *name, size_t n, const char *body) {
+    struct alias *a = xcalloc(1, sizeof(*a));
+    a->refs = 1;
+    a->text = xstrdup(body);
+    size_t len = strlen(body);
+    a->blank = len > 0 && (body[len - 1] == ' ' || body[len - 1] == '\t');
+    alias_split(a);
+    bool added;
+    struct hmap_entry *e = hmap_putn(&aliases, name, n, &added);
+    if (!added) {
+        alias_unref(e->value);
+    }
+    e->value = a;
+    generation++;
+}
+
+
+static struct alias *lookup(const char *name) {
+    return aliases.n ? hmap_get(&aliases, name) : NULL;
+}
+
+
+// Look up an alias
+const struct alias *alias_find(const char *name) {
+    return lookup(name);
+}
+
+
+/*The command as text with the body of alias a in place of word k*/
+static char *alias_text(const char **words, size_t n, size_t k, const struct alias *a) {
+    struct strbuf s = {0};
+    for (size_t i = 0; i < n; i++) {
+        if (i > 0) {
+            strbuf_addc(&s, ' ');
+        }
+        strbuf_adds(&s, i == k ? a->text : words[i]);
+    }
+    return strbuf_steal(&s);
+}
+
+
+static bool is_seen(const struct alias_use *use, const struct alias *a) {
+    for (size_t i = 0; i < use->n; i++) {
+        if (use->held[i] == a) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+static void hold(struct alias_use *use, struct alias *a) {
+    a->refs++;
+    use->held[use->n++] = a;
+}
+
+
+// Counter that changes whenever an alias is defined or removed
+unsigned long alias_generation(void) {
+    return generation;
+}
+
+
+// Copy the names of every alias
+void alias_names(struct strvec *out) {
+    for (size_t i = 0; i < aliases.cap; i++) {
+        if (aliases.tab[i].key != NULL) {
+            strvec_push(out, xstrdup(aliases.tab[i].key));
+        }
+    }
+}
+
+
+// Replace the alias in command position with the words of its body
+char *alias_expand(const char ***words, size_t *n, size_t first, struct alias_use *use) {
+    use->n = 0;
+    size_t k = first;
+    size_t after = 0;    // word to look up next when a body ended in a blank
+    while (k < *n && use->n < ALIAS_DEPTH) {
+        struct alias *a = lookup((*words)[k]);
+        if (a == NULL || a->active > 0 || is_seen(use, a)) {
+            if (after <= k) {
+                break;
+            }
+            k = after;
+            continue;
+        }
+        hold(use, a);
+        if (a->words == NULL) {
+            return alias_text(*words, *n, k, a);
+        }
+        size_t total = *n - 1 + a->nwords;
+        if (a->nwords > 1) {
+            *words = xrealloc(*words, total * sizeof(char *));
+        }
+        memmove(*words + k + a->nwords, *words + k + 1, (*n - k - 1) * sizeof(char *));
+        memcpy(*words + k, a->words, a->nwords * sizeof(char *));
+        *n = total;
+        // The body may start with another alias, which is looked up at
+        // the same place. A blank at its end makes the word after it a
+        // command name as well.
+        if (after > k) {
+            after += a->nwords - 1;
+        }
+        if (a->blank) {
+            after = k + a->nwords;
+        }
+    }
+    return NULL;
+}
+
+
+// Let go of the aliases a command was expanded with
+void alias_release(struct alias_use *use) {
+    for (size_t i = 0; i < use->n; i++) {
+        alias_unref(use->held[i]);
+    }
+    use->n = 0;
+}
+
+
+// Forget every alias
+void alias_free(void) {
+    hmap_free(&aliases, alias_unref);
+}
+
+
+static int name_cmp(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+
+static void alias_print(struct strbuf *out, const char *name, const struct alias *a) {
+    strbuf_adds(out, "alias ");
+    strbuf_adds(out, name);
+    strbuf_adds(out, "='");
+    for (const char *c = a->text; *c; c++) {
+        if (*c == '\'') {
+            strbuf_adds(out, "'\\''");
+        } else {
+            strbuf_addc(out, *c);
+        }
+    }
+    strbuf_adds(out, "'\n");
+}
+
+
+// List every alias sorted by name
+static int alias_list(void) {
+    struct strvec names = {0};
+    alias_names(&names);
+    qsort(names.v, names.n, sizeof(char *), name_cmp);
+    struct strbuf out = {0};
+    for (size_t i = 0; i < names.n; i++) {
+        alias_print(&out, names.v[i], alias_find(names.v[i]));
+    }
+    strvec_free(&names);
+    int rc = out.len > 0 && write_all(STDOUT_FILENO, out.s, out.len) < 0;
+    strbuf_free(&out);
+    return rc;
+}
+
+
+// The alias builtin
+int alias_builtin(struct shell *sh, char **argv) {
+    UNUSED(sh);
+    int i = 1;
+    if (argv[i] != NULL && strcmp(argv[i], "-p") == 0) {
+        i++;
+    }
+    if (argv[i] == NULL) {
+        return alias_list();
+    }
+    int rc = 0;
+    struct strbuf out = {0};
+    for (; argv[i]; i++) {
+        char *eq = strchr(argv[i], '=');
+        if (eq != NULL) {
+            if (!valid_alias_name(argv[i], eq - argv[i])) {
+                fprintf(stderr, "alias: `%.*s': invalid alias name\n", (int)(eq - argv[i]), argv[i]);
+                rc = 1;
+            } else {
+                alias_define(argv[i], eq - argv[i], eq + 1);
+            }
+            continue;
+        }
+        const struct alias *a = alias_find(argv[i]);
+        if (a == NULL) {
+            fprintf(stderr, "alias: %s: not found\n", argv[i]);
+            rc = 1;
+        } else {
+            alias_print(&out, argv[i], a);
+        }
+    }
+    if (out.len > 0 && write_all(STDOUT_FILENO, out.s, out.len) < 0) {
+        rc = 1;
+    }
+    strbuf_free(&out);
+    return rc;
+}
+
+
+// The unalias builtin
+int unalias_builtin(struct shell *sh, char **argv) {
+    UNUSED(sh);
+    if (argv[1] != NULL && strcmp(argv[1], "-a") == 0) {
+        hmap_free(&aliases, alias_unref);
+        generation++;
+        return 0;
+    }
+    if (argv[1] == NULL) {
+        fprintf(stderr, "unalias: usage: unalias [-a] name [name ...]\n");
+        return 2;
+    }
+    int rc = 0;
+    for (int i = 1; argv[i]; i++) {
+        struct alias *a = hmap_del(&aliases, argv[i]);
+        if (a == NULL) {
+            fprintf(stderr, "unalias: %s: not found\n", argv[i]);
+            rc = 1;
+        } else {
+            alias_unref(a);
+            generation++;
+        }
+    }
+    return rc;
+}
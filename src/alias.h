@@ -0,0 +1,140 @@
+#ifndef ALIAS_H
+#define ALIAS_H
+#include <stddef.h>
+#include <stdbool.h>
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+struct shell;
+struct strvec;
+
+// Aliases replaced inside each other at most this deep
+#define ALIAS_DEPTH 16
+
+
+/* An alias. The body is split into raw words once when it is defined
+* and those are spliced into each command that uses it. A body that is
+* more than a simple command, with operators or reserved words in it,
+* cannot be spliced and has words NULL. A command that borrows the words
+* or runs the text holds a reference, so the body outlives a redefinition
+* or unalias that happens meanwhile. */
+struct alias
+{
+char *text;          // the body as it was given
+char **words;        // raw words of the body, NULL when it is not a simple command
+size_t nwords;
+bool blank;          // the body ends in a blank, so the word after it is looked up too
+int active;          // its text is running, it is not replaced again meanwhile
+int refs;            // the table and every command that uses it
+};
+
+
+/* The aliases a command was expanded with, held until it is done with
+* their words */
+struct alias_use
+{
+struct alias *held[ALIAS_DEPTH];
+size_t n;
+};
+
+
+/**
+* @brief Look up an alias
+*
+* @param name The name, a raw word that has any quoting in it is never
+* an alias
+* @return const struct alias* The alias, NULL if there is none
+*/
+const struct alias *alias_find(const char *name);
+
+
+/**
+* @brief Counter that changes whenever an alias is defined or removed.
+* The completion trie, which holds the alias names, is out of date when
+* it changes.
+*
+* @return unsigned long The current generation
+*/
+unsigned long alias_generation(void);
+
+
+/**
+* @brief Copy the names of every alias, for completion
+*
+* @param out The names are appended here, each allocated with malloc
+*/
+void alias_names(struct strvec *out);
+
+
+/**
+* @brief Replace the alias in command position with the words of its
+* body. The first word of the body is looked up in turn unless it names
+* an alias that is already being replaced, and after a body that ends in
+* a blank the next word is looked up as well. The words of the body are
+* borrowed, not copied, and every alias used is held in use until
+* alias_release.
+*
+* @param words The raw words, an array allocated with malloc that may be
+* moved to make room
+* @param n The number of words, updated
+* @param first Index of the word in command position
+* @param use Set to the aliases used. When text is returned the last one
+* is the alias that is not a simple command, its active count is raised
+* while the text runs.
+* @return char* NULL when every alias was spliced in, otherwise the
+* whole command as text with the body of an alias that is not a simple
+* command put in, to be parsed and run instead. Free it with free.
+*/
+char *alias_expand(const char ***words, size_t *n, size_t first, struct alias_use *use);
+
+
+/**
+* @brief Let go of the aliases a command was expanded with, a body that
+* was replaced or removed meanwhile is freed with its last user
+*
+* @param use The aliases from alias_expand
+*/
+void alias_release(struct alias_use *use);
+
+
+/**
+* @brief Forget every alias
+*/
+void alias_free(void);
+
+
+/**
+* @brief The alias builtin.
+*
+*   alias [-p] [name[=value] ...]
+*
+* Defines each name=value, prints each name given alone and lists every
+* alias without arguments, in a form that can be read back.
+*
+* @param sh The shell
+* @param argv The arguments
+* @return int The exit status, 1 if a name is not an alias or not valid
+*/
+int alias_builtin(struct shell *sh, char **argv);
+
+
+/**
+* @brief The unalias builtin.
+*
+*   unalias [-a] name ...
+*
+* Removes the aliases, all of them with -a.
+*
+* @param sh The shell
+* @param argv The arguments
+* @return int The exit status, 1 if a name is not an alias
+*/
+int unalias_builtin(struct shell *sh, char **argv);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
@@ -0,0 +1,85 @@
+#include "arena.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdalign.h>
+
+
+static size_t align_up(size_t n) {
+    size_t a = alignof(max_align_t);
+    return (n + a - 1) & ~(a - 1);
+}
+
+
+// Allocate from an arena
+void *arena_alloc(struct arena *a, size_t n) {
+    n = align_up(n ? n : 1);
+    struct arena_chunk *c = a->cur;
+    if (c == NULL || c->size - c->used < n) {
+        // A spare chunk is reused when it is big enough, else dropped
+        c = a->spare;
+        if (c != NULL) {
+            a->spare = c->next;
+        }
+        if (c != NULL && c->size < n) {
+            free(c);
+            c = NULL;
+        }
+        if (c == NULL) {
+            size_t size = n > ARENA_CHUNK ? n : ARENA_CHUNK;
+            c = xmalloc(align_up(sizeof(struct arena_chunk)) + size);
+            c->size = size;
+        }
+        c->used = 0;
+        c->next = a->cur;
+        a->cur = c;
+    }
+    void *p = (char *)c + align_up(sizeof(struct arena_chunk)) + c->used;
+    c->used += n;
+    return p;
+}
+
+
+// Copy a string into an arena
+char *arena_strdup(struct arena *a, const char *s) {
+    size_t n = strlen(s) + 1;
+    return memcpy(arena_alloc(a, n), s, n);
+}
+
+
+// Remember the current position of an arena
+struct arena_mark arena_mark(const struct arena *a) {
+    struct arena_mark m = { a->cur, a->cur ? a->cur->used : 0 };
+    return m;
+}
+
+
+// Give back everything allocated since a mark was taken
+void arena_release(struct arena *a, struct arena_mark m) {
+    while (a->cur != NULL && a->cur != m.chunk) {
+        struct arena_chunk *c = a->cur;
+        a->cur = c->next;
+        c->next = a->spare;
+        a->spare = c;
+    }
+    if (a->cur != NULL) {
+        a->cur->used = m.used;
+    }
+}
+
+
+static void chunks_free(struct arena_chunk *c) {
+    while (c != NULL) {
+        struct arena_chunk *next = c->next;
+        free(c);
+        c = next;
+    }
+}
+
+
+// Free every chunk of an arena
+void arena_free(struct arena *a) {
+    chunks_free(a->cur);
+    chunks_free(a->spare);
+    a->cur = a->spare = NULL;
+}
@@ -0,0 +1,90 @@
+#ifndef ARENA_H
+#define ARENA_H
+#include <stddef.h>
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Smallest chunk the arena asks malloc for */
+#define ARENA_CHUNK 4096
+
+
+struct arena_chunk
+{
+struct arena_chunk *next;
+size_t size;         // bytes in data
+size_t used;
+char data[];
+};
+
+
+/* A bump allocator used as a stack. Everything allocated after a mark is
+* given back at once by arena_release, and the chunks are kept for the
+* next allocations so a steady state never calls malloc. */
+struct arena
+{
+struct arena_chunk *cur;   // chunk being filled, older chunks follow next
+struct arena_chunk *spare; // released chunks waiting to be used again
+};
+
+
+/* A position in an arena to release back to */
+struct arena_mark
+{
+struct arena_chunk *chunk;
+size_t used;
+};
+
+
+/**
+* @brief Allocate from an arena. The memory is aligned for any type and
+* stays valid until a mark taken before it is released.
+*
+* @param a The arena
+* @param n The number of bytes
+* @return void* The memory
+*/
+void *arena_alloc(struct arena *a, size_t n);
+
+
+/**
+* @brief Copy a string into an arena
+*
+* @param a The arena
+* @param s The string
+* @return char* The copy
+*/
+char *arena_strdup(struct arena *a, const char *s);
+
+
+/**
+* @brief Remember the current position of an arena
+*
+* @param a The arena
+* @return struct arena_mark The position
+*/
+struct arena_mark arena_mark(const struct arena *a);
+
+
+/**
+* @brief Give back everything allocated since a mark was taken
+*
+* @param a The arena
+* @param m The mark
+*/
+void arena_release(struct arena *a, struct arena_mark m);
+
+
+/**
+* @brief Free every chunk of an arena
+*
+* @param a The arena
+*/
+void arena_free(struct arena *a);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
@@ -0,0 +1,520 @@
+#include "arith.h"
+#include "expand.h"
+#include "hmap.h"
+#include "vars.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <inttypes.h>
+
+// Distinct expressions kept before the cache starts over
+#define ARITH_CACHE_MAX 512
+// Variables whose values are expressions again, nested this deep
+#define ARITH_MAXDEPTH 64
+
+
+enum arith_op
+{
+A_NUM,          // num
+A_VAR,          // the variable at name
+A_NEG, A_POS, A_NOT, A_BNOT,
+A_PREINC, A_PREDEC, A_POSTINC, A_POSTDEC,
+A_MUL, A_DIV, A_MOD,
+A_ADD, A_SUB,
+A_SHL, A_SHR,
+A_LT, A_LE, A_GT, A_GE,
+A_EQ, A_NE,
+A_BAND, A_XOR, A_BOR,
+A_LAND, A_LOR,
+A_COND,         // a ? b : c
+A_ASSIGN,       // variable a = b, or a op= b with the op in num
+A_COMMA,
+};
+
+
+struct anode
+{
+uint8_t op;
+int32_t a, b, c;
+int64_t num;
+uint32_t name;       // offset of a NUL terminated name in the pool
+};
+
+
+/* A parsed expression, the nodes refer to each other by index */
+struct arith_expr
+{
+struct anode *nodes;
+uint32_t n, cap;
+char *pool;
+uint32_t poollen, poolcap;
+int32_t root;
+};
+
+
+/* Operator tokens, longest first so that <<= wins over << and < */
+static const struct
+{
+const char *text;
+uint8_t op;          // binary op, or the op of a compound assignment
+uint8_t bp;          // binding power as an infix operator, 0 for none
+bool assign;
+} ops[] = {
+    { "<<=", A_SHL, 2, true }, { ">>=", A_SHR, 2, true },
+    { "*=", A_MUL, 2, true }, { "/=", A_DIV, 2, true }, { "%=", A_MOD, 2, true },
+    { "+=", A_ADD, 2, true }, { "-=", A_SUB, 2, true },
+    { "&=", A_BAND, 2, true }, { "^=", A_XOR, 2, true }, { "|=", A_BOR, 2, true },
+    { "<=", A_LE, 10, false }, { ">=", A_GE, 10, false },
+    { "==", A_EQ, 9, false }, { "!=", A_NE, 9, false },
+    { "&&", A_LAND, 5, false }, { "||", A_LOR, 4, false },
+    { "<<", A_SHL, 11, false }, { ">>", A_SHR, 11, false },
+    { "++", A_PREINC, 0, false }, { "--", A_PREDEC, 0, false },
+    { "*", A_MUL, 13, false }, { "/", A_DIV, 13, false }, { "%", A_MOD, 13, false },
+    { "+", A_ADD, 12, false }, { "-", A_SUB, 12, false },
+    { "<", A_LT, 10, false }, { ">", A_GT, 10, false },
+    { "&", A_BAND, 8, false }, { "^", A_XOR, 7, false }, { "|", A_BOR, 6, false },
+    { "=", A_ASSIGN, 2, true },
+    { "?", A_COND, 3, false },
+    { ",", A_COMMA, 1, false },
+    { "!", A_NOT, 0, false }, { "~", A_BNOT, 0, false },
+    { "(", 0, 0, false }, { ")", 0, 0, false }, { ":", 0, 0, false },
+};
+
+#define NOPS (sizeof(ops) / sizeof(ops[0]))
+#define PREFIX_BP 14
+
+
+struct aparser
+{
+struct arith_expr *x;
+const char *s;
+size_t pos, len;
+const char *error;
+};
+
+
+static struct hmap cache;
+
+
+static int32_t anode_new(struct arith_expr *x, uint8_t op) {
+    if (x->n == x->cap) {
+        x->cap = x->cap ? x->cap * 2 : 8;
+        x->nodes = xrealloc(x->nodes, x->cap * sizeof(struct anode));
+    }
+    struct anode *a = &x->nodes[x->n];
+    memset(a, 0, sizeof(*a));
+    a->op = op;
+    a->a = a->b = a->c = -1;
+    return x->n++;
+}
+
+
+static uint32_t name_add(struct arith_expr *x, const char *s, size_t n) {
+    if (x->poollen + n + 1 > x->poolcap) {
+        x->poolcap = (x->poollen + n + 1) * 2;
+        x->pool = xrealloc(x->pool, x->poolcap);
+    }
+    uint32_t off = x->poollen;
+    memcpy(x->pool + off, s, n);
+    x->pool[off + n] = '\0';
+    x->poollen += n + 1;
+    return off;
+}
+
+
+static void arith_expr_free(void *p) {
+    struct arith_expr *x = p;
+    if (x != NULL) {
+        free(x->nodes);
+        free(x->pool);
+        free(x);
+    }
+}
+
+
+static void skip_space(struct aparser *p) {
+    while (p->pos < p->len && isspace((unsigned char)p->s[p->pos])) {
+        p->pos++;
+    }
+}
+
+
+// The operator at the current position, -1 for none
+static int op_at(struct aparser *p) {
+    skip_space(p);
+    for (size_t i = 0; i < NOPS; i++) {
+        size_t n = strlen(ops[i].text);
+        if (p->pos + n <= p->len && memcmp(p->s + p->pos, ops[i].text, n) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+
+static bool accept(struct aparser *p, const char *text) {
+    int i = op_at(p);
+    if (i >= 0 && strcmp(ops[i].text, text) == 0) {
+        p->pos += strlen(text);
+        return true;
+    }
+    return false;
+}
+
+
+static int32_t parse_expr(struct aparser *p, int minbp);
+
+
+// A number, a variable, a parenthesized expression or a prefix operator
+static int32_t parse_prefix(struct aparser *p) {
+    struct arith_expr *x = p->x;
+    skip_space(p);
+    if (p->pos >= p->len) {
+        p->error = "syntax error: operand expected";
+        return -1;
+    }
+    const char *s = p->s + p->pos;
+    if (isdigit((unsigned char)*s)) {
+        char *end;
+        uint64_t v = strtoull(s, &end, 0);
+        if (end > p->s + p->len || isalnum((unsigned char)*end) || *end == '_') {
+            p->error = "value too great for base";
+            return -1;
+        }
+        int32_t n = anode_new(x, A_NUM);
+        x->nodes[n].num = (int64_t)v;
+        p->pos = end - p->s;
+        return n;
+    }
+    if (isalpha((unsigned char)*s) || *s == '_') {
+        size_t k = 0;
+        while (p->pos + k < p->len && (isalnum((unsigned char)s[k]) || s[k] == '_')) {
+            k++;
+        }
+        int32_t n = anode_new(x, A_VAR);
+        x->nodes[n].name = name_add(x, s, k);
+        p->pos += k;
+        if (accept(p, "++") || accept(p, "--")) {
+            int32_t post = anode_new(x, p->s[p->pos - 1] == '+' ? A_POSTINC : A_POSTDEC);
+            x->nodes[post].a = n;
+            return post;
+        }
+        return n;
+    }
+    if (accept(p, "(")) {
+        int32_t n = parse_expr(p, 1);
+        if (n >= 0 && !accept(p, ")")) {
+            p->error = "missing `)'";
+            return -1;
+        }
+        return n;
+    }
+    int i = op_at(p);
+    uint8_t op;
+    if (i < 0) {
+        p->error = "syntax error: operand expected";
+        return -1;
+    }
+    switch (ops[i].op) {
+    case A_SUB: op = A_NEG; break;
+    case A_ADD: op = A_POS; break;
+    case A_NOT: op = A_NOT; break;
+    case A_BNOT: op = A_BNOT; break;
+    case A_PREINC: op = A_PREINC; break;
+    case A_PREDEC: op = A_PREDEC; break;
+    default:
+        p->error = "syntax error: operand expected";
+        return -1;
+    }
+    if (ops[i].assign) {
+        // -= in front of an operand is - followed by =
+        p->error = "syntax error: operand expected";
+        return -1;
+    }
+    p->pos += strlen(ops[i].text);
+    int32_t operand = parse_expr(p, PREFIX_BP);
+    if (operand < 0) {
+        return -1;
+    }
+    if ((op == A_PREINC || op == A_PREDEC) && x->nodes[operand].op != A_VAR) {
+        p->error = "assignment requires a variable";
+        return -1;
+    }
+    int32_t n = anode_new(x, op);
+    x->nodes[n].a = operand;
+    return n;
+}
+
+
+/*Pratt parser: the left operand binds to the following operator as long
+* as it binds at least minbp tightly*/
+static int32_t parse_expr(struct aparser *p, int minbp) {
+    struct arith_expr *x = p->x;
+    int32_t left = parse_prefix(p);
+    while (left >= 0) {
+        int i = op_at(p);
+        if (i < 0 || ops[i].bp == 0 || ops[i].bp < minbp) {
+            break;
+        }
+        p->pos += strlen(ops[i].text);
+        int32_t n;
+        if (ops[i].assign) {
+            if (x->nodes[left].op != A_VAR) {
+                p->error = "attempted assignment to non-variable";
+                return -1;
+            }
+            // Right associative
+            int32_t right = parse_expr(p, ops[i].bp);
+            n = anode_new(x, A_ASSIGN);
+            x->nodes[n].num = ops[i].op;
+            x->nodes[n].a = left;
+            x->nodes[n].b = right;
+            if (right < 0) {
+                return -1;
+            }
+        } else if (ops[i].op == A_COND) {
+            int32_t then = parse_expr(p, 1);
+            if (then >= 0 && !accept(p, ":")) {
+                p->error = "`:' expected for conditional expression";
+                return -1;
+            }
+            int32_t other = then >= 0 ? parse_expr(p, ops[i].bp) : -1;
+            if (other < 0) {
+                return -1;
+            }
+            n = anode_new(x, A_COND);
+            x->nodes[n].a = left;
+            x->nodes[n].b = then;
+            x->nodes[n].c = other;
+        } else {
+            int32_t right = parse_expr(p, ops[i].bp + 1);
+            if (right < 0) {
+                return -1;
+            }
+            n = anode_new(x, ops[i].op);
+            x->nodes[n].a = left;
+            x->nodes[n].b = right;
+        }
+        left = n;
+    }
+    return left;
+}
+
+
+static struct arith_expr *arith_parse(const char *s, size_t len, const char **error) {
+    struct arith_expr *x = xcalloc(1, sizeof(*x));
+    struct aparser p = { x, s, 0, len, NULL };
+    skip_space(&p);
+    if (p.pos == len) {
+        // An empty expression is 0
+        x->root = anode_new(x, A_NUM);
+        return x;
+    }
+    x->root = parse_expr(&p, 1);
+    skip_space(&p);
+    if (p.error == NULL && p.pos < len) {
+        p.error = "syntax error: invalid arithmetic operator";
+    }
+    if (p.error != NULL) {
+        *error = p.error;
+        arith_expr_free(x);
+        return NULL;
+    }
+    return x;
+}
+
+
+/*The parsed tree of an expression, from the cache when it ran before.
+* A tree that did not fit in the cache is returned in owned and must be
+* freed after use.*/
+static struct arith_expr *arith_compile(const char *s, size_t len, struct arith_expr **owned, const char **error) {
+    struct hmap_entry *ent = hmap_findn(&cache, s, len);
+    if (ent != NULL) {
+        return ent->value;
+    }
+    struct arith_expr *x = arith_parse(s, len, error);
+    if (x == NULL) {
+        return NULL;
+    }
+    if (cache.n >= ARITH_CACHE_MAX) {
+        *owned = x;
+        return x;
+    }
+    bool added;
+    hmap_putn(&cache, s, len, &added)->value = x;
+    return x;
+}
+
+
+struct actx
+{
+struct shell *sh;
+struct arith_expr *x;
+int depth;
+const char *error;
+};
+
+
+static int eval_text(struct actx *c, const char *s, size_t len, int64_t *value);
+
+
+// The value of a variable, which may itself be an expression
+static int64_t var_value(struct actx *c, const char *name) {
+    const char *v = var_get(name);
+    if (v == NULL || *v == '\0') {
+        return 0;
+    }
+    char *end;
+    int64_t n = (int64_t)strtoull(v, &end, 0);
+    while (isspace((unsigned char)*end)) {
+        end++;
+    }
+    if (*end == '\0' && end != v) {
+        return n;
+    }
+    if (c->depth >= ARITH_MAXDEPTH) {
+        c->error = "expression recursion level exceeded";
+        return 0;
+    }
+    struct actx inner = { c->sh, NULL, c->depth + 1, NULL };
+    if (eval_text(&inner, v, strlen(v), &n) < 0) {
+        c->error = inner.error;
+        return 0;
+    }
+    return n;
+}
+
+
+static void var_assign(struct arith_expr *x, int32_t var, int64_t v) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%" PRId64, v);
+    var_set(x->pool + x->nodes[var].name, buf, false);
+}
+
+
+static int64_t binary(struct actx *c, uint8_t op, int64_t a, int64_t b) {
+    // Wrap around like the hardware instead of overflowing
+    uint64_t ua = (uint64_t)a, ub = (uint64_t)b;
+    switch (op) {
+    case A_MUL: return (int64_t)(ua * ub);
+    case A_DIV:
+    case A_MOD:
+        if (b == 0) {
+            c->error = "division by 0";
+            return 0;
+        }
+        if (b == -1) {
+            return op == A_DIV ? (int64_t)(0 - ua) : 0;
+        }
+        return op == A_DIV ? a / b : a % b;
+    case A_ADD: return (int64_t)(ua + ub);
+    case A_SUB: return (int64_t)(ua - ub);
+    case A_SHL: return (int64_t)(ua << (ub & 63));
+    case A_SHR: return a >> (ub & 63);
+    case A_LT: return a < b;
+    case A_LE: return a <= b;
+    case A_GT: return a > b;
+    case A_GE: return a >= b;
+    case A_EQ: return a == b;
+    case A_NE: return a != b;
+    case A_BAND: return a & b;
+    case A_XOR: return a ^ b;
+    case A_BOR: return a | b;
+    }
+    return 0;
+}
+
+
+static int64_t eval(struct actx *c, int32_t idx) {
+    struct arith_expr *x = c->x;
+    struct anode *n = &x->nodes[idx];
+    int64_t a, v;
+    switch (n->op) {
+    case A_NUM:
+        return n->num;
+    case A_VAR:
+        return var_value(c, x->pool + n->name);
+    case A_NEG:
+        return (int64_t)(0 - (uint64_t)eval(c, n->a));
+    case A_POS:
+        return eval(c, n->a);
+    case A_NOT:
+        return !eval(c, n->a);
+    case A_BNOT:
+        return ~eval(c, n->a);
+    case A_PREINC:
+    case A_PREDEC:
+    case A_POSTINC:
+    case A_POSTDEC:
+        a = eval(c, n->a);
+        v = (int64_t)((uint64_t)a + (n->op == A_PREINC || n->op == A_POSTINC ? 1 : -1));
+        if (c->error == NULL) {
+            var_assign(x, n->a, v);
+        }
+        return n->op == A_PREINC || n->op == A_PREDEC ? v : a;
+    case A_LAND:
+        return eval(c, n->a) && eval(c, n->b);
+    case A_LOR:
+        return eval(c, n->a) || eval(c, n->b);
+    case A_COND:
+        return eval(c, n->a) ? eval(c, n->b) : eval(c, n->c);
+    case A_COMMA:
+        eval(c, n->a);
+        return eval(c, n->b);
+    case A_ASSIGN:
+        v = eval(c, n->b);
+        if (n->num != A_ASSIGN) {
+            v = binary(c, (uint8_t)n->num, eval(c, n->a), v);
+        }
+        if (c->error == NULL) {
+            var_assign(x, n->a, v);
+        }
+        return v;
+    default:
+        a = eval(c, n->a);
+        return binary(c, n->op, a, eval(c, n->b));
+    }
+}
+
+
+static int eval_text(struct actx *c, const char *s, size_t len, int64_t *value) {
+    struct arith_expr *owned = NULL;
+    c->x = arith_compile(s, len, &owned, &c->error);
+    if (c->x == NULL) {
+        return -1;
+    }
+    *value = eval(c, c->x->root);
+    arith_expr_free(owned);
+    return c->error ? -1 : 0;
+}
+
+
+// Evaluate an arithmetic expression
+int arith_eval(struct shell *sh, const char *expr, size_t n, int64_t *value) {
+    char *expanded = NULL;
+    if (memchr(expr, '$', n) != NULL) {
+        // Parameters change the text, the expanded text is what gets cached
+        expanded = expand_heredoc(sh, expr, n, &n);
+        expr = expanded;
+    }
+    // Only start the cache over when no tree from it is in use
+    if (cache.n >= ARITH_CACHE_MAX) {
+        hmap_free(&cache, arith_expr_free);
+    }
+    struct actx c = { sh, NULL, 0, NULL };
+    int rc = eval_text(&c, expr, n, value);
+    if (rc < 0) {
+        fprintf(stderr, "lab: %.*s: %s\n", (int)n, expr, c.error);
+    }
+    free(expanded);
+    return rc;
+}
+
+
+// Forget the cached expressions
+void arith_free(void) {
+    hmap_free(&cache, arith_expr_free);
+}
@@ -0,0 +1,38 @@
+#ifndef ARITH_H
+#define ARITH_H
+#include <stddef.h>
+#include <stdint.h>
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+struct shell;
+
+
+/**
+* @brief Evaluate an arithmetic expression as $(( )) and (( )) do. The
+* arithmetic is 64-bit signed integers with the operators and precedence
+* of C, variables are read and assigned by name. Parameters in the text
+* are expanded first. Each distinct expression is parsed only once, the
+* tree is kept in a cache for the next time the same text runs.
+*
+* @param sh The shell
+* @param expr The expression text between the parentheses
+* @param n Its length
+* @param value Set to the result
+* @return int 0 on success, -1 after reporting an error on stderr
+*/
+int arith_eval(struct shell *sh, const char *expr, size_t n, int64_t *value);
+
+
+/**
+* @brief Forget the cached expressions
+*/
+void arith_free(void);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
@@ -0,0 +1,239 @@
+#include "array.h"
+#include "hmap.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+
+static bool is_owned(const struct array *a, size_t k) {
+    return (a->owned[k / 64] >> (k % 64)) & 1;
+}
+
+
+static void set_owned(struct array *a, size_t k, bool owned) {
+    if (owned) {
+        a->owned[k / 64] |= 1ULL << (k % 64);
+    } else {
+        a->owned[k / 64] &= ~(1ULL << (k % 64));
+    }
+}
+
+
+static void grow(struct array *a, size_t n) {
+    if (n <= a->cap) {
+        return;
+    }
+    size_t cap = a->cap ? a->cap : 8;
+    while (cap < n) {
+        cap *= 2;
+    }
+    a->v = xrealloc(a->v, cap * sizeof(char *));
+    if (a->idx != NULL) {
+        a->idx = xrealloc(a->idx, cap * sizeof(size_t));
+    }
+    a->owned = xrealloc(a->owned, (cap + 63) / 64 * sizeof(uint64_t));
+    memset(a->owned + (a->cap + 63) / 64, 0, ((cap + 63) / 64 - (a->cap + 63) / 64) * sizeof(uint64_t));
+    a->cap = cap;
+}
+
+
+/*Give a dense array its index table, needed before a gap appears*/
+static void make_sparse(struct array *a) {
+    if (a->idx != NULL) {
+        return;
+    }
+    a->idx = xmalloc((a->cap ? a->cap : 1) * sizeof(size_t));
+    for (size_t k = 0; k < a->n; k++) {
+        a->idx[k] = k;
+    }
+}
+
+
+/*Find the position of index i, or the position it would be inserted at.
+* Appends and lookups in a part without gaps need no search.*/
+static bool find(const struct array *a, size_t i, size_t *pos) {
+    if (a->idx == NULL || (i < a->n && a->idx[i] == i)) {
+        *pos = i < a->n ? i : a->n;
+        return i < a->n;
+    }
+    if (a->n == 0 || a->idx[a->n - 1] < i) {
+        *pos = a->n;
+        return false;
+    }
+    size_t lo = 0, hi = a->n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (a->idx[mid] < i) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    *pos = lo;
+    return lo < a->n && a->idx[lo] == i;
+}
+
+
+/*Move the owned bits from position k on by one, up when opening a slot
+* and down when closing one*/
+static void shift_owned(struct array *a, size_t k, bool up) {
+    if (up) {
+        for (size_t j = a->n; j > k; j--) {
+            set_owned(a, j, is_owned(a, j - 1));
+        }
+    } else {
+        for (size_t j = k; j + 1 < a->n; j++) {
+            set_owned(a, j, is_owned(a, j + 1));
+        }
+    }
+}
+
+
+static void insert(struct array *a, size_t pos, size_t i, char *s, bool owned) {
+    grow(a, a->n + 1);
+    if (a->idx == NULL && i != a->n) {
+        make_sparse(a);
+    }
+    if (pos < a->n) {
+        memmove(a->v + pos + 1, a->v + pos, (a->n - pos) * sizeof(char *));
+        memmove(a->idx + pos + 1, a->idx + pos, (a->n - pos) * sizeof(size_t));
+        shift_owned(a, pos, true);
+    }
+    a->v[pos] = s;
+    if (a->idx != NULL) {
+        a->idx[pos] = i;
+    }
+    set_owned(a, pos, owned);
+    a->n++;
+}
+
+
+static void store(struct array *a, size_t i, char *s, bool owned) {
+    size_t pos;
+    if (!find(a, i, &pos)) {
+        insert(a, pos, i, s, owned);
+        return;
+    }
+    if (is_owned(a, pos)) {
+        free(a->v[pos]);
+    }
+    a->v[pos] = s;
+    set_owned(a, pos, owned);
+}
+
+
+// Get an element
+const char *array_get(const struct array *a, size_t i) {
+    size_t pos;
+    return find(a, i, &pos) ? a->v[pos] : NULL;
+}
+
+
+// The index of the k-th element
+size_t array_index(const struct array *a, size_t k) {
+    return a->idx ? a->idx[k] : k;
+}
+
+
+// The index after the last element
+size_t array_next(const struct array *a) {
+    return a->n ? array_index(a, a->n - 1) + 1 : 0;
+}
+
+
+// Set an element to a copy of a value
+void array_set(struct array *a, size_t i, const char *value) {
+    store(a, i, xstrdup(value), true);
+}
+
+
+// Set an element that points into a blob
+void array_set_ref(struct array *a, size_t i, char *s) {
+    store(a, i, s, false);
+}
+
+
+// Give the array a block of memory to free with it
+void array_adopt(struct array *a, char *blob) {
+    a->blobs = xrealloc(a->blobs, (a->nblobs + 1) * sizeof(char *));
+    a->blobs[a->nblobs++] = blob;
+}
+
+
+// Remove an element
+void array_unset(struct array *a, size_t i) {
+    size_t pos;
+    if (!find(a, i, &pos)) {
+        return;
+    }
+    if (pos + 1 < a->n) {
+        // The elements after it keep their indexes, which leaves a gap
+        make_sparse(a);
+    }
+    if (is_owned(a, pos)) {
+        free(a->v[pos]);
+    }
+    memmove(a->v + pos, a->v + pos + 1, (a->n - pos - 1) * sizeof(char *));
+    if (a->idx != NULL) {
+        memmove(a->idx + pos, a->idx + pos + 1, (a->n - pos - 1) * sizeof(size_t));
+    }
+    shift_owned(a, pos, false);
+    a->n--;
+}
+
+
+// Drop the elements from index i on
+void array_truncate(struct array *a, size_t i) {
+    size_t pos;
+    find(a, i, &pos);
+    while (a->n > pos) {
+        a->n--;
+        if (is_owned(a, a->n)) {
+            free(a->v[a->n]);
+        }
+    }
+}
+
+
+// Free the elements and the blobs
+void array_clear(struct array *a) {
+    array_truncate(a, 0);
+    for (size_t i = 0; i < a->nblobs; i++) {
+        free(a->blobs[i]);
+    }
+    free(a->blobs);
+    free(a->v);
+    free(a->idx);
+    free(a->owned);
+    memset(a, 0, sizeof(*a));
+}
+
+
+// Get an element of an associative array
+const char *assoc_get(const struct hmap *m, const char *key) {
+    return hmap_get(m, key);
+}
+
+
+// Set an element of an associative array
+void assoc_set(struct hmap *m, const char *key, const char *value) {
+    bool added;
+    struct hmap_entry *e = hmap_putn(m, key, strlen(key), &added);
+    if (!added) {
+        free(e->value);
+    }
+    e->value = xstrdup(value);
+}
+
+
+// Remove an element of an associative array
+void assoc_unset(struct hmap *m, const char *key) {
+    free(hmap_del(m, key));
+}
+
+
+// Free the elements of an associative array
+void assoc_clear(struct hmap *m) {
+    hmap_free(m, free);
+}
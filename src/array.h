@@ -0,0 +1,157 @@
+#ifndef ARRAY_H
+#define ARRAY_H
+#include <stddef.h>
+#include <stdint.h>
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+struct hmap;
+
+
+/* The elements of an indexed array in index order. While the indexes run
+* from 0 without a gap the array is dense and element i is v[i]. The first
+* gap makes it sparse: idx then holds the index of each element and a
+* lookup is a binary search, so a[1000000]=x costs one element. Elements
+* loaded in bulk point into blobs the array owns and are never freed one
+* by one, any other element is allocated on its own and has its bit set
+* in owned. */
+struct array
+{
+char **v;
+size_t *idx;         // index of each element, NULL while the array is dense
+size_t n, cap;
+uint64_t *owned;     // a bit per element allocated on its own
+char **blobs;
+size_t nblobs;
+};
+
+
+/**
+* @brief Get an element
+*
+* @param a The array
+* @param i The index
+* @return const char* The element, NULL when it is not set
+*/
+const char *array_get(const struct array *a, size_t i);
+
+
+/**
+* @brief The index of the k-th element that is set
+*
+* @param a The array
+* @param k The position, less than a->n
+* @return size_t The index
+*/
+size_t array_index(const struct array *a, size_t k);
+
+
+/**
+* @brief The index after the last element, where an append goes
+*
+* @param a The array
+* @return size_t The index, 0 for an empty array
+*/
+size_t array_next(const struct array *a);
+
+
+/**
+* @brief Set an element to a copy of a value
+*
+* @param a The array
+* @param i The index
+* @param value The value
+*/
+void array_set(struct array *a, size_t i, const char *value);
+
+
+/**
+* @brief Set an element to a string that points into a blob given to the
+* array with array_adopt
+*
+* @param a The array
+* @param i The index
+* @param s The element
+*/
+void array_set_ref(struct array *a, size_t i, char *s);
+
+
+/**
+* @brief Give the array a block of memory to free with it
+*
+* @param a The array
+* @param blob The memory, allocated with malloc
+*/
+void array_adopt(struct array *a, char *blob);
+
+
+/**
+* @brief Remove an element, the ones after it keep their indexes
+*
+* @param a The array
+* @param i The index
+*/
+void array_unset(struct array *a, size_t i);
+
+
+/**
+* @brief Drop the elements with an index of i or more
+*
+* @param a The array
+* @param i The first index to drop
+*/
+void array_truncate(struct array *a, size_t i);
+
+
+/**
+* @brief Free the elements and the blobs, the array is empty afterwards
+*
+* @param a The array
+*/
+void array_clear(struct array *a);
+
+
+/**
+* @brief Get an element of an associative array, a hash map whose values
+* are strings it owns
+*
+* @param m The map
+* @param key The key
+* @return const char* The element, NULL when it is not set
+*/
+const char *assoc_get(const struct hmap *m, const char *key);
+
+
+/**
+* @brief Set an element of an associative array to a copy of a value
+*
+* @param m The map
+* @param key The key
+* @param value The value
+*/
+void assoc_set(struct hmap *m, const char *key, const char *value);
+
+
+/**
+* @brief Remove an element of an associative array
+*
+* @param m The map
+* @param key The key
+*/
+void assoc_unset(struct hmap *m, const char *key);
+
+
+/**
+* @brief Free the elements of an associative array, it is empty afterwards
+*
+* @param m The map
+*/
+void assoc_clear(struct hmap *m);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
@@ -0,0 +1,131 @@
+#include "cmdhash.h"
+#include "hmap.h"
+#include "lab.h"
+#include "util.h"
+#include "vars.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+
+// Command name -> full path, for the value of $PATH in path
+static struct hmap paths;
+static char *path;
+static unsigned long generation;
+
+
+// Forget every remembered path
+void cmdhash_reset(void) {
+    hmap_free(&paths, free);
+    generation++;
+}
+
+
+// Counter that changes whenever remembered paths are dropped
+unsigned long cmdhash_generation(void) {
+    const char *cur = var_get("PATH");
+    if (cur == NULL) {
+        cur = "";
+    }
+    if (path == NULL || strcmp(path, cur) != 0) {
+        free(path);
+        path = xstrdup(cur);
+        cmdhash_reset();
+    }
+    return generation;
+}
+
+
+static bool is_executable(const char *file) {
+    struct stat st;
+    return stat(file, &st) == 0 && S_ISREG(st.st_mode) && access(file, X_OK) == 0;
+}
+
+
+// Find the full path of a command
+const char *cmdhash_find(const char *name) {
+    if (strchr(name, '/') != NULL) {
+        return name;
+    }
+    cmdhash_generation();
+    const char *found = hmap_get(&paths, name);
+    if (found != NULL) {
+        return found;
+    }
+    struct strbuf file = {0};
+    for (const char *dir = path; ; ) {
+        const char *colon = strchr(dir, ':');
+        size_t n = colon ? (size_t)(colon - dir) : strlen(dir);
+        file.len = 0;
+        // An empty entry means the current directory
+        strbuf_add(&file, n ? dir : ".", n ? n : 1);
+        strbuf_addc(&file, '/');
+        strbuf_adds(&file, name);
+        if (is_executable(file.s)) {
+            char *full = strbuf_steal(&file);
+            hmap_put(&paths, name, full);
+            return full;
+        }
+        if (colon == NULL) {
+            break;
+        }
+        dir = colon + 1;
+    }
+    strbuf_free(&file);
+    return NULL;
+}
+
+
+// Find the full path of a command after checking a remembered one
+const char *cmdhash_check(const char *name) {
+    if (strchr(name, '/') != NULL) {
+        return name;
+    }
+    cmdhash_generation();
+    const char *found = hmap_get(&paths, name);
+    if (found != NULL && !is_executable(found)) {
+        cmdhash_forget(name);
+    }
+    return cmdhash_find(name);
+}
+
+
+// Forget the remembered path of one command
+void cmdhash_forget(const char *name) {
+    free(hmap_del(&paths, name));
+}
+
+
+// The hash builtin
+int hash_builtin(struct shell *sh, char **argv) {
+    UNUSED(sh);
+    int rc = 0;
+    if (argv[1] == NULL) {
+        cmdhash_generation();
+        struct strbuf out = {0};
+        for (size_t i = 0; i < paths.cap; i++) {
+            if (paths.tab[i].key != NULL) {
+                strbuf_adds(&out, paths.tab[i].key);
+                strbuf_addc(&out, '=');
+                strbuf_adds(&out, paths.tab[i].value);
+                strbuf_addc(&out, '\n');
+            }
+        }
+        if (write_all(STDOUT_FILENO, out.s, out.len) < 0) {
+            rc = 1;
+        }
+        strbuf_free(&out);
+        return rc;
+    }
+    for (int i = 1; argv[i]; i++) {
+        if (strcmp(argv[i], "-r") == 0) {
+            cmdhash_reset();
+        } else if (cmdhash_find(argv[i]) == NULL) {
+            fprintf(stderr, "hash: %s: not found\n", argv[i]);
+            rc = 1;
+        }
+    }
+    return rc;
+}
@@ -0,0 +1,77 @@
+#ifndef CMDHASH_H
+#define CMDHASH_H
+#include <stddef.h>
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+struct shell;
+
+
+/**
+* @brief Find the full path of a command, searching $PATH only the first
+* time a name is used. Names that contain a slash are returned as is.
+*
+* @param name The command name
+* @return const char* The path, valid until the hash is cleared, NULL if
+* the command is not found
+*/
+const char *cmdhash_find(const char *name);
+
+
+/**
+* @brief Find the full path of a command like cmdhash_find, but first make
+* sure a remembered path still names an executable. A stale one is
+* dropped and $PATH searched again, so a program that moved is found in
+* the shell and not once per child after a failed exec.
+*
+* @param name The command name
+* @return const char* The path, NULL if the command is not found
+*/
+const char *cmdhash_check(const char *name);
+
+
+/**
+* @brief Forget the remembered path of one command
+*
+* @param name The command name
+*/
+void cmdhash_forget(const char *name);
+
+
+/**
+* @brief Forget every remembered path, as done by hash -r
+*/
+void cmdhash_reset(void);
+
+
+/**
+* @brief Counter that changes whenever remembered paths are dropped, by
+* hash -r or because $PATH changed. Anything built from the commands on
+* $PATH, like the completion trie, is out of date when it changes.
+*
+* @return unsigned long The current generation
+*/
+unsigned long cmdhash_generation(void);
+
+
+/**
+* @brief The hash builtin.
+*
+*   hash [-r] [name ...]
+*
+* Lists the remembered paths, forgets all of them with -r, or looks up
+* each name and remembers its path.
+*
+* @param sh The shell
+* @param argv The arguments
+* @return int The exit status, 1 if a name was not found
+*/
+int hash_builtin(struct shell *sh, char **argv);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
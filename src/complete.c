@@ -0,0 +1,885 @@
+#define _GNU_SOURCE
+#include "complete.h"
+#include "alias.h"
+#include "cmdhash.h"
+#include "hmap.h"
+#include "lab.h"
+#include "vars.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "readline/readline.h"
+
+// Seconds after which Tab has the worker look for new commands again
+#define COMPLETE_RESCAN 5
+
+// Commands suggested for a name that was not found
+#define COMPLETE_SUGGEST 3
+
+// Most candidates offered by fuzzy completion
+#define COMPLETE_FUZZY 40
+
+// Directory listings kept for filename completion
+#define COMPLETE_MAXDIRS 64
+
+
+// Stamps every trie and directory listing, 0 is never used
+static unsigned long versions;
+
+
+static struct trie_node *node_new(const char *label, size_t n, bool terminal) {
+    struct trie_node *node = xcalloc(1, sizeof(*node));
+    node->label = xstrndup(label, n);
+    node->nlabel = n;
+    node->terminal = terminal;
+    return node;
+}
+
+
+/*Index of the child whose label starts with c. When there is none the
+* position where it would go is returned as -1 - pos.*/
+static long kid_find(const struct trie_node *node, unsigned char c) {
+    long lo = 0, hi = node->nkids;
+    while (lo < hi) {
+        long mid = (lo + hi) / 2;
+        unsigned char k = node->kids[mid]->label[0];
+        if (k == c) {
+            return mid;
+        }
+        if (k < c) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return -1 - lo;
+}
+
+
+static void kid_insert(struct trie_node *node, long pos, struct trie_node *kid) {
+    node->kids = xrealloc(node->kids, (node->nkids + 1) * sizeof(*node->kids));
+    memmove(&node->kids[pos + 1], &node->kids[pos], (node->nkids - pos) * sizeof(*node->kids));
+    node->kids[pos] = kid;
+    node->nkids++;
+}
+
+
+// Add a word to a trie
+void trie_insert(struct trie *t, const char *word, size_t len) {
+    struct trie_node *node = &t->root;
+    size_t i = 0;
+    for (;;) {
+        if (i == len) {
+            if (!node->terminal) {
+                node->terminal = true;
+                t->nwords++;
+            }
+            return;
+        }
+        long k = kid_find(node, word[i]);
+        if (k < 0) {
+            kid_insert(node, -1 - k, node_new(word + i, len - i, true));
+            t->nwords++;
+            return;
+        }
+        struct trie_node *kid = node->kids[k];
+        size_t m = 1;
+        while (m < kid->nlabel && i + m < len && kid->label[m] == word[i + m]) {
+            m++;
+        }
+        if (m < kid->nlabel) {
+            // The word leaves the edge half way, split it there
+            struct trie_node *mid = node_new(kid->label, m, false);
+            char *rest = xstrndup(kid->label + m, kid->nlabel - m);
+            free(kid->label);
+            kid->label = rest;
+            kid->nlabel -= m;
+            kid_insert(mid, 0, kid);
+            node->kids[k] = mid;
+            kid = mid;
+        }
+        node = kid;
+        i += m;
+    }
+}
+
+
+static void trie_collect(const struct trie_node *node, struct strbuf *word, struct strvec *out) {
+    size_t len = word->len;
+    strbuf_add(word, node->label, node->nlabel);
+    if (node->terminal) {
+        strvec_push(out, xstrndup(word->s, word->len));
+    }
+    for (uint32_t k = 0; k < node->nkids; k++) {
+        trie_collect(node->kids[k], word, out);
+    }
+    word->len = len;
+}
+
+
+// Collect every word that starts with a prefix, in sorted order
+size_t trie_complete(const struct trie *t, const char *prefix, size_t len, struct strvec *out) {
+    const struct trie_node *node = &t->root;
+    size_t before = out->n;
+    size_t i = 0;
+    size_t start = 0;   // length of the prefix above node
+    while (i < len) {
+        long k = kid_find(node, prefix[i]);
+        if (k < 0) {
+            return 0;
+        }
+        const struct trie_node *kid = node->kids[k];
+        size_t m = 1;
+        while (m < kid->nlabel && i + m < len && kid->label[m] == prefix[i + m]) {
+            m++;
+        }
+        if (i + m < len && m < kid->nlabel) {
+            return 0;
+        }
+        node = kid;
+        start = i;
+        i += m;
+    }
+    // node is the first one whose path covers the whole prefix
+    struct strbuf word = {0};
+    strbuf_add(&word, prefix, start);
+    if (node == &t->root) {
+        for (uint32_t k = 0; k < node->nkids; k++) {
+            trie_collect(node->kids[k], &word, out);
+        }
+    } else {
+        trie_collect(node, &word, out);
+    }
+    strbuf_free(&word);
+    return out->n - before;
+}
+
+
+/* Column of the distance matrix as Myers' bit vectors, with the distance
+* of the whole pattern to the text seen so far */
+struct fuzzy_state
+{
+uint64_t pv;         // rows where the distance goes up by one
+uint64_t mv;         // rows where it goes down by one
+uint64_t d0;         // diagonal zero differences
+uint64_t peq;        // match vector of the previous text byte
+int score;
+};
+
+
+// Start matching text against the pattern of f
+static void fuzzy_start(const struct fuzzy *f, struct fuzzy_state *st) {
+    st->pv = f->last | (f->last - 1);
+    st->mv = 0;
+    st->d0 = 0;
+    st->peq = 0;
+    st->score = f->m;
+}
+
+
+/*Advance the distance by one byte of text. This is Myers' algorithm with
+* Hyyrö's extension for transpositions, so "gerp" is one edit from "grep".*/
+static void fuzzy_step(const struct fuzzy *f, struct fuzzy_state *st, unsigned char c) {
+    uint64_t eq = f->peq[c];
+    uint64_t tr = ((~st->d0 & eq) << 1) & st->peq;
+    uint64_t d0 = (((eq & st->pv) + st->pv) ^ st->pv) | eq | st->mv | tr;
+    uint64_t ph = st->mv | ~(d0 | st->pv);
+    uint64_t mh = d0 & st->pv;
+    if (ph & f->last) {
+        st->score++;
+    } else if (mh & f->last) {
+        st->score--;
+    }
+    uint64_t x = (ph << 1) | 1;
+    st->mv = x & d0;
+    st->pv = (mh << 1) | ~(x | d0);
+    st->d0 = d0;
+    st->peq = eq;
+}
+
+
+/*Smallest value in the current column of the distance matrix. No text
+* that starts with the text seen so far, j bytes of it, can be closer to
+* the pattern than this.*/
+static int fuzzy_floor(const struct fuzzy *f, const struct fuzzy_state *st, size_t j) {
+    if (st->score <= 0) {
+        return st->score;
+    }
+    int d = j;
+    int min = d;
+    for (int i = 0; i < f->m; i++) {
+        d += (int)((st->pv >> i) & 1) - (int)((st->mv >> i) & 1);
+        if (d < min) {
+            min = d;
+        }
+    }
+    return min;
+}
+
+
+// Prepare the pattern for fuzzy_distance
+void fuzzy_init(struct fuzzy *f, const char *pattern, size_t len) {
+    memset(f, 0, sizeof(*f));
+    if (len > 64) {
+        len = 64;
+    }
+    for (size_t i = 0; i < len; i++) {
+        f->peq[(unsigned char)pattern[i]] |= (uint64_t)1 << i;
+    }
+    f->m = len;
+    f->last = len ? (uint64_t)1 << (len - 1) : 0;
+}
+
+
+// Edit distance between the pattern and s
+int fuzzy_distance(const struct fuzzy *f, const char *s, size_t len) {
+    if (f->m == 0) {
+        return len;
+    }
+    struct fuzzy_state st;
+    fuzzy_start(f, &st);
+    for (size_t i = 0; i < len; i++) {
+        fuzzy_step(f, &st, s[i]);
+    }
+    return st.score;
+}
+
+
+/* The closest words found so far, ordered by rank and then name. The
+* rank is twice the distance, plus one when the first byte differs. */
+struct suggestions
+{
+const struct fuzzy *f;
+int limit;
+uint64_t mask;       // bits of the pattern
+char first;          // first byte of the pattern
+size_t max;
+size_t n;
+int *rank;
+char **words;
+struct strbuf word;
+};
+
+
+static void suggest_add(struct suggestions *sg, int rank) {
+    size_t i = sg->n;
+    while (i > 0 && (sg->rank[i - 1] > rank || (sg->rank[i - 1] == rank && strcmp(sg->words[i - 1], sg->word.s) > 0))) {
+        i--;
+    }
+    if (i == sg->max) {
+        return;
+    }
+    if (sg->n == sg->max) {
+        free(sg->words[--sg->n]);
+    }
+    memmove(&sg->rank[i + 1], &sg->rank[i], (sg->n - i) * sizeof(int));
+    memmove(&sg->words[i + 1], &sg->words[i], (sg->n - i) * sizeof(char *));
+    sg->rank[i] = rank;
+    sg->words[i] = xstrndup(sg->word.s, sg->word.len);
+    sg->n++;
+}
+
+
+/*Walk the trie carrying the distance state down the edges, words that
+* share a prefix share the work for it*/
+static void suggest_walk(struct suggestions *sg, const struct trie_node *node, struct fuzzy_state st) {
+    size_t len = sg->word.len;
+    for (uint32_t i = 0; i < node->nlabel; i++) {
+        fuzzy_step(sg->f, &st, node->label[i]);
+        /* Quick bounds on the column minimum, from the bottom row down
+        * by every +1 and from the top row up by every -1 */
+        if (st.score - __builtin_popcountll(st.pv & sg->mask) > sg->limit ||
+            (int)(len + i + 1) - __builtin_popcountll(st.mv & sg->mask) > sg->limit) {
+            return;
+        }
+    }
+    strbuf_add(&sg->word, node->label, node->nlabel);
+    // Every longer word is at least this much longer than the pattern
+    if ((int)sg->word.len - sg->f->m <= sg->limit && fuzzy_floor(sg->f, &st, sg->word.len) <= sg->limit) {
+        if (node->terminal && st.score <= sg->limit) {
+            // At the same distance a word that starts the same way is closer
+            suggest_add(sg, st.score * 2 + (sg->word.s[0] != sg->first));
+        }
+        for (uint32_t k = 0; k < node->nkids; k++) {
+            suggest_walk(sg, node->kids[k], st);
+        }
+    }
+    sg->word.len = len;
+}
+
+
+// Words of a trie close to name, closest first
+size_t trie_suggest(const struct trie *t, const char *name, size_t max, struct strvec *out) {
+    size_t len = strlen(name);
+    struct fuzzy f;
+    struct fuzzy_state st;
+    if (len == 0 || len > 64 || max == 0) {
+        return 0;
+    }
+    fuzzy_init(&f, name, len);
+    fuzzy_start(&f, &st);
+    struct suggestions sg = {
+        .f = &f,
+        .mask = f.last | (f.last - 1),
+        .first = name[0],
+        .limit = len <= 2 ? 1 : len / 3 > 2 ? (int)len / 3 : 2,
+        .max = max,
+        .rank = xmalloc(max * sizeof(int)),
+        .words = xmalloc(max * sizeof(char *)),
+    };
+    strbuf_add(&sg.word, "", 0);
+    suggest_walk(&sg, &t->root, st);
+    for (size_t i = 0; i < sg.n; i++) {
+        strvec_push(out, sg.words[i]);
+    }
+    strbuf_free(&sg.word);
+    free(sg.rank);
+    free(sg.words);
+    return sg.n;
+}
+
+
+static void node_free(struct trie_node *node) {
+    for (uint32_t k = 0; k < node->nkids; k++) {
+        node_free(node->kids[k]);
+        free(node->kids[k]);
+    }
+    free(node->kids);
+    free(node->label);
+}
+
+
+// Free the nodes of a trie, the trie itself is left empty
+void trie_free(struct trie *t) {
+    node_free(&t->root);
+    memset(t, 0, sizeof(*t));
+}
+
+
+/* Executables found in one $PATH directory at its last modification time */
+struct dircache
+{
+char *dir;
+struct timespec mtime;
+struct strvec names;
+bool seen;           // still in $PATH
+};
+
+
+/* The completion worker. The fields above the line are guarded by lock,
+* the directory cache is only used by the worker. */
+static struct
+{
+pthread_mutex_t lock;
+pthread_cond_t cond;
+pthread_t thread;
+bool started;
+bool quit;
+bool requested;
+char *path;          // $PATH to scan next
+struct strvec aliases;  // alias names to go with it
+struct trie *trie;   // newest complete trie, NULL before the first scan
+unsigned long version;  // stamp of trie
+unsigned long gen;   // command hash generation of the last request
+unsigned long agen;  // alias generation of the last request
+time_t requested_at;
+// ----
+struct dircache *dirs;
+size_t ndirs;
+} comp = { .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+
+
+static void dir_scan(struct dircache *dc) {
+    strvec_free(&dc->names);
+    int fd = open(dc->dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *d = fd < 0 ? NULL : fdopendir(fd);
+    if (d == NULL) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+    struct dirent *de;
+    struct stat st;
+    while ((de = readdir(d)) != NULL) {
+        if (de->d_name[0] == '.' || de->d_type == DT_DIR) {
+            continue;
+        }
+        if (fstatat(fd, de->d_name, &st, 0) == 0 && S_ISREG(st.st_mode) && (st.st_mode & 0111)) {
+            strvec_push(&dc->names, xstrdup(de->d_name));
+        }
+    }
+    closedir(d);
+}
+
+
+/*Bring the directory cache up to date with path. Only directories whose
+* modification time changed since the last scan are read again.*/
+static void dirs_refresh(const char *path) {
+    for (size_t i = 0; i < comp.ndirs; i++) {
+        comp.dirs[i].seen = false;
+    }
+    for (const char *dir = path; *dir;) {
+        const char *colon = strchr(dir, ':');
+        size_t n = colon ? (size_t)(colon - dir) : strlen(dir);
+        size_t i = 0;
+        while (i < comp.ndirs && (strlen(comp.dirs[i].dir) != n || strncmp(comp.dirs[i].dir, dir, n) != 0)) {
+            i++;
+        }
+        if (n > 0 && i == comp.ndirs) {
+            comp.dirs = xrealloc(comp.dirs, (comp.ndirs + 1) * sizeof(struct dircache));
+            memset(&comp.dirs[i], 0, sizeof(struct dircache));
+            comp.dirs[i].dir = xstrndup(dir, n);
+            comp.dirs[i].mtime.tv_sec = -1;
+            comp.ndirs++;
+        }
+        if (n > 0) {
+            struct dircache *dc = &comp.dirs[i];
+            struct stat st;
+            dc->seen = true;
+            if (stat(dc->dir, &st) < 0) {
+                strvec_free(&dc->names);
+                dc->mtime.tv_sec = -1;
+            } else if (st.st_mtim.tv_sec != dc->mtime.tv_sec || st.st_mtim.tv_nsec != dc->mtime.tv_nsec) {
+                dir_scan(dc);
+                dc->mtime = st.st_mtim;
+            }
+        }
+        dir += n + (colon != NULL);
+    }
+    // Forget directories that left $PATH
+    size_t out = 0;
+    for (size_t i = 0; i < comp.ndirs; i++) {
+        if (comp.dirs[i].seen) {
+            comp.dirs[out++] = comp.dirs[i];
+        } else {
+            free(comp.dirs[i].dir);
+            strvec_free(&comp.dirs[i].names);
+        }
+    }
+    comp.ndirs = out;
+}
+
+
+static void *complete_worker(void *arg) {
+    UNUSED(arg);
+    pthread_mutex_lock(&comp.lock);
+    for (;;) {
+        while (!comp.requested && !comp.quit) {
+            pthread_cond_wait(&comp.cond, &comp.lock);
+        }
+        if (comp.quit) {
+            break;
+        }
+        comp.requested = false;
+        char *path = comp.path;
+        comp.path = NULL;
+        struct strvec aliases = comp.aliases;
+        memset(&comp.aliases, 0, sizeof(comp.aliases));
+        pthread_mutex_unlock(&comp.lock);
+
+        dirs_refresh(path ? path : "");
+        free(path);
+        struct trie *t = xcalloc(1, sizeof(*t));
+        for (size_t i = 0; i < comp.ndirs; i++) {
+            for (size_t k = 0; k < comp.dirs[i].names.n; k++) {
+                trie_insert(t, comp.dirs[i].names.v[k], strlen(comp.dirs[i].names.v[k]));
+            }
+        }
+        const char *name;
+        for (size_t i = 0; (name = builtin_name(i)) != NULL; i++) {
+            trie_insert(t, name, strlen(name));
+        }
+        for (size_t i = 0; i < aliases.n; i++) {
+            trie_insert(t, aliases.v[i], strlen(aliases.v[i]));
+        }
+        strvec_free(&aliases);
+
+        pthread_mutex_lock(&comp.lock);
+        struct trie *old = comp.trie;
+        comp.trie = t;
+        comp.version = __atomic_add_fetch(&versions, 1, __ATOMIC_RELAXED);
+        // Completion only reads the trie while holding the lock
+        pthread_mutex_unlock(&comp.lock);
+        if (old != NULL) {
+            trie_free(old);
+            free(old);
+        }
+        pthread_mutex_lock(&comp.lock);
+    }
+    pthread_mutex_unlock(&comp.lock);
+    return NULL;
+}
+
+
+// Ask the worker for a new trie, the caller holds the lock
+static void complete_request(unsigned long gen) {
+    if (!comp.started) {
+        sigset_t all, old;
+        sigfillset(&all);
+        pthread_sigmask(SIG_SETMASK, &all, &old);
+        comp.started = pthread_create(&comp.thread, NULL, complete_worker, NULL) == 0;
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+    }
+    const char *path = var_get("PATH");
+    free(comp.path);
+    comp.path = xstrdup(path ? path : "");
+    comp.gen = gen;
+    // The alias table belongs to the main thread, the worker gets a copy
+    strvec_free(&comp.aliases);
+    alias_names(&comp.aliases);
+    comp.agen = alias_generation();
+    comp.requested_at = time(NULL);
+    comp.requested = true;
+    pthread_cond_signal(&comp.cond);
+}
+
+
+// Command names that start with a prefix, from the newest trie
+size_t complete_commands(const char *prefix, struct strvec *out) {
+    unsigned long gen = cmdhash_generation();
+    size_t len = strlen(prefix);
+    size_t n = 0;
+    pthread_mutex_lock(&comp.lock);
+    if (!comp.started || gen != comp.gen || alias_generation() != comp.agen ||
+        time(NULL) - comp.requested_at >= COMPLETE_RESCAN) {
+        complete_request(gen);
+    }
+    if (comp.trie != NULL) {
+        n = trie_complete(comp.trie, prefix, len, out);
+    } else {
+        // The first scan is still running, builtins and aliases are all
+        // we know
+        const char *name;
+        for (size_t i = 0; (name = builtin_name(i)) != NULL; i++) {
+            if (strncmp(name, prefix, len) == 0) {
+                strvec_push(out, xstrdup(name));
+                n++;
+            }
+        }
+        struct strvec aliases = {0};
+        alias_names(&aliases);
+        for (size_t i = 0; i < aliases.n; i++) {
+            if (strncmp(aliases.v[i], prefix, len) == 0) {
+                strvec_push(out, xstrdup(aliases.v[i]));
+                n++;
+            }
+        }
+        strvec_free(&aliases);
+    }
+    pthread_mutex_unlock(&comp.lock);
+    return n;
+}
+
+
+// The shell whose options decide how Tab completes
+static struct shell *comp_shell;
+
+
+/* The sorted names of one directory as of its modification time */
+struct listing
+{
+struct timespec mtime;
+unsigned long version;
+struct strvec names;
+};
+
+
+// Directory path -> struct listing
+static struct hmap listings;
+
+
+static int name_cmp(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+
+static void listing_free(void *p) {
+    struct listing *l = p;
+    strvec_free(&l->names);
+    free(l);
+}
+
+
+/*The listing of a directory, read again only when the directory was
+* modified since it was cached. NULL if it cannot be read.*/
+static struct listing *listing_get(const char *dir) {
+    struct stat st;
+    struct listing *l = hmap_get(&listings, dir);
+    if (stat(dir, &st) < 0 || !S_ISDIR(st.st_mode)) {
+        return NULL;
+    }
+    if (l != NULL && l->mtime.tv_sec == st.st_mtim.tv_sec && l->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+        return l;
+    }
+    DIR *d = opendir(dir);
+    if (d == NULL) {
+        return NULL;
+    }
+    if (l == NULL) {
+        if (listings.n >= COMPLETE_MAXDIRS) {
+            hmap_free(&listings, listing_free);
+        }
+        l = xcalloc(1, sizeof(*l));
+        hmap_put(&listings, dir, l);
+    }
+    strvec_free(&l->names);
+    struct dirent *de;
+    while ((de = readdir(d)) != NULL) {
+        if (strcmp(de->d_name, ".") != 0 && strcmp(de->d_name, "..") != 0) {
+            strvec_push(&l->names, xstrdup(de->d_name));
+        }
+    }
+    closedir(d);
+    if (l->names.n > 0) {
+        qsort(l->names.v, l->names.n, sizeof(char *), name_cmp);
+    }
+    l->mtime = st.st_mtim;
+    l->version = __atomic_add_fetch(&versions, 1, __ATOMIC_RELAXED);
+    return l;
+}
+
+
+// First index in a sorted vector whose name is not below prefix
+static size_t lower_bound(const struct strvec *sv, const char *prefix, size_t len) {
+    size_t lo = 0, hi = sv->n;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (strncmp(sv->v[mid], prefix, len) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+
+/*Look up the listing for the directory part of text, the directory as
+* typed is returned in dirlen*/
+static struct listing *files_listing(const char *text, size_t *dirlen) {
+    const char *slash = strrchr(text, '/');
+    *dirlen = slash ? (size_t)(slash - text) + 1 : 0;
+    if (*dirlen == 0) {
+        return listing_get(".");
+    }
+    char *dir = xstrndup(text, *dirlen);
+    if (dir[0] == '~') {
+        char *full = tilde_expand(dir);
+        free(dir);
+        dir = full;
+    }
+    struct listing *l = listing_get(dir);
+    free(dir);
+    return l;
+}
+
+
+static size_t listing_matches(const struct listing *l, const char *text, size_t dirlen, struct strvec *out) {
+    const char *base = text + dirlen;
+    size_t len = strlen(base);
+    size_t n = 0;
+    for (size_t i = lower_bound(&l->names, base, len); i < l->names.n; i++, n++) {
+        const char *name = l->names.v[i];
+        if (strncmp(name, base, len) != 0) {
+            break;
+        }
+        char *match = xmalloc(dirlen + strlen(name) + 1);
+        memcpy(match, text, dirlen);
+        strcpy(match + dirlen, name);
+        strvec_push(out, match);
+    }
+    return n;
+}
+
+
+// File names that complete a partial path
+size_t complete_files(const char *text, struct strvec *out) {
+    size_t dirlen;
+    struct listing *l = files_listing(text, &dirlen);
+    return l ? listing_matches(l, text, dirlen, out) : 0;
+}
+
+
+/* Candidates for the last completed word. When the next Tab only adds to
+* the word and the trie or listing is unchanged they are narrowed in place
+* instead of being generated again. */
+static struct
+{
+unsigned long version;  // stamp of the trie or listing they came from
+char *text;
+struct strvec names;    // sorted
+size_t next;            // next name handed to readline
+} cand;
+
+
+static bool cand_narrow(unsigned long version, const char *text) {
+    size_t old = cand.text ? strlen(cand.text) : 0;
+    if (version == 0 || version != cand.version || strncmp(text, cand.text, old) != 0) {
+        return false;
+    }
+    size_t len = strlen(text);
+    size_t lo = lower_bound(&cand.names, text, len);
+    size_t hi = lo;
+    while (hi < cand.names.n && strncmp(cand.names.v[hi], text, len) == 0) {
+        hi++;
+    }
+    for (size_t i = 0; i < cand.names.n; i++) {
+        if (i < lo || i >= hi) {
+            free(cand.names.v[i]);
+        }
+    }
+    if (cand.names.v != NULL) {
+        memmove(cand.names.v, cand.names.v + lo, (hi - lo) * sizeof(char *));
+        cand.names.n = hi - lo;
+        cand.names.v[cand.names.n] = NULL;
+    }
+    free(cand.text);
+    cand.text = xstrdup(text);
+    return true;
+}
+
+
+static void cand_reset(unsigned long version, const char *text) {
+    strvec_free(&cand.names);
+    free(cand.text);
+    cand.text = xstrdup(text);
+    cand.version = version;
+}
+
+
+static char *cand_generator(const char *text, int state) {
+    UNUSED(text);
+    UNUSED(state);
+    return cand.next < cand.names.n ? xstrdup(cand.names.v[cand.next++]) : NULL;
+}
+
+
+/*Complete command names in command position, file names anywhere else
+* and for names with a slash*/
+static char **complete_attempt(const char *text, int start, int end) {
+    UNUSED(end);
+    int i = start;
+    while (i > 0 && isspace((unsigned char)rl_line_buffer[i - 1])) {
+        i--;
+    }
+    bool fuzzy = false;
+    bool command = (i == 0 || strchr(";|&(", rl_line_buffer[i - 1]) != NULL) && strchr(text, '/') == NULL;
+    if (command) {
+        pthread_mutex_lock(&comp.lock);
+        unsigned long version = comp.trie ? comp.version : 0;
+        pthread_mutex_unlock(&comp.lock);
+        if (!cand_narrow(version, text)) {
+            cand_reset(version, text);
+            complete_commands(text, &cand.names);
+        }
+        if (cand.names.n == 0 && *text && (comp_shell->options & OPT_FUZZYCOMPLETE)) {
+            // Closest names first, they do not share the typed prefix
+            cand.version = 0;
+            fuzzy = complete_suggest(text, COMPLETE_FUZZY, &cand.names) > 0;
+        }
+    }
+    if (!command || (cand.names.n == 0 && !fuzzy)) {
+        size_t dirlen;
+        struct listing *l = files_listing(text, &dirlen);
+        if (l == NULL) {
+            cand_reset(0, text);
+        } else if (!cand_narrow(l->version, text)) {
+            cand_reset(l->version, text);
+            listing_matches(l, text, dirlen, &cand.names);
+        }
+        rl_filename_completion_desired = 1;
+    }
+    // Candidates are already sorted and readline must not fall back to its own
+    rl_attempted_completion_over = 1;
+    rl_sort_completion_matches = 0;
+    cand.next = 0;
+    char **matches = rl_completion_matches(text, cand_generator);
+    if (fuzzy && matches[1] != NULL) {
+        // The common prefix of fuzzy matches would cut the typed word short
+        free(matches[0]);
+        matches[0] = xstrdup(text);
+    }
+    return matches;
+}
+
+
+// Commands close to a name that was not found
+size_t complete_suggest(const char *name, size_t max, struct strvec *out) {
+    size_t n = 0;
+    // A child forked while the worker held the lock must not wait for it
+    if (pthread_mutex_trylock(&comp.lock) != 0) {
+        return 0;
+    }
+    if (comp.trie != NULL) {
+        n = trie_suggest(comp.trie, name, max, out);
+    }
+    pthread_mutex_unlock(&comp.lock);
+    return n;
+}
+
+
+// Report a command that is not on $PATH, with the closest ones
+void complete_not_found(const char *name) {
+    struct strvec near = {0};
+    fprintf(stderr, "lab: %s: command not found\n", name);
+    if (complete_suggest(name, COMPLETE_SUGGEST, &near) > 0) {
+        fprintf(stderr, "Did you mean:\n");
+        for (size_t i = 0; i < near.n; i++) {
+            fprintf(stderr, "  %s\n", near.v[i]);
+        }
+    }
+    strvec_free(&near);
+}
+
+
+// Hook command name completion into readline and start the first scan
+void complete_init(struct shell *sh) {
+    comp_shell = sh;
+    rl_attempted_completion_function = complete_attempt;
+    pthread_mutex_lock(&comp.lock);
+    complete_request(cmdhash_generation());
+    pthread_mutex_unlock(&comp.lock);
+}
+
+
+// Stop the worker thread and free the trie
+void complete_shutdown(void) {
+    pthread_mutex_lock(&comp.lock);
+    bool started = comp.started;
+    comp.quit = true;
+    pthread_cond_signal(&comp.cond);
+    pthread_mutex_unlock(&comp.lock);
+    if (started) {
+        pthread_join(comp.thread, NULL);
+    }
+    if (comp.trie != NULL) {
+        trie_free(comp.trie);
+        free(comp.trie);
+    }
+    for (size_t i = 0; i < comp.ndirs; i++) {
+        free(comp.dirs[i].dir);
+        strvec_free(&comp.dirs[i].names);
+    }
+    free(comp.dirs);
+    free(comp.path);
+    strvec_free(&comp.aliases);
+    hmap_free(&listings, listing_free);
+    strvec_free(&cand.names);
+    free(cand.text);
+    cand.text = NULL;
+    cand.version = 0;
+    comp.trie = NULL;
+    comp.dirs = NULL;
+    comp.path = NULL;
+    comp.ndirs = 0;
+    comp.started = comp.quit = comp.requested = false;
+}
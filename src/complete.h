@@ -0,0 +1,183 @@
+#ifndef COMPLETE_H
+#define COMPLETE_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "util.h"
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+struct shell;
+
+
+/* A node of a compressed trie, every edge is labeled with a string and no
+* node other than the root has a single child unless it ends a word */
+struct trie_node
+{
+char *label;         // bytes on the edge into this node
+uint32_t nlabel;
+bool terminal;       // a word ends here
+uint32_t nkids;
+struct trie_node **kids;  // sorted by the first byte of their label
+};
+
+
+struct trie
+{
+struct trie_node root;
+size_t nwords;
+};
+
+
+/**
+* @brief Add a word to a trie
+*
+* @param t The trie
+* @param word The word
+* @param len The length of the word
+*/
+void trie_insert(struct trie *t, const char *word, size_t len);
+
+
+/**
+* @brief Collect every word that starts with a prefix, in sorted order
+*
+* @param t The trie
+* @param prefix The prefix
+* @param len The length of the prefix
+* @param out The words are appended to this vector
+* @return size_t The number of words found
+*/
+size_t trie_complete(const struct trie *t, const char *prefix, size_t len, struct strvec *out);
+
+
+/**
+* @brief Free the nodes of a trie, the trie itself is left empty
+*
+* @param t The trie
+*/
+void trie_free(struct trie *t);
+
+
+/* A pattern prepared for bit-parallel edit distance */
+struct fuzzy
+{
+uint64_t peq[256];   // positions of each byte in the pattern
+uint64_t last;       // bit of the last pattern character
+int m;               // pattern length, at most 64
+};
+
+
+/**
+* @brief Prepare a pattern for fuzzy_distance. Only the first 64 bytes
+* of the pattern are used.
+*
+* @param f The prepared pattern
+* @param pattern The pattern
+* @param len The length of the pattern
+*/
+void fuzzy_init(struct fuzzy *f, const char *pattern, size_t len);
+
+
+/**
+* @brief Edit distance between a prepared pattern and a string, computed
+* with Myers' bit-parallel algorithm in one pass over s. Swapping two
+* adjacent bytes counts as one edit, the restricted Damerau-Levenshtein
+* distance.
+*
+* @param f The prepared pattern
+* @param s The string
+* @param len The length of the string
+* @return int The number of insertions, deletions, substitutions and
+* transpositions
+*/
+int fuzzy_distance(const struct fuzzy *f, const char *s, size_t len);
+
+
+/**
+* @brief Words of a trie close to a name, closest first. Words sharing a
+* prefix share the distance computation for it, and branches that are
+* already too long to be close are not visited.
+*
+* @param t The trie
+* @param name The name
+* @param max Most words returned
+* @param out The words are appended to this vector
+* @return size_t The number of words found
+*/
+size_t trie_suggest(const struct trie *t, const char *name, size_t max, struct strvec *out);
+
+
+/**
+* @brief Hook command and file name completion into readline and start
+* building the trie of commands on $PATH and builtins on a background
+* thread. Tab never waits for the scan, it uses what has been built so
+* far. With set -o fuzzycomplete a command name that matches nothing
+* is completed to the closest names instead. When a Tab extends the
+* word of the previous one the earlier candidates are narrowed instead
+* of generated again.
+*
+* @param sh The shell
+*/
+void complete_init(struct shell *sh);
+
+
+/**
+* @brief Command names that start with a prefix, from the newest trie.
+* Asks the worker for a new trie when the command hash was invalidated.
+*
+* @param prefix The prefix
+* @param out The names are appended to this vector
+* @return size_t The number of names found
+*/
+size_t complete_commands(const char *prefix, struct strvec *out);
+
+
+/**
+* @brief Commands close to a name, closest first, from the newest trie.
+* Safe to call in a forked child, where it finds nothing if the worker
+* was holding the trie at the time of the fork.
+*
+* @param name The name
+* @param max Most names returned
+* @param out The names are appended to this vector
+* @return size_t The number of names found
+*/
+size_t complete_suggest(const char *name, size_t max, struct strvec *out);
+
+
+/**
+* @brief Print that a command was not found on stderr, followed by the
+* closest command names
+*
+* @param name The command name
+*/
+void complete_not_found(const char *name);
+
+
+/**
+* @brief File names that complete a partial path. Directory listings are
+* cached and read again only when the directory's modification time
+* changes, so completing in a large directory does not list it on every
+* Tab. The directory part of text is kept as typed, ~ is expanded for
+* the lookup only.
+*
+* @param text The partial path
+* @param out The matches are appended to this vector, sorted
+* @return size_t The number of matches
+*/
+size_t complete_files(const char *text, struct strvec *out);
+
+
+/**
+* @brief Stop the worker thread and free the trie
+*/
+void complete_shutdown(void);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
@@ -0,0 +1,289 @@
+#include "cond.h"
+#include "arith.h"
+#include "expand.h"
+#include "lab.h"
+#include "pattern.h"
+#include "regcache.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+
+/* Walks the words of one expression. The parsing functions take a run
+* flag: when it is false, for the side of && or || that does not count,
+* the operands are only skipped and never expanded. */
+struct cond
+{
+struct shell *sh;
+struct ast *ast;
+uint32_t word0, n, i;
+const char *error;
+};
+
+
+static const char *word_at(struct cond *c, uint32_t i) {
+    return ast_str(c->ast, c->ast->words[c->word0 + i]);
+}
+
+
+static bool is_op(struct cond *c, const char *op) {
+    return c->i < c->n && strcmp(word_at(c, c->i), op) == 0;
+}
+
+
+static char *operand(struct cond *c, uint32_t i) {
+    char *s = expand_string(c->sh, word_at(c, i));
+    if (s == NULL) {
+        c->error = "";
+        return xstrdup("");
+    }
+    return s;
+}
+
+
+static bool unary_op(const char *w) {
+    return w[0] == '-' && w[1] != '\0' && w[2] == '\0' && strchr("nzefdrwxsLh", w[1]) != NULL;
+}
+
+
+static const char *binary_ops[] = {
+    "==", "=", "!=", "=~", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge",
+};
+
+
+static int binary_op(const char *w) {
+    for (size_t i = 0; i < sizeof(binary_ops) / sizeof(binary_ops[0]); i++) {
+        if (strcmp(w, binary_ops[i]) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+
+static bool file_test(char op, const char *path) {
+    struct stat st;
+    if (op == 'L' || op == 'h') {
+        return lstat(path, &st) == 0 && S_ISLNK(st.st_mode);
+    }
+    if (stat(path, &st) != 0) {
+        return false;
+    }
+    switch (op) {
+    case 'f': return S_ISREG(st.st_mode);
+    case 'd': return S_ISDIR(st.st_mode);
+    case 's': return st.st_size > 0;
+    case 'r': return access(path, R_OK) == 0;
+    case 'w': return access(path, W_OK) == 0;
+    case 'x': return access(path, X_OK) == 0;
+    }
+    return true;
+}
+
+
+static bool integer(struct cond *c, uint32_t i, int64_t *v) {
+    char *s = operand(c, i);
+    bool ok = arith_eval(c->sh, s, strlen(s), v) == 0;
+    free(s);
+    if (!ok) {
+        c->error = "";
+    }
+    return ok;
+}
+
+
+// Forget the groups of the last match
+void cond_match_clear(struct shell *sh) {
+    for (int i = 0; i < sh->nmatch; i++) {
+        free(sh->match[i]);
+    }
+    free(sh->match);
+    sh->match = NULL;
+    sh->nmatch = 0;
+}
+
+
+/*Match s against the expression in word right, the whole match and the
+* groups go to MATCH*/
+static bool regex_match(struct cond *c, const char *s, uint32_t right) {
+    char *text = expand_regex(c->sh, word_at(c, right));
+    if (text == NULL) {
+        c->error = "";
+        return false;
+    }
+    char *error = NULL;
+    const regex_t *re = regcache_get(text, &error);
+    free(text);
+    if (re == NULL) {
+        fprintf(stderr, "lab: [[: %s\n", error);
+        free(error);
+        c->error = "";
+        return false;
+    }
+    size_t ngroups = re->re_nsub + 1;
+    regmatch_t local[10];
+    regmatch_t *m = ngroups <= 10 ? local : xmalloc(ngroups * sizeof(regmatch_t));
+    bool match = regexec(re, s, ngroups, m, 0) == 0;
+    cond_match_clear(c->sh);
+    if (match) {
+        c->sh->match = xmalloc(ngroups * sizeof(char *));
+        c->sh->nmatch = ngroups;
+        for (size_t i = 0; i < ngroups; i++) {
+            // A group that took no part in the match is empty
+            c->sh->match[i] = m[i].rm_so < 0 ? xstrdup("") : xstrndup(s + m[i].rm_so, m[i].rm_eo - m[i].rm_so);
+        }
+    }
+    if (m != local) {
+        free(m);
+    }
+    return match;
+}
+
+
+static bool binary(struct cond *c, int op, uint32_t left, uint32_t right) {
+    const char *name = binary_ops[op];
+    if (name[0] == '-') {
+        int64_t a, b;
+        if (!integer(c, left, &a) || !integer(c, right, &b)) {
+            return false;
+        }
+        if (strcmp(name, "-eq") == 0) {
+            return a == b;
+        } else if (strcmp(name, "-ne") == 0) {
+            return a != b;
+        } else if (strcmp(name, "-lt") == 0) {
+            return a < b;
+        } else if (strcmp(name, "-le") == 0) {
+            return a <= b;
+        } else if (strcmp(name, "-gt") == 0) {
+            return a > b;
+        }
+        return a >= b;
+    }
+    char *s = operand(c, left);
+    bool result;
+    if (strcmp(name, "=~") == 0) {
+        result = regex_match(c, s, right);
+    } else if (strcmp(name, "==") == 0 || strcmp(name, "!=") == 0) {
+        // The right side is a pattern, quoting makes it literal
+        char *pat = expand_pattern(c->sh, word_at(c, right));
+        result = pat != NULL && pattern_matches(pat, s);
+        if (pat == NULL) {
+            c->error = "";
+        }
+        free(pat);
+        result = result != (name[0] == '!');
+    } else {
+        char *t = operand(c, right);
+        int cmp = strcmp(s, t);
+        result = name[0] == '=' ? cmp == 0 : name[0] == '<' ? cmp < 0 : cmp > 0;
+        free(t);
+    }
+    free(s);
+    return result;
+}
+
+
+static bool cond_or(struct cond *c, bool run);
+
+
+static bool cond_primary(struct cond *c, bool run) {
+    if (c->i >= c->n) {
+        c->error = "unexpected end of expression";
+        return false;
+    }
+    if (is_op(c, "(")) {
+        c->i++;
+        bool v = cond_or(c, run);
+        if (!is_op(c, ")")) {
+            c->error = "expected `)'";
+            return false;
+        }
+        c->i++;
+        return v;
+    }
+    const char *w = word_at(c, c->i);
+    if (unary_op(w) && c->i + 1 < c->n) {
+        uint32_t arg = c->i + 1;
+        c->i += 2;
+        if (!run) {
+            return false;
+        }
+        char *s = operand(c, arg);
+        bool v = w[1] == 'n' ? *s != '\0' : w[1] == 'z' ? *s == '\0' : file_test(w[1], s);
+        free(s);
+        return v;
+    }
+    int op = c->i + 2 < c->n ? binary_op(word_at(c, c->i + 1)) : -1;
+    if (op >= 0) {
+        uint32_t left = c->i;
+        c->i += 3;
+        return run && binary(c, op, left, left + 2);
+    }
+    if (strcmp(w, ")") == 0 || strcmp(w, "&&") == 0 || strcmp(w, "||") == 0) {
+        c->error = "unexpected operator";
+        return false;
+    }
+    // A word alone is true when it is not empty
+    c->i++;
+    if (!run) {
+        return false;
+    }
+    char *s = operand(c, c->i - 1);
+    bool v = *s != '\0';
+    free(s);
+    return v;
+}
+
+
+static bool cond_not(struct cond *c, bool run) {
+    if (is_op(c, "!")) {
+        c->i++;
+        return !cond_not(c, run);
+    }
+    return cond_primary(c, run);
+}
+
+
+static bool cond_and(struct cond *c, bool run) {
+    bool v = cond_not(c, run);
+    while (is_op(c, "&&") && c->error == NULL) {
+        c->i++;
+        bool r = cond_not(c, run && v);
+        v = v && r;
+    }
+    return v;
+}
+
+
+static bool cond_or(struct cond *c, bool run) {
+    bool v = cond_and(c, run);
+    while (is_op(c, "||") && c->error == NULL) {
+        c->i++;
+        bool r = cond_and(c, run && !v);
+        v = v || r;
+    }
+    return v;
+}
+
+
+// Evaluate [[ expression ]]
+int cond_eval(struct shell *sh, struct ast *ast, int32_t idx) {
+    struct node *n = &ast->nodes[idx];
+    struct cond c = { sh, ast, n->word0, n->nwords, 0, NULL };
+    bool v = cond_or(&c, true);
+    if (c.error == NULL && c.i < c.n) {
+        c.error = "unexpected word";
+    }
+    if (c.error != NULL) {
+        if (*c.error) {
+            fprintf(stderr, "lab: [[: %s\n", c.error);
+        }
+        return 2;
+    }
+    return !v;
+}
@@ -0,0 +1,42 @@
+#ifndef COND_H
+#define COND_H
+#include <stdint.h>
+#include "parse.h"
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+struct shell;
+
+
+/**
+* @brief Evaluate [[ expression ]]. Supported are ( ), !, && and ||,
+* the string tests -n and -z, the file tests -e -f -d -r -w -x -s -L,
+* string comparison with == and != against a pattern, =~ against a
+* regular expression that fills MATCH with the groups, = and < >, and
+* integer comparison with -eq -ne -lt -le -gt -ge. Words are expanded
+* without field splitting or pathname expansion, only the operands
+* that are needed are expanded.
+*
+* @param sh The shell
+* @param ast The tree
+* @param idx The cond node
+* @return int 0 when the expression is true, 1 when false, 2 for a
+* syntax error
+*/
+int cond_eval(struct shell *sh, struct ast *ast, int32_t idx);
+
+
+/**
+* @brief Empty MATCH
+*
+* @param sh The shell
+*/
+void cond_match_clear(struct shell *sh);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
@@ -0,0 +1,415 @@
+#define _GNU_SOURCE
+#include "dirdb.h"
+#include "lab.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Size of a record with a path of len bytes, keeps records 8 byte aligned
+#define REC_SIZE(len) (sizeof(struct dirdb_rec) + (((size_t)(len) + 8) & ~(size_t)7))
+
+// Longest path worth remembering
+#define DIRDB_MAXPATH 4096
+
+
+static struct dirdb_rec *rec_at(const struct dirdb *db, size_t doc) {
+    return (struct dirdb_rec *)(db->map + db->offs[doc]);
+}
+
+
+static const char *rec_path(const struct dirdb_rec *rec) {
+    return (const char *)(rec + 1);
+}
+
+
+// Index the records that were appended since the last call
+static void index_new(struct dirdb *db) {
+    while (db->end + sizeof(struct dirdb_rec) <= db->maplen) {
+        struct dirdb_rec *rec = (struct dirdb_rec *)(db->map + db->end);
+        if (rec->len == 0 || rec->len > DIRDB_MAXPATH || db->end + REC_SIZE(rec->len) > db->maplen ||
+            rec_path(rec)[rec->len] != '\0') {
+            break;
+        }
+        if (db->noffs == db->capoffs) {
+            db->capoffs = db->capoffs ? db->capoffs * 2 : 256;
+            db->offs = xrealloc(db->offs, db->capoffs * sizeof(size_t));
+        }
+        size_t doc = db->noffs++;
+        db->offs[doc] = db->end;
+        hmap_put(&db->dirs, rec_path(rec), (void *)(doc + 1));
+        trigram_add(&db->ix, doc, rec_path(rec), rec->len);
+        db->total += rec->rank;
+        db->end += REC_SIZE(rec->len);
+    }
+}
+
+
+// Map the file again when it grew and index the new records
+static int db_map(struct dirdb *db) {
+    struct stat st;
+    if (fstat(db->fd, &st) < 0) {
+        return -1;
+    }
+    if ((size_t)st.st_size > db->maplen) {
+        char *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, db->fd, 0);
+        if (map == MAP_FAILED) {
+            return -1;
+        }
+        if (db->map != NULL) {
+            munmap(db->map, db->maplen);
+        }
+        db->map = map;
+        db->maplen = st.st_size;
+    }
+    index_new(db);
+    return 0;
+}
+
+
+static void db_unload(struct dirdb *db) {
+    if (db->map != NULL) {
+        munmap(db->map, db->maplen);
+    }
+    if (db->fd >= 0) {
+        close(db->fd);
+    }
+    free(db->offs);
+    hmap_free(&db->dirs, NULL);
+    trigram_free(&db->ix);
+    db->fd = -1;
+    db->map = NULL;
+    db->maplen = db->end = 0;
+    db->offs = NULL;
+    db->noffs = db->capoffs = 0;
+    db->total = 0;
+}
+
+
+static int db_load(struct dirdb *db) {
+    db->fd = open(db->path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (db->fd < 0) {
+        return -1;
+    }
+    // Two shells starting at once must not both write a header
+    flock(db->fd, LOCK_EX);
+    struct stat st;
+    if (fstat(db->fd, &st) < 0) {
+        db_unload(db);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        struct dirdb_header hdr = { DIRDB_MAGIC, DIRDB_VERSION };
+        if (write_all(db->fd, (const char *)&hdr, sizeof(hdr)) < 0) {
+            db_unload(db);
+            return -1;
+        }
+    }
+    flock(db->fd, LOCK_UN);
+    db->dev = st.st_dev;
+    db->ino = st.st_ino;
+    db->end = sizeof(struct dirdb_header);
+    if (db_map(db) < 0 || db->maplen < sizeof(struct dirdb_header) ||
+        memcmp(db->map, DIRDB_MAGIC, 4) != 0) {
+        fprintf(stderr, "lab: %s: not a directory database\n", db->path);
+        db_unload(db);
+        return -1;
+    }
+    return 0;
+}
+
+
+/*Catch up with other shells. A shell that aged the ranks replaced the
+* file, anything else only appends to it.*/
+static int db_refresh(struct dirdb *db) {
+    struct stat st;
+    if (db->fd >= 0 && stat(db->path, &st) == 0 && st.st_dev == db->dev && st.st_ino == db->ino) {
+        return db_map(db);
+    }
+    db_unload(db);
+    return db_load(db);
+}
+
+
+// Take the write lock on the file that is currently at the path
+static int db_lock(struct dirdb *db) {
+    for (int tries = 0; tries < 3; tries++) {
+        if (db_refresh(db) < 0) {
+            return -1;
+        }
+        flock(db->fd, LOCK_EX);
+        struct stat st;
+        if (stat(db->path, &st) == 0 && st.st_dev == db->dev && st.st_ino == db->ino) {
+            return db_map(db);
+        }
+        flock(db->fd, LOCK_UN);
+    }
+    return -1;
+}
+
+
+// Open a directory database, creating it when it does not exist
+struct dirdb *dirdb_open(const char *path) {
+    struct dirdb *db = xcalloc(1, sizeof(*db));
+    db->fd = -1;
+    db->path = xstrdup(path);
+    if (db_load(db) < 0) {
+        free(db->path);
+        free(db);
+        return NULL;
+    }
+    return db;
+}
+
+
+/*Rewrite the file with every rank aged by 1%, dropping directories that
+* fall below one visit. The caller holds the lock.*/
+static int db_age(struct dirdb *db) {
+    char *tmp = xmalloc(strlen(db->path) + 5);
+    sprintf(tmp, "%s.tmp", db->path);
+    int out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    int rc = -1;
+    if (out >= 0) {
+        struct strbuf buf = {0};
+        struct dirdb_header hdr = { DIRDB_MAGIC, DIRDB_VERSION };
+        strbuf_add(&buf, (const char *)&hdr, sizeof(hdr));
+        for (size_t i = 0; i < db->noffs; i++) {
+            struct dirdb_rec *rec = rec_at(db, i);
+            struct dirdb_rec aged = *rec;
+            aged.rank = (uint64_t)rec->rank * 99 / 100;
+            if (aged.rank < DIRDB_SCALE) {
+                continue;
+            }
+            size_t at = buf.len;
+            strbuf_add(&buf, (const char *)&aged, sizeof(aged));
+            strbuf_add(&buf, rec_path(rec), rec->len);
+            while (buf.len - at < REC_SIZE(rec->len)) {
+                strbuf_addc(&buf, '\0');
+            }
+        }
+        rc = write_all(out, buf.s, buf.len);
+        strbuf_free(&buf);
+        if (close(out) < 0 || rc < 0 || rename(tmp, db->path) < 0) {
+            unlink(tmp);
+            rc = -1;
+        }
+    }
+    free(tmp);
+    return rc;
+}
+
+
+// Record a visit to a directory
+int dirdb_visit(struct dirdb *db, const char *dir) {
+    size_t len = dir ? strlen(dir) : 0;
+    if (len == 0 || len > DIRDB_MAXPATH) {
+        return 0;
+    }
+    if (db_refresh(db) < 0) {
+        return -1;
+    }
+    size_t doc = (size_t)hmap_get(&db->dirs, dir);
+    if (doc == 0) {
+        // Another shell may be adding the same directory
+        if (db_lock(db) < 0) {
+            return -1;
+        }
+        doc = (size_t)hmap_get(&db->dirs, dir);
+        if (doc == 0) {
+            struct strbuf buf = {0};
+            struct dirdb_rec rec = { 0, len, 0 };
+            strbuf_add(&buf, (const char *)&rec, sizeof(rec));
+            strbuf_add(&buf, dir, len);
+            while (buf.len < REC_SIZE(len)) {
+                strbuf_addc(&buf, '\0');
+            }
+            int rc = write_all(db->fd, buf.s, buf.len);
+            strbuf_free(&buf);
+            if (rc < 0 || db_map(db) < 0) {
+                flock(db->fd, LOCK_UN);
+                return -1;
+            }
+            doc = (size_t)hmap_get(&db->dirs, dir);
+        }
+        flock(db->fd, LOCK_UN);
+        if (doc == 0) {
+            errno = EIO;
+            return -1;
+        }
+    }
+    // Other shells update the same mapping
+    struct dirdb_rec *rec = rec_at(db, doc - 1);
+    __atomic_add_fetch(&rec->rank, DIRDB_SCALE, __ATOMIC_RELAXED);
+    __atomic_store_n(&rec->time, (int64_t)time(NULL), __ATOMIC_RELAXED);
+    db->total += DIRDB_SCALE;
+    if (db->total <= DIRDB_MAXRANK) {
+        return 0;
+    }
+    // Our total misses the visits of other shells, count them before aging
+    if (db_lock(db) < 0) {
+        return -1;
+    }
+    db->total = 0;
+    for (size_t i = 0; i < db->noffs; i++) {
+        db->total += rec_at(db, i)->rank;
+    }
+    int rc = 0;
+    if (db->total > DIRDB_MAXRANK) {
+        rc = db_age(db);
+    }
+    flock(db->fd, LOCK_UN);
+    if (rc == 0) {
+        db_unload(db);
+        rc = db_load(db);
+    }
+    return rc;
+}
+
+
+// Frecency of a record
+uint64_t dirdb_score(const struct dirdb_rec *rec, time_t now) {
+    int64_t age = now - rec->time;
+    // Four times the rank within the hour down to a quarter after a week, times 4
+    uint64_t weight = age < 3600 ? 16 : age < 86400 ? 8 : age < 604800 ? 2 : 1;
+    return rec->rank * weight;
+}
+
+
+/* A directory that matched, see dirdb_find */
+struct dir_match
+{
+uint64_t score;
+size_t doc;
+};
+
+
+static int match_cmp(const void *a, const void *b) {
+    const struct dir_match *x = a, *y = b;
+    if (x->score != y->score) {
+        return x->score < y->score ? 1 : -1;
+    }
+    return x->doc < y->doc ? 1 : -1;
+}
+
+
+/* Candidates handed out by the trigram index */
+struct doc_list
+{
+uint32_t *docs;
+size_t n;
+size_t cap;
+};
+
+
+static bool doc_push(uint32_t doc, void *arg) {
+    struct doc_list *l = arg;
+    if (l->n == l->cap) {
+        l->cap = l->cap ? l->cap * 2 : 64;
+        l->docs = xrealloc(l->docs, l->cap * sizeof(uint32_t));
+    }
+    l->docs[l->n++] = doc;
+    return true;
+}
+
+
+// Check that every word appears in path, in order
+static bool words_match(const char *path, char **words) {
+    for (int i = 0; words[i]; i++) {
+        const char *at = strstr(path, words[i]);
+        if (at == NULL) {
+            return false;
+        }
+        path = at + strlen(words[i]);
+    }
+    return true;
+}
+
+
+// Find the directories whose path contains every word
+size_t dirdb_find(struct dirdb *db, char **words, time_t now, struct strvec *out) {
+    if (db_refresh(db) < 0) {
+        return 0;
+    }
+    const char *longest = "";
+    for (int i = 0; words[i]; i++) {
+        if (strlen(words[i]) > strlen(longest)) {
+            longest = words[i];
+        }
+    }
+    struct doc_list cands = {0};
+    bool indexed = trigram_search(&db->ix, longest, strlen(longest), doc_push, &cands);
+    size_t n = indexed ? cands.n : db->noffs;
+    struct dir_match *m = xmalloc((n ? n : 1) * sizeof(*m));
+    size_t found = 0;
+    for (size_t i = 0; i < n; i++) {
+        size_t doc = indexed ? cands.docs[i] : i;
+        struct dirdb_rec *rec = rec_at(db, doc);
+        if (rec->rank > 0 && words_match(rec_path(rec), words)) {
+            m[found].score = dirdb_score(rec, now);
+            m[found].doc = doc;
+            found++;
+        }
+    }
+    qsort(m, found, sizeof(*m), match_cmp);
+    for (size_t i = 0; i < found; i++) {
+        strvec_push(out, xstrdup(rec_path(rec_at(db, m[i].doc))));
+    }
+    free(m);
+    free(cands.docs);
+    return found;
+}
+
+
+// Close a database
+void dirdb_close(struct dirdb *db) {
+    if (db == NULL) {
+        return;
+    }
+    db_unload(db);
+    free(db->path);
+    free(db);
+}
+
+
+// The z builtin
+int z_builtin(struct shell *sh, char **argv) {
+    if (sh->dirs == NULL) {
+        fprintf(stderr, "z: no directory database\n");
+        return 1;
+    }
+    bool list = argv[1] != NULL && strcmp(argv[1], "-l") == 0;
+    char **words = argv + 1 + list;
+    struct strvec found = {0};
+    time_t now = time(NULL);
+    dirdb_find(sh->dirs, words, now, &found);
+    int rc = 1;
+    if (list || words[0] == NULL) {
+        // Best last, next to the prompt
+        for (size_t i = found.n; i-- > 0;) {
+            size_t doc = (size_t)hmap_get(&sh->dirs->dirs, found.v[i]) - 1;
+            printf("%-10.2f %s\n", (double)dirdb_score(rec_at(sh->dirs, doc), now) / (4 * DIRDB_SCALE), found.v[i]);
+            rc = 0;
+        }
+    } else {
+        char *cwd = getcwd(NULL, 0);
+        for (size_t i = 0; i < found.n && rc != 0; i++) {
+            char *cd[] = { "cd", found.v[i], NULL };
+            // Directories that are gone are skipped
+            if ((cwd == NULL || strcmp(cwd, found.v[i]) != 0) && change_dir(cd) == 0) {
+                dirdb_visit(sh->dirs, found.v[i]);
+                rc = 0;
+            }
+        }
+        free(cwd);
+        if (rc != 0) {
+            fprintf(stderr, "z: no match\n");
+        }
+    }
+    strvec_free(&found);
+    return rc;
+}
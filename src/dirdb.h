@@ -0,0 +1,140 @@
+#ifndef DIRDB_H
+#define DIRDB_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/types.h>
+#include "hmap.h"
+#include "trigram.h"
+#include "util.h"
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+struct shell;
+
+
+/* File header, followed by the records */
+#define DIRDB_MAGIC "LABZ"
+#define DIRDB_VERSION 1
+
+/* A visit adds this much to the rank of a directory */
+#define DIRDB_SCALE 100
+
+/* When the ranks add up to more than this every rank is aged by 1% and
+* directories that fall below one visit are forgotten */
+#define DIRDB_MAXRANK (9000 * DIRDB_SCALE)
+
+struct dirdb_header
+{
+char magic[4];
+uint32_t version;
+};
+
+
+/* On disk record, followed by the NUL terminated path padded to 8 bytes.
+* rank and time are updated in place through the shared mapping. */
+struct dirdb_rec
+{
+uint32_t rank;       // visits times DIRDB_SCALE, aged over time
+uint32_t len;        // length of the path without the NUL
+int64_t time;        // last visit
+};
+
+
+/* An open directory database. The whole file is mapped, new records are
+* appended with write and picked up by mapping the file again. */
+struct dirdb
+{
+int fd;              // opened with O_APPEND
+char *path;
+dev_t dev;           // identity of the file fd refers to
+ino_t ino;
+char *map;
+size_t maplen;
+size_t end;          // end of the last record indexed
+size_t *offs;        // offset of every record, indexed by document number
+size_t noffs;
+size_t capoffs;
+struct hmap dirs;    // path -> document number + 1
+struct trigram_index ix;  // trigrams of the paths
+uint64_t total;      // sum of the ranks as far as we know
+};
+
+
+/**
+* @brief Open a directory database, creating it when it does not exist
+*
+* @param path The file
+* @return struct dirdb* The database, NULL on error
+*/
+struct dirdb *dirdb_open(const char *path);
+
+
+/**
+* @brief Record a visit to a directory. A directory seen before has its
+* rank bumped in place, a new one is appended. The ranks are aged when
+* they add up to more than DIRDB_MAXRANK.
+*
+* @param db The database
+* @param dir The absolute path of the directory, NULL is ignored
+* @return int 0 on success, -1 on error
+*/
+int dirdb_visit(struct dirdb *db, const char *dir);
+
+
+/**
+* @brief Frecency of a record at a time, the rank weighted by how
+* recently the directory was visited. The weights of z are used, scaled
+* by 4 to stay in integers.
+*
+* @param rec The record
+* @param now The time
+* @return uint64_t The score
+*/
+uint64_t dirdb_score(const struct dirdb_rec *rec, time_t now);
+
+
+/**
+* @brief Find the directories whose path contains every word, in order.
+* Candidates come from the trigram index of the longest word, only words
+* shorter than a trigram make it walk all records.
+*
+* @param db The database
+* @param words The words, NULL terminated
+* @param now The time used for the scores
+* @param out The paths are appended here, best first
+* @return size_t The number of paths found
+*/
+size_t dirdb_find(struct dirdb *db, char **words, time_t now, struct strvec *out);
+
+
+/**
+* @brief Close a database
+*
+* @param db The database, may be NULL
+*/
+void dirdb_close(struct dirdb *db);
+
+
+/**
+* @brief The z builtin.
+*
+*   z [-l] [word ...]
+*
+* Changes to the best matching directory that still exists, or lists
+* the matches with their scores with -l or without words.
+*
+* @param sh The shell
+* @param argv The arguments
+* @return int The exit status, 1 when nothing matched
+*/
+int z_builtin(struct shell *sh, char **argv);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
@@ -0,0 +1,162 @@
+#define _GNU_SOURCE
+#include "dirstack.h"
+#include "dirdb.h"
+#include "lab.h"
+#include "util.h"
+#include "vars.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+// Print a directory with $HOME shown as ~
+static void print_dir(const char *dir, const char *sep) {
+    const char *home = var_get("HOME");
+    size_t n = home ? strlen(home) : 0;
+    if (n > 1 && strncmp(dir, home, n) == 0 && (dir[n] == '/' || dir[n] == '\0')) {
+        printf("~%s%s", dir + n, sep);
+    } else {
+        printf("%s%s", dir, sep);
+    }
+}
+
+
+// The current directory as a stack entry
+static struct dir_entry dir_here(void) {
+    const char *pwd = var_get("PWD");
+    struct dir_entry e;
+    e.path = pwd ? xstrdup(pwd) : getcwd(NULL, 0);
+    if (e.path == NULL) {
+        e.path = xstrdup(".");
+    }
+    e.fd = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    return e;
+}
+
+
+static void dir_entry_free(struct dir_entry *e) {
+    if (e->fd >= 0) {
+        close(e->fd);
+    }
+    free(e->path);
+}
+
+
+static void dirstack_push(struct shell *sh, struct dir_entry e) {
+    if (sh->ndirstack == sh->capdirstack) {
+        sh->capdirstack = sh->capdirstack ? sh->capdirstack * 2 : 8;
+        sh->dirstack = xrealloc(sh->dirstack, sh->capdirstack * sizeof(struct dir_entry));
+    }
+    sh->dirstack[sh->ndirstack++] = e;
+}
+
+
+static void dirs_print(struct shell *sh) {
+    const char *pwd = var_get("PWD");
+    print_dir(pwd ? pwd : ".", sh->ndirstack ? " " : "\n");
+    for (int i = sh->ndirstack; i-- > 0;) {
+        print_dir(sh->dirstack[i].path, i ? " " : "\n");
+    }
+}
+
+
+// Count the directory we ended up in for z
+static void visited(struct shell *sh) {
+    if (sh->dirs != NULL) {
+        dirdb_visit(sh->dirs, var_get("PWD"));
+    }
+}
+
+
+// The pushd builtin
+int pushd_builtin(struct shell *sh, char **argv) {
+    struct dir_entry here = dir_here();
+    if (argv[1] == NULL) {
+        if (sh->ndirstack == 0) {
+            fprintf(stderr, "pushd: no other directory\n");
+            dir_entry_free(&here);
+            return 1;
+        }
+        struct dir_entry *top = &sh->dirstack[sh->ndirstack - 1];
+        if (change_dir_at(top->fd, top->path) != 0) {
+            perror("pushd");
+            dir_entry_free(&here);
+            return 1;
+        }
+        dir_entry_free(top);
+        *top = here;
+    } else {
+        char *cd[] = { "cd", argv[1], NULL };
+        int rc = change_dir(cd);
+        if (rc != 0) {
+            if (rc == -1) {
+                fprintf(stderr, "pushd: %s: %s\n", argv[1], strerror(errno));
+            }
+            dir_entry_free(&here);
+            return 1;
+        }
+        dirstack_push(sh, here);
+    }
+    visited(sh);
+    dirs_print(sh);
+    return 0;
+}
+
+
+// The popd builtin
+int popd_builtin(struct shell *sh, char **argv) {
+    UNUSED(argv);
+    if (sh->ndirstack == 0) {
+        fprintf(stderr, "popd: directory stack empty\n");
+        return 1;
+    }
+    struct dir_entry *top = &sh->dirstack[sh->ndirstack - 1];
+    if (change_dir_at(top->fd, top->path) != 0) {
+        perror("popd");
+        return 1;
+    }
+    dir_entry_free(top);
+    sh->ndirstack--;
+    visited(sh);
+    dirs_print(sh);
+    return 0;
+}
+
+
+// The dirs builtin
+int dirs_builtin(struct shell *sh, char **argv) {
+    if (argv[1] != NULL && strcmp(argv[1], "-c") == 0) {
+        dirstack_free(sh);
+        return 0;
+    }
+    if (argv[1] != NULL && strcmp(argv[1], "-v") == 0) {
+        const char *pwd = var_get("PWD");
+        printf(" 0  ");
+        print_dir(pwd ? pwd : ".", "\n");
+        for (int i = sh->ndirstack; i-- > 0;) {
+            printf("%2d  ", sh->ndirstack - i);
+            print_dir(sh->dirstack[i].path, "\n");
+        }
+        return 0;
+    }
+    if (argv[1] != NULL) {
+        fprintf(stderr, "dirs: %s: invalid option\n", argv[1]);
+        return 2;
+    }
+    dirs_print(sh);
+    return 0;
+}
+
+
+// Close the descriptors of the directory stack and free it
+void dirstack_free(struct shell *sh) {
+    for (int i = 0; i < sh->ndirstack; i++) {
+        dir_entry_free(&sh->dirstack[i]);
+    }
+    free(sh->dirstack);
+    sh->dirstack = NULL;
+    sh->ndirstack = sh->capdirstack = 0;
+}
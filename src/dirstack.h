@@ -0,0 +1,73 @@
+#ifndef DIRSTACK_H
+#define DIRSTACK_H
+#include <stddef.h>
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+struct shell;
+
+
+/* A directory on the pushd stack. The O_PATH descriptor takes us back
+* without resolving the path again, the path is only shown. */
+struct dir_entry
+{
+char *path;
+int fd;
+};
+
+
+/**
+* @brief The pushd builtin.
+*
+*   pushd [dir]
+*
+* Saves the current directory on the stack and changes to dir. Without
+* dir the current directory and the top of the stack are swapped.
+*
+* @param sh The shell
+* @param argv The arguments
+* @return int The exit status
+*/
+int pushd_builtin(struct shell *sh, char **argv);
+
+
+/**
+* @brief The popd builtin. Changes to the directory on top of the stack
+* and removes it.
+*
+* @param sh The shell
+* @param argv The arguments
+* @return int The exit status, 1 when the stack is empty
+*/
+int popd_builtin(struct shell *sh, char **argv);
+
+
+/**
+* @brief The dirs builtin.
+*
+*   dirs [-c | -v]
+*
+* Prints the current directory followed by the stack, top first, with
+* $HOME shown as ~. -v numbers them one per line, -c clears the stack.
+*
+* @param sh The shell
+* @param argv The arguments
+* @return int The exit status
+*/
+int dirs_builtin(struct shell *sh, char **argv);
+
+
+/**
+* @brief Close the descriptors of the directory stack and free it
+*
+* @param sh The shell
+*/
+void dirstack_free(struct shell *sh);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
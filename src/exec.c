@@ -0,0 +1,1300 @@
+#define _GNU_SOURCE
+#include "exec.h"
+#include "alias.h"
+#include "arith.h"
+#include "array.h"
+#include "expand.h"
+#include "hmap.h"
+#include "cmdhash.h"
+#include "cond.h"
+#include "func.h"
+#include "input.h"
+#include "complete.h"
+#include "jobs.h"
+#include "lab.h"
+#include "util.h"
+#include "vm.h"
+#include "vars.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+static int exec_node(struct shell *sh, struct ast *ast, int32_t idx);
+
+/* File descriptors replaced by in-process redirections and their saved
+* copies. A saved value of -1 means the descriptor was closed before.*/
+struct fdsave
+{
+int fd;
+int saved;
+};
+
+struct redir_save
+{
+struct fdsave *v;
+int n;
+int cap;
+};
+
+
+static void heredoc_release(struct redir *r) {
+    if (r->map != NULL) {
+        munmap((void *)r->map, r->maplen);
+    }
+    if (r->memfd >= 0) {
+        close(r->memfd);
+    }
+    r->map = NULL;
+    r->maplen = 0;
+    r->memfd = -1;
+}
+
+
+/*Open a new description of the cached memfd so every reader starts at
+* offset zero, even when an earlier child is still reading it.*/
+static int heredoc_reopen(int memfd) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", memfd);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fd = fcntl(memfd, F_DUPFD_CLOEXEC, 0);
+        if (fd >= 0) {
+            lseek(fd, 0, SEEK_SET);
+        }
+    }
+    return fd;
+}
+
+
+/*Put a heredoc body in an unlinked temporary file, only used when the
+* kernel has no memfd support*/
+static int heredoc_tmpfile(const char *body, size_t len) {
+    const char *dir = var_get("TMPDIR");
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/lab-heredoc-XXXXXX", dir ? dir : "/tmp");
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        return -1;
+    }
+    unlink(path);
+    if (write_all(fd, body, len) < 0 || lseek(fd, 0, SEEK_SET) < 0) {
+        close(fd);
+        return -1;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+}
+
+
+/*Return a readable descriptor holding the body of a heredoc or
+* here-string. The body is written once to a sealed memfd that stays
+* cached on the redirection, so a heredoc that runs again with the same
+* body costs only an open.*/
+static int heredoc_fd(struct shell *sh, struct ast *ast, struct redir *r) {
+    const char *raw = ast_str(ast, r->arg);
+    char *body = NULL;
+    size_t len;
+    if (r->kind == REDIR_HERESTR) {
+        char *s = expand_string(sh, raw);
+        if (s == NULL) {
+            return -1;
+        }
+        len = strlen(s);
+        body = xrealloc(s, len + 2);
+        body[len++] = '\n';
+        body[len] = '\0';
+    } else if (r->flags & REDIR_QUOTED) {
+        len = r->arg.len;
+    } else {
+        body = expand_heredoc(sh, raw, r->arg.len, &len);
+    }
+    const char *data = body ? body : raw;
+
+    bool cached = r->memfd >= 0 && r->maplen == len &&
+                  (len == 0 || memcmp(r->map, data, len) == 0);
+    if (!cached) {
+        heredoc_release(r);
+        int fd = memfd_create("heredoc", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (fd < 0) {
+            fd = heredoc_tmpfile(data, len);
+            free(body);
+            return fd;
+        }
+        if (write_all(fd, data, len) < 0) {
+            close(fd);
+            free(body);
+            return -1;
+        }
+        fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+        // The mapping lets the next run compare bodies without a syscall
+        void *map = NULL;
+        if (len > 0) {
+            map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+            if (map == MAP_FAILED) {
+                lseek(fd, 0, SEEK_SET);
+                free(body);
+                return fd;
+            }
+        }
+        r->memfd = fd;
+        r->map = map;
+        r->maplen = len;
+    }
+    free(body);
+    return heredoc_reopen(r->memfd);
+}
+
+
+static void save_fd(struct redir_save *save, int fd) {
+    for (int i = 0; i < save->n; i++) {
+        if (save->v[i].fd == fd) {
+            return;
+        }
+    }
+    if (save->n == save->cap) {
+        save->cap = save->cap ? save->cap * 2 : 4;
+        save->v = xrealloc(save->v, save->cap * sizeof(struct fdsave));
+    }
+    save->v[save->n].fd = fd;
+    save->v[save->n].saved = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+    save->n++;
+}
+
+
+/*Undo in-process redirections in reverse order*/
+static void redirs_restore(struct redir_save *save) {
+    fflush(stdout);
+    fflush(stderr);
+    for (int i = save->n - 1; i >= 0; i--) {
+        struct fdsave *s = &save->v[i];
+        input_sync(s->fd);
+        if (s->saved >= 0) {
+            dup2(s->saved, s->fd);
+            close(s->saved);
+        } else {
+            close(s->fd);
+        }
+    }
+    free(save->v);
+    save->v = NULL;
+    save->n = save->cap = 0;
+}
+
+
+/*Open the heredocs of a command in the parent so their memfds stay
+* cached on the tree instead of dying with the child. Returns NULL when
+* the command has no heredocs.*/
+static int *heredocs_open(struct shell *sh, struct ast *ast, struct node *n, bool *ok) {
+    int *fds = NULL;
+    *ok = true;
+    for (uint32_t i = 0; i < n->nredirs; i++) {
+        struct redir *r = &ast->redirs[n->redir0 + i];
+        if (r->kind != REDIR_HEREDOC && r->kind != REDIR_HERESTR) {
+            continue;
+        }
+        if (fds == NULL) {
+            fds = xmalloc(n->nredirs * sizeof(int));
+            for (uint32_t j = 0; j < n->nredirs; j++) {
+                fds[j] = -1;
+            }
+        }
+        fds[i] = heredoc_fd(sh, ast, r);
+        if (fds[i] < 0) {
+            fprintf(stderr, "here-document: %s\n", strerror(errno));
+            *ok = false;
+        }
+    }
+    return fds;
+}
+
+
+static void heredocs_close(int *fds, uint32_t n) {
+    if (fds == NULL) {
+        return;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        if (fds[i] >= 0) {
+            close(fds[i]);
+        }
+    }
+    free(fds);
+}
+
+
+/*Apply the redirections of a command. When save is not NULL the
+* replaced descriptors are kept so redirs_restore can put them back.
+* Heredocs already opened by heredocs_open are passed in hfds.*/
+static int redirs_apply(struct shell *sh, struct ast *ast, struct node *n, struct redir_save *save, int *hfds) {
+    if (save != NULL) {
+        fflush(stdout);
+        fflush(stderr);
+    }
+    for (uint32_t i = 0; i < n->nredirs; i++) {
+        struct redir *r = &ast->redirs[n->redir0 + i];
+        char *target = NULL;
+        int fd = -1;
+        bool owned = true;
+
+        if (save != NULL) {
+            save_fd(save, r->fd);
+        }
+        input_sync(r->fd);
+        if (r->kind != REDIR_HEREDOC && r->kind != REDIR_HERESTR) {
+            target = expand_string(sh, ast_str(ast, r->arg));
+            if (target == NULL) {
+                return -1;
+            }
+        }
+        switch (r->kind) {
+        case REDIR_IN:
+            fd = open(target, O_RDONLY | O_CLOEXEC);
+            break;
+        case REDIR_OUT:
+            fd = open(target, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+            break;
+        case REDIR_APPEND:
+            fd = open(target, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666);
+            break;
+        case REDIR_DUP: {
+            if (strcmp(target, "-") == 0) {
+                close(r->fd);
+                free(target);
+                continue;
+            }
+            char *end;
+            long src = strtol(target, &end, 10);
+            if (*target == '\0' || *end != '\0' || src < 0 || fcntl((int)src, F_GETFD) < 0) {
+                fprintf(stderr, "%s: bad file descriptor\n", target);
+                free(target);
+                return -1;
+            }
+            fd = (int)src;
+            owned = false;
+            break;
+        }
+        case REDIR_HEREDOC:
+        case REDIR_HERESTR:
+            fd = hfds ? hfds[i] : heredoc_fd(sh, ast, r);
+            break;
+        }
+
+        if (fd < 0) {
+            fprintf(stderr, "%s: %s\n", target ? target : "here-document", strerror(errno));
+            free(target);
+            return -1;
+        }
+        free(target);
+        if (fd != r->fd) {
+            dup2(fd, r->fd);
+            if (owned) {
+                close(fd);
+            }
+        } else {
+            // The target was closed so open handed it back to us
+            fcntl(fd, F_SETFD, 0);
+        }
+    }
+    return 0;
+}
+
+
+// Put the signals the shell ignores back to their defaults in a child
+static void child_signals(void) {
+    signal(SIGINT, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGTTIN, SIG_DFL);
+    signal(SIGTTOU, SIG_DFL);
+}
+
+
+// Start a process substitution
+char *procsubst_open(struct shell *sh, const char *cmd, size_t len, bool reader) {
+    int p[2];
+    if (pipe2(p, O_CLOEXEC) < 0) {
+        perror("pipe");
+        return NULL;
+    }
+    // Our end is p[0] when we read what the command writes
+    int ours = reader ? p[0] : p[1];
+    int theirs = reader ? p[1] : p[0];
+
+    char *text = xstrndup(cmd, len);
+    fflush(stdout);
+    fflush(stderr);
+    input_sync_all();
+    pid_t pid = fork();
+    if (pid == 0) {
+        child_signals();
+        dup2(theirs, reader ? STDOUT_FILENO : STDIN_FILENO);
+        close(theirs);
+        close(ours);
+        // Ends belonging to sibling substitutions would hold their pipes open
+        for (int i = 0; i < sh->npsfds; i++) {
+            close(sh->psfds[i]);
+        }
+        sh->npsfds = 0;
+        sh->shell_is_interactive = 0;
+        int status = exec_string(sh, text);
+        fflush(stdout);
+        input_sync_all();
+        _exit(status);
+    } else if (pid < 0) {
+        perror("fork");
+        close(p[0]);
+        close(p[1]);
+        free(text);
+        return NULL;
+    }
+    close(theirs);
+    struct job *job = job_new(sh, text, JOB_PROCSUBST);
+    job_add_pid(job, pid);
+    free(text);
+
+    if (sh->npsfds == sh->cappsfds) {
+        sh->cappsfds = sh->cappsfds ? sh->cappsfds * 2 : 4;
+        sh->psfds = xrealloc(sh->psfds, sh->cappsfds * sizeof(int));
+    }
+    sh->psfds[sh->npsfds++] = ours;
+    char path[32];
+    snprintf(path, sizeof(path), "/dev/fd/%d", ours);
+    return xstrdup(path);
+}
+
+
+// Close our ends of the process substitution pipes
+void procsubst_close(struct shell *sh) {
+    if (sh->npsfds == 0) {
+        return;
+    }
+    for (int i = 0; i < sh->npsfds; i++) {
+        close(sh->psfds[i]);
+    }
+    sh->npsfds = 0;
+    jobs_reap(sh);
+}
+
+
+/*Set up a freshly forked child of a job. Every process of the job joins
+* the process group of the first one, which gets the terminal when the
+* job runs in the foreground.*/
+static void child_setup(struct shell *sh, pid_t pgid, bool foreground) {
+    if (sh->shell_is_interactive) {
+        pid_t child = getpid();
+        if (pgid == 0) {
+            pgid = child;
+        }
+        setpgid(child, pgid);
+        if (foreground) {
+            tcsetpgrp(sh->shell_terminal, pgid);
+        }
+    }
+    child_signals();
+    // Only the top level shell manages the terminal
+    sh->shell_is_interactive = 0;
+}
+
+
+/*This is in the parent put the child process into the process group of
+* its job as well, so it does not matter which side runs first*/
+static void parent_setup(struct shell *sh, struct job *job, pid_t pid) {
+    if (sh->shell_is_interactive) {
+        setpgid(pid, job->pgid ? job->pgid : pid);
+    }
+    job_add_pid(job, pid);
+}
+
+
+/* The parts of an assignment word name[sub]+=value, sub is NULL without
+* a subscript and value starts with ( for a compound name=(...) */
+struct assign
+{
+const char *name;
+size_t n;
+const char *sub;
+size_t nsub;
+bool append;         // += adds to the value instead of replacing it
+const char *value;
+};
+
+
+/*Split an assignment word into its parts. Returns false when the word is
+* not an assignment.*/
+static bool assign_parse(const char *w, struct assign *a) {
+    size_t i = 0;
+    while (w[i] == '_' || isalnum((unsigned char)w[i])) {
+        i++;
+    }
+    if (!var_name_valid(w, i)) {
+        return false;
+    }
+    a->name = w;
+    a->n = i;
+    a->sub = NULL;
+    a->nsub = 0;
+    if (w[i] == '[') {
+        // The subscript ends at the first ] that an = follows
+        size_t k = i + 1;
+        while (w[k] && !(w[k] == ']' && (w[k + 1] == '=' || (w[k + 1] == '+' && w[k + 2] == '=')))) {
+            k++;
+        }
+        if (w[k] == '\0') {
+            return false;
+        }
+        a->sub = w + i + 1;
+        a->nsub = k - i - 1;
+        i = k + 1;
+    }
+    a->append = w[i] == '+';
+    i += a->append;
+    if (w[i] != '=') {
+        return false;
+    }
+    a->value = w + i + 1;
+    return true;
+}
+
+
+/*Count the assignments at the start of a simple command, the words of
+* the form name=value that come before the command name*/
+static uint32_t assign_count(struct ast *ast, struct node *n) {
+    uint32_t i = 0;
+    struct assign a;
+    while (i < n->nwords && assign_parse(ast_str(ast, ast->words[n->word0 + i]), &a)) {
+        i++;
+    }
+    return i;
+}
+
+
+/*Expand the first count words of a command as assignments into
+* name=value strings. Only plain strings can go in front of a command.*/
+static int assigns_expand(struct shell *sh, struct ast *ast, struct node *n, uint32_t count, struct strvec *out) {
+    for (uint32_t i = 0; i < count; i++) {
+        const char *w = ast_str(ast, ast->words[n->word0 + i]);
+        struct assign a;
+        assign_parse(w, &a);
+        if (a.sub != NULL || a.value[0] == '(') {
+            fprintf(stderr, "lab: %.*s: cannot assign an array in front of a command\n", (int)a.n, w);
+            return -1;
+        }
+        char *value = expand_string(sh, a.value);
+        if (value == NULL) {
+            return -1;
+        }
+        struct strbuf s = {0};
+        strbuf_add(&s, w, a.n);
+        strbuf_addc(&s, '=');
+        if (a.append) {
+            char *name = xstrndup(w, a.n);
+            const char *old = var_get(name);
+            strbuf_adds(&s, old ? old : "");
+            free(name);
+        }
+        strbuf_adds(&s, value);
+        free(value);
+        strvec_push(out, strbuf_steal(&s));
+    }
+    return 0;
+}
+
+
+/*The subscript of an indexed array, negative ones count back from the
+* end. Returns -1 on an error.*/
+static int array_subscript(struct shell *sh, struct array *arr, const char *name, const char *sub, size_t nsub, size_t *i) {
+    int64_t v;
+    if (arith_eval(sh, sub, nsub, &v) < 0) {
+        return -1;
+    }
+    if (v < 0 && (v += array_next(arr)) < 0) {
+        fprintf(stderr, "lab: %s[%.*s]: bad array subscript\n", name, (int)nsub, sub);
+        return -1;
+    }
+    *i = (size_t)v;
+    return 0;
+}
+
+
+// Expand the subscript of an associative array into its key
+static char *assoc_key(struct shell *sh, const char *sub, size_t nsub) {
+    char *raw = xstrndup(sub, nsub);
+    char *key = expand_string(sh, raw);
+    free(raw);
+    return key;
+}
+
+
+/*Assign one element, name[sub]=value. A string or unset variable turns
+* into an indexed array.*/
+static int assign_elem(struct shell *sh, const char *name, struct assign *a, const char *value) {
+    struct hmap *m = var_assoc(name);
+    struct strbuf s = {0};
+    int rc = 0;
+    if (m != NULL) {
+        char *key = assoc_key(sh, a->sub, a->nsub);
+        if (key == NULL) {
+            return -1;
+        }
+        const char *old = a->append ? assoc_get(m, key) : NULL;
+        strbuf_adds(&s, old ? old : "");
+        strbuf_adds(&s, value);
+        assoc_set(m, key, s.s);
+        free(key);
+    } else {
+        struct array *arr = var_as_array(name);
+        size_t i;
+        if (array_subscript(sh, arr, name, a->sub, a->nsub, &i) < 0) {
+            rc = -1;
+        } else {
+            const char *old = a->append ? array_get(arr, i) : NULL;
+            strbuf_adds(&s, old ? old : "");
+            strbuf_adds(&s, value);
+            array_set(arr, i, s.s);
+        }
+    }
+    strbuf_free(&s);
+    return rc;
+}
+
+
+/*Expand the list of name=(...) into values, keys gets the raw subscript
+* of each [key]=value and NULL for the other elements. Every element is
+* expanded before the array changes, so a=(x "${a[@]}") sees the old
+* elements.*/
+static int compound_expand(struct shell *sh, const char *list, size_t len, struct strvec *keys, struct strvec *values) {
+    for (size_t i = 0; i < len;) {
+        if (list[i] == ' ' || list[i] == '\t' || list[i] == '\n') {
+            i++;
+            continue;
+        }
+        size_t end = strchr(";&|<>()", list[i]) ? 0 : parse_word_end(list, i, len);
+        if (end == 0) {
+            fprintf(stderr, "lab: syntax error in array assignment\n");
+            return -1;
+        }
+        char *raw = xstrndup(list + i, end - i);
+        i = end;
+        const char *close = raw[0] == '[' ? strstr(raw, "]=") : NULL;
+        bool ok;
+        if (close != NULL) {
+            char *value = expand_string(sh, close + 2);
+            ok = value != NULL;
+            if (ok) {
+                strvec_push(keys, xstrndup(raw + 1, close - raw - 1));
+                strvec_push(values, value);
+            }
+        } else {
+            ok = expand_word(sh, raw, values) == 0;
+            while (keys->n < values->n) {
+                strvec_push(keys, NULL);
+            }
+        }
+        free(raw);
+        if (!ok) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+
+/*Assign name=(...) or add to the array with name+=(...). An indexed array
+* takes the elements in order, [i]=value moves on to index i. An
+* associative array takes [key]=value, other elements pair up as a key
+* followed by its value.*/
+static int assign_compound(struct shell *sh, const char *name, struct assign *a) {
+    struct strvec keys = {0}, values = {0};
+    int rc = compound_expand(sh, a->value + 1, strlen(a->value) - 2, &keys, &values);
+    struct hmap *m = var_assoc(name);
+    struct array *arr = NULL;
+    if (rc == 0 && m != NULL && !a->append) {
+        m = var_set_assoc(name);
+    } else if (rc == 0 && m == NULL) {
+        arr = a->append ? var_as_array(name) : var_set_array(name);
+    }
+    size_t next = arr ? array_next(arr) : 0;
+    for (size_t k = 0; k < keys.n && rc == 0; k++) {
+        const char *key = keys.v[k];
+        if (m != NULL && key == NULL) {
+            const char *k0 = values.v[k];
+            const char *value = k + 1 < keys.n && keys.v[k + 1] == NULL ? values.v[++k] : "";
+            assoc_set(m, k0, value);
+        } else if (m != NULL) {
+            char *s = assoc_key(sh, key, strlen(key));
+            if (s == NULL) {
+                rc = -1;
+            } else {
+                assoc_set(m, s, values.v[k]);
+                free(s);
+            }
+        } else if (key != NULL && array_subscript(sh, arr, name, key, strlen(key), &next) < 0) {
+            rc = -1;
+        } else {
+            array_set(arr, next++, values.v[k]);
+        }
+    }
+    strvec_free(&keys);
+    strvec_free(&values);
+    return rc;
+}
+
+
+/*Carry out an assignment word on its own or given to declare, any of the
+* forms assign_parse knows. Returns -1 on an error.*/
+static int assign_word(struct shell *sh, const char *w) {
+    struct assign a;
+    assign_parse(w, &a);
+    char *name = xstrndup(a.name, a.n);
+    int rc = 0;
+    if (a.sub == NULL && a.value[0] == '(') {
+        rc = assign_compound(sh, name, &a);
+    } else {
+        char *value = expand_string(sh, a.value);
+        if (value == NULL) {
+            rc = -1;
+        } else if (a.sub != NULL) {
+            rc = assign_elem(sh, name, &a, value);
+        } else if (a.append) {
+            const char *old = var_get(name);
+            struct strbuf s = {0};
+            strbuf_adds(&s, old ? old : "");
+            strbuf_adds(&s, value);
+            var_set(name, s.s, false);
+            strbuf_free(&s);
+        } else {
+            var_set(name, value, false);
+        }
+        free(value);
+    }
+    free(name);
+    return rc;
+}
+
+
+static void assigns_apply(struct strvec *assigns, bool exported) {
+    for (size_t i = 0; i < assigns->n; i++) {
+        char *eq = strchr(assigns->v[i], '=');
+        *eq = '\0';
+        var_set(assigns->v[i], eq + 1, exported);
+        *eq = '=';
+    }
+}
+
+
+/*Builtins whose assignments in front stay set afterwards, as POSIX has
+* it for its special builtins*/
+static bool special_builtin(const char *name) {
+    static const char *names[] = {
+        ":", ".", "break", "continue", "exit", "export", "return", "set",
+        "shift", "source", "unset",
+    };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strcmp(name, names[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/*Remember the values the assignments in front of a command replace, as
+* name=value or just name for a variable that was unset*/
+static void assigns_save(struct strvec *assigns, struct strvec *old) {
+    for (size_t i = 0; i < assigns->n; i++) {
+        char *eq = strchr(assigns->v[i], '=');
+        *eq = '\0';
+        const char *value = var_get(assigns->v[i]);
+        struct strbuf a = {0};
+        strbuf_adds(&a, assigns->v[i]);
+        if (value != NULL) {
+            strbuf_addc(&a, '=');
+            strbuf_adds(&a, value);
+        }
+        strvec_push(old, strbuf_steal(&a));
+        *eq = '=';
+    }
+}
+
+
+/*Put back what assigns_save remembered, last first so a name assigned
+* twice gets its first value*/
+static void assigns_restore(struct strvec *old) {
+    for (size_t i = old->n; i-- > 0;) {
+        char *eq = strchr(old->v[i], '=');
+        if (eq == NULL) {
+            var_unset(old->v[i]);
+            continue;
+        }
+        *eq = '\0';
+        var_set(old->v[i], eq + 1, false);
+        *eq = '=';
+    }
+    strvec_free(old);
+}
+
+
+/*The raw words of a command with the alias in command position replaced,
+* NULL when there is none and the words of the tree stand. An alias that
+* is not a simple command sets text to the command to parse and run
+* instead. The aliases used are held in use.*/
+static const char **cmd_alias(struct ast *ast, struct node *n, uint32_t first, size_t *count, char **text,
+                              struct alias_use *use) {
+    *text = NULL;
+    use->n = 0;
+    *count = n->nwords;
+    if (first >= n->nwords || alias_find(ast_str(ast, ast->words[n->word0 + first])) == NULL) {
+        return NULL;
+    }
+    const char **raw = xmalloc(n->nwords * sizeof(char *));
+    for (uint32_t i = 0; i < n->nwords; i++) {
+        raw[i] = ast_str(ast, ast->words[n->word0 + i]);
+    }
+    *text = alias_expand(&raw, count, first, use);
+    if (*text != NULL) {
+        free(raw);
+        return NULL;
+    }
+    return raw;
+}
+
+
+/*Run the text an alias turned a command into. The alias is not replaced
+* again inside it.*/
+static int alias_run(struct shell *sh, char *text, struct alias_use *use) {
+    struct alias *body = use->held[use->n - 1];
+    body->active++;
+    int status = exec_string(sh, text);
+    body->active--;
+    free(text);
+    return status;
+}
+
+
+/*Replace the child with a program. A file the kernel does not know how
+* to run, a script without #!, is handed to /bin/sh like execvp does.*/
+static void exec_file(const char *file, char **argv, char **envp) {
+    execve(file, argv, envp);
+    if (errno != ENOEXEC) {
+        return;
+    }
+    int argc = 0;
+    while (argv[argc] != NULL) {
+        argc++;
+    }
+    char **sh_argv = xmalloc((argc + 2) * sizeof(char *));
+    sh_argv[0] = "/bin/sh";
+    sh_argv[1] = (char *)file;
+    memcpy(sh_argv + 2, argv + 1, argc * sizeof(char *));
+    execve("/bin/sh", sh_argv, envp);
+    free(sh_argv);
+    errno = ENOEXEC;
+}
+
+
+/*Run a node inside a forked child and exit with its status. A simple
+* command is exec'd directly, argv and assigns hold its words when they
+* were already expanded by the parent. Assignments in front of a program
+* only go into its environment, the array the parent built is reused
+* when there are none.*/
+static void exec_in_child(struct shell *sh, struct ast *ast, int32_t idx, char **argv, struct strvec *assigns, int *hfds) {
+    struct node *n = &ast->nodes[idx];
+    if (n->kind != NODE_CMD) {
+        int status = exec_node(sh, ast, idx);
+        fflush(stdout);
+        input_sync_all();
+        _exit(status);
+    }
+    struct strvec words = {0};
+    struct strvec own = {0};
+    if (argv == NULL) {
+        uint32_t nassign = assign_count(ast, n);
+        size_t nwords;
+        char *text;
+        struct alias_use use;
+        const char **raw = cmd_alias(ast, n, nassign, &nwords, &text, &use);
+        if (text != NULL) {
+            int status = redirs_apply(sh, ast, n, NULL, hfds) < 0 ? 1 : alias_run(sh, text, &use);
+            fflush(stdout);
+            input_sync_all();
+            _exit(status);
+        }
+        if (nassign == n->nwords) {
+            // Only assignments, they go nowhere but can still fail
+            for (uint32_t i = 0; i < nassign; i++) {
+                if (assign_word(sh, ast_str(ast, ast->words[n->word0 + i])) < 0) {
+                    _exit(1);
+                }
+            }
+        } else if (assigns_expand(sh, ast, n, nassign, &own) < 0) {
+            _exit(1);
+        }
+        for (size_t i = nassign; i < nwords; i++) {
+            if (expand_word(sh, raw ? raw[i] : ast_str(ast, ast->words[n->word0 + i]), &words) < 0) {
+                _exit(1);
+            }
+        }
+        free(raw);
+        alias_release(&use);
+        argv = words.v;
+        assigns = &own;
+    }
+    // The command reaches process substitutions through /dev/fd
+    for (int i = 0; i < sh->npsfds; i++) {
+        fcntl(sh->psfds[i], F_SETFD, 0);
+    }
+    if (redirs_apply(sh, ast, n, NULL, hfds) < 0) {
+        _exit(1);
+    }
+    if (argv == NULL || argv[0] == NULL) {
+        _exit(0);
+    }
+    struct func *fn = func_find(argv[0]);
+    if (fn != NULL) {
+        assigns_apply(assigns, false);
+        int status = func_call(sh, fn, argv);
+        fflush(stdout);
+        input_sync_all();
+        _exit(status);
+    }
+    if (is_builtin(argv[0])) {
+        assigns_apply(assigns, false);
+        do_builtin(sh, argv);
+        fflush(stdout);
+        input_sync_all();
+        _exit(sh->status);
+    }
+    assigns_apply(assigns, true);
+    char **envp = vars_envp();
+    const char *file = cmdhash_find(argv[0]);
+    int err = ENOENT;
+    if (file != NULL) {
+        exec_file(file, argv, envp);
+        err = errno;
+    }
+    if (file != NULL && err == ENOENT && strchr(argv[0], '/') == NULL) {
+        // The remembered path went stale after the parent checked it
+        cmdhash_forget(argv[0]);
+        file = cmdhash_find(argv[0]);
+        if (file != NULL) {
+            exec_file(file, argv, envp);
+            err = errno;
+        }
+    }
+    if (err == ENOENT && strchr(argv[0], '/') == NULL) {
+        complete_not_found(argv[0]);
+    } else {
+        fprintf(stderr, "lab: %s: %s\n", argv[0], strerror(err));
+    }
+    _exit(err == ENOENT ? 127 : 126);
+}
+
+
+static pid_t fork_child(void) {
+    fflush(stdout);
+    fflush(stderr);
+    // The child must find stdin where the read builtin left it
+    input_sync_all();
+    pid_t pid = fork();
+    if (pid < 0) {
+        // If fork failed we are in trouble!
+        perror("fork return < 0 Process creation failed!");
+        abort();
+    }
+    return pid;
+}
+
+
+static void set_pipestatus(struct shell *sh, int status) {
+    free(sh->pipestatus);
+    sh->pipestatus = xmalloc(sizeof(int));
+    sh->pipestatus[0] = status;
+    sh->npipestatus = 1;
+}
+
+
+/*Pipe buffer size requested through $PIPESIZE for the pipeline about to
+* start, 0 to keep the kernel default*/
+static long pipe_size(void) {
+    const char *val = var_get("PIPESIZE");
+    if (val == NULL || *val == '\0') {
+        return 0;
+    }
+    char *end;
+    long size = strtol(val, &end, 10);
+    if (*end == 'k' || *end == 'K') {
+        size *= 1024;
+    } else if (*end == 'm' || *end == 'M') {
+        size *= 1024 * 1024;
+    }
+    return size > 0 ? size : 0;
+}
+
+
+/*Launch every stage of a pipeline at once. All pipes are created before
+* the first fork and all stages join one process group, which is then
+* waited for as a whole unless the pipeline runs in the background. A
+* single stage is used to run any node in the background.*/
+static int exec_pipeline(struct shell *sh, struct ast *ast, int32_t *stages, int n, bool bg) {
+    int (*pipes)[2] = n > 1 ? xmalloc((n - 1) * sizeof(*pipes)) : NULL;
+    long size = pipe_size();
+    for (int i = 0; i < n - 1; i++) {
+        if (pipe2(pipes[i], O_CLOEXEC) < 0) {
+            perror("pipe");
+            for (int j = 0; j < i; j++) {
+                close(pipes[j][0]);
+                close(pipes[j][1]);
+            }
+            free(pipes);
+            return 1;
+        }
+        if (size > 0 && fcntl(pipes[i][1], F_SETPIPE_SZ, (int)size) < 0 && i == 0) {
+            fprintf(stderr, "PIPESIZE: %s\n", strerror(errno));
+        }
+    }
+
+    bool ok = true;
+    int **hfds = xcalloc(n, sizeof(int *));
+    for (int i = 0; i < n && ok; i++) {
+        struct node *stage = &ast->nodes[stages[i]];
+        if (stage->kind == NODE_CMD) {
+            hfds[i] = heredocs_open(sh, ast, stage, &ok);
+        }
+    }
+
+    struct strbuf text = {0};
+    for (int i = 0; i < n; i++) {
+        if (i > 0) {
+            strbuf_adds(&text, " | ");
+        }
+        ast_text(ast, stages[i], &text);
+    }
+    struct job *job = ok ? job_new(sh, text.s, 0) : NULL;
+    strbuf_free(&text);
+    // Build the environment once here instead of in every child
+    vars_envp();
+
+    for (int i = 0; i < n && ok; i++) {
+        pid_t pid = fork_child();
+        if (pid == 0) {
+            /*This is the child process*/
+            child_setup(sh, job->pgid, !bg);
+            if (i > 0) {
+                dup2(pipes[i - 1][0], STDIN_FILENO);
+            }
+            if (i < n - 1) {
+                dup2(pipes[i][1], STDOUT_FILENO);
+            }
+            // Builtins never exec so close-on-exec is not enough
+            for (int j = 0; j < n - 1; j++) {
+                close(pipes[j][0]);
+                close(pipes[j][1]);
+            }
+            exec_in_child(sh, ast, stages[i], NULL, NULL, hfds[i]);
+        }
+        parent_setup(sh, job, pid);
+    }
+
+    for (int i = 0; i < n - 1; i++) {
+        close(pipes[i][0]);
+        close(pipes[i][1]);
+    }
+    free(pipes);
+    for (int i = 0; i < n; i++) {
+        heredocs_close(hfds[i], ast->nodes[stages[i]].nredirs);
+    }
+    free(hfds);
+
+    if (!ok) {
+        return 1;
+    }
+    if (bg) {
+        job_background(sh, job);
+        if (sh->shell_is_interactive) {
+            fprintf(stderr, "[%d] %d\n", job->id, (int)job->pgid);
+        }
+        return 0;
+    }
+    return job_wait(sh, job);
+}
+
+
+/*Run a command made only of assignments. Each sets a shell variable or
+* array element, then the redirections are opened and closed again.*/
+static int exec_assigns(struct shell *sh, struct ast *ast, int32_t idx) {
+    struct node *n = &ast->nodes[idx];
+    int status = 0;
+    for (uint32_t i = 0; i < n->nwords && status == 0; i++) {
+        if (assign_word(sh, ast_str(ast, ast->words[n->word0 + i])) < 0) {
+            status = 1;
+        }
+    }
+    if (status == 0) {
+        struct redir_save save = {0};
+        if (redirs_apply(sh, ast, n, &save, NULL) < 0) {
+            status = 1;
+        }
+        redirs_restore(&save);
+    }
+    procsubst_close(sh);
+    set_pipestatus(sh, status);
+    return status;
+}
+
+
+/*declare takes assignments the way the shell does: a word like
+* name=(...) is not expanded as an argument. declare gets the bare name
+* to set its type and the assignment is run after it.*/
+static bool declare_word(const char *w, struct strvec *argv, struct strvec *decls) {
+    struct assign a;
+    if (!assign_parse(w, &a)) {
+        return false;
+    }
+    strvec_push(argv, xstrndup(w, a.n));
+    strvec_push(decls, xstrdup(w));
+    return true;
+}
+
+
+/*Run a simple command in the foreground. Builtins and functions run in
+* the shell, an external command becomes a job with a single process.
+* Assignments in front of a builtin or function only last while it runs,
+* unless it is a special builtin. On their own they set shell variables.*/
+static int exec_cmd(struct shell *sh, struct ast *ast, int32_t idx) {
+    struct node *n = &ast->nodes[idx];
+    uint32_t nassign = assign_count(ast, n);
+    if (nassign == n->nwords) {
+        return exec_assigns(sh, ast, idx);
+    }
+    size_t nwords;
+    char *text;
+    struct alias_use use;
+    const char **raw = cmd_alias(ast, n, nassign, &nwords, &text, &use);
+    if (text != NULL) {
+        struct redir_save save = {0};
+        int status = redirs_apply(sh, ast, n, &save, NULL) < 0 ? 1 : alias_run(sh, text, &use);
+        alias_release(&use);
+        redirs_restore(&save);
+        return status;
+    }
+    struct strvec argv = {0};
+    struct strvec assigns = {0};
+    struct strvec decls = {0};
+    bool expanded = assigns_expand(sh, ast, n, nassign, &assigns) == 0;
+    for (size_t i = nassign; i < nwords && expanded; i++) {
+        const char *w = raw ? raw[i] : ast_str(ast, ast->words[n->word0 + i]);
+        if (argv.n > 0 && strcmp(argv.v[0], "declare") == 0 && declare_word(w, &argv, &decls)) {
+            continue;
+        }
+        expanded = expand_word(sh, w, &argv) == 0;
+    }
+    free(raw);
+    alias_release(&use);
+    if (!expanded) {
+        procsubst_close(sh);
+        strvec_free(&argv);
+        strvec_free(&assigns);
+        strvec_free(&decls);
+        return 1;
+    }
+
+    int status = 0;
+    struct func *fn = argv.n > 0 ? func_find(argv.v[0]) : NULL;
+    if (argv.n == 0 || fn != NULL || is_builtin(argv.v[0])) {
+        // Redirections for builtins and functions are applied to the shell itself
+        struct redir_save save = {0};
+        struct strvec old = {0};
+        if (argv.n > 0 && !special_builtin(argv.v[0])) {
+            assigns_save(&assigns, &old);
+        }
+        if (redirs_apply(sh, ast, n, &save, NULL) < 0) {
+            status = 1;
+        } else if (fn != NULL) {
+            assigns_apply(&assigns, false);
+            status = func_call(sh, fn, argv.v);
+        } else if (argv.n > 0) {
+            assigns_apply(&assigns, false);
+            // exit and return without a status take the last one
+            do_builtin(sh, argv.v);
+            status = sh->status;
+            for (size_t i = 0; i < decls.n && status == 0; i++) {
+                if (assign_word(sh, decls.v[i]) < 0) {
+                    status = 1;
+                }
+            }
+        } else {
+            assigns_apply(&assigns, false);
+        }
+        redirs_restore(&save);
+        assigns_restore(&old);
+        set_pipestatus(sh, status);
+    } else {
+        bool ok;
+        int *hfds = heredocs_open(sh, ast, n, &ok);
+        if (ok) {
+            struct strbuf text = {0};
+            ast_text(ast, idx, &text);
+            struct job *job = job_new(sh, text.s, 0);
+            strbuf_free(&text);
+            // Look the command up and build the environment here so both
+            // are remembered for the next command. A stale path is dropped
+            // here too, the child's retry would not outlive it.
+            cmdhash_check(argv.v[0]);
+            vars_envp();
+            pid_t pid = fork_child();
+            if (pid == 0) {
+                /*This is the child process*/
+                child_setup(sh, 0, true);
+                exec_in_child(sh, ast, idx, argv.v, &assigns, hfds);
+            }
+            parent_setup(sh, job, pid);
+            heredocs_close(hfds, n->nredirs);
+            status = job_wait(sh, job);
+        } else {
+            heredocs_close(hfds, n->nredirs);
+            status = 1;
+        }
+    }
+    procsubst_close(sh);
+    strvec_free(&argv);
+    strvec_free(&assigns);
+    strvec_free(&decls);
+    return status;
+}
+
+
+/*return ran in the innermost function or break or continue in a loop,
+* skip the rest of the body*/
+static bool stopped(struct shell *sh) {
+    return (sh->frame != NULL && sh->frame->returning) || sh->loopjump != 0;
+}
+
+
+static int exec_node(struct shell *sh, struct ast *ast, int32_t idx) {
+    if (idx < 0) {
+        return sh->status;
+    }
+    struct node *n = &ast->nodes[idx];
+    int status = sh->status;
+    // The redirections of a compound command hold for all of it
+    bool redirected = n->kind != NODE_CMD && n->nredirs > 0;
+    struct redir_save save = {0};
+    if (redirected && redirs_apply(sh, ast, n, &save, NULL) < 0) {
+        redirs_restore(&save);
+        sh->status = 1;
+        return 1;
+    }
+    switch (n->kind) {
+    case NODE_LIST:
+        for (int32_t c = n->a; c >= 0 && !stopped(sh); c = ast->nodes[c].next) {
+            if (ast->nodes[c].flags & NODE_BG) {
+                status = exec_pipeline(sh, ast, &c, 1, true);
+            } else {
+                status = exec_node(sh, ast, c);
+            }
+            sh->status = status;
+        }
+        break;
+    case NODE_CMD:
+        status = exec_cmd(sh, ast, idx);
+        break;
+    case NODE_PIPE: {
+        int nstages = 0;
+        for (int32_t c = n->a; c >= 0; c = ast->nodes[c].next) {
+            nstages++;
+        }
+        int32_t *stages = xmalloc(nstages * sizeof(int32_t));
+        nstages = 0;
+        for (int32_t c = n->a; c >= 0; c = ast->nodes[c].next) {
+            stages[nstages++] = c;
+        }
+        status = exec_pipeline(sh, ast, stages, nstages, false);
+        free(stages);
+        break;
+    }
+    case NODE_AND:
+        status = exec_node(sh, ast, n->a);
+        if (status == 0 && !stopped(sh)) {
+            status = exec_node(sh, ast, n->b);
+        }
+        break;
+    case NODE_OR:
+        status = exec_node(sh, ast, n->a);
+        if (status != 0 && !stopped(sh)) {
+            status = exec_node(sh, ast, n->b);
+        }
+        break;
+    case NODE_GROUP:
+        status = exec_node(sh, ast, n->a);
+        break;
+    case NODE_IF:
+    case NODE_WHILE:
+    case NODE_FOR:
+    case NODE_CASE:
+        // Only reached inside a pipeline, in the background or with
+        // redirections
+        status = vm_exec_node(sh, ast, idx);
+        break;
+    case NODE_ARITH: {
+        // Like the test commands: true when the value is not 0
+        struct word w = ast->words[n->word0];
+        int64_t value;
+        status = arith_eval(sh, ast_str(ast, w), w.len, &value) < 0 ? 1 : value == 0;
+        break;
+    }
+    case NODE_COND:
+        status = cond_eval(sh, ast, idx);
+        break;
+    case NODE_FUNC:
+        func_define(ast_str(ast, ast->words[n->word0]), ast, n->a);
+        status = 0;
+        break;
+    }
+    if (redirected) {
+        redirs_restore(&save);
+    }
+    if (n->flags & NODE_NEGATE) {
+        status = !status;
+    }
+    sh->status = status;
+    return status;
+}
+
+
+// Run one node of a tree
+int exec_run(struct shell *sh, struct ast *ast, int32_t idx) {
+    return exec_node(sh, ast, idx);
+}
+
+
+// Start one node of a tree in the background
+int exec_background(struct shell *sh, struct ast *ast, int32_t idx) {
+    return exec_pipeline(sh, ast, &idx, 1, true);
+}
+
+
+// Execute a parsed tree
+int exec_ast(struct shell *sh, struct ast *ast) {
+    return vm_run(sh, vm_program(ast));
+}
+
+
+// Parse and execute a string
+int exec_string(struct shell *sh, const char *src) {
+    int status;
+    struct ast *ast = ast_parse(src, &status);
+    if (status == PARSE_OK) {
+        status = exec_ast(sh, ast);
+    } else {
+        fprintf(stderr, "lab: %s\n", status == PARSE_ERROR ? ast->error : "syntax error: unexpected end of file");
+        sh->status = status = 2;
+    }
+    ast_free(ast);
+    return status;
+}
@@ -0,0 +1,90 @@
+#ifndef EXEC_H
+#define EXEC_H
+#include <stdbool.h>
+#include <stddef.h>
+#include "parse.h"
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+struct shell;
+
+
+/**
+* @brief Execute a parsed tree. Builtins run inside the shell with their
+* redirections applied temporarily, everything else is forked and
+* exec'd. Control flow runs on the program compiled for the tree, see
+* vm.h. The exit status of the last command is stored in sh->status.
+*
+* @param sh The shell
+* @param ast The tree to run
+* @return int The exit status of the last command
+*/
+int exec_ast(struct shell *sh, struct ast *ast);
+
+
+/**
+* @brief Run one node of a tree: a command, a pipeline, a list or a
+* function definition. Used by the VM for everything it does not
+* compile into jumps.
+*
+* @param sh The shell
+* @param ast The tree
+* @param idx The node
+* @return int The exit status
+*/
+int exec_run(struct shell *sh, struct ast *ast, int32_t idx);
+
+
+/**
+* @brief Start one node of a tree in the background as a job
+*
+* @param sh The shell
+* @param ast The tree
+* @param idx The node
+* @return int The exit status, 0 when the job started
+*/
+int exec_background(struct shell *sh, struct ast *ast, int32_t idx);
+
+
+/**
+* @brief Parse and execute a string. Syntax errors are reported on
+* stderr and give a status of 2.
+*
+* @param sh The shell
+* @param src The source text
+* @return int The exit status of the last command
+*/
+int exec_string(struct shell *sh, const char *src);
+
+
+/**
+* @brief Start a process substitution. The command runs concurrently in a
+* child connected to the shell through a pipe. The child is added to the
+* job table so it gets reaped, and our end of the pipe stays open until
+* the current command is done with it.
+*
+* @param sh The shell
+* @param cmd The command text between the parens
+* @param len The length of the command text
+* @param reader True for <(cmd) where the command writes and the caller
+* reads, false for >(cmd)
+* @return char* The /dev/fd path of our end of the pipe, NULL on error
+*/
+char *procsubst_open(struct shell *sh, const char *cmd, size_t len, bool reader);
+
+
+/**
+* @brief Close our ends of the process substitution pipes opened while
+* expanding the current command and reap producers that have finished.
+*
+* @param sh The shell
+*/
+void procsubst_close(struct shell *sh);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
@@ -0,0 +1,680 @@
+#include "expand.h"
+#include "arith.h"
+#include "array.h"
+#include "lab.h"
+#include "exec.h"
+#include "hmap.h"
+#include "parse.h"
+#include "vars.h"
+#include "func.h"
+#include "pattern.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+/* State while expanding one word. When out is NULL the word expands to a
+* single string and no field splitting happens.*/
+struct expander
+{
+struct shell *sh;
+struct strvec *out;
+struct strbuf field;
+bool active;        // the current field exists even if it is empty
+bool error;
+const char *escape; // quoted characters to escape with a backslash, NULL for none
+bool glob;          // fields go through pathname expansion
+bool magic;         // the current field has an unquoted wildcard
+struct strbuf pat;  // the current field as a pattern, when glob is set
+const char *ifs;
+};
+
+
+static bool is_wildcard(char c) {
+    return c == '*' || c == '?' || c == '[';
+}
+
+
+// Keep the pattern of the field in step, quoted text matches literally
+static void pat_add(struct expander *e, const char *s, size_t n, bool quoted) {
+    for (size_t i = 0; i < n; i++) {
+        if (quoted && strchr("*?[]\\", s[i]) != NULL) {
+            strbuf_addc(&e->pat, '\\');
+        } else if (!quoted && is_wildcard(s[i])) {
+            e->magic = true;
+        }
+        strbuf_addc(&e->pat, s[i]);
+    }
+}
+
+
+// Add text that is not subject to field splitting
+static void emit_quoted(struct expander *e, const char *s, size_t n) {
+    if (e->escape == NULL) {
+        strbuf_add(&e->field, s, n);
+    } else {
+        for (size_t i = 0; i < n; i++) {
+            if (strchr(e->escape, s[i]) != NULL) {
+                strbuf_addc(&e->field, '\\');
+            }
+            strbuf_addc(&e->field, s[i]);
+        }
+    }
+    if (e->glob) {
+        pat_add(e, s, n, true);
+    }
+    e->active = true;
+}
+
+
+// Add unquoted text, which keeps its meaning in a pattern
+static void emit_plain(struct expander *e, const char *s, size_t n) {
+    strbuf_add(&e->field, s, n);
+    if (e->glob) {
+        pat_add(e, s, n, false);
+    }
+    e->active = true;
+}
+
+
+static int path_cmp(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+
+/*Match the rest of a pattern, pat, below the directory in path. Matches
+* are added to out.*/
+static void glob_dir(struct strbuf *path, const char *pat, struct strvec *out) {
+    const char *slash = strchr(pat, '/');
+    size_t n = slash ? (size_t)(slash - pat) : strlen(pat);
+    const char *rest = NULL;
+    if (slash != NULL) {
+        for (rest = slash; *rest == '/'; rest++) {
+        }
+    }
+    size_t base = path->len;
+    if (!pattern_has_magic(pat, n)) {
+        // A plain component only has to exist
+        for (size_t i = 0; i < n; i++) {
+            if (pat[i] == '\\' && i + 1 < n) {
+                i++;
+            }
+            strbuf_addc(path, pat[i]);
+        }
+        struct stat st;
+        if (rest == NULL) {
+            if (lstat(path->len ? path->s : ".", &st) == 0) {
+                strvec_push(out, xstrdup(path->s));
+            }
+        } else if (stat(path->len ? path->s : ".", &st) == 0 && S_ISDIR(st.st_mode)) {
+            strbuf_addc(path, '/');
+            glob_dir(path, rest, out);
+        }
+        path->len = base;
+        if (path->s != NULL) {
+            path->s[base] = '\0';
+        }
+        return;
+    }
+    DIR *dir = opendir(base ? path->s : ".");
+    if (dir == NULL) {
+        return;
+    }
+    struct pattern *p = pattern_get(pat, n);
+    // Only a pattern that starts with a dot matches hidden names
+    bool dot = pat[0] == '.' || (pat[0] == '\\' && pat[1] == '.');
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL) {
+        const char *name = de->d_name;
+        if ((name[0] == '.' && !dot) || strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+            continue;
+        }
+        if (!pattern_match(p, name, strlen(name))) {
+            continue;
+        }
+        strbuf_adds(path, name);
+        if (rest == NULL) {
+            strvec_push(out, xstrdup(path->s));
+        } else {
+            strbuf_addc(path, '/');
+            glob_dir(path, rest, out);
+        }
+        path->len = base;
+        path->s[base] = '\0';
+    }
+    closedir(dir);
+    pattern_put(p);
+}
+
+
+/*Pathname expansion of the current field. Returns false when no name
+* matches and the field stays as it is.*/
+static bool glob_field(struct expander *e) {
+    size_t before = e->out->n;
+    struct strbuf path = {0};
+    const char *pat = e->pat.s;
+    if (*pat == '/') {
+        strbuf_addc(&path, '/');
+        while (*pat == '/') {
+            pat++;
+        }
+    }
+    glob_dir(&path, pat, e->out);
+    strbuf_free(&path);
+    if (e->out->n == before) {
+        return false;
+    }
+    qsort(e->out->v + before, e->out->n - before, sizeof(char *), path_cmp);
+    return true;
+}
+
+
+static void end_field(struct expander *e) {
+    if (e->active && e->out != NULL) {
+        if (e->magic && glob_field(e)) {
+            e->field.len = 0;
+            e->field.s[0] = '\0';
+        } else {
+            strvec_push(e->out, strbuf_steal(&e->field));
+        }
+    }
+    e->active = false;
+    e->magic = false;
+    if (e->pat.s != NULL) {
+        e->pat.len = 0;
+        e->pat.s[0] = '\0';
+    }
+}
+
+
+// Add the result of an unquoted expansion, splitting it on IFS
+static void emit_split(struct expander *e, const char *s, size_t n) {
+    if (e->out == NULL) {
+        emit_plain(e, s, n);
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (strchr(e->ifs, s[i]) != NULL) {
+            end_field(e);
+        } else {
+            strbuf_addc(&e->field, s[i]);
+            if (e->glob) {
+                pat_add(e, s + i, 1, false);
+            }
+            e->active = true;
+        }
+    }
+}
+
+
+// A dollar sign that starts no expansion is literal
+static void emit_dollar(struct expander *e, bool quoted) {
+    if (quoted) {
+        emit_quoted(e, "$", 1);
+    } else {
+        emit_plain(e, "$", 1);
+    }
+}
+
+
+static bool is_name_start(char c) {
+    return isalpha((unsigned char)c) || c == '_';
+}
+
+
+static bool is_name_char(char c) {
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+
+/*Look up the value of a parameter. Special parameters are formatted into
+* buf. Returns NULL when the parameter is unset.*/
+static const char *param_value(struct expander *e, const char *name, size_t n, char *buf, size_t bufsz) {
+    if (n == 1 && name[0] == '?') {
+        snprintf(buf, bufsz, "%d", e->sh->status);
+        return buf;
+    }
+    if (n == 1 && name[0] == '$') {
+        snprintf(buf, bufsz, "%d", (int)getpid());
+        return buf;
+    }
+    if (n == 1 && name[0] == '#') {
+        snprintf(buf, bufsz, "%zu", func_nparams(e->sh));
+        return buf;
+    }
+    if (isdigit((unsigned char)name[0])) {
+        size_t i = 0;
+        for (size_t k = 0; k < n; k++) {
+            if (!isdigit((unsigned char)name[k])) {
+                return NULL;
+            }
+            i = i * 10 + (name[k] - '0');
+        }
+        return func_param(e->sh, i);
+    }
+    char key[256];
+    if (n >= sizeof(key)) {
+        return NULL;
+    }
+    memcpy(key, name, n);
+    key[n] = '\0';
+    return var_get(key);
+}
+
+
+/*Get the elements of an array parameter, or its keys when keys is set.
+* The special ones are copied into vals, an array variable is handed out
+* as it is in arr or map. Returns false when the name is not an array.*/
+static bool param_array(struct expander *e, const char *name, size_t n, struct strvec *vals, const struct array **arr,
+                        const struct hmap **map) {
+    if (n == 1 && (name[0] == '@' || name[0] == '*')) {
+        size_t count = func_nparams(e->sh);
+        for (size_t i = 1; i <= count; i++) {
+            strvec_push(vals, xstrdup(func_param(e->sh, i)));
+        }
+        return true;
+    }
+    if (n == 5 && memcmp(name, "MATCH", 5) == 0) {
+        for (int i = 0; i < e->sh->nmatch; i++) {
+            strvec_push(vals, xstrdup(e->sh->match[i]));
+        }
+        return true;
+    }
+    if (n == 10 && memcmp(name, "PIPESTATUS", 10) == 0) {
+        char buf[16];
+        for (int i = 0; i < e->sh->npipestatus; i++) {
+            snprintf(buf, sizeof(buf), "%d", e->sh->pipestatus[i]);
+            strvec_push(vals, xstrdup(buf));
+        }
+        return true;
+    }
+    char key[256];
+    if (n >= sizeof(key)) {
+        return false;
+    }
+    memcpy(key, name, n);
+    key[n] = '\0';
+    *arr = var_array(key);
+    *map = *arr ? NULL : var_assoc(key);
+    return *arr != NULL || *map != NULL;
+}
+
+
+/*Copy the elements of an array variable, or its keys or indexes, into
+* vals in the order ${a[@]} gives them*/
+static void array_list(const struct array *arr, const struct hmap *map, bool keys, struct strvec *vals) {
+    char buf[32];
+    for (size_t k = 0; arr != NULL && k < arr->n; k++) {
+        if (keys) {
+            snprintf(buf, sizeof(buf), "%zu", array_index(arr, k));
+        }
+        strvec_push(vals, xstrdup(keys ? buf : arr->v[k]));
+    }
+    for (size_t k = 0; map != NULL && k < map->cap; k++) {
+        if (map->tab[k].key != NULL) {
+            strvec_push(vals, xstrdup(keys ? map->tab[k].key : (char *)map->tab[k].value));
+        }
+    }
+}
+
+
+/*One element of an array variable: the subscript is an arithmetic
+* expression for an indexed array, negative counting back from the end,
+* and is expanded into the key of an associative array*/
+static const char *array_elem(struct expander *e, const struct array *arr, const struct hmap *map, const char *sub, size_t nsub) {
+    if (map != NULL) {
+        char *raw = xstrndup(sub, nsub);
+        char *key = expand_string(e->sh, raw);
+        free(raw);
+        if (key == NULL) {
+            e->error = true;
+            return NULL;
+        }
+        const char *val = assoc_get(map, key);
+        free(key);
+        return val;
+    }
+    int64_t idx;
+    if (arith_eval(e->sh, sub, nsub, &idx) < 0) {
+        e->error = true;
+        return NULL;
+    }
+    if (idx < 0) {
+        idx += array_next(arr);
+    }
+    return idx >= 0 ? array_get(arr, idx) : NULL;
+}
+
+
+static void emit_value(struct expander *e, const char *val, bool quoted) {
+    if (quoted) {
+        emit_quoted(e, val, strlen(val));
+    } else {
+        emit_split(e, val, strlen(val));
+    }
+}
+
+
+/*Expand $(( expression )) starting at s[i]. Returns the index just past
+* it.*/
+static size_t expand_arith(struct expander *e, const char *s, size_t i, bool quoted) {
+    size_t end = parse_group_end(s, i + 2, strlen(s));
+    if (end == 0 || s[end - 2] != ')') {
+        emit_dollar(e, quoted);
+        return i + 1;
+    }
+    int64_t value;
+    if (arith_eval(e->sh, s + i + 3, end - 2 - (i + 3), &value) < 0) {
+        e->error = true;
+        return end;
+    }
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%" PRId64, value);
+    emit_value(e, buf, quoted);
+    return end;
+}
+
+
+/*Expand the parameter starting at s[i] == '$'. Returns the index just past
+* the expansion.*/
+static size_t expand_param(struct expander *e, const char *s, size_t i, bool quoted) {
+    if (s[i + 1] == '(' && s[i + 2] == '(') {
+        return expand_arith(e, s, i, quoted);
+    }
+    char buf[32];
+    const char *name = s + i + 1;
+    size_t n = 0;
+    size_t end;
+    bool length = false;
+    bool keys = false;          // ${!name[@]} lists the indexes or keys
+    const char *sub = NULL;     // subscript of name[sub]
+    size_t nsub = 0;
+
+    if (*name == '{') {
+        name++;
+        if (*name == '#' && name[1] != '}') {
+            length = true;
+            name++;
+        } else if (*name == '!' && is_name_start(name[1])) {
+            keys = true;
+            name++;
+        }
+        const char *close = strchr(name, '}');
+        if (close == NULL) {
+            emit_dollar(e, quoted);
+            return i + 1;
+        }
+        n = close - name;
+        end = close - s + 1;
+        const char *lb = memchr(name, '[', n);
+        if (lb != NULL && close[-1] == ']') {
+            sub = lb + 1;
+            nsub = close - 1 - sub;
+            n = lb - name;
+        }
+    } else if (is_name_start(*name)) {
+        while (is_name_char(name[n])) {
+            n++;
+        }
+        end = i + 1 + n;
+    } else if (*name == '?' || *name == '$' || *name == '#' || *name == '@' ||
+               *name == '*' || isdigit((unsigned char)*name)) {
+        n = 1;
+        end = i + 2;
+    } else {
+        // A lone dollar sign is literal
+        emit_dollar(e, quoted);
+        return i + 1;
+    }
+
+    // $@ and $* are the positional parameters as an array
+    if (n == 1 && (*name == '@' || *name == '*') && sub == NULL) {
+        sub = name;
+        nsub = 1;
+    }
+    struct strvec vals = {0};
+    const struct array *arr = NULL;
+    const struct hmap *map = NULL;
+    const char *val = NULL;
+    bool all = sub != NULL && nsub == 1 && (*sub == '@' || *sub == '*');
+    if (keys && !all) {
+        // Indirect expansion is not supported, ${!name} is empty
+        keys = false;
+        sub = NULL;
+        n = 0;
+    }
+    if (n > 0 && param_array(e, name, n, &vals, &arr, &map)) {
+        if (!all && (arr != NULL || map != NULL)) {
+            // One element is looked up without copying the array, $a is
+            // the one at 0
+            val = array_elem(e, arr, map, sub ? sub : "0", sub ? nsub : 1);
+            if (e->error) {
+                return end;
+            }
+        } else if (!all) {
+            // The subscript is an arithmetic expression
+            int64_t idx = 0;
+            if (sub != NULL && arith_eval(e->sh, sub, nsub, &idx) < 0) {
+                e->error = true;
+                strvec_free(&vals);
+                return end;
+            }
+            if (idx < 0) {
+                idx += vals.n;
+            }
+            val = idx >= 0 && (uint64_t)idx < vals.n ? vals.v[idx] : NULL;
+        } else if (keys && arr == NULL && map == NULL) {
+            // The special arrays are indexed from 0
+            size_t count = vals.n;
+            strvec_free(&vals);
+            for (size_t k = 0; k < count; k++) {
+                snprintf(buf, sizeof(buf), "%zu", k);
+                strvec_push(&vals, xstrdup(buf));
+            }
+        } else if (!length || keys) {
+            array_list(arr, map, keys, &vals);
+        }
+        size_t count = arr ? arr->n : map ? map->n : vals.n;
+        if (length && all) {
+            snprintf(buf, sizeof(buf), "%zu", count);
+            val = buf;
+            length = false;
+        } else if (all) {
+            // "${a[@]}" keeps every element a separate field
+            for (size_t k = 0; k < vals.n; k++) {
+                if (k > 0) {
+                    // Expanding to one string the elements are joined
+                    if (quoted && *sub == '@' && e->out != NULL) {
+                        end_field(e);
+                    } else {
+                        emit_value(e, " ", quoted);
+                    }
+                }
+                emit_value(e, vals.v[k], quoted);
+            }
+            if (quoted && vals.n == 0 && *sub == '@') {
+                e->active = false;
+            }
+            strvec_free(&vals);
+            return end;
+        }
+    } else if (n > 0 && (sub == NULL || all || (nsub == 1 && *sub == '0'))) {
+        val = param_value(e, name, n, buf, sizeof(buf));
+    }
+    if (length) {
+        snprintf(buf, sizeof(buf), "%zu", val ? strlen(val) : (size_t)0);
+        val = buf;
+    }
+    if (val != NULL) {
+        emit_value(e, val, quoted);
+    } else if (quoted) {
+        e->active = true;
+    }
+    strvec_free(&vals);
+    return end;
+}
+
+
+/*Expand <(cmd) or >(cmd) starting at s[i] into the /dev/fd path of a
+* pipe to the running command. Returns the index just past the group.*/
+static size_t expand_procsubst(struct expander *e, const char *s, size_t i) {
+    size_t len = strlen(s);
+    size_t end = parse_group_end(s, i + 2, len);
+    if (end == 0) {
+        end = len + 1;
+    }
+    char *path = procsubst_open(e->sh, s + i + 2, end - i - 3, s[i] == '<');
+    if (path == NULL) {
+        e->error = true;
+    } else {
+        emit_quoted(e, path, strlen(path));
+        free(path);
+    }
+    return end > len ? len : end;
+}
+
+
+// Walk a raw word, removing quotes and expanding parameters
+static void expand_raw(struct expander *e, const char *s) {
+    size_t i = 0;
+    while (s[i]) {
+        char c = s[i];
+        if (c == '\'') {
+            const char *close = strchr(s + i + 1, '\'');
+            size_t n = close ? (size_t)(close - s - i - 1) : strlen(s + i + 1);
+            emit_quoted(e, s + i + 1, n);
+            i += n + (close ? 2 : 1);
+        } else if (c == '"') {
+            e->active = true;
+            for (i++; s[i] && s[i] != '"';) {
+                if (s[i] == '\\' && s[i + 1] && strchr("$`\"\\\n", s[i + 1])) {
+                    if (s[i + 1] != '\n') {
+                        emit_quoted(e, s + i + 1, 1);
+                    }
+                    i += 2;
+                } else if (s[i] == '$') {
+                    i = expand_param(e, s, i, true);
+                } else {
+                    emit_quoted(e, s + i, 1);
+                    i++;
+                }
+            }
+            if (s[i] == '"') {
+                i++;
+            }
+        } else if (c == '\\') {
+            if (s[i + 1] == '\n') {
+                i += 2;
+            } else if (s[i + 1]) {
+                emit_quoted(e, s + i + 1, 1);
+                i += 2;
+            } else {
+                emit_quoted(e, s + i, 1);
+                i++;
+            }
+        } else if (c == '$') {
+            i = expand_param(e, s, i, false);
+        } else if ((c == '<' || c == '>') && s[i + 1] == '(') {
+            i = expand_procsubst(e, s, i);
+        } else {
+            emit_plain(e, s + i, 1);
+            i++;
+        }
+    }
+}
+
+
+static void expander_init(struct expander *e, struct shell *sh, struct strvec *out) {
+    memset(e, 0, sizeof(*e));
+    e->sh = sh;
+    e->out = out;
+    e->glob = out != NULL && !(sh->options & OPT_NOGLOB);
+    e->ifs = var_get("IFS");
+    if (e->ifs == NULL) {
+        e->ifs = " \t\n";
+    }
+}
+
+
+// Expand a raw word from the parser into zero or more fields
+int expand_word(struct shell *sh, const char *raw, struct strvec *out) {
+    struct expander e;
+    expander_init(&e, sh, out);
+    expand_raw(&e, raw);
+    end_field(&e);
+    strbuf_free(&e.field);
+    strbuf_free(&e.pat);
+    return e.error ? -1 : 0;
+}
+
+
+// Expand a raw word into exactly one string without field splitting
+char *expand_string(struct shell *sh, const char *raw) {
+    struct expander e;
+    expander_init(&e, sh, NULL);
+    expand_raw(&e, raw);
+    if (e.error) {
+        strbuf_free(&e.field);
+        return NULL;
+    }
+    return strbuf_steal(&e.field);
+}
+
+
+static char *expand_escaped(struct shell *sh, const char *raw, const char *escape) {
+    struct expander e;
+    expander_init(&e, sh, NULL);
+    e.escape = escape;
+    expand_raw(&e, raw);
+    if (e.error) {
+        strbuf_free(&e.field);
+        return NULL;
+    }
+    return strbuf_steal(&e.field);
+}
+
+
+// Expand a raw word into a pattern for case and [[ ]]
+char *expand_pattern(struct shell *sh, const char *raw) {
+    return expand_escaped(sh, raw, "*?[]\\");
+}
+
+
+// Expand a raw word into a regular expression for [[ =~ ]]
+char *expand_regex(struct shell *sh, const char *raw) {
+    return expand_escaped(sh, raw, "\\.[]()*+?{}|^$");
+}
+
+
+// Expand the body of a heredoc with an unquoted delimiter
+char *expand_heredoc(struct shell *sh, const char *body, size_t len, size_t *outlen) {
+    struct expander e;
+    expander_init(&e, sh, NULL);
+    size_t i = 0;
+    while (i < len) {
+        char c = body[i];
+        if (c == '\\' && i + 1 < len && strchr("$`\\\n", body[i + 1])) {
+            if (body[i + 1] != '\n') {
+                emit_quoted(&e, body + i + 1, 1);
+            }
+            i += 2;
+        } else if (c == '$') {
+            i = expand_param(&e, body, i, true);
+        } else {
+            // Copy the run of plain text up to the next special character
+            size_t j = i + 1;
+            while (j < len && body[j] != '\\' && body[j] != '$') {
+                j++;
+            }
+            emit_quoted(&e, body + i, j - i);
+            i = j;
+        }
+    }
+    *outlen = e.field.len;
+    return strbuf_steal(&e.field);
+}
@@ -0,0 +1,80 @@
+#ifndef EXPAND_H
+#define EXPAND_H
+#include <stddef.h>
+#include "util.h"
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+struct shell;
+
+
+/**
+* @brief Expand a raw word from the parser into zero or more fields.
+* Parameters are substituted, unquoted results are split on IFS, fields
+* with unquoted wildcards are replaced by the names they match unless
+* noglob is set, and quotes are removed. The fields are appended to out.
+*
+* @param sh The shell
+* @param raw The raw word including its quotes
+* @param out The vector to append fields to
+* @return 0 on success, -1 on an expansion error
+*/
+int expand_word(struct shell *sh, const char *raw, struct strvec *out);
+
+
+/**
+* @brief Expand a raw word into exactly one string without field
+* splitting. This is used for redirection targets, here-strings and
+* assignments. The caller must free the result.
+*
+* @param sh The shell
+* @param raw The raw word including its quotes
+* @return char* The expanded string, NULL on an expansion error
+*/
+char *expand_string(struct shell *sh, const char *raw);
+
+
+/**
+* @brief Expand a raw word into a pattern, as case and [[ == ]] do.
+* Glob characters that were quoted or escaped are matched literally.
+* The caller must free the result.
+*
+* @param sh The shell
+* @param raw The raw word including its quotes
+* @return char* The pattern, NULL on an expansion error
+*/
+char *expand_pattern(struct shell *sh, const char *raw);
+
+
+/**
+* @brief Expand a raw word into a POSIX extended regular expression, as
+* [[ =~ ]] does. Characters that were quoted or escaped are matched
+* literally. The caller must free the result.
+*
+* @param sh The shell
+* @param raw The raw word including its quotes
+* @return char* The expression, NULL on an expansion error
+*/
+char *expand_regex(struct shell *sh, const char *raw);
+
+
+/**
+* @brief Expand the body of a heredoc with an unquoted delimiter.
+* Parameters are substituted and backslash only escapes $, ` and \ as
+* well as joining lines. The caller must free the result.
+*
+* @param sh The shell
+* @param body The raw body
+* @param len The length of the body
+* @param outlen Set to the length of the expanded body
+* @return char* The expanded body
+*/
+char *expand_heredoc(struct shell *sh, const char *body, size_t len, size_t *outlen);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
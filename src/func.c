@@ -0,0 +1,158 @@
+#include "func.h"
+#include "arena.h"
+#include "exec.h"
+#include "hmap.h"
+#include "lab.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// Function name -> struct func
+static struct hmap funcs;
+// Frames of the running calls, released as each call returns
+static struct arena frames;
+
+
+static void func_unref(void *p) {
+    struct func *fn = p;
+    if (fn != NULL && --fn->refs == 0) {
+        ast_free(fn->body);
+        free(fn);
+    }
+}
+
+
+// Define a function
+void func_define(const char *name, const struct ast *ast, int32_t body) {
+    struct func *fn = xmalloc(sizeof(*fn));
+    fn->body = ast_extract(ast, body);
+    fn->refs = 1;
+    func_unref(hmap_put(&funcs, name, fn));
+}
+
+
+// Look up a function
+struct func *func_find(const char *name) {
+    return funcs.n ? hmap_get(&funcs, name) : NULL;
+}
+
+
+// Remove a function
+bool func_unset(const char *name) {
+    struct func *fn = hmap_del(&funcs, name);
+    func_unref(fn);
+    return fn != NULL;
+}
+
+
+// Run a tree with its own positional parameters
+int func_run(struct shell *sh, struct ast *ast, char **argv) {
+    int depth = sh->frame ? sh->frame->depth + 1 : 1;
+    if (depth > FUNC_MAXDEPTH) {
+        fprintf(stderr, "%s: maximum function nesting level exceeded (%d)\n", argv[0], FUNC_MAXDEPTH);
+        return 1;
+    }
+    struct arena_mark mark = arena_mark(&frames);
+    int argc = 0;
+    while (argv[argc] != NULL) {
+        argc++;
+    }
+    struct frame *f = arena_alloc(&frames, sizeof(*f));
+    f->argv = arena_alloc(&frames, (argc + 1) * sizeof(char *));
+    for (int i = 0; i < argc; i++) {
+        f->argv[i] = arena_strdup(&frames, argv[i]);
+    }
+    f->argv[argc] = NULL;
+    f->argc = argc;
+    f->depth = depth;
+    f->returning = false;
+    f->prev = sh->frame;
+
+    sh->frame = f;
+    int status = exec_ast(sh, ast);
+    sh->frame = f->prev;
+    arena_release(&frames, mark);
+    return status;
+}
+
+
+// Call a function inside the shell
+int func_call(struct shell *sh, struct func *fn, char **argv) {
+    // The body stays alive even if the call defines the function again
+    fn->refs++;
+    int status = func_run(sh, fn->body, argv);
+    func_unref(fn);
+    return status;
+}
+
+
+// Get a positional parameter of the innermost call
+const char *func_param(struct shell *sh, size_t i) {
+    if (i == 0) {
+        return "lab";
+    }
+    if (sh->frame == NULL || i >= (size_t)sh->frame->argc) {
+        return NULL;
+    }
+    return sh->frame->argv[i];
+}
+
+
+// The number of positional parameters
+size_t func_nparams(struct shell *sh) {
+    return sh->frame ? (size_t)sh->frame->argc - 1 : 0;
+}
+
+
+// Forget every function
+void func_free(void) {
+    hmap_free(&funcs, func_unref);
+    arena_free(&frames);
+}
+
+
+static bool parse_count(const char *name, const char *arg, long *n) {
+    char *end;
+    *n = strtol(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0') {
+        fprintf(stderr, "%s: %s: numeric argument required\n", name, arg);
+        return false;
+    }
+    return true;
+}
+
+
+// The return builtin
+int return_builtin(struct shell *sh, char **argv) {
+    if (sh->frame == NULL) {
+        fprintf(stderr, "return: can only `return' from a function\n");
+        return 1;
+    }
+    long n = sh->status;
+    if (argv[1] != NULL && !parse_count("return", argv[1], &n)) {
+        n = 2;
+    }
+    sh->frame->returning = true;
+    return (int)(n & 0xff);
+}
+
+
+// The shift builtin
+int shift_builtin(struct shell *sh, char **argv) {
+    long n = 1;
+    if (argv[1] != NULL && !parse_count("shift", argv[1], &n)) {
+        return 2;
+    }
+    if (n < 0 || (size_t)n > func_nparams(sh)) {
+        return 1;
+    }
+    if (n > 0) {
+        // argv[0] keeps the function name
+        struct frame *f = sh->frame;
+        memmove(f->argv + 1, f->argv + 1 + n, (f->argc - n) * sizeof(char *));
+        f->argc -= n;
+    }
+    return 0;
+}
@@ -0,0 +1,152 @@
+#ifndef FUNC_H
+#define FUNC_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "parse.h"
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+struct shell;
+
+
+/* Calls nested deeper than this fail instead of running out of stack */
+#define FUNC_MAXDEPTH 1000
+
+
+/* A defined function. The body is parsed once and kept as its own flat
+* tree, so calls never parse again and heredocs in it stay cached. */
+struct func
+{
+struct ast *body;
+int refs;            // the table and every call that is running it
+};
+
+
+/* The frame of a running function, allocated from the call arena and
+* given back as a whole when the call returns */
+struct frame
+{
+struct frame *prev;
+int argc;            // argv[0] is the function name, then $1 ...
+char **argv;
+int depth;
+bool returning;      // return ran, the rest of the body is skipped
+};
+
+
+/**
+* @brief Define a function, replacing an older one of the same name. A
+* running call of the old definition finishes with its own body.
+*
+* @param name The name
+* @param ast The tree holding the body
+* @param body The index of the body, copied out of the tree
+*/
+void func_define(const char *name, const struct ast *ast, int32_t body);
+
+
+/**
+* @brief Look up a function
+*
+* @param name The name
+* @return struct func* The function, NULL if none is defined
+*/
+struct func *func_find(const char *name);
+
+
+/**
+* @brief Remove a function
+*
+* @param name The name
+* @return true When it was defined
+*/
+bool func_unset(const char *name);
+
+
+/**
+* @brief Run a tree in a new frame, so that argv are its positional
+* parameters and return ends it. Used for function bodies and for
+* scripts run with arguments.
+*
+* @param sh The shell
+* @param ast The tree
+* @param argv The name and the arguments
+* @return int The exit status of the tree, or the value given to return
+*/
+int func_run(struct shell *sh, struct ast *ast, char **argv);
+
+
+/**
+* @brief Call a function inside the shell. The arguments become the
+* positional parameters of a new frame; nothing forks unless the body
+* runs a program.
+*
+* @param sh The shell
+* @param fn The function
+* @param argv The name and the arguments
+* @return int The exit status of the body, or the value given to return
+*/
+int func_call(struct shell *sh, struct func *fn, char **argv);
+
+
+/**
+* @brief Get a positional parameter of the innermost call
+*
+* @param sh The shell
+* @param i The number, 0 is the name of the shell
+* @return const char* The value, NULL when there is no such parameter
+*/
+const char *func_param(struct shell *sh, size_t i);
+
+
+/**
+* @brief The number of positional parameters, $#
+*
+* @param sh The shell
+* @return size_t The count
+*/
+size_t func_nparams(struct shell *sh);
+
+
+/**
+* @brief Forget every function and free the call arena
+*/
+void func_free(void);
+
+
+/**
+* @brief The return builtin.
+*
+*   return [n]
+*
+* Ends the innermost function call with status n, or the status of the
+* last command.
+*
+* @param sh The shell
+* @param argv The arguments
+* @return int The status
+*/
+int return_builtin(struct shell *sh, char **argv);
+
+
+/**
+* @brief The shift builtin.
+*
+*   shift [n]
+*
+* Drops the first n positional parameters, one by default.
+*
+* @param sh The shell
+* @param argv The arguments
+* @return int The exit status, 1 if there are fewer than n
+*/
+int shift_builtin(struct shell *sh, char **argv);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
@@ -0,0 +1,352 @@
+#define _GNU_SOURCE
+#include "histcmd.h"
+#include "histlog.h"
+#include "parse.h"
+#include "lab.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "readline/history.h"
+
+// Entries written per writev call, three buffers each
+#define HIST_BATCH 300
+
+
+// Number of entries in the history
+size_t hist_count(struct shell *sh) {
+    if (sh->hist != NULL) {
+        return histlog_count(sh->hist);
+    }
+    return history_length;
+}
+
+
+// Get a history entry in constant time, 0 is the oldest
+const char *hist_line(struct shell *sh, size_t idx, size_t *len) {
+    if (sh->hist != NULL) {
+        struct hist_entry e;
+        if (!histlog_get(sh->hist, idx, &e)) {
+            return NULL;
+        }
+        *len = e.cmdlen;
+        return e.cmd;
+    }
+    HIST_ENTRY *e = history_get(history_base + (int)idx);
+    if (e == NULL) {
+        return NULL;
+    }
+    *len = strlen(e->line);
+    return e->line;
+}
+
+
+/*Parse the range argument of the history builtin, n for the last n
+* entries or first-last. Returns false if it is not a range.*/
+static bool history_range(const char *arg, size_t count, size_t *first, size_t *last) {
+    char *end;
+    unsigned long a = strtoul(arg, &end, 10);
+    if (end == arg) {
+        return false;
+    }
+    if (*end == '\0') {
+        *first = a < count ? count - a : 0;
+        *last = count;
+        return true;
+    }
+    if (*end != '-' || a == 0) {
+        return false;
+    }
+    const char *rest = end + 1;
+    unsigned long b = strtoul(rest, &end, 10);
+    if (end == rest || *end != '\0' || b < a) {
+        return false;
+    }
+    *first = a - 1;
+    *last = b < count ? b : count;
+    return true;
+}
+
+
+// The history builtin
+int history_builtin(struct shell *sh, char **argv) {
+    size_t count = hist_count(sh);
+    size_t first = 0, last = count;
+    const char *grep = NULL;
+    for (int i = 1; argv[i]; i++) {
+        if (strcmp(argv[i], "-g") == 0 && argv[i + 1] != NULL) {
+            grep = argv[++i];
+        } else if (!history_range(argv[i], count, &first, &last)) {
+            fprintf(stderr, "history: %s: invalid argument\n", argv[i]);
+            fprintf(stderr, "usage: history [-g text] [n | first-last]\n");
+            return 2;
+        }
+    }
+
+    /* Entries go out straight from the log, only the numbers are
+    * formatted, and a batch of entries is written with one writev */
+    struct iovec iov[HIST_BATCH * 3];
+    char nums[HIST_BATCH][24];
+    int n = 0;
+    size_t glen = grep ? strlen(grep) : 0;
+    for (size_t i = first; i < last; i++) {
+        size_t len;
+        const char *line = hist_line(sh, i, &len);
+        if (line == NULL || (grep && memmem(line, len, grep, glen) == NULL)) {
+            continue;
+        }
+        int k = n / 3;
+        int w = snprintf(nums[k], sizeof(nums[k]), "%5zu  ", i + 1);
+        iov[n++] = (struct iovec){ nums[k], w };
+        iov[n++] = (struct iovec){ (void *)line, len };
+        iov[n++] = (struct iovec){ "\n", 1 };
+        if (n == HIST_BATCH * 3) {
+            if (writev_all(STDOUT_FILENO, iov, n) < 0) {
+                perror("history");
+                return 1;
+            }
+            n = 0;
+        }
+    }
+    if (n > 0 && writev_all(STDOUT_FILENO, iov, n) < 0) {
+        perror("history");
+        return 1;
+    }
+    return 0;
+}
+
+
+static struct hist_expand *hist_state(struct shell *sh) {
+    if (sh->hexp == NULL) {
+        sh->hexp = xcalloc(1, sizeof(struct hist_expand));
+    }
+    return sh->hexp;
+}
+
+
+static bool is_word_end(char c) {
+    return c == '\0' || isspace((unsigned char)c) || strchr(";&|<>()'\"", c) != NULL;
+}
+
+
+/*The child of node p for byte c, added when create is set. Returns 0
+* when there is none.*/
+static uint32_t name_kid(struct hist_expand *he, uint32_t p, unsigned char c, bool create) {
+    for (uint32_t k = he->names[p].kid; k != 0; k = he->names[k].next) {
+        if (he->names[k].c == c) {
+            return k;
+        }
+    }
+    if (!create) {
+        return 0;
+    }
+    if (he->nnames == he->capnames) {
+        he->capnames *= 2;
+        he->names = xrealloc(he->names, he->capnames * sizeof(struct hist_name));
+    }
+    uint32_t k = he->nnames++;
+    he->names[k] = (struct hist_name){ 0, he->names[p].kid, 0, c };
+    he->names[p].kid = k;
+    return k;
+}
+
+
+/*Add the command names of entries added since the last call to the trie.
+* Entries only ever get appended while the log keeps its generation, a log
+* that was opened again or renumbered is indexed from scratch, and so is a
+* readline list that was cleared.*/
+static void names_update(struct shell *sh, struct hist_expand *he) {
+    size_t count = hist_count(sh);
+    unsigned long gen = 0;
+    const char *last = NULL;
+    if (sh->hist != NULL) {
+        gen = histlog_generation(sh->hist);
+    } else if (he->nindexed > 0 && he->nindexed <= count) {
+        // The readline list has no generation, but a list that was
+        // cleared or cut no longer has the last line indexed where it was
+        HIST_ENTRY *e = history_get(history_base + (int)he->nindexed - 1);
+        last = e ? e->line : NULL;
+    }
+    if (he->names == NULL || gen != he->gen || count < he->nindexed || (sh->hist == NULL && last != he->last)) {
+        if (he->names == NULL) {
+            he->capnames = 256;
+            he->names = xmalloc(he->capnames * sizeof(struct hist_name));
+        }
+        he->names[0] = (struct hist_name){ 0, 0, 0, 0 };
+        he->nnames = 1;
+        he->nindexed = 0;
+        he->gen = gen;
+    }
+    for (; he->nindexed < count; he->nindexed++) {
+        size_t len;
+        const char *line = hist_line(sh, he->nindexed, &len);
+        if (line == NULL) {
+            continue;
+        }
+        size_t i = 0;
+        while (i < len && isspace((unsigned char)line[i])) {
+            i++;
+        }
+        uint32_t p = 0;
+        he->names[0].newest = he->nindexed + 1;
+        for (; i < len && !is_word_end(line[i]); i++) {
+            p = name_kid(he, p, (unsigned char)line[i], true);
+            he->names[p].newest = he->nindexed + 1;
+        }
+    }
+    if (sh->hist == NULL && count > 0) {
+        HIST_ENTRY *e = history_get(history_base + (int)count - 1);
+        he->last = e ? e->line : NULL;
+    }
+}
+
+
+/*Find the entry a reference starting just after the ! refers to. Sets
+* used to the length of the reference. Returns the entry number or
+* SIZE_MAX if there is none.*/
+static size_t hist_event(struct shell *sh, const char *s, size_t *used) {
+    size_t count = hist_count(sh);
+    char *end;
+    if (*s == '!' || *s == '$') {
+        *used = 1;
+        return count > 0 ? count - 1 : SIZE_MAX;
+    }
+    if (*s == '-' || isdigit((unsigned char)*s)) {
+        long n = strtol(s, &end, 10);
+        *used = end - s;
+        if (*s == '-') {
+            return n < 0 && (size_t)-n <= count ? count + n : SIZE_MAX;
+        }
+        return n > 0 && (size_t)n <= count ? (size_t)n - 1 : SIZE_MAX;
+    }
+
+    size_t n = 0;
+    while (!is_word_end(s[n])) {
+        n++;
+    }
+    *used = n;
+    struct hist_expand *he = hist_state(sh);
+    names_update(sh, he);
+    uint32_t p = 0;
+    for (size_t i = 0; i < n; i++) {
+        p = name_kid(he, p, (unsigned char)s[i], false);
+        if (p == 0) {
+            return SIZE_MAX;
+        }
+    }
+    return he->names[p].newest > 0 ? he->names[p].newest - 1 : SIZE_MAX;
+}
+
+
+// Expand !!, !n, !-n, !prefix and !$ in a line the user typed
+int hist_expand_line(struct shell *sh, const char *line, char **out) {
+    struct strbuf sb = {0};
+    bool expanded = false;
+    bool dquote = false;
+    *out = NULL;
+    for (size_t i = 0; line[i];) {
+        char c = line[i];
+        if (c == '\'' && !dquote) {
+            const char *close = strchr(line + i + 1, '\'');
+            size_t n = close ? (size_t)(close - line - i + 1) : strlen(line + i);
+            strbuf_add(&sb, line + i, n);
+            i += n;
+            continue;
+        }
+        if (c == '\\' && line[i + 1]) {
+            strbuf_add(&sb, line + i, 2);
+            i += 2;
+            continue;
+        }
+        if (c == '"') {
+            dquote = !dquote;
+        }
+        char next = line[i + 1];
+        if (c != '!' || next == '\0' || isspace((unsigned char)next) || next == '=' || next == '(' ||
+            (dquote && next == '"')) {
+            strbuf_addc(&sb, c);
+            i++;
+            continue;
+        }
+
+        size_t used;
+        size_t idx = hist_event(sh, line + i + 1, &used);
+        size_t len;
+        const char *text = idx == SIZE_MAX ? NULL : hist_line(sh, idx, &len);
+        if (text == NULL) {
+            fprintf(stderr, "lab: !%.*s: event not found\n", (int)used, line + i + 1);
+            strbuf_free(&sb);
+            return -1;
+        }
+        if (next == '$') {
+            // The last word of the previous command
+            while (len > 0 && isspace((unsigned char)text[len - 1])) {
+                len--;
+            }
+            size_t start = len;
+            while (start > 0 && !isspace((unsigned char)text[start - 1])) {
+                start--;
+            }
+            text += start;
+            len -= start;
+        }
+        strbuf_add(&sb, text, len);
+        i += 1 + used;
+        expanded = true;
+    }
+    if (!expanded) {
+        strbuf_free(&sb);
+        return 0;
+    }
+    *out = strbuf_steal(&sb);
+    return 1;
+}
+
+
+// Take a parsed command line out of the cache
+struct ast *hist_ast_take(struct shell *sh, const char *text) {
+    if (sh->hexp == NULL) {
+        return NULL;
+    }
+    struct hist_expand *he = sh->hexp;
+    for (int i = 0; i < HIST_AST_CACHE; i++) {
+        if (he->parsed[i].text != NULL && strcmp(he->parsed[i].text, text) == 0) {
+            struct ast *ast = he->parsed[i].ast;
+            free(he->parsed[i].text);
+            he->parsed[i].text = NULL;
+            he->parsed[i].ast = NULL;
+            return ast;
+        }
+    }
+    return NULL;
+}
+
+
+// Give a parsed command line to the cache after it ran
+void hist_ast_keep(struct shell *sh, const char *text, struct ast *ast) {
+    struct hist_expand *he = hist_state(sh);
+    int slot = he->nextparsed;
+    he->nextparsed = (slot + 1) % HIST_AST_CACHE;
+    free(he->parsed[slot].text);
+    ast_free(he->parsed[slot].ast);
+    he->parsed[slot].text = xstrdup(text);
+    he->parsed[slot].ast = ast;
+}
+
+
+// Free the history expansion state
+void hist_expand_free(struct hist_expand *he) {
+    if (he == NULL) {
+        return;
+    }
+    free(he->names);
+    for (int i = 0; i < HIST_AST_CACHE; i++) {
+        free(he->parsed[i].text);
+        ast_free(he->parsed[i].ast);
+    }
+    free(he);
+}
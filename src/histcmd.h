@@ -0,0 +1,134 @@
+#ifndef HISTCMD_H
+#define HISTCMD_H
+#include <stddef.h>
+#include <stdint.h>
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+struct shell;
+struct ast;
+
+
+/* Parsed command lines kept for history expansion to reuse */
+#define HIST_AST_CACHE 16
+
+
+/* A node of the trie of command names behind !prefix. Node 0 is the
+* root, the children of a node are a list linked through next and 0 ends
+* a list. */
+struct hist_name
+{
+uint32_t kid;        // first child
+uint32_t next;       // next sibling
+size_t newest;       // newest entry whose command name is below, + 1
+unsigned char c;     // the byte leading to this node
+};
+
+
+/* State behind history expansion */
+struct hist_expand
+{
+struct hist_name *names;  // trie of command names
+uint32_t nnames, capnames;
+size_t nindexed;       // entries already added to names
+unsigned long gen;     // histlog generation the trie was built for
+const char *last;      // last readline line indexed, without a log
+struct
+{
+char *text;
+struct ast *ast;
+} parsed[HIST_AST_CACHE];
+int nextparsed;        // slot the next parsed line replaces
+};
+
+
+/**
+* @brief Number of entries in the history, the persistent log when the
+* shell has one and the readline history otherwise
+*
+* @param sh The shell
+* @return size_t The number of entries
+*/
+size_t hist_count(struct shell *sh);
+
+
+/**
+* @brief Get a history entry in constant time, 0 is the oldest
+*
+* @param sh The shell
+* @param idx The entry number
+* @param len Set to the length of the entry
+* @return const char* The entry, not NUL terminated, NULL if out of range
+*/
+const char *hist_line(struct shell *sh, size_t idx, size_t *len);
+
+
+/**
+* @brief The history builtin.
+*
+*   history [-g text] [n | first-last]
+*
+* Prints the whole history, the last n entries or the entries numbered
+* first to last, keeping only those that contain text when -g is given.
+* The output is written straight from the history with writev.
+*
+* @param sh The shell
+* @param argv The arguments
+* @return int The exit status
+*/
+int history_builtin(struct shell *sh, char **argv);
+
+
+/**
+* @brief Expand !!, !n, !-n, !prefix and !$ in a line the user typed.
+* Numbers are resolved with an index lookup and a prefix by following it
+* down a trie of command names, where every node knows the newest entry
+* below it, so a lookup costs the length of the prefix.
+*
+* @param sh The shell
+* @param line The line
+* @param out Set to the expanded line when something was expanded, the
+* caller must free it
+* @return int 1 if the line was expanded, 0 if it has no references, -1
+* if a reference could not be resolved, the error is printed
+*/
+int hist_expand_line(struct shell *sh, const char *line, char **out);
+
+
+/**
+* @brief Take a parsed command line out of the cache. Running a history
+* entry again with !! or !n gives the same text, which then does not
+* need to be parsed again.
+*
+* @param sh The shell
+* @param text The command line
+* @return struct ast* The tree, NULL if text is not cached
+*/
+struct ast *hist_ast_take(struct shell *sh, const char *text);
+
+
+/**
+* @brief Give a parsed command line to the cache after it ran, the oldest
+* cached line is freed when the cache is full
+*
+* @param sh The shell
+* @param text The command line, copied
+* @param ast The tree, owned by the cache from now on
+*/
+void hist_ast_keep(struct shell *sh, const char *text, struct ast *ast);
+
+
+/**
+* @brief Free the history expansion state
+*
+* @param he The state, may be NULL
+*/
+void hist_expand_free(struct hist_expand *he);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
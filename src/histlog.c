@@ -0,0 +1,363 @@
+#define _GNU_SOURCE
+#include "histlog.h"
+#include "hmap.h"
+#include "lab.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Files smaller than this are never compacted
+#define HISTLOG_MIN_COMPACT (1024 * 1024)
+
+#define REC_MIN (sizeof(struct histlog_rec) + sizeof(uint32_t))
+
+// Generations handed out to opened logs
+static unsigned long generations;
+
+
+// Bytes of the log at a virtual offset, see struct histlog
+static const char *log_at(const struct histlog *h, size_t off) {
+    return off < h->maplen ? h->map + off : h->tail.s + (off - h->maplen);
+}
+
+
+/*Decode the record at off in a buffer of size bytes. Returns the length of
+* the record, 0 when it is damaged or cut short.*/
+static size_t rec_decode(const char *buf, size_t size, size_t off, struct hist_entry *e) {
+    struct histlog_rec rec;
+    uint32_t trailer;
+    if (off + REC_MIN > size) {
+        return 0;
+    }
+    memcpy(&rec, buf + off, sizeof(rec));
+    if (rec.len < REC_MIN || rec.len > size - off || rec.cwdlen > rec.len - REC_MIN) {
+        return 0;
+    }
+    memcpy(&trailer, buf + off + rec.len - sizeof(trailer), sizeof(trailer));
+    if (trailer != rec.len) {
+        return 0;
+    }
+    if (e != NULL) {
+        e->time = rec.time;
+        e->status = rec.status;
+        e->duration_ms = rec.duration_ms;
+        e->cwd = buf + off + sizeof(rec);
+        e->cwdlen = rec.cwdlen;
+        e->cmd = e->cwd + rec.cwdlen;
+        e->cmdlen = rec.len - REC_MIN - rec.cwdlen;
+    }
+    return rec.len;
+}
+
+
+// Decode a record at a virtual offset of the log
+static size_t log_decode(const struct histlog *h, size_t off, struct hist_entry *e) {
+    if (off < h->maplen) {
+        return rec_decode(h->map, h->maplen, off, e);
+    }
+    return rec_decode(h->tail.s, h->tail.len, off - h->maplen, e);
+}
+
+
+static bool header_valid(const char *map, size_t len) {
+    return len >= sizeof(struct histlog_header) && memcmp(map, HISTLOG_MAGIC, 4) == 0;
+}
+
+
+// Open a history log, creating it when it does not exist
+struct histlog *histlog_open(const char *path) {
+    int fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return NULL;
+    }
+    // Two shells starting at once must not both write a header
+    flock(fd, LOCK_EX);
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return NULL;
+    }
+    if (st.st_size == 0) {
+        struct histlog_header hdr = { HISTLOG_MAGIC, HISTLOG_VERSION, 0 };
+        if (write_all(fd, (const char *)&hdr, sizeof(hdr)) < 0) {
+            close(fd);
+            return NULL;
+        }
+        st.st_size = sizeof(hdr);
+    }
+    flock(fd, LOCK_UN);
+
+    char *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+    if (!header_valid(map, st.st_size)) {
+        fprintf(stderr, "lab: %s: not a history file\n", path);
+        munmap(map, st.st_size);
+        close(fd);
+        return NULL;
+    }
+    struct histlog *h = xcalloc(1, sizeof(*h));
+    h->fd = fd;
+    h->path = xstrdup(path);
+    h->dev = st.st_dev;
+    h->ino = st.st_ino;
+    h->map = map;
+    h->maplen = st.st_size;
+    h->gen = ++generations;
+    return h;
+}
+
+
+static void index_push(struct histlog *h, size_t off) {
+    if (h->noffs == h->capoffs) {
+        h->capoffs = h->capoffs ? h->capoffs * 2 : 1024;
+        h->offs = xrealloc(h->offs, h->capoffs * sizeof(size_t));
+    }
+    h->offs[h->noffs++] = off;
+}
+
+
+// Build the offset index on first use
+static void index_build(struct histlog *h) {
+    if (h->indexed) {
+        return;
+    }
+    size_t end = h->maplen + h->tail.len;
+    size_t off = sizeof(struct histlog_header);
+    size_t len;
+    while (off < end && (len = log_decode(h, off, NULL)) > 0) {
+        index_push(h, off);
+        off += len;
+    }
+    h->indexed = true;
+}
+
+
+/*Working directory for new records. getcwd is only called again after a
+* cd changed the directory.*/
+static const char *log_cwd(struct histlog *h) {
+    if (h->cwd == NULL || h->cwd_gen != cwd_generation()) {
+        free(h->cwd);
+        h->cwd = getcwd(NULL, 0);
+        if (h->cwd == NULL) {
+            h->cwd = xstrdup("");
+        }
+        h->cwd_gen = cwd_generation();
+    }
+    return h->cwd;
+}
+
+
+/*Another shell that compacted the log replaced the file. Switch to the new
+* one so our records are not written to the unlinked copy.*/
+static void log_reopen(struct histlog *h) {
+    struct stat st;
+    if (stat(h->path, &st) < 0 || (st.st_dev == h->dev && st.st_ino == h->ino)) {
+        return;
+    }
+    int fd = open(h->path, O_RDWR | O_APPEND | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    close(h->fd);
+    h->fd = fd;
+    h->dev = st.st_dev;
+    h->ino = st.st_ino;
+}
+
+
+// Append a command to the log with a single write
+int histlog_add(struct histlog *h, const char *cmd, int status, uint32_t duration_ms) {
+    const char *cwd = log_cwd(h);
+    size_t cwdlen = strlen(cwd);
+    size_t cmdlen = strlen(cmd);
+    if (cwdlen > UINT16_MAX) {
+        cwdlen = 0;
+    }
+    if (cmdlen > UINT32_MAX - REC_MIN - cwdlen) {
+        errno = EFBIG;
+        return -1;
+    }
+    struct histlog_rec rec = {
+        .len = REC_MIN + cwdlen + cmdlen,
+        .status = status,
+        .time = time(NULL),
+        .duration_ms = duration_ms,
+        .cwdlen = cwdlen,
+        .flags = 0,
+    };
+
+    // Build the record at the end of tail and write it from there
+    size_t off = h->tail.len;
+    strbuf_add(&h->tail, (const char *)&rec, sizeof(rec));
+    strbuf_add(&h->tail, cwd, cwdlen);
+    strbuf_add(&h->tail, cmd, cmdlen);
+    strbuf_add(&h->tail, (const char *)&rec.len, sizeof(rec.len));
+    if (h->indexed) {
+        index_push(h, h->maplen + off);
+    }
+    log_reopen(h);
+    return write_all(h->fd, h->tail.s + off, rec.len);
+}
+
+
+// Counter that changes when the records are numbered anew
+unsigned long histlog_generation(const struct histlog *h) {
+    return h->gen;
+}
+
+
+// Number of records in the log
+size_t histlog_count(struct histlog *h) {
+    index_build(h);
+    return h->noffs;
+}
+
+
+// Decode a record, 0 is the oldest
+bool histlog_get(struct histlog *h, size_t idx, struct hist_entry *e) {
+    index_build(h);
+    if (idx >= h->noffs) {
+        return false;
+    }
+    return log_decode(h, h->offs[idx], e) > 0;
+}
+
+
+// Call fn for the newest n records, oldest first
+size_t histlog_recent(struct histlog *h, size_t n, void (*fn)(const struct hist_entry *, void *), void *arg) {
+    size_t *offs = xmalloc((n ? n : 1) * sizeof(size_t));
+    size_t found = 0;
+    size_t off = h->maplen + h->tail.len;
+    while (found < n && off >= sizeof(struct histlog_header) + REC_MIN) {
+        uint32_t len;
+        memcpy(&len, log_at(h, off - sizeof(len)), sizeof(len));
+        // Records never straddle the mapped file and tail
+        if (len < REC_MIN || len > off - sizeof(struct histlog_header) ||
+            (off > h->maplen && off - len < h->maplen) || log_decode(h, off - len, NULL) != len) {
+            break;
+        }
+        off -= len;
+        offs[found++] = off;
+    }
+    struct hist_entry e;
+    for (size_t i = found; i-- > 0;) {
+        log_decode(h, offs[i], &e);
+        fn(&e, arg);
+    }
+    free(offs);
+    return found;
+}
+
+
+// Rewrite a log file keeping the newest occurrence of every command
+int histlog_compact(const char *path, size_t keep) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    flock(fd, LOCK_EX);
+    struct stat st;
+    char *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    if (map == MAP_FAILED || !header_valid(map, st.st_size)) {
+        if (map != MAP_FAILED) {
+            munmap(map, st.st_size);
+        }
+        close(fd);
+        return -1;
+    }
+    size_t size = st.st_size;
+
+    // Find every record, then keep the newest ones with a command not seen yet
+    size_t *offs = NULL;
+    size_t n = 0, cap = 0, len;
+    size_t end = sizeof(struct histlog_header);
+    while ((len = rec_decode(map, size, end, NULL)) > 0) {
+        if (n == cap) {
+            cap = cap ? cap * 2 : 1024;
+            offs = xrealloc(offs, cap * sizeof(size_t));
+        }
+        offs[n++] = end;
+        end += len;
+    }
+    struct hmap seen = {0};
+    size_t nkeep = 0;
+    struct hist_entry e;
+    for (size_t i = n; i-- > 0 && nkeep < keep;) {
+        rec_decode(map, size, offs[i], &e);
+        bool added;
+        hmap_putn(&seen, e.cmd, e.cmdlen, &added);
+        if (added) {
+            offs[n - 1 - nkeep++] = offs[i];
+        }
+    }
+    hmap_free(&seen, NULL);
+
+    char *tmp = xmalloc(strlen(path) + 5);
+    sprintf(tmp, "%s.tmp", path);
+    int out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    int rc = -1;
+    if (out >= 0) {
+        struct strbuf buf = {0};
+        struct histlog_header hdr = { HISTLOG_MAGIC, HISTLOG_VERSION, 0 };
+        strbuf_add(&buf, (const char *)&hdr, sizeof(hdr));
+        for (size_t i = n - nkeep; i < n; i++) {
+            strbuf_add(&buf, map + offs[i], rec_decode(map, size, offs[i], NULL));
+        }
+        ((struct histlog_header *)buf.s)->compacted = buf.len;
+        rc = write_all(out, buf.s, buf.len);
+        // Keep what other shells appended while we were busy
+        if (rc == 0 && fstat(fd, &st) == 0 && (size_t)st.st_size > end) {
+            char chunk[65536];
+            ssize_t got;
+            while ((got = pread(fd, chunk, sizeof(chunk), end)) > 0 && rc == 0) {
+                rc = write_all(out, chunk, got);
+                end += got;
+            }
+        }
+        strbuf_free(&buf);
+        if (close(out) < 0 || rc < 0 || rename(tmp, path) < 0) {
+            unlink(tmp);
+            rc = -1;
+        }
+    }
+    free(tmp);
+    free(offs);
+    munmap(map, size);
+    close(fd);
+    return rc;
+}
+
+
+// Close a log, compacting it when it grew too much
+void histlog_close(struct histlog *h, size_t keep) {
+    if (h == NULL) {
+        return;
+    }
+    struct histlog_header hdr;
+    struct stat st;
+    if (pread(h->fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) && fstat(h->fd, &st) == 0 &&
+        st.st_size > HISTLOG_MIN_COMPACT &&
+        (uint64_t)st.st_size > 2 * hdr.compacted) {
+        histlog_compact(h->path, keep);
+    }
+    munmap(h->map, h->maplen);
+    close(h->fd);
+    strbuf_free(&h->tail);
+    free(h->offs);
+    free(h->path);
+    free(h->cwd);
+    free(h);
+}
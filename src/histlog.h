@@ -0,0 +1,167 @@
+#ifndef HISTLOG_H
+#define HISTLOG_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include "util.h"
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/* File header, followed by the records */
+#define HISTLOG_MAGIC "LABH"
+#define HISTLOG_VERSION 1
+
+struct histlog_header
+{
+char magic[4];
+uint32_t version;
+uint64_t compacted;  // file size right after the last compaction
+};
+
+
+/* On disk record, followed by the cwd, the command and a uint32_t copy of
+* len so the file can be walked backwards from the end */
+struct histlog_rec
+{
+uint32_t len;        // size of the whole record including the trailer
+int32_t status;
+int64_t time;
+uint32_t duration_ms;
+uint16_t cwdlen;
+uint16_t flags;
+};
+
+
+/* A decoded record, the strings point into the log and are not NUL
+* terminated */
+struct hist_entry
+{
+int64_t time;
+int status;
+uint32_t duration_ms;
+const char *cwd;
+size_t cwdlen;
+const char *cmd;
+size_t cmdlen;
+};
+
+
+/* An open history log. Offsets below maplen are in the file as it was
+* mapped when the log was opened, the rest are in tail. */
+struct histlog
+{
+int fd;              // opened with O_APPEND
+char *path;
+dev_t dev;           // identity of the file fd refers to
+ino_t ino;
+char *map;
+size_t maplen;
+struct strbuf tail;  // records appended by this shell
+size_t *offs;        // offset of every record, built on first use
+size_t noffs;
+size_t capoffs;
+bool indexed;
+char *cwd;           // cached working directory for new records
+unsigned long cwd_gen;
+unsigned long gen;   // see histlog_generation
+};
+
+
+/**
+* @brief Open a history log, creating it when it does not exist. The file
+* is mapped but not read, records are only looked at when they are used.
+*
+* @param path The file name
+* @return struct histlog* The log, NULL when it can not be opened
+*/
+struct histlog *histlog_open(const char *path);
+
+
+/**
+* @brief Append a command to the log with a single write. The data is not
+* synced to disk, a crash may lose the last few commands.
+*
+* @param h The log
+* @param cmd The command line
+* @param status Its exit status
+* @param duration_ms How long it ran
+* @return int 0 on success, -1 with errno set on error
+*/
+int histlog_add(struct histlog *h, const char *cmd, int status, uint32_t duration_ms);
+
+
+/**
+* @brief Number of records in the log. The first call indexes the file.
+*
+* @param h The log
+* @return size_t The number of records
+*/
+size_t histlog_count(struct histlog *h);
+
+
+/**
+* @brief Counter that changes whenever the records of a log may be
+* numbered differently, when it is opened or replaced by a compacted
+* copy. Appending keeps the numbers, so anything indexed by record number
+* stays valid until this changes.
+*
+* @param h The log
+* @return unsigned long The generation, never 0
+*/
+unsigned long histlog_generation(const struct histlog *h);
+
+
+/**
+* @brief Decode a record, 0 is the oldest
+*
+* @param h The log
+* @param idx The record number
+* @param e Filled with the record
+* @return bool False if idx is out of range
+*/
+bool histlog_get(struct histlog *h, size_t idx, struct hist_entry *e);
+
+
+/**
+* @brief Call fn for the newest n records, oldest first. The file is
+* walked backwards from the end so the cost does not depend on its size.
+*
+* @param h The log
+* @param n The number of records
+* @param fn Called for every record
+* @param arg Passed to fn
+* @return size_t The number of records visited
+*/
+size_t histlog_recent(struct histlog *h, size_t n, void (*fn)(const struct hist_entry *, void *), void *arg);
+
+
+/**
+* @brief Rewrite a log file keeping only the newest occurrence of every
+* command and at most keep records. The new file replaces the old one
+* atomically.
+*
+* @param path The file name
+* @param keep The number of records to keep
+* @return int 0 on success, -1 on error
+*/
+int histlog_compact(const char *path, size_t keep);
+
+
+/**
+* @brief Close a log. The file is compacted when it grew to more than
+* twice its size after the last compaction.
+*
+* @param h The log, may be NULL
+* @param keep The number of records to keep when compacting
+*/
+void histlog_close(struct histlog *h, size_t keep);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
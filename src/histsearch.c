@@ -0,0 +1,229 @@
+#define _GNU_SOURCE
+#include "histsearch.h"
+#include "histlog.h"
+#include "lab.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "readline/history.h"
+#include "readline/readline.h"
+
+// Newest matches looked at when ranking, keeps every search bounded
+#define HISTSEARCH_SCAN 256
+
+
+// Record a command that was run
+void histsearch_add(struct hist_search *hs, const char *cmd, size_t len) {
+    if (len == 0 || len > UINT32_MAX) {
+        return;
+    }
+    bool added;
+    struct hmap_entry *e = hmap_putn(&hs->cmds, cmd, len, &added);
+    uint32_t count = 1;
+    if (!added) {
+        struct hist_doc *old = &hs->docs[(uintptr_t)e->value - 1];
+        old->dead = true;
+        count = old->count + 1;
+    }
+    if (hs->ndocs == hs->capdocs) {
+        hs->capdocs = hs->capdocs ? hs->capdocs * 2 : 1024;
+        hs->docs = xrealloc(hs->docs, hs->capdocs * sizeof(struct hist_doc));
+    }
+    uint32_t doc = hs->ndocs++;
+    hs->docs[doc].cmd = e->key;
+    hs->docs[doc].len = len;
+    hs->docs[doc].count = count;
+    hs->docs[doc].dead = false;
+    e->value = (void *)(uintptr_t)(doc + 1);
+    trigram_add(&hs->ix, doc, cmd, len);
+}
+
+
+// Build the search index over the history of the shell
+struct hist_search *histsearch_build(struct shell *sh) {
+    struct hist_search *hs = xcalloc(1, sizeof(*hs));
+    if (sh->hist != NULL) {
+        struct hist_entry e;
+        size_t n = histlog_count(sh->hist);
+        for (size_t i = 0; i < n; i++) {
+            if (histlog_get(sh->hist, i, &e)) {
+                histsearch_add(hs, e.cmd, e.cmdlen);
+            }
+        }
+    } else {
+        HIST_ENTRY **list = history_list();
+        for (int i = 0; list && list[i]; i++) {
+            histsearch_add(hs, list[i]->line, strlen(list[i]->line));
+        }
+    }
+    return hs;
+}
+
+
+struct find_state
+{
+struct hist_search *hs;
+const char *q;
+size_t len;
+uint32_t hits[HISTSEARCH_SCAN];
+size_t nhits;
+};
+
+
+static bool find_hit(uint32_t doc, void *arg) {
+    struct find_state *st = arg;
+    struct hist_doc *d = &st->hs->docs[doc];
+    if (!d->dead && memmem(d->cmd, d->len, st->q, st->len) != NULL) {
+        st->hits[st->nhits++] = doc;
+    }
+    return st->nhits < HISTSEARCH_SCAN;
+}
+
+
+struct ranked
+{
+double score;
+size_t age;
+const char *cmd;
+};
+
+
+static int ranked_cmp(const void *a, const void *b) {
+    const struct ranked *x = a;
+    const struct ranked *y = b;
+    if (x->score != y->score) {
+        return x->score < y->score ? 1 : -1;
+    }
+    return (x->age > y->age) - (x->age < y->age);
+}
+
+
+/*Find commands that contain a string. A command run often beats one that
+* is only a little more recent, the score is its count divided by how many
+* newer matches there are.*/
+size_t histsearch_find(struct hist_search *hs, const char *q, const char **res, size_t max) {
+    struct find_state st = { .hs = hs, .q = q, .len = strlen(q), .nhits = 0 };
+    if (st.len == 0) {
+        return 0;
+    }
+    if (!trigram_search(&hs->ix, q, st.len, find_hit, &st)) {
+        // Too short for the index, the newest documents are checked in turn
+        for (size_t doc = hs->ndocs; doc-- > 0 && find_hit(doc, &st);) {
+        }
+    }
+    struct ranked r[HISTSEARCH_SCAN];
+    for (size_t i = 0; i < st.nhits; i++) {
+        struct hist_doc *d = &hs->docs[st.hits[i]];
+        r[i].score = (double)d->count / (i + 1);
+        r[i].age = i;
+        r[i].cmd = d->cmd;
+    }
+    qsort(r, st.nhits, sizeof(r[0]), ranked_cmp);
+    size_t n = st.nhits < max ? st.nhits : max;
+    for (size_t i = 0; i < n; i++) {
+        res[i] = r[i].cmd;
+    }
+    return n;
+}
+
+
+// Free the index
+void histsearch_free(struct hist_search *hs) {
+    if (hs == NULL) {
+        return;
+    }
+    hmap_free(&hs->cmds, NULL);
+    trigram_free(&hs->ix);
+    free(hs->docs);
+    free(hs);
+}
+
+
+// The shell whose history Ctrl-R searches
+static struct shell *search_shell;
+
+
+static void search_show(const struct strbuf *q, const char *match, bool failed) {
+    struct strbuf p = {0};
+    strbuf_adds(&p, failed ? "(failed reverse-i-search)`" : "(reverse-i-search)`");
+    strbuf_add(&p, q->s, q->len);
+    strbuf_adds(&p, "': ");
+    rl_set_prompt(p.s);
+    strbuf_free(&p);
+    rl_replace_line(match, 0);
+    const char *at = q->len ? strstr(match, q->s) : NULL;
+    rl_point = at ? at - match : 0;
+    rl_redisplay();
+}
+
+
+/*Ctrl-R. Typing refines the search, Ctrl-R moves to the next match,
+* Ctrl-G gives the old line back and any other key takes the match and
+* is then handled as usual, so Enter runs it.*/
+static int reverse_search(int count, int key) {
+    UNUSED(count);
+    UNUSED(key);
+    struct shell *sh = search_shell;
+    if (sh->hsearch == NULL) {
+        sh->hsearch = histsearch_build(sh);
+    }
+    // The prompt refresh hook would draw over the search prompt
+    rl_hook_func_t *hook = rl_event_hook;
+    rl_event_hook = NULL;
+    char *saved_prompt = xstrdup(rl_prompt ? rl_prompt : "");
+    char *saved_line = xstrdup(rl_line_buffer);
+    int saved_point = rl_point;
+
+    struct strbuf q = {0};
+    strbuf_adds(&q, "");
+    const char *res[64];
+    size_t nres = 0, sel = 0;
+    const char *match = saved_line;
+    bool failed = false;
+    for (;;) {
+        search_show(&q, match, failed);
+        int c = rl_read_key();
+        if (c == CTRL('R')) {
+            if (sel + 1 < nres) {
+                match = res[++sel];
+            }
+            continue;
+        }
+        if (c == CTRL('G')) {
+            rl_replace_line(saved_line, 0);
+            rl_point = saved_point;
+            break;
+        }
+        if (c == RUBOUT || c == CTRL('H')) {
+            if (q.len > 0) {
+                q.s[--q.len] = '\0';
+            }
+        } else if (c >= ' ') {
+            strbuf_addc(&q, c);
+        } else {
+            rl_execute_next(c);
+            break;
+        }
+        nres = histsearch_find(sh->hsearch, q.s, res, sizeof(res) / sizeof(res[0]));
+        sel = 0;
+        failed = nres == 0 && q.len > 0;
+        if (nres > 0) {
+            match = res[0];
+        }
+    }
+    rl_set_prompt(saved_prompt);
+    rl_redisplay();
+    rl_event_hook = hook;
+    free(saved_prompt);
+    free(saved_line);
+    strbuf_free(&q);
+    return 0;
+}
+
+
+// Bind Ctrl-R in readline to a reverse search that uses the index
+void histsearch_bind(struct shell *sh) {
+    search_shell = sh;
+    rl_bind_key(CTRL('R'), reverse_search);
+}
@@ -0,0 +1,92 @@
+#ifndef HISTSEARCH_H
+#define HISTSEARCH_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "hmap.h"
+#include "trigram.h"
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+struct shell;
+
+
+/* One distinct command. Running a command again gives it a new number so
+* the posting lists stay ordered by last use, the old one is marked dead. */
+struct hist_doc
+{
+const char *cmd;     // key of the cmds map
+uint32_t len;
+uint32_t count;      // times the command was run
+bool dead;
+};
+
+
+/* Search index over the history */
+struct hist_search
+{
+struct hmap cmds;    // command -> document number + 1
+struct hist_doc *docs;
+size_t ndocs;
+size_t capdocs;
+struct trigram_index ix;
+};
+
+
+/**
+* @brief Build the search index over the history of the shell, the
+* persistent log when there is one and the readline history otherwise
+*
+* @param sh The shell
+* @return struct hist_search* The index
+*/
+struct hist_search *histsearch_build(struct shell *sh);
+
+
+/**
+* @brief Record a command that was run, called for every new history
+* entry so the index never has to be rebuilt
+*
+* @param hs The index
+* @param cmd The command
+* @param len The length of the command
+*/
+void histsearch_add(struct hist_search *hs, const char *cmd, size_t len);
+
+
+/**
+* @brief Find commands that contain a string. The most recent matches are
+* ranked by how recently and how often they were run.
+*
+* @param hs The index
+* @param q The string to look for
+* @param res Filled with the commands, best first, owned by the index
+* @param max The size of res
+* @return size_t The number of commands found
+*/
+size_t histsearch_find(struct hist_search *hs, const char *q, const char **res, size_t max);
+
+
+/**
+* @brief Free the index
+*
+* @param hs The index, may be NULL
+*/
+void histsearch_free(struct hist_search *hs);
+
+
+/**
+* @brief Bind Ctrl-R in readline to a reverse search that uses the index
+* of the shell, built the first time it is needed
+*
+* @param sh The shell
+*/
+void histsearch_bind(struct shell *sh);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
@@ -0,0 +1,133 @@
+#include "histshare.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define HISTSHARE_SIZE (sizeof(struct histshare_header) + HISTSHARE_SLOTS * sizeof(struct histshare_slot))
+
+// Rings opened by this process, part of the owner tag
+static uint32_t sessions;
+
+
+// Map the shared ring, creating the file when it does not exist
+struct histshare *histshare_open(const char *path) {
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return NULL;
+    }
+    // Only the first shell sizes the file and writes the header
+    flock(fd, LOCK_EX);
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0;
+    if (ok && st.st_size == 0) {
+        struct histshare_header hdr = { HISTSHARE_MAGIC, HISTSHARE_SLOTS, 0 };
+        ok = ftruncate(fd, HISTSHARE_SIZE) == 0 && pwrite(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr);
+        st.st_size = HISTSHARE_SIZE;
+    }
+    flock(fd, LOCK_UN);
+    void *map = MAP_FAILED;
+    if (ok && (size_t)st.st_size >= HISTSHARE_SIZE) {
+        map = mmap(NULL, HISTSHARE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (map == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+    struct histshare_header *hdr = map;
+    if (memcmp(hdr->magic, HISTSHARE_MAGIC, 4) != 0 || hdr->nslots != HISTSHARE_SLOTS) {
+        fprintf(stderr, "lab: %s: not a shared history file\n", path);
+        munmap(map, HISTSHARE_SIZE);
+        close(fd);
+        return NULL;
+    }
+    struct histshare *hs = xcalloc(1, sizeof(*hs));
+    hs->fd = fd;
+    hs->hdr = hdr;
+    hs->slots = (struct histshare_slot *)(hdr + 1);
+    hs->maplen = HISTSHARE_SIZE;
+    hs->next = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE) + 1;
+    hs->owner = (uint32_t)getpid() << 8 | (sessions++ & 0xff);
+    return hs;
+}
+
+
+// Publish a command to the other shells
+void histshare_publish(struct histshare *hs, const char *cmd) {
+    size_t len = strlen(cmd);
+    if (len > sizeof(hs->slots[0].data)) {
+        return;
+    }
+    uint64_t seq = __atomic_add_fetch(&hs->hdr->head, 1, __ATOMIC_ACQ_REL);
+    struct histshare_slot *slot = &hs->slots[(seq - 1) % HISTSHARE_SLOTS];
+    // Readers see 0 and leave the slot alone until it is complete
+    __atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->len = len;
+    slot->owner = hs->owner;
+    memcpy(slot->data, cmd, len);
+    __atomic_store_n(&slot->seq, seq, __ATOMIC_RELEASE);
+    // Our own entry does not need to be pulled again
+    if (hs->next == seq) {
+        hs->next++;
+    }
+}
+
+
+// Call fn for every entry other shells published since the last pull
+size_t histshare_pull(struct histshare *hs, void (*fn)(const char *cmd, size_t len, void *arg), void *arg) {
+    uint64_t head = __atomic_load_n(&hs->hdr->head, __ATOMIC_ACQUIRE);
+    if (head >= HISTSHARE_SLOTS && hs->next <= head - HISTSHARE_SLOTS) {
+        // We fell a whole ring behind, the oldest entries are gone
+        hs->next = head - HISTSHARE_SLOTS + 1;
+    }
+    size_t n = 0;
+    char buf[sizeof(hs->slots[0].data)];
+    for (; hs->next <= head; hs->next++) {
+        struct histshare_slot *slot = &hs->slots[(hs->next - 1) % HISTSHARE_SLOTS];
+        uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq < hs->next) {
+            // Still being written, try again before the next prompt. A
+            // writer that died half way is skipped the second time.
+            if (hs->stuck != hs->next) {
+                hs->stuck = hs->next;
+                break;
+            }
+            continue;
+        }
+        if (seq > hs->next) {
+            continue;
+        }
+        uint32_t len = slot->len;
+        uint32_t owner = slot->owner;
+        if (len > sizeof(buf)) {
+            continue;
+        }
+        memcpy(buf, slot->data, len);
+        // A writer that lapped us while we copied changed seq
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq || owner == hs->owner) {
+            continue;
+        }
+        fn(buf, len, arg);
+        n++;
+    }
+    return n;
+}
+
+
+// Unmap the ring
+void histshare_close(struct histshare *hs) {
+    if (hs == NULL) {
+        return;
+    }
+    munmap(hs->hdr, hs->maplen);
+    close(hs->fd);
+    free(hs);
+}
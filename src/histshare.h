@@ -0,0 +1,94 @@
+#ifndef HISTSHARE_H
+#define HISTSHARE_H
+#include <stddef.h>
+#include <stdint.h>
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+#define HISTSHARE_MAGIC "LABS"
+#define HISTSHARE_SLOTS 1024
+#define HISTSHARE_SLOT_SIZE 1024
+
+
+/* Start of the shared file. head is the last sequence number handed out,
+* writers claim the next one with an atomic add. */
+struct histshare_header
+{
+char magic[4];
+uint32_t nslots;
+uint64_t head;
+};
+
+
+/* Entry n lives in slot (n - 1) % nslots. seq is 0 while a writer fills
+* the slot and n once the entry is complete. */
+struct histshare_slot
+{
+uint64_t seq;
+uint32_t len;
+uint32_t owner;      // session that published the entry
+char data[HISTSHARE_SLOT_SIZE - 16];
+};
+
+
+/* A shell's view of the shared ring */
+struct histshare
+{
+int fd;
+struct histshare_header *hdr;
+struct histshare_slot *slots;
+size_t maplen;
+uint64_t next;       // sequence number of the next entry to read
+uint64_t stuck;      // entry that was incomplete at the last pull
+uint32_t owner;      // tags our own entries so we skip them
+};
+
+
+/**
+* @brief Map the shared ring, creating the file when it does not exist.
+* Only entries published after this call are pulled.
+*
+* @param path The file name
+* @return struct histshare* The ring, NULL on error
+*/
+struct histshare *histshare_open(const char *path);
+
+
+/**
+* @brief Publish a command to the other shells. Commands that do not fit
+* in a slot are not shared.
+*
+* @param hs The ring
+* @param cmd The command
+*/
+void histshare_publish(struct histshare *hs, const char *cmd);
+
+
+/**
+* @brief Call fn for every entry other shells published since the last
+* pull. Entries overwritten before they were read are lost, an entry that
+* is still being written is picked up by the next pull.
+*
+* @param hs The ring
+* @param fn Called with each command, which is not NUL terminated
+* @param arg Passed to fn
+* @return size_t The number of entries
+*/
+size_t histshare_pull(struct histshare *hs, void (*fn)(const char *cmd, size_t len, void *arg), void *arg);
+
+
+/**
+* @brief Unmap the ring
+*
+* @param hs The ring, may be NULL
+*/
+void histshare_close(struct histshare *hs);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
@@ -0,0 +1,143 @@
+#include "hmap.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+
+
+// Hash a key, FNV-1a over the bytes
+uint32_t hmap_hash(const char *key, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)key[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+
+// Slot holding the key, or the empty slot where it would go
+static size_t hmap_slot(const struct hmap *m, const char *key, size_t len, uint32_t hash) {
+    size_t mask = m->cap - 1;
+    size_t i = hash & mask;
+    while (m->tab[i].key != NULL) {
+        struct hmap_entry *e = &m->tab[i];
+        if (e->hash == hash && e->keylen == len && memcmp(e->key, key, len) == 0) {
+            break;
+        }
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+
+static void hmap_grow(struct hmap *m) {
+    struct hmap_entry *old = m->tab;
+    size_t oldcap = m->cap;
+    m->cap = oldcap ? oldcap * 2 : 16;
+    m->tab = xcalloc(m->cap, sizeof(struct hmap_entry));
+    for (size_t i = 0; i < oldcap; i++) {
+        if (old[i].key != NULL) {
+            size_t j = old[i].hash & (m->cap - 1);
+            while (m->tab[j].key != NULL) {
+                j = (j + 1) & (m->cap - 1);
+            }
+            m->tab[j] = old[i];
+        }
+    }
+    free(old);
+}
+
+
+// Find the entry for a key
+struct hmap_entry *hmap_findn(const struct hmap *m, const char *key, size_t len) {
+    if (m->n == 0) {
+        return NULL;
+    }
+    size_t i = hmap_slot(m, key, len, hmap_hash(key, len));
+    return m->tab[i].key ? &m->tab[i] : NULL;
+}
+
+
+struct hmap_entry *hmap_find(const struct hmap *m, const char *key) {
+    return hmap_findn(m, key, strlen(key));
+}
+
+
+// Look up the value stored for a key
+void *hmap_get(const struct hmap *m, const char *key) {
+    struct hmap_entry *e = hmap_find(m, key);
+    return e ? e->value : NULL;
+}
+
+
+// Find the entry for a key, adding it with a NULL value when it is missing
+struct hmap_entry *hmap_putn(struct hmap *m, const char *key, size_t len, bool *added) {
+    // Keep the load factor under 3/4 so probe sequences stay short
+    if ((m->n + 1) * 4 > m->cap * 3) {
+        hmap_grow(m);
+    }
+    uint32_t hash = hmap_hash(key, len);
+    struct hmap_entry *e = &m->tab[hmap_slot(m, key, len, hash)];
+    if (added != NULL) {
+        *added = e->key == NULL;
+    }
+    if (e->key == NULL) {
+        e->key = xstrndup(key, len);
+        e->keylen = len;
+        e->hash = hash;
+        e->value = NULL;
+        m->n++;
+    }
+    return e;
+}
+
+
+// Store a value for a NUL terminated key, replacing the old one
+void *hmap_put(struct hmap *m, const char *key, void *value) {
+    struct hmap_entry *e = hmap_putn(m, key, strlen(key), NULL);
+    void *old = e->value;
+    e->value = value;
+    return old;
+}
+
+
+/*Remove a key from the map. Entries after it in the same probe run are
+* shifted back so lookups never need tombstones.*/
+void *hmap_del(struct hmap *m, const char *key) {
+    struct hmap_entry *e = hmap_find(m, key);
+    if (e == NULL) {
+        return NULL;
+    }
+    void *value = e->value;
+    size_t mask = m->cap - 1;
+    size_t i = e - m->tab;
+    free(e->key);
+    m->tab[i].key = NULL;
+    m->n--;
+    for (size_t j = (i + 1) & mask; m->tab[j].key != NULL; j = (j + 1) & mask) {
+        size_t home = m->tab[j].hash & mask;
+        // Move the entry back if its home slot is not between the hole and j
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            m->tab[i] = m->tab[j];
+            m->tab[j].key = NULL;
+            i = j;
+        }
+    }
+    return value;
+}
+
+
+// Free the map and every key in it
+void hmap_free(struct hmap *m, void (*free_value)(void *)) {
+    for (size_t i = 0; i < m->cap; i++) {
+        if (m->tab[i].key != NULL) {
+            if (free_value != NULL) {
+                free_value(m->tab[i].value);
+            }
+            free(m->tab[i].key);
+        }
+    }
+    free(m->tab);
+    m->tab = NULL;
+    m->cap = m->n = 0;
+}
@@ -0,0 +1,109 @@
+#ifndef HMAP_H
+#define HMAP_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/* One slot of the table, key is NULL for an empty slot */
+struct hmap_entry
+{
+char *key;           // NUL terminated copy owned by the map
+size_t keylen;
+uint32_t hash;       // stored so growing and probing never rehash keys
+void *value;
+};
+
+
+/* A string keyed hash map using open addressing with linear probing */
+struct hmap
+{
+struct hmap_entry *tab;
+size_t cap;          // always a power of two, 0 for an empty map
+size_t n;
+};
+
+
+/**
+* @brief Hash a key, FNV-1a over the bytes
+*
+* @param key The key
+* @param len The length of the key
+* @return uint32_t The hash
+*/
+uint32_t hmap_hash(const char *key, size_t len);
+
+
+/**
+* @brief Find the entry for a key
+*
+* @param m The map
+* @param key The key, it does not need to be NUL terminated
+* @param len The length of the key
+* @return struct hmap_entry* The entry, NULL if the key is not in the map
+*/
+struct hmap_entry *hmap_findn(const struct hmap *m, const char *key, size_t len);
+struct hmap_entry *hmap_find(const struct hmap *m, const char *key);
+
+
+/**
+* @brief Look up the value stored for a key
+*
+* @param m The map
+* @param key The key
+* @return void* The value, NULL if the key is not in the map
+*/
+void *hmap_get(const struct hmap *m, const char *key);
+
+
+/**
+* @brief Find the entry for a key, adding it with a NULL value when it is
+* missing. The entry stays valid until the next insert or delete.
+*
+* @param m The map
+* @param key The key, copied into the map
+* @param len The length of the key
+* @param added Set to true when the key was not in the map, may be NULL
+* @return struct hmap_entry* The entry
+*/
+struct hmap_entry *hmap_putn(struct hmap *m, const char *key, size_t len, bool *added);
+
+
+/**
+* @brief Store a value for a NUL terminated key, replacing the old one
+*
+* @param m The map
+* @param key The key
+* @param value The value
+* @return void* The value that was replaced, NULL if the key is new
+*/
+void *hmap_put(struct hmap *m, const char *key, void *value);
+
+
+/**
+* @brief Remove a key from the map
+*
+* @param m The map
+* @param key The key
+* @return void* The value of the removed key, NULL if it was not there
+*/
+void *hmap_del(struct hmap *m, const char *key);
+
+
+/**
+* @brief Free the map and every key in it
+*
+* @param m The map
+* @param free_value Called for every value, may be NULL
+*/
+void hmap_free(struct hmap *m, void (*free_value)(void *));
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
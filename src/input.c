@@ -0,0 +1,648 @@
+#define _GNU_SOURCE
+#include "input.h"
+#include "array.h"
+#include "lab.h"
+#include "vars.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+
+// Block size mapfile reads a stream with
+#define MAPFILE_CHUNK (1 << 20)
+
+
+enum input_mode
+{
+MODE_NONE,      // not looked at yet
+MODE_SEEK,      // regular file: read ahead, seek back on sync
+MODE_PIPE,      // pipe: peek with tee, take out only the line
+MODE_SOCKET,    // socket: peek with MSG_PEEK, take out only the line
+MODE_BYTE,      // anything else, one byte at a time
+};
+
+
+/* What is known about one descriptor. Once synced the read ahead of a
+* file was given back but is kept, it is used again when the descriptor
+* still points at the same file and nothing moved the offset. */
+struct inbuf
+{
+int mode;
+bool synced;
+dev_t dev;
+ino_t ino;
+off_t pos;           // offset of buf[start] when synced
+char *buf;           // INPUT_CHUNK bytes, NULL until needed
+size_t start, end;   // read ahead not used yet
+};
+
+
+static struct inbuf *bufs;
+static int nbufs;
+static int scratch[2] = { -1, -1 };    // pipe that tee copies into
+
+
+/*Find out how a descriptor can be read*/
+static void inbuf_mode(int fd, struct inbuf *b) {
+    struct stat st;
+    b->mode = MODE_BYTE;
+    b->start = b->end = 0;
+    if (fstat(fd, &st) < 0) {
+        return;
+    }
+    if (S_ISREG(st.st_mode) && lseek(fd, 0, SEEK_CUR) >= 0) {
+        b->mode = MODE_SEEK;
+        b->dev = st.st_dev;
+        b->ino = st.st_ino;
+    } else if (S_ISSOCK(st.st_mode)) {
+        b->mode = MODE_SOCKET;
+    }
+#ifdef __linux__
+    else if (S_ISFIFO(st.st_mode) && (scratch[0] >= 0 || pipe2(scratch, O_CLOEXEC) == 0)) {
+        b->mode = MODE_PIPE;
+    }
+#endif
+    if (b->mode != MODE_BYTE && b->buf == NULL) {
+        b->buf = xmalloc(INPUT_CHUNK);
+    }
+}
+
+
+/*Check that a synced file is where it was left, then skip the read
+* ahead again*/
+static bool inbuf_resume(int fd, struct inbuf *b) {
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_dev != b->dev || st.st_ino != b->ino) {
+        return false;
+    }
+    if (lseek(fd, 0, SEEK_CUR) != b->pos) {
+        return false;
+    }
+    return lseek(fd, b->end - b->start, SEEK_CUR) >= 0;
+}
+
+
+static struct inbuf *inbuf_get(int fd) {
+    if (fd >= nbufs) {
+        int n = fd < 8 ? 8 : fd + 1;
+        bufs = xrealloc(bufs, n * sizeof(*bufs));
+        memset(bufs + nbufs, 0, (n - nbufs) * sizeof(*bufs));
+        nbufs = n;
+    }
+    struct inbuf *b = &bufs[fd];
+    if (b->synced) {
+        b->synced = false;
+        if (!inbuf_resume(fd, b)) {
+            b->mode = MODE_NONE;
+        }
+    }
+    if (b->mode == MODE_NONE) {
+        inbuf_mode(fd, b);
+    }
+    return b;
+}
+
+
+/*Copy what is waiting in a pipe or socket into the buffer without
+* taking it out. The copy tee makes is read back in full so the scratch
+* pipe is empty again.*/
+static ssize_t peek(int fd, struct inbuf *b) {
+    if (b->mode == MODE_SOCKET) {
+        return recv(fd, b->buf, INPUT_CHUNK, MSG_PEEK);
+    }
+    ssize_t n = -1;
+#ifdef __linux__
+    n = tee(fd, scratch[1], INPUT_CHUNK, 0);
+    for (ssize_t got = 0; got < n;) {
+        ssize_t r = read(scratch[0], b->buf + got, n - got);
+        if (r < 0 && errno != EINTR) {
+            return -1;
+        }
+        got += r > 0 ? r : 0;
+    }
+#else
+    errno = EINVAL;
+#endif
+    return n;
+}
+
+
+/*Take n bytes that were peeked at out of a pipe or socket*/
+static int consume(int fd, struct inbuf *b, size_t n) {
+    while (n > 0) {
+        ssize_t r = read(fd, b->buf, n);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            return -1;
+        }
+        n -= r;
+    }
+    return 0;
+}
+
+
+static int line_bytes(int fd, int delim, struct strbuf *out) {
+    for (;;) {
+        char c;
+        ssize_t r = read(fd, &c, 1);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            return (int)r;
+        }
+        if ((unsigned char)c == delim) {
+            return 1;
+        }
+        strbuf_addc(out, c);
+    }
+}
+
+
+// Read one line from a file descriptor
+int input_line(int fd, int delim, struct strbuf *out) {
+    struct inbuf *b = inbuf_get(fd);
+    delim = (unsigned char)delim;
+    for (;;) {
+        if (b->mode == MODE_BYTE) {
+            return line_bytes(fd, delim, out);
+        }
+        if (b->start == b->end) {
+            ssize_t n = b->mode == MODE_SEEK ? read(fd, b->buf, INPUT_CHUNK) : peek(fd, b);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0 && errno == EINVAL && b->mode != MODE_SEEK) {
+                // Not something that can be peeked at after all
+                b->mode = MODE_BYTE;
+                continue;
+            }
+            if (n <= 0) {
+                return (int)n;
+            }
+            b->start = 0;
+            b->end = n;
+        }
+        char *s = b->buf + b->start;
+        size_t avail = b->end - b->start;
+        char *nl = memchr(s, delim, avail);
+        size_t take = nl != NULL ? (size_t)(nl - s) + 1 : avail;
+        strbuf_add(out, s, nl != NULL ? take - 1 : take);
+        if (b->mode == MODE_SEEK) {
+            b->start += take;
+        } else {
+            // Only the line comes out of the pipe, the rest stays in it
+            b->start = b->end = 0;
+            if (consume(fd, b, take) < 0) {
+                return -1;
+            }
+        }
+        if (nl != NULL) {
+            return 1;
+        }
+    }
+}
+
+
+// Give back the read ahead of a descriptor
+void input_sync(int fd) {
+    if (fd < 0 || fd >= nbufs) {
+        return;
+    }
+    struct inbuf *b = &bufs[fd];
+    if (b->synced) {
+        return;
+    }
+    if (b->mode == MODE_SEEK && b->end > b->start) {
+        b->pos = lseek(fd, -(off_t)(b->end - b->start), SEEK_CUR);
+        b->synced = b->pos >= 0;
+    }
+    if (!b->synced) {
+        b->mode = MODE_NONE;
+    }
+}
+
+
+// Give back the read ahead of every descriptor
+void input_sync_all(void) {
+    for (int fd = 0; fd < nbufs; fd++) {
+        input_sync(fd);
+    }
+}
+
+
+// Sync and free the buffers
+void input_free(void) {
+    input_sync_all();
+    for (int fd = 0; fd < nbufs; fd++) {
+        free(bufs[fd].buf);
+    }
+    free(bufs);
+    bufs = NULL;
+    nbufs = 0;
+    if (scratch[0] >= 0) {
+        close(scratch[0]);
+        close(scratch[1]);
+        scratch[0] = scratch[1] = -1;
+    }
+}
+
+
+/* A line being split into fields. lit marks the bytes a backslash
+* quoted, those never separate fields. */
+struct fields
+{
+const char *text;
+const char *lit;
+size_t n, pos;
+const char *ifs;
+};
+
+
+static bool is_sep(struct fields *f, size_t i) {
+    return !f->lit[i] && f->text[i] != '\0' && strchr(f->ifs, f->text[i]) != NULL;
+}
+
+
+static bool is_space_sep(struct fields *f, size_t i) {
+    return is_sep(f, i) && strchr(" \t\n", f->text[i]) != NULL;
+}
+
+
+static void skip_spaces(struct fields *f) {
+    while (f->pos < f->n && is_space_sep(f, f->pos)) {
+        f->pos++;
+    }
+}
+
+
+/*Take the field at pos and the separator after it: IFS white space
+* around at most one other IFS character*/
+static char *next_field(struct fields *f) {
+    size_t start = f->pos;
+    while (f->pos < f->n && !is_sep(f, f->pos)) {
+        f->pos++;
+    }
+    char *field = xstrndup(f->text + start, f->pos - start);
+    skip_spaces(f);
+    if (f->pos < f->n && is_sep(f, f->pos)) {
+        f->pos++;
+        skip_spaces(f);
+    }
+    return field;
+}
+
+
+/*The rest of the line for the last name, without trailing IFS white
+* space. A single field keeps nothing of the separator after it.*/
+static char *rest_field(struct fields *f) {
+    struct fields one = *f;
+    char *field = next_field(&one);
+    if (one.pos == one.n) {
+        return field;
+    }
+    free(field);
+    size_t end = f->n;
+    while (end > f->pos && is_space_sep(f, end - 1)) {
+        end--;
+    }
+    return xstrndup(f->text + f->pos, end - f->pos);
+}
+
+
+/*A line ending in an odd number of backslashes has its delimiter
+* quoted*/
+static bool quoted_end(struct strbuf *line) {
+    size_t k = 0;
+    while (k < line->len && line->s[line->len - 1 - k] == '\\') {
+        k++;
+    }
+    return k % 2 == 1;
+}
+
+
+/*Parse the options of read and mapfile. The letters in flags turn on
+* the matching entry of on, the letters in opts take an argument that is
+* stored in args. Returns the index of the first operand, -1 on a usage
+* error.*/
+static int builtin_opts(char **argv, const char *flags, bool *on, const char *opts, const char **args) {
+    int i = 1;
+    for (; argv[i] && argv[i][0] == '-' && argv[i][1]; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            return i + 1;
+        }
+        for (const char *o = argv[i] + 1; *o; o++) {
+            const char *f = strchr(flags, *o);
+            if (f != NULL) {
+                on[f - flags] = true;
+                continue;
+            }
+            const char *a = strchr(opts, *o);
+            if (a == NULL) {
+                fprintf(stderr, "%s: -%c: invalid option\n", argv[0], *o);
+                return -1;
+            }
+            const char *arg = o[1] ? o + 1 : argv[++i];
+            if (arg == NULL) {
+                fprintf(stderr, "%s: -%c: option requires an argument\n", argv[0], *o);
+                return -1;
+            }
+            args[a - opts] = arg;
+            break;
+        }
+    }
+    return i;
+}
+
+
+static bool valid_name(const char *cmd, const char *name) {
+    if (!var_name_valid(name, strlen(name))) {
+        fprintf(stderr, "%s: `%s': not a valid identifier\n", cmd, name);
+        return false;
+    }
+    return true;
+}
+
+
+// The read builtin
+int read_builtin(struct shell *sh, char **argv) {
+    UNUSED(sh);
+    bool raw = false;
+    const char *args[2] = { NULL, NULL };
+    int i = builtin_opts(argv, "r", &raw, "da", args);
+    if (i < 0) {
+        return 2;
+    }
+    int delim = args[0] ? (unsigned char)args[0][0] : '\n';
+    const char *array = args[1];
+    char **names = argv + i;
+    if (array != NULL && !valid_name(argv[0], array)) {
+        return 1;
+    }
+    for (int k = 0; names[k]; k++) {
+        if (!valid_name(argv[0], names[k])) {
+            return 1;
+        }
+    }
+
+    struct strbuf line = {0};
+    int rc;
+    for (;;) {
+        rc = input_line(STDIN_FILENO, delim, &line);
+        if (rc <= 0 || raw || !quoted_end(&line)) {
+            break;
+        }
+        if (delim == '\n') {
+            // A backslash newline joins the next line
+            line.s[--line.len] = '\0';
+        } else {
+            strbuf_addc(&line, delim);
+        }
+    }
+    if (rc < 0) {
+        fprintf(stderr, "read: %s\n", strerror(errno));
+        strbuf_free(&line);
+        return 1;
+    }
+
+    // Take out the backslashes, remembering what they quoted
+    char *text = xmalloc(line.len + 1);
+    char *lit = xmalloc(line.len + 1);
+    size_t n = 0;
+    for (size_t k = 0; k < line.len; k++) {
+        bool quoted = false;
+        if (!raw && line.s[k] == '\\') {
+            if (++k == line.len) {
+                break;
+            }
+            if (line.s[k] == '\n') {
+                // Joins lines wherever it shows up
+                continue;
+            }
+            quoted = true;
+        }
+        text[n] = line.s[k];
+        lit[n++] = quoted;
+    }
+    text[n] = '\0';
+    strbuf_free(&line);
+
+    const char *ifs = var_get("IFS");
+    struct fields f = { text, lit, n, 0, ifs ? ifs : " \t\n" };
+    if (array != NULL) {
+        struct array *a = var_set_array(array);
+        skip_spaces(&f);
+        while (f.pos < f.n) {
+            char *field = next_field(&f);
+            array_set(a, a->n, field);
+            free(field);
+        }
+    } else if (*names == NULL) {
+        var_set("REPLY", text, false);
+    } else {
+        skip_spaces(&f);
+        for (; *names; names++) {
+            char *value = names[1] ? next_field(&f) : rest_field(&f);
+            var_set(*names, value, false);
+            free(value);
+        }
+    }
+    free(text);
+    free(lit);
+    return rc == 1 ? 0 : 1;
+}
+
+
+static ssize_t read_retry(int fd, char *p, size_t n) {
+    ssize_t r;
+    do {
+        r = read(fd, p, n);
+    } while (r < 0 && errno == EINTR);
+    return r;
+}
+
+
+/*Read everything left on fd into one block with a byte to spare at the
+* end. A regular file is read in one go, anything else in chunks of
+* MAPFILE_CHUNK growing the block as needed. Returns NULL on an error.*/
+static char *slurp(int fd, size_t *len) {
+    size_t cap = MAPFILE_CHUNK;
+    struct stat st;
+    off_t off;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && (off = lseek(fd, 0, SEEK_CUR)) >= 0 && st.st_size > off) {
+        cap = st.st_size - off + 1;
+    }
+    char *buf = xmalloc(cap);
+    size_t n = 0;
+    for (;;) {
+        ssize_t r;
+        if (n + 1 == cap) {
+            // Full, look for more before growing: a file read in one go
+            // ends here
+            char probe[4096];
+            r = read_retry(fd, probe, sizeof(probe));
+            if (r > 0) {
+                cap = cap * 2 + r;
+                buf = xrealloc(buf, cap);
+                memcpy(buf + n, probe, r);
+            }
+        } else {
+            r = read_retry(fd, buf + n, cap - 1 - n);
+        }
+        if (r < 0) {
+            free(buf);
+            return NULL;
+        }
+        if (r == 0) {
+            break;
+        }
+        n += r;
+    }
+    *len = n;
+    return buf;
+}
+
+
+/*Load all of fd into a, one element per line. The lines stay in the
+* block they were read into, found with memchr, and end where the
+* delimiter was unless it is kept, then they are copied into a block
+* with room for the terminators. The first line goes to index origin.
+* With copy each line is copied on its own instead and the block freed,
+* for an array that has elements already: lines that overwrite them
+* would otherwise leave older blocks behind that nothing points into.*/
+static int load_all(int fd, struct array *a, size_t origin, int delim, bool trim, size_t skip, bool copy) {
+    size_t len;
+    char *buf = slurp(fd, &len);
+    if (buf == NULL) {
+        return -1;
+    }
+    char *end = buf + len;
+    if (!trim && delim != '\0') {
+        size_t lines = 1;
+        for (char *p = buf; (p = memchr(p, delim, end - p)) != NULL; p++) {
+            lines++;
+        }
+        char *copy = xmalloc(len + lines + 1);
+        char *out = copy;
+        for (char *p = buf; p < end;) {
+            char *d = memchr(p, delim, end - p);
+            size_t n = d ? (size_t)(d - p) + 1 : (size_t)(end - p);
+            memcpy(out, p, n);
+            out[n] = '\0';
+            out += n + 1;
+            p += n;
+        }
+        free(buf);
+        buf = copy;
+        end = out;
+        delim = '\0';
+    }
+    if (!copy) {
+        array_adopt(a, buf);
+    }
+    for (char *p = buf; p < end;) {
+        char *d = memchr(p, delim, end - p);
+        if (d == NULL) {
+            d = end;
+        }
+        *d = '\0';
+        if (skip > 0) {
+            skip--;
+        } else if (copy) {
+            array_set(a, origin++, p);
+        } else {
+            array_set_ref(a, origin++, p);
+        }
+        p = d + 1;
+    }
+    if (copy) {
+        free(buf);
+    }
+    return 0;
+}
+
+
+static bool count_arg(const char *cmd, const char *arg, size_t *n) {
+    char *end;
+    long v = arg ? strtol(arg, &end, 10) : 0;
+    if (arg != NULL && (*arg == '\0' || *end != '\0' || v < 0)) {
+        fprintf(stderr, "%s: %s: invalid number\n", cmd, arg);
+        return false;
+    }
+    *n = (size_t)v;
+    return true;
+}
+
+
+// The mapfile builtin
+int mapfile_builtin(struct shell *sh, char **argv) {
+    UNUSED(sh);
+    bool trim = false;
+    const char *args[5] = { NULL, NULL, NULL, NULL, NULL };
+    int i = builtin_opts(argv, "t", &trim, "dnOsu", args);
+    size_t count, origin, skip, fd;
+    if (i < 0 || !count_arg(argv[0], args[1], &count) || !count_arg(argv[0], args[2], &origin) ||
+        !count_arg(argv[0], args[3], &skip) || !count_arg(argv[0], args[4], &fd)) {
+        return 2;
+    }
+    int delim = args[0] ? (unsigned char)args[0][0] : '\n';
+    const char *name = argv[i] ? argv[i] : "MAPFILE";
+    if (!valid_name(argv[0], name)) {
+        return 1;
+    }
+    if (fcntl((int)fd, F_GETFD) < 0) {
+        fprintf(stderr, "%s: %zu: invalid file descriptor\n", argv[0], fd);
+        return 1;
+    }
+    // Without -O the array starts out empty, with it only the elements
+    // read are replaced
+    struct array *a = args[2] ? var_array(name) : NULL;
+    if (a == NULL) {
+        a = var_set_array(name);
+    } else if (a->n == 0) {
+        // Blocks of an array whose elements were all unset are garbage
+        array_clear(a);
+    }
+
+    if (count == 0) {
+        // What the read builtin read ahead goes back to the file first
+        input_sync((int)fd);
+        if (load_all((int)fd, a, origin, delim, trim, skip, a->n > 0) < 0) {
+            fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+            return 1;
+        }
+        return 0;
+    }
+    // Only count lines may be taken, leave the rest where it is
+    struct strbuf line = {0};
+    for (size_t k = 0; k < count + skip; k++) {
+        int rc = input_line((int)fd, delim, &line);
+        if (rc < 0) {
+            fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+            strbuf_free(&line);
+            return 1;
+        }
+        if (rc == 0 && line.len == 0) {
+            break;
+        }
+        if (rc == 1 && !trim) {
+            strbuf_addc(&line, delim);
+        }
+        if (k >= skip) {
+            array_set(a, origin++, line.s ? line.s : "");
+        }
+        line.len = 0;
+        if (rc == 0) {
+            break;
+        }
+    }
+    strbuf_free(&line);
+    return 0;
+}
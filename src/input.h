@@ -0,0 +1,96 @@
+#ifndef INPUT_H
+#define INPUT_H
+#include "util.h"
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+struct shell;
+
+// Bytes read ahead of the current line at once
+#define INPUT_CHUNK 65536
+
+
+/**
+* @brief Read one line from a file descriptor for the shell. A regular
+* file is read a chunk at a time and what is left over stays buffered
+* for the next line, a pipe or socket is looked at without consuming it
+* and only the line is taken out. Anything else is read a byte at a time.
+* The read ahead is given back with input_sync before another process or
+* redirection can see the descriptor.
+*
+* @param fd The file descriptor
+* @param delim The byte that ends the line
+* @param out The line is added here, without the delimiter
+* @return int 1 when the line ended with delim, 0 at the end of the
+* input, -1 with errno set on an error
+*/
+int input_line(int fd, int delim, struct strbuf *out);
+
+
+/**
+* @brief Give the bytes read ahead on a descriptor back by seeking back
+* over them and forget what was known about it. Called before the
+* descriptor is redirected.
+*
+* @param fd The file descriptor
+*/
+void input_sync(int fd);
+
+
+/**
+* @brief input_sync every descriptor, called before a fork
+*/
+void input_sync_all(void);
+
+
+/**
+* @brief Sync every descriptor and free the buffers
+*/
+void input_free(void);
+
+
+/**
+* @brief The read builtin.
+*
+*   read [-r] [-d delim] [-a name] [name ...]
+*
+* Reads a line from standard input and splits it on IFS into the names,
+* the last name gets the rest of the line. Without names the line goes
+* to REPLY. A backslash quotes the next character and joins lines unless
+* -r is given. -d ends the line at the first character of delim instead
+* of a newline, an empty delim at a NUL byte. -a assigns the fields to
+* an indexed array.
+*
+* @param sh The shell
+* @param argv The arguments
+* @return int 0 when a whole line was read, 1 at the end of the input or
+* on an error, 2 for a usage error
+*/
+int read_builtin(struct shell *sh, char **argv);
+
+
+/**
+* @brief The mapfile builtin, also called readarray.
+*
+*   mapfile [-t] [-d delim] [-n count] [-O origin] [-s count] [-u fd] [name]
+*
+* Reads lines into an indexed array, MAPFILE without a name. The input
+* is read in large blocks and the lines are left in them, so a big file
+* costs a few allocations. -t drops the delimiter from each line, -d sets
+* it, -n reads at most count lines and leaves the rest unread, -O starts
+* at index origin instead of emptying the array, -s skips the first
+* count lines and -u reads from fd instead of standard input.
+*
+* @param sh The shell
+* @param argv The arguments
+* @return int The exit status, 2 for a usage error
+*/
+int mapfile_builtin(struct shell *sh, char **argv);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
@@ -0,0 +1,305 @@
+#include "jobs.h"
+#include "lab.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+
+// Add a new empty job to the job table of the shell
+struct job *job_new(struct shell *sh, const char *cmd, int flags) {
+    if (sh->njobs == sh->capjobs) {
+        sh->capjobs = sh->capjobs ? sh->capjobs * 2 : 8;
+        sh->jobs = xrealloc(sh->jobs, sh->capjobs * sizeof(struct job *));
+    }
+    struct job *job = xcalloc(1, sizeof(*job));
+    job->flags = flags;
+    job->cmd = cmd ? xstrdup(cmd) : NULL;
+    sh->jobs[sh->njobs++] = job;
+    return job;
+}
+
+
+// Record a process that belongs to a job
+void job_add_pid(struct job *job, pid_t pid) {
+    job->pids = xrealloc(job->pids, (job->npids + 1) * sizeof(pid_t));
+    job->status = xrealloc(job->status, (job->npids + 1) * sizeof(int));
+    job->pids[job->npids] = pid;
+    job->status[job->npids] = -1;
+    job->npids++;
+    job->nlive++;
+    if (job->pgid == 0) {
+        job->pgid = pid;
+    }
+}
+
+
+static void job_free(struct job *job) {
+    free(job->pids);
+    free(job->status);
+    free(job->cmd);
+    free(job);
+}
+
+
+static void job_remove(struct shell *sh, struct job *job) {
+    for (int j = 0; j < sh->njobs; j++) {
+        if (sh->jobs[j] == job) {
+            memmove(&sh->jobs[j], &sh->jobs[j + 1], (sh->njobs - j - 1) * sizeof(struct job *));
+            sh->njobs--;
+            break;
+        }
+    }
+    job_free(job);
+}
+
+
+/*Give a job that keeps running in the background a number the user can
+* refer to, one past the highest number in use like other shells do*/
+void job_background(struct shell *sh, struct job *job) {
+    if (job->id > 0) {
+        return;
+    }
+    int max = 0;
+    for (int j = 0; j < sh->njobs; j++) {
+        if (sh->jobs[j]->id > max) {
+            max = sh->jobs[j]->id;
+        }
+    }
+    job->id = max + 1;
+}
+
+
+// Exit status of a job as seen by $?
+static int job_status(struct shell *sh, struct job *job) {
+    int status = 0;
+    free(sh->pipestatus);
+    sh->pipestatus = xmalloc(job->npids * sizeof(int));
+    sh->npipestatus = job->npids;
+    for (int i = 0; i < job->npids; i++) {
+        int st = job->status[i] >= 0 ? job->status[i] : job->stopped ? 128 + job->stopsig : 0;
+        sh->pipestatus[i] = st;
+        if (!(sh->options & OPT_PIPEFAIL) || st != 0) {
+            status = st;
+        }
+    }
+    return status;
+}
+
+
+/*Store the status of a reaped process with whichever job it belongs to.
+* Returns false when it is in none.*/
+static bool job_record(struct shell *sh, pid_t pid, int status) {
+    for (int j = 0; j < sh->njobs; j++) {
+        struct job *job = sh->jobs[j];
+        for (int i = 0; i < job->npids; i++) {
+            if (job->pids[i] == pid && job->status[i] < 0) {
+                job->status[i] = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+                job->nlive--;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+
+/*Wait for the processes of a job one pid at a time. Without job control
+* they stay in the shell's process group, so there is no group of their
+* own to wait on.*/
+static void job_wait_pids(struct job *job) {
+    for (int i = 0; i < job->npids && !job->stopped; i++) {
+        while (job->status[i] < 0) {
+            int status;
+            pid_t pid = waitpid(job->pids[i], &status, WUNTRACED);
+            if (pid < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                // Somebody else reaped it, we will never know the status
+                job->status[i] = 127;
+                job->nlive--;
+                break;
+            }
+            if (WIFSTOPPED(status)) {
+                job->stopped = true;
+                job->stopsig = WSTOPSIG(status);
+                break;
+            }
+            job->status[i] = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+            job->nlive--;
+        }
+    }
+}
+
+
+/*Wait on the process group of a job as a unit, so whichever process
+* stops or exits first is seen at once and not after the ones before it
+* in the pipeline.*/
+static void job_wait_group(struct shell *sh, struct job *job) {
+    while (job->nlive > 0) {
+        int status;
+        pid_t pid = waitpid(-job->pgid, &status, WUNTRACED);
+        if (pid < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // Somebody else reaped the rest, we will never know the status
+            for (int i = 0; i < job->npids; i++) {
+                if (job->status[i] < 0) {
+                    job->status[i] = 127;
+                    job->nlive--;
+                }
+            }
+            break;
+        }
+        if (WIFSTOPPED(status)) {
+            job->stopped = true;
+            job->stopsig = WSTOPSIG(status);
+            break;
+        }
+        job_record(sh, pid, status);
+    }
+}
+
+
+// Wait for a foreground job
+int job_wait(struct shell *sh, struct job *job) {
+    job->stopped = false;
+    if (sh->shell_is_interactive) {
+        tcsetpgrp(sh->shell_terminal, job->pgid);
+        job_wait_group(sh, job);
+    } else {
+        job_wait_pids(job);
+    }
+    // get control of the shell
+    if (sh->shell_is_interactive) {
+        tcsetpgrp(sh->shell_terminal, sh->shell_pgid);
+    }
+
+    if (job->stopped) {
+        job_background(sh, job);
+        fprintf(stderr, "\n[%d]+  Stopped                 %s\n", job->id, job->cmd ? job->cmd : "");
+        job_status(sh, job);
+        return 128 + job->stopsig;
+    }
+    int status = job_status(sh, job);
+    job_remove(sh, job);
+    return status;
+}
+
+
+// Find a job from a job spec such as %2
+struct job *job_find(struct shell *sh, const char *spec) {
+    struct job *found = NULL;
+    int id = 0;
+    if (spec != NULL && strcmp(spec, "%%") != 0 && strcmp(spec, "%+") != 0) {
+        id = atoi(spec[0] == '%' ? spec + 1 : spec);
+        if (id <= 0) {
+            return NULL;
+        }
+    }
+    for (int j = 0; j < sh->njobs; j++) {
+        struct job *job = sh->jobs[j];
+        if (job->flags & JOB_PROCSUBST) {
+            continue;
+        }
+        if (id == 0 || job->id == id) {
+            found = job;
+        }
+    }
+    return found;
+}
+
+
+// Continue a stopped or background job with SIGCONT
+int job_continue(struct shell *sh, struct job *job, bool foreground) {
+    job->stopped = false;
+    if (kill(-job->pgid, SIGCONT) < 0) {
+        perror("kill (SIGCONT)");
+    }
+    if (foreground) {
+        return job_wait(sh, job);
+    }
+    return 0;
+}
+
+
+// Count the jobs shown by the jobs builtin
+int jobs_count(struct shell *sh) {
+    int count = 0;
+    for (int j = 0; j < sh->njobs; j++) {
+        if (!(sh->jobs[j]->flags & JOB_PROCSUBST)) {
+            count++;
+        }
+    }
+    return count;
+}
+
+
+// Report background jobs that finished since the last call
+void jobs_notify(struct shell *sh) {
+    jobs_reap(sh);
+    for (int j = 0; j < sh->njobs;) {
+        struct job *job = sh->jobs[j];
+        if (job->nlive == 0) {
+            if (sh->shell_is_interactive) {
+                fprintf(stderr, "[%d]+  Done                    %s\n", job->id, job->cmd ? job->cmd : "");
+            }
+            job_remove(sh, job);
+        } else {
+            j++;
+        }
+    }
+}
+
+
+/*Collect the exit status of every child that has finished. Only pids in
+* the job table are waited for, helpers such as the prompt worker reap
+* their own children.*/
+void jobs_reap(struct shell *sh) {
+    for (int j = 0; j < sh->njobs; j++) {
+        struct job *job = sh->jobs[j];
+        for (int i = 0; i < job->npids; i++) {
+            int status;
+            if (job->status[i] >= 0) {
+                continue;
+            }
+            pid_t pid = waitpid(job->pids[i], &status, WNOHANG);
+            if (pid == job->pids[i]) {
+                job->status[i] = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+                job->nlive--;
+            } else if (pid < 0 && errno == ECHILD) {
+                job->status[i] = 127;
+                job->nlive--;
+            }
+        }
+    }
+
+    // Drop finished hidden jobs, keeping the order of the rest
+    int out = 0;
+    for (int j = 0; j < sh->njobs; j++) {
+        struct job *job = sh->jobs[j];
+        if ((job->flags & JOB_PROCSUBST) && job->nlive == 0) {
+            job_free(job);
+        } else {
+            sh->jobs[out++] = job;
+        }
+    }
+    sh->njobs = out;
+}
+
+
+// Release the job table
+void jobs_free(struct shell *sh) {
+    for (int j = 0; j < sh->njobs; j++) {
+        job_free(sh->jobs[j]);
+    }
+    free(sh->jobs);
+    sh->jobs = NULL;
+    sh->njobs = sh->capjobs = 0;
+}
@@ -0,0 +1,142 @@
+#ifndef JOBS_H
+#define JOBS_H
+#include <stdbool.h>
+#include <sys/types.h>
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+struct shell;
+
+
+/* Job flags */
+#define JOB_PROCSUBST 0x01  // producer of a process substitution, never listed
+
+
+/* A job is one or more processes started for a single command line */
+struct job
+{
+int id;              // number shown to the user, 0 for hidden jobs
+int flags;
+pid_t pgid;
+pid_t *pids;
+int *status;         // exit status per process, -1 while it runs
+int npids;
+int nlive;           // processes not reaped yet
+bool stopped;
+int stopsig;         // signal that stopped the job
+char *cmd;
+};
+
+
+/**
+* @brief Add a new empty job to the job table of the shell
+*
+* @param sh The shell
+* @param cmd Command text shown by the jobs builtin, may be NULL
+* @param flags Job flags
+* @return struct job* The new job
+*/
+struct job *job_new(struct shell *sh, const char *cmd, int flags);
+
+
+/**
+* @brief Record a process that belongs to a job
+*
+* @param job The job
+* @param pid The process id
+*/
+void job_add_pid(struct job *job, pid_t pid);
+
+
+/**
+* @brief Give a job that keeps running in the background a number the
+* user can refer to, one past the highest number in use.
+*
+* @param sh The shell
+* @param job The job
+*/
+void job_background(struct shell *sh, struct job *job);
+
+
+/**
+* @brief Wait for a foreground job. The terminal is handed to the job
+* while it runs and taken back afterwards. The exit status of every
+* process is stored in sh->pipestatus. A finished job is removed from the
+* table, a job stopped from the terminal stays in it.
+*
+* @param sh The shell
+* @param job The job
+* @return int Exit status of the last process, or of the rightmost failing
+* one when pipefail is set, 128 + the stop signal when the job was stopped.
+* Processes still running in a stopped job get that status too in
+* sh->pipestatus.
+*/
+int job_wait(struct shell *sh, struct job *job);
+
+
+/**
+* @brief Find a job from a job spec such as %2. NULL or "%%" and "%+"
+* select the most recent job.
+*
+* @param sh The shell
+* @param spec The job spec
+* @return struct job* The job, NULL if there is no such job
+*/
+struct job *job_find(struct shell *sh, const char *spec);
+
+
+/**
+* @brief Continue a stopped or background job with SIGCONT
+*
+* @param sh The shell
+* @param job The job
+* @param foreground Move the job to the foreground and wait for it
+* @return int The exit status when waited for, 0 otherwise
+*/
+int job_continue(struct shell *sh, struct job *job, bool foreground);
+
+
+/**
+* @brief Count the jobs shown by the jobs builtin
+*
+* @param sh The shell
+* @return int The number of jobs
+*/
+int jobs_count(struct shell *sh);
+
+
+/**
+* @brief Report background jobs that finished since the last call and drop
+* them from the table. Called before each prompt.
+*
+* @param sh The shell
+*/
+void jobs_notify(struct shell *sh);
+
+
+/**
+* @brief Collect the exit status of every job process that has finished
+* without blocking. Children that are not in the job table are left
+* alone so helpers can wait for their own processes. Hidden jobs are
+* dropped from the table as soon as all of their processes have been
+* reaped.
+*
+* @param sh The shell
+*/
+void jobs_reap(struct shell *sh);
+
+
+/**
+* @brief Release the job table. Running processes are not waited for.
+*
+* @param sh The shell
+*/
+void jobs_free(struct shell *sh);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
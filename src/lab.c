@@ -1,9 +1,33 @@
+#define _GNU_SOURCE
 #include "lab.h"
+#include "alias.h"
+#include "jobs.h"
+#include "prompt.h"
+#include "histlog.h"
+#include "histsearch.h"
+#include "histshare.h"
+#include "histcmd.h"
+#include "hmap.h"
+#include "cmdhash.h"
+#include "complete.h"
+#include "dirdb.h"
+#include "dirstack.h"
+#include "vars.h"
+#include "func.h"
+#include "vm.h"
+#include "source.h"
+#include "arith.h"
+#include "pattern.h"
+#include "regcache.h"
+#include "cond.h"
+#include "input.h"
+#include "util.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <ctype.h>
 #include <sys/types.h>
 #include <pwd.h>
@@ -11,6 +35,105 @@
 #include "readline/history.h"
 #include "readline/readline.h"
 
+// Read a history size from the environment
+static size_t hist_limit(const char *env, size_t def) {
+    const char *val = var_get(env);
+    char *end;
+    if (val == NULL || *val == '\0') {
+        return def;
+    }
+    unsigned long n = strtoul(val, &end, 10);
+    return *end == '\0' ? n : def;
+}
+
+
+static void history_add_entry(const struct hist_entry *e, void *arg) {
+    UNUSED(arg);
+    char *line = xstrndup(e->cmd, e->cmdlen);
+    add_history(line);
+    free(line);
+}
+
+
+/*Open the history log, $LAB_HISTFILE or ~/.lab_history, and give the
+* newest $HISTSIZE commands to readline. The rest of the file is not read.*/
+static void history_load(struct shell *sh) {
+    const char *path = var_get("LAB_HISTFILE");
+    char *buf = NULL;
+    if (path == NULL) {
+        const char *home = var_get("HOME");
+        if (home == NULL) {
+            return;
+        }
+        buf = xmalloc(strlen(home) + sizeof("/.lab_history"));
+        sprintf(buf, "%s/.lab_history", home);
+        path = buf;
+    }
+    sh->hist = histlog_open(path);
+    free(buf);
+    if (sh->hist != NULL) {
+        histlog_recent(sh->hist, hist_limit("HISTSIZE", 1000), history_add_entry, NULL);
+    }
+}
+
+
+/*Open the database of visited directories, $LAB_DIRDB or ~/.lab_dirs*/
+static void dirs_load(struct shell *sh) {
+    const char *path = var_get("LAB_DIRDB");
+    char *buf = NULL;
+    if (path == NULL) {
+        const char *home = var_get("HOME");
+        if (home == NULL) {
+            return;
+        }
+        buf = xmalloc(strlen(home) + sizeof("/.lab_dirs"));
+        sprintf(buf, "%s/.lab_dirs", home);
+        path = buf;
+    }
+    sh->dirs = dirdb_open(path);
+    free(buf);
+}
+
+
+static void history_pulled(const char *cmd, size_t len, void *arg) {
+    struct shell *sh = arg;
+    char *line = xstrndup(cmd, len);
+    add_history(line);
+    if (sh->hsearch != NULL) {
+        histsearch_add(sh->hsearch, cmd, len);
+    }
+    free(line);
+}
+
+
+/*Called before each prompt. Maps or unmaps the shared history ring,
+* $LAB_HISTSHARE or ~/.lab_history.shared, and pulls new commands.*/
+void history_sync(struct shell *sh) {
+    bool on = (sh->options & OPT_SHAREHIST) != 0;
+    if (on && sh->share == NULL) {
+        const char *path = var_get("LAB_HISTSHARE");
+        char *buf = NULL;
+        const char *home = var_get("HOME");
+        if (path == NULL && home != NULL) {
+            buf = xmalloc(strlen(home) + sizeof("/.lab_history.shared"));
+            sprintf(buf, "%s/.lab_history.shared", home);
+            path = buf;
+        }
+        if (path == NULL || (sh->share = histshare_open(path)) == NULL) {
+            fprintf(stderr, "lab: can not open the shared history, sharehistory is off\n");
+            sh->options &= ~OPT_SHAREHIST;
+        }
+        free(buf);
+    } else if (!on && sh->share != NULL) {
+        histshare_close(sh->share);
+        sh->share = NULL;
+    }
+    if (sh->share != NULL) {
+        histshare_pull(sh->share, history_pulled, sh);
+    }
+}
+
+
 /*Initialize the shell for use. Allocate all data structures
 * Grab control of the terminal and put the shell in its own
 * process group. NOTE: This function will block until the shell is
@@ -24,6 +147,27 @@ void sh_init(struct shell *sh) {
     sh->shell_terminal = STDIN_FILENO;
     sh->shell_is_interactive = isatty(sh->shell_terminal);
     sh->prompt = get_prompt("MY PROMPT");
+    sh->ps = prompt_compile(sh->prompt);
+    sh->status = 0;
+    sh->duration_ms = 0;
+    sh->options = 0;
+    sh->pipestatus = NULL;
+    sh->npipestatus = 0;
+    sh->match = NULL;
+    sh->nmatch = 0;
+    sh->jobs = NULL;
+    sh->njobs = sh->capjobs = 0;
+    sh->psfds = NULL;
+    sh->npsfds = sh->cappsfds = 0;
+    sh->hist = NULL;
+    sh->hsearch = NULL;
+    sh->share = NULL;
+    sh->hexp = NULL;
+    sh->dirs = NULL;
+    sh->dirstack = NULL;
+    sh->ndirstack = sh->capdirstack = 0;
+    sh->frame = NULL;
+    sh->loops = sh->loopjump = 0;
     sh->shell_pgid = getpid();
     
     // Set the shell prompt
@@ -32,14 +176,20 @@ void sh_init(struct shell *sh) {
             kill(-sh->shell_pgid, SIGTTIN);
     }
 
-    // Set the shell process group ID
-    //sh->shell_pgid = getpid();
-
-    // Set the shell process group ID
-    if(setpgid(sh->shell_pgid, sh->shell_pgid) < 0){
+    // Set the shell process group ID, a session leader already is one
+    sh->shell_pgid = getpid();
+    if(getpgrp() != sh->shell_pgid && setpgid(sh->shell_pgid, sh->shell_pgid) < 0){
         perror("setpgid");
         exit(1);
     }
+
+    // Jobs hand the terminal back to this group when they are done
+    if(sh->shell_is_interactive){
+        tcsetpgrp(sh->shell_terminal, sh->shell_pgid);
+        tcgetattr(sh->shell_terminal, &sh->shell_tmodes);
+        history_load(sh);
+        dirs_load(sh);
+    }
 }
 
 
@@ -48,6 +198,26 @@ void sh_destroy(struct shell *sh) {
 
     // Free any allocated memory
     free(sh->prompt);
+    prompt_free(sh->ps);
+    histlog_close(sh->hist, hist_limit("HISTFILESIZE", 1000000));
+    histsearch_free(sh->hsearch);
+    histshare_close(sh->share);
+    hist_expand_free(sh->hexp);
+    dirdb_close(sh->dirs);
+    dirstack_free(sh);
+    complete_shutdown();
+    jobs_reap(sh);
+    jobs_free(sh);
+    free(sh->psfds);
+    free(sh->pipestatus);
+    cond_match_clear(sh);
+    func_free();
+    arith_free();
+    pattern_free();
+    regcache_free();
+    input_free();
+    alias_free();
+    vars_free();
 
     // Exit the shell, don't want this
     // This caused too many problems, saw it already in main
@@ -60,7 +230,12 @@ void sh_destroy(struct shell *sh) {
 * not set a default prompt of "shell>" is returned. This function calls
 * malloc internally and the caller must free the resulting string.*/
 char *get_prompt(const char *env) {
-    char *prompt = getenv(env);
+    const char *prompt = var_get(env);
+    // Names that are not identifiers, like "MY PROMPT", only live in the
+    // environment
+    if (prompt == NULL) {
+        prompt = getenv(env);
+    }
     if (prompt == NULL) {
         prompt = "shell>";
     }
@@ -69,16 +244,67 @@ char *get_prompt(const char *env) {
 }
 
 
+// Bumped on every successful chdir so the prompt knows when to refresh \w
+static unsigned long cwd_gen;
+
+
+// Counter that change_dir bumps every time the working directory changes
+unsigned long cwd_generation(void) {
+    return cwd_gen;
+}
+
+
+// Directory we came from, kept open for cd -
+static int oldpwd_fd = -1;
+static char *oldpwd;
+
+
+// Change to a directory, through an O_PATH descriptor when there is one
+int change_dir_at(int fd, const char *path) {
+    char *from = getcwd(NULL, 0);
+    int here = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    int rc = fd >= 0 ? fchdir(fd) : -1;
+    if (rc != 0 && path != NULL) {
+        rc = chdir(path);
+    }
+    if (rc != 0) {
+        int err = errno;
+        free(from);
+        if (here >= 0) {
+            close(here);
+        }
+        errno = err;
+        return -1;
+    }
+    cwd_gen++;
+    if (oldpwd_fd >= 0) {
+        close(oldpwd_fd);
+    }
+    oldpwd_fd = here;
+    free(oldpwd);
+    oldpwd = from;
+    if (from != NULL) {
+        var_set("OLDPWD", from, true);
+    }
+    char *to = getcwd(NULL, 0);
+    if (to != NULL) {
+        var_set("PWD", to, true);
+    }
+    free(to);
+    return 0;
+}
+
+
 /*Changes the current working directory of the shell. Uses the linux system
 * call chdir. With no arguments the users home directory is used as the
-* directory to change to.*/
+* directory to change to. cd - goes back to $OLDPWD.*/
 int change_dir(char **dir) {
     if (dir[1] == NULL){
         // No argument, change to home directory
-        char *myHome = getenv("HOME");
+        const char *myHome = var_get("HOME");
         if (myHome == NULL) {
             fprintf(stderr, "cd: HOME not set\n");
-            return -1;
+            return -2;
         }
         // If HOME is not set, get the home directory from passwd
         // struct passwd *pw = getpwnam(getlogin());
@@ -86,10 +312,24 @@ int change_dir(char **dir) {
             struct passwd *pw = getpwuid(getuid());
             myHome = pw ? pw->pw_dir : NULL;
         }
-        return chdir(myHome);
+        return change_dir_at(-1, myHome);
+    }
+    if (strcmp(dir[1], "-") == 0) {
+        const char *back = var_get("OLDPWD");
+        if (back == NULL) {
+            fprintf(stderr, "cd: OLDPWD not set\n");
+            return -2;
+        }
+        // The descriptor is only good while $OLDPWD is the one we set
+        int fd = oldpwd != NULL && strcmp(back, oldpwd) == 0 ? oldpwd_fd : -1;
+        if (change_dir_at(fd, back) != 0) {
+            return -1;
+        }
+        printf("%s\n", var_get("PWD"));
+        return 0;
     }
-    return chdir(dir[1]);
     // If chdir fails, it will return -1 and set errno
+    return change_dir_at(-1, dir[1]);
 }
 
 
@@ -129,6 +369,31 @@ char **cmd_parse(char const *line) {
     // Free the line copy
     free(line_copy);
 
+    // An alias in command position is replaced by the words its body
+    // was split into when it was defined
+    if (i > 0 && alias_find(argv[0]) != NULL) {
+        size_t n = i;
+        const char **words = xmalloc(n * sizeof(char *));
+        memcpy(words, argv, n * sizeof(char *));
+        struct alias_use use;
+        char *text = alias_expand(&words, &n, 0, &use);
+        if (text == NULL && n < (size_t)sysconf(_SC_ARG_MAX)) {
+            char **copy = xmalloc((n + 1) * sizeof(char *));
+            for (size_t k = 0; k < n; k++) {
+                copy[k] = strdup(words[k]);
+            }
+            for (int k = 0; k < i; k++) {
+                free(argv[k]);
+            }
+            memcpy(argv, copy, n * sizeof(char *));
+            argv[n] = NULL;
+            free(copy);
+        }
+        free(text);
+        free(words);
+        alias_release(&use);
+    }
+
     return argv;
 }
 
@@ -179,11 +444,228 @@ char *trim_white(char *line) {
 }
 
 
+// Options that can be changed with set -o and set +o
+static const struct
+{
+const char *name;
+int flag;
+} shell_options[] = {
+    { "pipefail", OPT_PIPEFAIL },
+    { "sharehistory", OPT_SHAREHIST },
+    { "fuzzycomplete", OPT_FUZZYCOMPLETE },
+    { "noglob", OPT_NOGLOB },
+};
+
+
+/*The set builtin. Only long options are supported, set -o alone lists
+* them with their current state.*/
+static int set_options(struct shell *sh, char **argv) {
+    size_t nopts = sizeof(shell_options) / sizeof(shell_options[0]);
+    if (argv[1] == NULL || (strcmp(argv[1], "-o") == 0 && argv[2] == NULL)) {
+        for (size_t i = 0; i < nopts; i++) {
+            printf("%-15s\t%s\n", shell_options[i].name,
+                   (sh->options & shell_options[i].flag) ? "on" : "off");
+        }
+        return 0;
+    }
+    for (int i = 1; argv[i]; i++) {
+        bool on = strcmp(argv[i], "-o") == 0;
+        if (!on && strcmp(argv[i], "+o") != 0) {
+            fprintf(stderr, "set: %s: invalid option\n", argv[i]);
+            return 2;
+        }
+        if (argv[++i] == NULL) {
+            fprintf(stderr, "set: option name required\n");
+            return 2;
+        }
+        size_t k = 0;
+        while (k < nopts && strcmp(argv[i], shell_options[k].name) != 0) {
+            k++;
+        }
+        if (k == nopts) {
+            fprintf(stderr, "set: %s: invalid option name\n", argv[i]);
+            return 2;
+        }
+        if (on) {
+            sh->options |= shell_options[k].flag;
+        } else {
+            sh->options &= ~shell_options[k].flag;
+        }
+    }
+    return 0;
+}
+
+
+static int builtin_exit(struct shell *sh, char **argv) {
+    long status = sh->status;
+    if (argv[1] != NULL) {
+        char *end;
+        status = strtol(argv[1], &end, 10);
+        if (*argv[1] == '\0' || *end != '\0') {
+            fprintf(stderr, "exit: %s: numeric argument required\n", argv[1]);
+            status = 2;
+        }
+    }
+    // Lets the history log be compacted, children just leave
+    if (sh->shell_is_interactive) {
+        sh_destroy(sh);
+    }
+    input_sync_all();
+    exit(status & 0xff);
+}
+
+
+static int builtin_cd(struct shell *sh, char **argv) {
+    int rc = change_dir(argv);
+    if (rc != 0) {
+        // -2 was reported already, there was no directory to go to
+        if (rc == -1) {
+            const char *dir = argv[1] == NULL ? var_get("HOME") : strcmp(argv[1], "-") == 0 ? var_get("OLDPWD") : argv[1];
+            fprintf(stderr, "cd: %s: %s\n", dir, strerror(errno));
+        }
+        return 1;
+    }
+    // Remember the directory for z
+    if (sh->dirs != NULL && dirdb_visit(sh->dirs, var_get("PWD")) < 0) {
+        perror("z");
+    }
+    return 0;
+}
+
+
+// Resume a stopped or background job
+static int builtin_fg(struct shell *sh, char **argv) {
+    struct job *job = job_find(sh, argv[1]);
+    if (job == NULL) {
+        fprintf(stderr, "%s: %s: no such job\n", argv[0], argv[1] ? argv[1] : "current");
+        return 1;
+    }
+    bool fg = argv[0][0] == 'f';
+    if (fg) {
+        printf("%s\n", job->cmd);
+    } else {
+        printf("[%d]+ %s &\n", job->id, job->cmd);
+    }
+    fflush(stdout);
+    return job_continue(sh, job, fg);
+}
+
+
+// List the jobs in the job table
+static int builtin_jobs(struct shell *sh, char **argv) {
+    UNUSED(argv);
+    jobs_reap(sh);
+    struct strbuf out = {0};
+    char buf[32];
+    for (int j = 0; j < sh->njobs; j++) {
+        struct job *job = sh->jobs[j];
+        if (job->flags & JOB_PROCSUBST) {
+            continue;
+        }
+        snprintf(buf, sizeof(buf), "[%d]  ", job->id);
+        strbuf_adds(&out, buf);
+        strbuf_adds(&out, job->nlive == 0 ? "Done                    " :
+                          job->stopped ? "Stopped                 " : "Running                 ");
+        strbuf_adds(&out, job->cmd ? job->cmd : "");
+        strbuf_addc(&out, '\n');
+    }
+    int rc = write_all(STDOUT_FILENO, out.s, out.len) < 0 ? 1 : 0;
+    strbuf_free(&out);
+    return rc;
+}
+
+
+static int builtin_set(struct shell *sh, char **argv) {
+    return set_options(sh, argv);
+}
+
+
+// true and :, loop conditions should not need a fork
+static int builtin_true(struct shell *sh, char **argv) {
+    UNUSED(sh);
+    UNUSED(argv);
+    return 0;
+}
+
+
+static int builtin_false(struct shell *sh, char **argv) {
+    UNUSED(sh);
+    UNUSED(argv);
+    return 1;
+}
+
+
+/* A builtin gets the expanded arguments and returns its exit status */
+typedef int (*builtin_fn)(struct shell *sh, char **argv);
+
+static const struct
+{
+const char *name;
+builtin_fn fn;
+} builtins[] = {
+    { "exit", builtin_exit },
+    { "cd", builtin_cd },
+    { "jobs", builtin_jobs },
+    { "set", builtin_set },
+    { "fg", builtin_fg },
+    { "bg", builtin_fg },
+    { "history", history_builtin },
+    { "hash", hash_builtin },
+    { "z", z_builtin },
+    { "pushd", pushd_builtin },
+    { "popd", popd_builtin },
+    { "dirs", dirs_builtin },
+    { "export", export_builtin },
+    { "unset", unset_builtin },
+    { "declare", declare_builtin },
+    { "alias", alias_builtin },
+    { "unalias", unalias_builtin },
+    { "return", return_builtin },
+    { "shift", shift_builtin },
+    { "break", break_builtin },
+    { "continue", continue_builtin },
+    { "source", source_builtin },
+    { ".", source_builtin },
+    { "true", builtin_true },
+    { ":", builtin_true },
+    { "false", builtin_false },
+    { "read", read_builtin },
+    { "mapfile", mapfile_builtin },
+    { "readarray", mapfile_builtin },
+};
+
+
+// Builtins by name, filled on first use
+static struct hmap builtin_map;
+
+
+static builtin_fn builtin_lookup(const char *name) {
+    if (builtin_map.n == 0) {
+        for (size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+            hmap_put(&builtin_map, builtins[i].name, (void *)builtins[i].fn);
+        }
+    }
+    return (builtin_fn)hmap_get(&builtin_map, name);
+}
+
+
+// Name of the i-th builtin
+const char *builtin_name(size_t i) {
+    return i < sizeof(builtins) / sizeof(builtins[0]) ? builtins[i].name : NULL;
+}
+
+
+// Check if a command name is handled by do_builtin
+bool is_builtin(const char *name) {
+    return builtin_lookup(name) != NULL;
+}
+
+
 /*Takes an argument list and checks if the first argument is a
 * built in command such as exit, cd, jobs, etc. If the command is a
-* built in command this function will handle the command and then return
-* true. If the first argument is NOT a built in command this function will
-* return false.*/
+* built in command this function will handle the command, store its exit
+* status in sh->status and then return true. If the first argument is NOT
+* a built in command this function will return false.*/
 bool do_builtin(struct shell *sh, char **argv) {
     
     // Check for NULL or empty command
@@ -191,42 +673,30 @@ bool do_builtin(struct shell *sh, char **argv) {
         return false;
     }
 
-    // Check for built-in commands
-    if(strcmp(argv[0], "exit") == 0) {
-        exit(0);
-    }
-
-    // Check for change directory command
-    if(strcmp(argv[0], "cd") == 0) {
-        return change_dir(argv) == 0;
-    }
-
-    if(strcmp(argv[0], "jobs") == 0) {
-        HIST_ENTRY **the_list;
-        //register int i;
-
-        //the_list = history_list ();
-        the_list = history_list();
-          if (the_list)
-            for (int i = 0; the_list[i]; i++)
-              printf ("%d: %s\n", i + history_base, the_list[i]->line);
-        return true;
+    builtin_fn fn = builtin_lookup(argv[0]);
+    if (fn == NULL) {
+        return false;
     }
-
-    // If no built-in command was found, return false
-    return false;
+    sh->status = fn(sh, argv);
+    return true;
 }
 
 
 // Parse command line args from the user when the shell was launched
-void parse_args(int argc, char **argv) {
-    // If the version flag is found, print the version and exit
-    for (int i = 0; i < argc; i++) {
+int parse_args(int argc, char **argv) {
+    int i = 1;
+    for (; i < argc && argv[i][0] == '-'; i++) {
         // Check for version flag
         if(strcmp(argv[i], "-v") == 0){
             // Print version and exit
             printf("The Shell Version is: %d.%d\n", lab_VERSION_MAJOR, lab_VERSION_MAJOR);
             exit(0);
         }
+        // The command string and its arguments are left to the caller
+        if (strcmp(argv[i], "-c") == 0) {
+            break;
+        }
     }
+    // Everything after the script name belongs to the script
+    return i;
 }
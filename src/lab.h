@@ -8,11 +8,26 @@
 #define lab_VERSION_MAJOR 1
 #define lab_VERSION_MINOR 0
 #define UNUSED(x) (void)x;
+
+/* Shell options changed with set -o */
+#define OPT_PIPEFAIL 0x01
+#define OPT_SHAREHIST 0x02   // share history with other shells as they run
+#define OPT_FUZZYCOMPLETE 0x04  // complete unknown command names to close ones
+#define OPT_NOGLOB 0x08      // no pathname expansion
 #ifdef __cplusplus
 extern "C"
 {
 #endif
 
+struct job;
+struct prompt;
+struct histlog;
+struct hist_search;
+struct histshare;
+struct hist_expand;
+struct dirdb;
+struct dir_entry;
+struct frame;
 
 struct shell
 {
@@ -20,7 +35,32 @@ int shell_is_interactive;
 pid_t shell_pgid;
 struct termios shell_tmodes;
 int shell_terminal;
-char *prompt;
+char *prompt;          // prompt template from get_prompt
+struct prompt *ps;     // compiled prompt, see prompt.h
+int status;            // exit status of the last command, $?
+long duration_ms;      // run time of the last command line
+int options;           // OPT_* flags
+int *pipestatus;       // exit status of each stage of the last pipeline
+int npipestatus;
+char **match;          // MATCH, the groups of the last [[ =~ ]] that matched
+int nmatch;
+struct job **jobs;     // job table, see jobs.h
+int njobs;
+int capjobs;
+int *psfds;            // our ends of process substitution pipes
+int npsfds;
+int cappsfds;
+struct histlog *hist;  // persistent history, NULL when not interactive
+struct hist_search *hsearch; // Ctrl-R index, built on first use
+struct histshare *share;     // ring shared with other shells, see set -o sharehistory
+struct hist_expand *hexp;    // history expansion index, see histcmd.h
+struct dirdb *dirs;    // visited directories for z, NULL when not interactive
+struct dir_entry *dirstack; // pushd stack, the top is the last entry
+int ndirstack;
+int capdirstack;
+struct frame *frame;   // innermost running function, NULL at top level
+int loops;             // loops running, for break and continue
+int loopjump;          // pending break (> 0) or continue (< 0) of that many loops
 };
 
 
@@ -39,13 +79,49 @@ char *get_prompt(const char *env);
 /**
 * Changes the current working directory of the shell. Uses the linux system
 * call chdir. With no arguments the users home directory is used as the
-* directory to change to.
+* directory to change to, cd - goes back to $OLDPWD and prints it.
 *
 * @param dir The directory to change to
+* @return On success, zero is returned. When the directory can not be
+* changed to -1 is returned and errno is set to indicate the error, left
+* for the caller to report. When there is no directory to go to because
+* $HOME or $OLDPWD is not set -2 is returned, the error was printed.
+*/
+int change_dir(char **dir);
+
+
+/**
+* @brief Change to a directory through an O_PATH descriptor, which needs
+* no path lookup and still works after the directory was renamed. Falls
+* back to the path when the descriptor is -1 or no longer valid. Keeps
+* $PWD and $OLDPWD up to date and the directory we left open for cd -.
+*
+* @param fd An O_PATH descriptor of the directory or -1
+* @param path The path of the directory, may be NULL when fd is valid
 * @return On success, zero is returned. On error, -1 is returned, and
 * errno is set to indicate the error.
 */
-int change_dir(char **dir);
+int change_dir_at(int fd, const char *path);
+
+
+/**
+* @brief Counter that change_dir bumps every time the working directory
+* changes. Lets the prompt know when \w must be looked up again without
+* calling getcwd before every prompt.
+*
+* @return unsigned long The current generation
+*/
+unsigned long cwd_generation(void);
+
+
+/**
+* @brief Called before each prompt. Maps or unmaps the shared history ring
+* when set -o sharehistory changed, then adds the commands other shells
+* published since the last prompt to the history.
+*
+* @param sh The shell
+*/
+void history_sync(struct shell *sh);
 
 
 /**
@@ -95,6 +171,27 @@ char *trim_white(char *line);
 bool do_builtin(struct shell *sh, char **argv);
 
 
+/**
+* @brief Check if a command name is handled by do_builtin. Builtins run
+* inside the shell process so their redirections are applied to the
+* shell and undone afterwards.
+*
+* @param name The command name
+* @return True if the name is a built in command
+*/
+bool is_builtin(const char *name);
+
+
+/**
+* @brief Walk the names of the built in commands, for completion. The
+* names are constant and safe to read from any thread.
+*
+* @param i Index of the builtin
+* @return const char* The name, NULL when i is past the last builtin
+*/
+const char *builtin_name(size_t i);
+
+
 /**
 * @brief Initialize the shell for use. Allocate all data structures
 * Grab control of the terminal and put the shell in its own
@@ -122,8 +219,10 @@ void sh_destroy(struct shell *sh);
 *
 * @param argc Number of args
 * @param argv The arg array
+* @return int Index of the script to run or of a -c option, argc when
+* there is neither
 */
-void parse_args(int argc, char **argv);
+int parse_args(int argc, char **argv);
 
 
 #ifdef __cplusplus
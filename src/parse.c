@@ -0,0 +1,1506 @@
+#include "parse.h"
+#include "util.h"
+#include "vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+enum tok_kind
+{
+T_EOF,
+T_WORD,
+T_NEWLINE,
+T_SEMI,
+T_AMP,
+T_PIPE,
+T_ANDIF,
+T_ORIF,
+T_LPAREN,
+T_RPAREN,
+T_LESS,
+T_GREAT,
+T_DGREAT,
+T_DLESS,
+T_DLESSDASH,
+T_TLESS,
+T_LESSAND,
+T_GREATAND,
+T_DSEMI,
+T_ARITH,            // (( expression )), the text is the expression
+};
+
+struct tok
+{
+int kind;
+const char *text;
+uint32_t len;
+int fd;             // io number in front of a redirection, -1 if none
+};
+
+/* A heredoc waiting for its body, which starts after the next newline */
+struct heredoc
+{
+struct word delim;
+uint8_t flags;
+bool done;
+int32_t redir;      // index in the tree once the command is committed
+struct word body;
+};
+
+struct parser
+{
+struct ast *ast;
+const char *src;
+size_t pos;
+size_t len;
+int status;
+bool have_tok;
+struct tok tok;
+struct heredoc *heredocs;
+int nheredocs;
+int capheredocs;
+int nread;          // heredocs whose bodies have been read
+int depth;          // open { groups
+};
+
+static const char *tok_names[] = {
+    "end of file", "word", "newline", ";", "&", "|", "&&", "||", "(", ")",
+    "<", ">", ">>", "<<", "<<-", "<<<", "<&", ">&", ";;", "((",
+};
+
+
+// Record the first error, later errors are usually consequences of it
+static void parse_error(struct parser *p, const char *fmt, const char *arg) {
+    if (p->status != PARSE_OK) {
+        return;
+    }
+    p->status = PARSE_ERROR;
+    char buf[256];
+    snprintf(buf, sizeof(buf), fmt, arg);
+    p->ast->error = xstrdup(buf);
+}
+
+
+static void incomplete(struct parser *p) {
+    if (p->status == PARSE_OK) {
+        p->status = PARSE_INCOMPLETE;
+    }
+}
+
+
+/*Copy bytes into the string pool of the tree and return the new word*/
+static struct word pool_add(struct ast *ast, const char *s, size_t n) {
+    if (ast->poollen + n + 1 > ast->poolcap) {
+        size_t cap = ast->poolcap ? ast->poolcap * 2 : 256;
+        while (cap < ast->poollen + n + 1) {
+            cap *= 2;
+        }
+        ast->pool = xrealloc(ast->pool, cap);
+        ast->poolcap = cap;
+    }
+    struct word w = { ast->poollen, (uint32_t)n };
+    memcpy(ast->pool + ast->poollen, s, n);
+    ast->pool[ast->poollen + n] = '\0';
+    ast->poollen += n + 1;
+    return w;
+}
+
+
+static int32_t node_new(struct ast *ast, int kind) {
+    if (ast->nnodes == ast->capnodes) {
+        ast->capnodes = ast->capnodes ? ast->capnodes * 2 : 16;
+        ast->nodes = xrealloc(ast->nodes, ast->capnodes * sizeof(struct node));
+    }
+    struct node *n = &ast->nodes[ast->nnodes];
+    memset(n, 0, sizeof(*n));
+    n->kind = kind;
+    n->next = n->a = n->b = n->c = -1;
+    return ast->nnodes++;
+}
+
+
+static uint32_t word_push(struct ast *ast, struct word w) {
+    if (ast->nwords == ast->capwords) {
+        ast->capwords = ast->capwords ? ast->capwords * 2 : 16;
+        ast->words = xrealloc(ast->words, ast->capwords * sizeof(struct word));
+    }
+    ast->words[ast->nwords] = w;
+    return ast->nwords++;
+}
+
+
+static uint32_t redir_push(struct ast *ast, struct redir *r) {
+    if (ast->nredirs == ast->capredirs) {
+        ast->capredirs = ast->capredirs ? ast->capredirs * 2 : 8;
+        ast->redirs = xrealloc(ast->redirs, ast->capredirs * sizeof(struct redir));
+    }
+    ast->redirs[ast->nredirs] = *r;
+    return ast->nredirs++;
+}
+
+
+static bool is_meta(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == ';' || c == '&' ||
+           c == '|' || c == '<' || c == '>' || c == '(' || c == ')';
+}
+
+
+/*Find the end of a balanced group starting just after the opening
+* paren. Quotes inside the group are skipped. Returns the index just past
+* the closing paren or 0 if the input ended first.*/
+size_t parse_group_end(const char *s, size_t i, size_t len) {
+    int depth = 1;
+    while (i < len) {
+        char c = s[i];
+        if (c == '\\') {
+            i += 2;
+            continue;
+        }
+        if (c == '\'') {
+            const char *q = memchr(s + i + 1, '\'', len - i - 1);
+            if (q == NULL) {
+                return 0;
+            }
+            i = q - s + 1;
+            continue;
+        }
+        if (c == '"') {
+            for (i++; i < len && s[i] != '"'; i++) {
+                if (s[i] == '\\') {
+                    i++;
+                }
+            }
+            if (i >= len) {
+                return 0;
+            }
+        } else if (c == '(') {
+            depth++;
+        } else if (c == ')' && --depth == 0) {
+            return i + 1;
+        }
+        i++;
+    }
+    return 0;
+}
+
+
+// <(cmd) and >(cmd) are words even though < and > are operators
+static bool is_procsubst(const char *s, size_t i, size_t len) {
+    return (s[i] == '<' || s[i] == '>') && i + 1 < len && s[i + 1] == '(';
+}
+
+
+/*A word that starts with name= or name+= takes a parenthesized list
+* right after the = as a compound array value*/
+static bool is_compound(const char *s, size_t start, size_t i, size_t len) {
+    if (s[i] != '=' || i + 1 >= len || s[i + 1] != '(') {
+        return false;
+    }
+    size_t n = i > start && s[i - 1] == '+' ? i - 1 - start : i - start;
+    if (n == 0 || isdigit((unsigned char)s[start])) {
+        return false;
+    }
+    for (size_t k = start; k < start + n; k++) {
+        if (!isalnum((unsigned char)s[k]) && s[k] != '_') {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// Find the end of the word starting at s[i]
+size_t parse_word_end(const char *s, size_t i, size_t len) {
+    size_t start = i;
+    while (i < len && (!is_meta(s[i]) || is_procsubst(s, i, len))) {
+        char c = s[i];
+        if (is_procsubst(s, i, len)) {
+            i = parse_group_end(s, i + 2, len);
+            if (i == 0) {
+                return 0;
+            }
+        } else if (is_compound(s, start, i, len)) {
+            i = parse_group_end(s, i + 2, len);
+            if (i == 0) {
+                return 0;
+            }
+        } else if (c == '\\') {
+            if (i + 1 >= len) {
+                return 0;
+            }
+            i += 2;
+        } else if (c == '\'') {
+            const char *q = memchr(s + i + 1, '\'', len - i - 1);
+            if (q == NULL) {
+                return 0;
+            }
+            i = q - s + 1;
+        } else if (c == '"') {
+            for (i++; i < len && s[i] != '"'; i++) {
+                if (s[i] == '\\') {
+                    i++;
+                } else if (s[i] == '$' && i + 1 < len && s[i + 1] == '(') {
+                    size_t e = parse_group_end(s, i + 2, len);
+                    if (e == 0) {
+                        return 0;
+                    }
+                    i = e - 1;
+                } else if (s[i] == '$' && i + 1 < len && s[i + 1] == '{') {
+                    // Quotes inside ${...} do not end the string
+                    const char *q = memchr(s + i + 2, '}', len - i - 2);
+                    if (q == NULL) {
+                        return 0;
+                    }
+                    i = q - s;
+                }
+            }
+            if (i >= len) {
+                return 0;
+            }
+            i++;
+        } else if (c == '$' && i + 1 < len && s[i + 1] == '(') {
+            i = parse_group_end(s, i + 2, len);
+            if (i == 0) {
+                return 0;
+            }
+        } else if (c == '$' && i + 1 < len && s[i + 1] == '{') {
+            const char *q = memchr(s + i + 2, '}', len - i - 2);
+            if (q == NULL) {
+                return 0;
+            }
+            i = q - s + 1;
+        } else {
+            i++;
+        }
+    }
+    return i;
+}
+
+
+/*Scan a word starting at p->pos. Returns the index just past the word or
+* 0 when the input ends inside a quote or expansion.*/
+static size_t scan_word(struct parser *p) {
+    return parse_word_end(p->src, p->pos, p->len);
+}
+
+
+/*Read the bodies of all pending heredocs. p->pos is just past the newline
+* that ended the line holding the redirections.*/
+static void read_heredocs(struct parser *p) {
+    struct ast *ast = p->ast;
+    for (; p->nread < p->nheredocs; p->nread++) {
+        struct heredoc *h = &p->heredocs[p->nread];
+        const char *delim = ast_str(ast, h->delim);
+        size_t dlen = h->delim.len;
+        struct strbuf body = {0};
+        bool found = false;
+        while (p->pos < p->len) {
+            const char *line = p->src + p->pos;
+            const char *nl = memchr(line, '\n', p->len - p->pos);
+            size_t llen = nl ? (size_t)(nl - line) : p->len - p->pos;
+            p->pos += llen + (nl ? 1 : 0);
+            if (h->flags & REDIR_STRIPTABS) {
+                while (llen > 0 && *line == '\t') {
+                    line++;
+                    llen--;
+                }
+            }
+            if (llen == dlen && memcmp(line, delim, dlen) == 0) {
+                found = true;
+                break;
+            }
+            strbuf_add(&body, line, llen);
+            strbuf_addc(&body, '\n');
+        }
+        if (!found) {
+            strbuf_free(&body);
+            incomplete(p);
+            return;
+        }
+        h->body = pool_add(ast, body.s ? body.s : "", body.len);
+        h->done = true;
+        if (h->redir >= 0) {
+            ast->redirs[h->redir].arg = h->body;
+        }
+        strbuf_free(&body);
+    }
+}
+
+
+// Lex the next token into p->tok
+static void lex(struct parser *p) {
+    const char *s = p->src;
+    struct tok *t = &p->tok;
+    t->fd = -1;
+    t->text = NULL;
+    t->len = 0;
+
+    for (;;) {
+        while (p->pos < p->len && (s[p->pos] == ' ' || s[p->pos] == '\t')) {
+            p->pos++;
+        }
+        // Backslash newline joins lines
+        if (p->pos + 1 < p->len && s[p->pos] == '\\' && s[p->pos + 1] == '\n') {
+            p->pos += 2;
+            continue;
+        }
+        if (p->pos < p->len && s[p->pos] == '#') {
+            while (p->pos < p->len && s[p->pos] != '\n') {
+                p->pos++;
+            }
+        }
+        break;
+    }
+
+    if (p->pos >= p->len) {
+        if (p->nread < p->nheredocs) {
+            incomplete(p);
+        }
+        t->kind = T_EOF;
+        return;
+    }
+
+    // An io number is a run of digits directly in front of < or >
+    size_t d = p->pos;
+    while (d < p->len && isdigit((unsigned char)s[d])) {
+        d++;
+    }
+    if (d > p->pos && d < p->len && (s[d] == '<' || s[d] == '>') && !is_procsubst(s, d, p->len)) {
+        t->fd = atoi(s + p->pos);
+        p->pos = d;
+    }
+
+    char c = s[p->pos];
+    char c1 = p->pos + 1 < p->len ? s[p->pos + 1] : '\0';
+    char c2 = p->pos + 2 < p->len ? s[p->pos + 2] : '\0';
+    size_t adv = 1;
+    if (is_procsubst(s, p->pos, p->len)) {
+        // Let the default case scan it as a word
+        c = 'w';
+    }
+    switch (c) {
+    case '\n':
+        t->kind = T_NEWLINE;
+        p->pos++;
+        read_heredocs(p);
+        return;
+    case ';':
+        t->kind = c1 == ';' ? T_DSEMI : T_SEMI;
+        adv = c1 == ';' ? 2 : 1;
+        break;
+    case '&':
+        t->kind = c1 == '&' ? T_ANDIF : T_AMP;
+        adv = c1 == '&' ? 2 : 1;
+        break;
+    case '|':
+        t->kind = c1 == '|' ? T_ORIF : T_PIPE;
+        adv = c1 == '|' ? 2 : 1;
+        break;
+    case '(':
+        t->kind = T_LPAREN;
+        if (c1 == '(') {
+            // (( expression )) when the parentheses close as a pair
+            size_t end = parse_group_end(s, p->pos + 1, p->len);
+            if (end == 0) {
+                incomplete(p);
+                t->kind = T_EOF;
+                p->pos = p->len;
+                return;
+            }
+            if (s[end - 2] == ')') {
+                t->kind = T_ARITH;
+                t->text = s + p->pos + 2;
+                t->len = end - 2 - (p->pos + 2);
+                p->pos = end;
+                return;
+            }
+        }
+        break;
+    case ')':
+        t->kind = T_RPAREN;
+        break;
+    case '<':
+        if (c1 == '<' && c2 == '<') {
+            t->kind = T_TLESS;
+            adv = 3;
+        } else if (c1 == '<' && c2 == '-') {
+            t->kind = T_DLESSDASH;
+            adv = 3;
+        } else if (c1 == '<') {
+            t->kind = T_DLESS;
+            adv = 2;
+        } else if (c1 == '&') {
+            t->kind = T_LESSAND;
+            adv = 2;
+        } else {
+            t->kind = T_LESS;
+        }
+        break;
+    case '>':
+        if (c1 == '>') {
+            t->kind = T_DGREAT;
+            adv = 2;
+        } else if (c1 == '&') {
+            t->kind = T_GREATAND;
+            adv = 2;
+        } else {
+            t->kind = T_GREAT;
+            adv = c1 == '|' ? 2 : 1;
+        }
+        break;
+    default: {
+        size_t end = scan_word(p);
+        if (end == 0) {
+            incomplete(p);
+            t->kind = T_EOF;
+            p->pos = p->len;
+            return;
+        }
+        t->kind = T_WORD;
+        t->text = s + p->pos;
+        t->len = end - p->pos;
+        p->pos = end;
+        return;
+    }
+    }
+    t->text = s + p->pos;
+    t->len = adv;
+    p->pos += adv;
+}
+
+
+static struct tok *peek(struct parser *p) {
+    if (!p->have_tok) {
+        lex(p);
+        p->have_tok = true;
+    }
+    return &p->tok;
+}
+
+
+static void advance(struct parser *p) {
+    peek(p);
+    p->have_tok = false;
+}
+
+
+static void unexpected(struct parser *p, struct tok *t) {
+    if (t->kind == T_EOF) {
+        incomplete(p);
+        return;
+    }
+    if (t->kind == T_WORD) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%.*s", (int)(t->len < 60 ? t->len : 60), t->text);
+        parse_error(p, "syntax error near unexpected token `%s'", buf);
+    } else {
+        parse_error(p, "syntax error near unexpected token `%s'", tok_names[t->kind]);
+    }
+}
+
+
+static bool is_redir(int kind) {
+    return kind >= T_LESS && kind <= T_GREATAND;
+}
+
+
+/*Remove quotes from a heredoc delimiter. Any quoting at all means the
+* body is taken literally.*/
+static struct word heredoc_delim(struct parser *p, struct tok *t, uint8_t *flags) {
+    struct strbuf sb = {0};
+    for (uint32_t i = 0; i < t->len; i++) {
+        char c = t->text[i];
+        if (c == '\'' || c == '"') {
+            *flags |= REDIR_QUOTED;
+        } else if (c == '\\' && i + 1 < t->len) {
+            *flags |= REDIR_QUOTED;
+            strbuf_addc(&sb, t->text[++i]);
+        } else {
+            strbuf_addc(&sb, c);
+        }
+    }
+    struct word w = pool_add(p->ast, sb.s ? sb.s : "", sb.len);
+    strbuf_free(&sb);
+    return w;
+}
+
+
+/*Parse one redirection operator and its word into r. For a heredoc the
+* index of its pending body is stored in pending, otherwise -1.*/
+static bool parse_redir(struct parser *p, struct redir *r, int *pending) {
+    struct tok *t = peek(p);
+    int kind = t->kind;
+    memset(r, 0, sizeof(*r));
+    r->memfd = -1;
+    r->fd = t->fd;
+    *pending = -1;
+    advance(p);
+
+    switch (kind) {
+    case T_LESS:
+        r->kind = REDIR_IN;
+        break;
+    case T_GREAT:
+        r->kind = REDIR_OUT;
+        break;
+    case T_DGREAT:
+        r->kind = REDIR_APPEND;
+        break;
+    case T_LESSAND:
+    case T_GREATAND:
+        r->kind = REDIR_DUP;
+        break;
+    case T_DLESSDASH:
+        r->flags |= REDIR_STRIPTABS;
+        // fall through
+    case T_DLESS:
+        r->kind = REDIR_HEREDOC;
+        break;
+    case T_TLESS:
+        r->kind = REDIR_HERESTR;
+        break;
+    }
+    if (r->fd < 0) {
+        r->fd = (kind == T_LESS || kind == T_LESSAND || kind == T_DLESS ||
+                 kind == T_DLESSDASH || kind == T_TLESS) ? 0 : 1;
+    }
+
+    t = peek(p);
+    if (t->kind != T_WORD) {
+        unexpected(p, t);
+        return false;
+    }
+    if (r->kind == REDIR_HEREDOC) {
+        r->arg = heredoc_delim(p, t, &r->flags);
+        if (p->nheredocs == p->capheredocs) {
+            p->capheredocs = p->capheredocs ? p->capheredocs * 2 : 4;
+            p->heredocs = xrealloc(p->heredocs, p->capheredocs * sizeof(struct heredoc));
+        }
+        struct heredoc *h = &p->heredocs[p->nheredocs];
+        memset(h, 0, sizeof(*h));
+        h->delim = r->arg;
+        h->flags = r->flags;
+        h->redir = -1;
+        *pending = p->nheredocs++;
+    } else {
+        r->arg = pool_add(p->ast, t->text, t->len);
+    }
+    advance(p);
+    return true;
+}
+
+
+/*Give node n the redirections parsed for it. A heredoc whose body comes
+* later is told where its redirection ended up.*/
+static void redirs_commit(struct parser *p, int32_t n, struct redir *redirs, int *pending, size_t nr) {
+    struct ast *ast = p->ast;
+    ast->nodes[n].redir0 = ast->nredirs;
+    ast->nodes[n].nredirs = nr;
+    for (size_t i = 0; i < nr; i++) {
+        uint32_t idx = redir_push(ast, &redirs[i]);
+        // The body may already have been read while looking ahead
+        if (pending[i] >= 0) {
+            struct heredoc *h = &p->heredocs[pending[i]];
+            if (h->done) {
+                ast->redirs[idx].arg = h->body;
+            } else {
+                h->redir = idx;
+            }
+        }
+    }
+}
+
+
+/*Parse a simple command: words and redirections in any order*/
+static int32_t parse_simple(struct parser *p) {
+    struct ast *ast = p->ast;
+    struct word *words = NULL;
+    struct redir *redirs = NULL;
+    int *pending = NULL;
+    size_t nw = 0, cw = 0, nr = 0, cr = 0;
+
+    for (;;) {
+        struct tok *t = peek(p);
+        if (t->kind == T_WORD) {
+            if (nw == cw) {
+                cw = cw ? cw * 2 : 8;
+                words = xrealloc(words, cw * sizeof(*words));
+            }
+            words[nw++] = pool_add(ast, t->text, t->len);
+            advance(p);
+        } else if (is_redir(t->kind)) {
+            if (nr == cr) {
+                cr = cr ? cr * 2 : 4;
+                redirs = xrealloc(redirs, cr * sizeof(*redirs));
+                pending = xrealloc(pending, cr * sizeof(*pending));
+            }
+            if (!parse_redir(p, &redirs[nr], &pending[nr])) {
+                break;
+            }
+            nr++;
+        } else {
+            break;
+        }
+    }
+
+    int32_t n = -1;
+    if (nw == 0 && nr == 0) {
+        unexpected(p, peek(p));
+    } else if (p->status != PARSE_ERROR) {
+        n = node_new(ast, NODE_CMD);
+        ast->nodes[n].word0 = ast->nwords;
+        ast->nodes[n].nwords = nw;
+        for (size_t i = 0; i < nw; i++) {
+            word_push(ast, words[i]);
+        }
+        redirs_commit(p, n, redirs, pending, nr);
+    }
+    free(words);
+    free(redirs);
+    free(pending);
+    return n;
+}
+
+
+/*Parse the redirections after a compound command, they apply to all of
+* it. Returns the node or -1 on an error.*/
+static int32_t parse_compound_redirs(struct parser *p, int32_t n) {
+    struct redir *redirs = NULL;
+    int *pending = NULL;
+    size_t nr = 0;
+    while (n >= 0 && is_redir(peek(p)->kind)) {
+        redirs = xrealloc(redirs, (nr + 1) * sizeof(*redirs));
+        pending = xrealloc(pending, (nr + 1) * sizeof(*pending));
+        if (!parse_redir(p, &redirs[nr], &pending[nr])) {
+            n = -1;
+            break;
+        }
+        nr++;
+    }
+    if (n >= 0) {
+        redirs_commit(p, n, redirs, pending, nr);
+    }
+    free(redirs);
+    free(pending);
+    return n;
+}
+
+
+static void skip_newlines(struct parser *p) {
+    while (peek(p)->kind == T_NEWLINE) {
+        advance(p);
+    }
+}
+
+
+static int32_t parse_list(struct parser *p);
+
+
+// A reserved word such as { is only recognized as a word of its own
+static bool is_reserved(struct tok *t, const char *word) {
+    return t->kind == T_WORD && t->len == strlen(word) && memcmp(t->text, word, t->len) == 0;
+}
+
+
+// Reserved words that end the list of a compound command
+static bool is_terminator(struct tok *t) {
+    static const char *words[] = { "}", "then", "elif", "else", "fi", "do", "done", "esac" };
+    for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+        if (is_reserved(t, words[i])) {
+            return true;
+        }
+    }
+    return t->kind == T_DSEMI;
+}
+
+
+// Consume a reserved word that must come next
+static bool expect(struct parser *p, const char *word) {
+    struct tok *t = peek(p);
+    if (p->status != PARSE_OK) {
+        return false;
+    }
+    if (!is_reserved(t, word)) {
+        unexpected(p, t);
+        return false;
+    }
+    advance(p);
+    return true;
+}
+
+
+/*Parse the list inside a compound command, which ends at one of the
+* terminators. An empty list is only allowed where empty is true.*/
+static int32_t parse_body(struct parser *p, bool empty) {
+    p->depth++;
+    int32_t list = parse_list(p);
+    p->depth--;
+    if (p->status != PARSE_OK) {
+        return -1;
+    }
+    if (!empty && p->ast->nodes[list].a < 0) {
+        unexpected(p, peek(p));
+        return -1;
+    }
+    return list;
+}
+
+
+/*Parse { list }*/
+static int32_t parse_group(struct parser *p) {
+    advance(p);
+    int32_t list = parse_body(p, false);
+    if (list < 0 || !expect(p, "}")) {
+        return -1;
+    }
+    int32_t n = node_new(p->ast, NODE_GROUP);
+    p->ast->nodes[n].a = list;
+    return n;
+}
+
+
+/*Parse if list; then list [elif list; then list]... [else list] fi. An
+* elif becomes an if node in the else branch and shares the fi.*/
+static int32_t parse_if(struct parser *p) {
+    advance(p);
+    int32_t cond = parse_body(p, false);
+    if (cond < 0 || !expect(p, "then")) {
+        return -1;
+    }
+    int32_t then = parse_body(p, false);
+    if (then < 0) {
+        return -1;
+    }
+    int32_t other = -1;
+    struct tok *t = peek(p);
+    if (is_reserved(t, "elif")) {
+        other = parse_if(p);
+        if (other < 0) {
+            return -1;
+        }
+    } else {
+        if (is_reserved(t, "else")) {
+            advance(p);
+            other = parse_body(p, false);
+            if (other < 0) {
+                return -1;
+            }
+        }
+        if (!expect(p, "fi")) {
+            return -1;
+        }
+    }
+    int32_t n = node_new(p->ast, NODE_IF);
+    p->ast->nodes[n].a = cond;
+    p->ast->nodes[n].b = then;
+    p->ast->nodes[n].c = other;
+    return n;
+}
+
+
+/*Parse while list; do list; done and the same with until*/
+static int32_t parse_while(struct parser *p) {
+    bool until = is_reserved(peek(p), "until");
+    advance(p);
+    int32_t cond = parse_body(p, false);
+    if (cond < 0 || !expect(p, "do")) {
+        return -1;
+    }
+    int32_t body = parse_body(p, false);
+    if (body < 0 || !expect(p, "done")) {
+        return -1;
+    }
+    int32_t n = node_new(p->ast, NODE_WHILE);
+    p->ast->nodes[n].a = cond;
+    p->ast->nodes[n].b = body;
+    p->ast->nodes[n].flags |= until ? NODE_UNTIL : 0;
+    return n;
+}
+
+
+/*Parse for name [in word...]; do list; done. The name and the words are
+* the words of the node, without in the loop goes over "$@".*/
+static int32_t parse_for(struct parser *p) {
+    struct ast *ast = p->ast;
+    advance(p);
+    struct tok *t = peek(p);
+    if (t->kind != T_WORD) {
+        unexpected(p, t);
+        return -1;
+    }
+    uint32_t word0 = word_push(ast, pool_add(ast, t->text, t->len));
+    uint32_t nwords = 1;
+    uint8_t flags = NODE_FORALL;
+    advance(p);
+    skip_newlines(p);
+    if (is_reserved(peek(p), "in")) {
+        flags = 0;
+        advance(p);
+        for (t = peek(p); t->kind == T_WORD; t = peek(p)) {
+            word_push(ast, pool_add(ast, t->text, t->len));
+            nwords++;
+            advance(p);
+        }
+    }
+    t = peek(p);
+    if (t->kind == T_SEMI) {
+        advance(p);
+    }
+    skip_newlines(p);
+    if (!expect(p, "do")) {
+        return -1;
+    }
+    int32_t body = parse_body(p, false);
+    if (body < 0 || !expect(p, "done")) {
+        return -1;
+    }
+    int32_t n = node_new(ast, NODE_FOR);
+    ast->nodes[n].word0 = word0;
+    ast->nodes[n].nwords = nwords;
+    ast->nodes[n].flags = flags;
+    ast->nodes[n].a = body;
+    return n;
+}
+
+
+/*Parse one pattern list and its body of a case, up to and including the
+* ;; or esac that ends it. Sets *last when esac was seen.*/
+static int32_t parse_case_item(struct parser *p, bool *last) {
+    struct ast *ast = p->ast;
+    struct tok *t = peek(p);
+    if (t->kind == T_LPAREN) {
+        advance(p);
+        t = peek(p);
+    }
+    uint32_t word0 = ast->nwords;
+    uint32_t nwords = 0;
+    for (;;) {
+        if (t->kind != T_WORD) {
+            unexpected(p, t);
+            return -1;
+        }
+        word_push(ast, pool_add(ast, t->text, t->len));
+        nwords++;
+        advance(p);
+        t = peek(p);
+        if (t->kind != T_PIPE) {
+            break;
+        }
+        advance(p);
+        t = peek(p);
+    }
+    if (t->kind != T_RPAREN) {
+        unexpected(p, t);
+        return -1;
+    }
+    advance(p);
+    int32_t body = parse_body(p, true);
+    if (body < 0) {
+        return -1;
+    }
+    t = peek(p);
+    if (t->kind == T_DSEMI) {
+        advance(p);
+    } else if (!expect(p, "esac")) {
+        return -1;
+    } else {
+        *last = true;
+    }
+    int32_t n = node_new(ast, NODE_CASEITEM);
+    ast->nodes[n].word0 = word0;
+    ast->nodes[n].nwords = nwords;
+    ast->nodes[n].a = body;
+    return n;
+}
+
+
+/*Parse case word in [pattern [| pattern]...) list ;;]... esac*/
+static int32_t parse_case(struct parser *p) {
+    struct ast *ast = p->ast;
+    advance(p);
+    struct tok *t = peek(p);
+    if (t->kind != T_WORD) {
+        unexpected(p, t);
+        return -1;
+    }
+    uint32_t word0 = word_push(ast, pool_add(ast, t->text, t->len));
+    advance(p);
+    skip_newlines(p);
+    if (!expect(p, "in")) {
+        return -1;
+    }
+    int32_t first = -1, prev = -1;
+    bool last = false;
+    while (!last) {
+        skip_newlines(p);
+        if (is_reserved(peek(p), "esac")) {
+            advance(p);
+            break;
+        }
+        int32_t item = parse_case_item(p, &last);
+        if (item < 0) {
+            return -1;
+        }
+        if (prev < 0) {
+            first = item;
+        } else {
+            ast->nodes[prev].next = item;
+        }
+        prev = item;
+    }
+    int32_t n = node_new(ast, NODE_CASE);
+    ast->nodes[n].word0 = word0;
+    ast->nodes[n].nwords = 1;
+    ast->nodes[n].a = first;
+    return n;
+}
+
+
+static bool is_func_name(const char *s, size_t n) {
+    if (n == 0 || isdigit((unsigned char)s[0])) {
+        return false;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (!isalnum((unsigned char)s[i]) && s[i] != '_' && s[i] != '-' && s[i] != '.') {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/*Check whether the word just lexed is followed by () and skip past them
+* if it is*/
+static bool func_parens(struct parser *p) {
+    size_t i = p->pos;
+    while (i < p->len && (p->src[i] == ' ' || p->src[i] == '\t')) {
+        i++;
+    }
+    if (i >= p->len || p->src[i] != '(') {
+        return false;
+    }
+    for (i++; i < p->len && (p->src[i] == ' ' || p->src[i] == '\t'); i++) {
+    }
+    if (i >= p->len || p->src[i] != ')') {
+        return false;
+    }
+    p->pos = i + 1;
+    return true;
+}
+
+
+/*The word after =~ may use ( ) and | without quotes. It runs to the
+* next blank outside of parentheses.*/
+static bool cond_regex(struct parser *p) {
+    const char *s = p->src;
+    size_t i = p->pos;
+    while (i < p->len && (s[i] == ' ' || s[i] == '\t')) {
+        i++;
+    }
+    size_t start = i;
+    int depth = 0;
+    while (i < p->len) {
+        char c = s[i];
+        if (c == '\\') {
+            i += 2;
+            continue;
+        }
+        if (c == '\'' || c == '"') {
+            for (i++; i < p->len && s[i] != c; i++) {
+                if (c == '"' && s[i] == '\\') {
+                    i++;
+                }
+            }
+            if (i >= p->len) {
+                incomplete(p);
+                return false;
+            }
+        } else if (depth == 0 && (c == ' ' || c == '\t' || c == '\n')) {
+            break;
+        } else if (c == '(') {
+            depth++;
+        } else if (c == ')' && depth > 0) {
+            depth--;
+        }
+        i++;
+    }
+    if (i > p->len) {
+        i = p->len;
+    }
+    if (i == start) {
+        unexpected(p, peek(p));
+        return false;
+    }
+    word_push(p->ast, pool_add(p->ast, s + start, i - start));
+    p->pos = i;
+    return true;
+}
+
+
+/*Parse [[ expression ]]. The words of the expression are kept as they
+* are, operators such as && and ( included; the expression is only
+* evaluated when it runs.*/
+static int32_t parse_cond(struct parser *p) {
+    struct ast *ast = p->ast;
+    advance(p);
+    uint32_t word0 = ast->nwords, nwords = 0;
+    for (;;) {
+        struct tok *t = peek(p);
+        if (p->status != PARSE_OK) {
+            return -1;
+        }
+        if (t->kind == T_NEWLINE) {
+            advance(p);
+            continue;
+        }
+        if (is_reserved(t, "]]")) {
+            if (nwords == 0) {
+                unexpected(p, t);
+                return -1;
+            }
+            advance(p);
+            break;
+        }
+        switch (t->kind) {
+        case T_WORD:
+        case T_ANDIF:
+        case T_ORIF:
+        case T_LPAREN:
+        case T_RPAREN:
+        case T_LESS:
+        case T_GREAT:
+            word_push(ast, pool_add(ast, t->text, t->len));
+            nwords++;
+            if (is_reserved(t, "=~")) {
+                advance(p);
+                if (!cond_regex(p)) {
+                    return -1;
+                }
+                nwords++;
+                break;
+            }
+            advance(p);
+            break;
+        default:
+            unexpected(p, t);
+            return -1;
+        }
+    }
+    int32_t n = node_new(ast, NODE_COND);
+    ast->nodes[n].word0 = word0;
+    ast->nodes[n].nwords = nwords;
+    return n;
+}
+
+
+/*Parse a command: a compound command, a function definition
+* name() { ... } or a simple command*/
+static int32_t parse_command(struct parser *p) {
+    struct ast *ast = p->ast;
+    struct tok *t = peek(p);
+    if (is_reserved(t, "{")) {
+        return parse_compound_redirs(p, parse_group(p));
+    }
+    if (is_reserved(t, "if")) {
+        return parse_compound_redirs(p, parse_if(p));
+    }
+    if (is_reserved(t, "while") || is_reserved(t, "until")) {
+        return parse_compound_redirs(p, parse_while(p));
+    }
+    if (is_reserved(t, "for")) {
+        return parse_compound_redirs(p, parse_for(p));
+    }
+    if (is_reserved(t, "case")) {
+        return parse_compound_redirs(p, parse_case(p));
+    }
+    if (is_reserved(t, "[[")) {
+        return parse_cond(p);
+    }
+    if (is_terminator(t)) {
+        unexpected(p, t);
+        return -1;
+    }
+    if (t->kind == T_ARITH) {
+        int32_t n = node_new(ast, NODE_ARITH);
+        ast->nodes[n].word0 = word_push(ast, pool_add(ast, t->text, t->len));
+        ast->nodes[n].nwords = 1;
+        advance(p);
+        return n;
+    }
+    if (t->kind == T_WORD && is_func_name(t->text, t->len) && func_parens(p)) {
+        struct word name = pool_add(ast, t->text, t->len);
+        advance(p);
+        skip_newlines(p);
+        t = peek(p);
+        if (!is_reserved(t, "{")) {
+            unexpected(p, t);
+            return -1;
+        }
+        int32_t body = parse_compound_redirs(p, parse_group(p));
+        if (body < 0) {
+            return -1;
+        }
+        int32_t n = node_new(ast, NODE_FUNC);
+        ast->nodes[n].word0 = word_push(ast, name);
+        ast->nodes[n].nwords = 1;
+        ast->nodes[n].a = body;
+        return n;
+    }
+    return parse_simple(p);
+}
+
+
+/*Parse a pipeline: an optional ! and commands joined by |. A single
+* command is returned as is without a pipe node around it.*/
+static int32_t parse_pipeline(struct parser *p) {
+    struct ast *ast = p->ast;
+    bool negate = false;
+    struct tok *t = peek(p);
+    if (t->kind == T_WORD && t->len == 1 && t->text[0] == '!') {
+        negate = true;
+        advance(p);
+    }
+
+    int32_t first = parse_command(p);
+    if (first < 0) {
+        return -1;
+    }
+    int32_t result = first;
+    if (peek(p)->kind == T_PIPE) {
+        result = node_new(ast, NODE_PIPE);
+        ast->nodes[result].a = first;
+        int32_t last = first;
+        while (peek(p)->kind == T_PIPE) {
+            advance(p);
+            skip_newlines(p);
+            int32_t cmd = parse_command(p);
+            if (cmd < 0) {
+                return -1;
+            }
+            ast->nodes[last].next = cmd;
+            last = cmd;
+        }
+    }
+    if (negate) {
+        ast->nodes[result].flags |= NODE_NEGATE;
+    }
+    return result;
+}
+
+
+/*Parse pipelines joined by && and ||, which group to the left*/
+static int32_t parse_and_or(struct parser *p) {
+    struct ast *ast = p->ast;
+    int32_t left = parse_pipeline(p);
+    while (left >= 0) {
+        int kind = peek(p)->kind;
+        if (kind != T_ANDIF && kind != T_ORIF) {
+            break;
+        }
+        advance(p);
+        skip_newlines(p);
+        int32_t right = parse_pipeline(p);
+        if (right < 0) {
+            return -1;
+        }
+        int32_t n = node_new(ast, kind == T_ANDIF ? NODE_AND : NODE_OR);
+        ast->nodes[n].a = left;
+        ast->nodes[n].b = right;
+        left = n;
+    }
+    return left;
+}
+
+
+/*Parse a sequence of and-or lists separated by ;, & and newlines. An
+* item followed by & is marked to run in the background. Inside a
+* compound command the sequence ends at a terminator such as fi or done.*/
+static int32_t parse_list(struct parser *p) {
+    struct ast *ast = p->ast;
+    int32_t list = node_new(ast, NODE_LIST);
+    int32_t last = -1;
+
+    for (;;) {
+        struct tok *t = peek(p);
+        while (t->kind == T_NEWLINE || t->kind == T_SEMI) {
+            advance(p);
+            t = peek(p);
+        }
+        if (t->kind == T_EOF || p->status != PARSE_OK) {
+            break;
+        }
+        if (is_terminator(t)) {
+            // Ends the list of a compound command, anywhere else it is an error
+            if (p->depth == 0) {
+                unexpected(p, t);
+            }
+            break;
+        }
+        int32_t item = parse_and_or(p);
+        if (item < 0) {
+            break;
+        }
+        if (last < 0) {
+            ast->nodes[list].a = item;
+        } else {
+            ast->nodes[last].next = item;
+        }
+        last = item;
+
+        t = peek(p);
+        if (t->kind == T_AMP) {
+            ast->nodes[item].flags |= NODE_BG;
+            advance(p);
+        } else if (t->kind != T_NEWLINE && t->kind != T_SEMI && t->kind != T_EOF &&
+                   t->kind != T_DSEMI) {
+            unexpected(p, t);
+            break;
+        }
+    }
+    if (p->depth > 0 && peek(p)->kind == T_EOF) {
+        // A compound command is still open
+        incomplete(p);
+    }
+    return list;
+}
+
+
+// Render a node back into shell syntax, used to show jobs
+void ast_text(const struct ast *ast, int32_t idx, struct strbuf *out) {
+    if (idx < 0) {
+        return;
+    }
+    const struct node *n = &ast->nodes[idx];
+    static const char *redir_ops[] = { "<", ">", ">>", ">&", "<<", "<<<" };
+    if (n->flags & NODE_NEGATE) {
+        strbuf_adds(out, "! ");
+    }
+    switch (n->kind) {
+    case NODE_CMD:
+        for (uint32_t i = 0; i < n->nwords; i++) {
+            if (i > 0) {
+                strbuf_addc(out, ' ');
+            }
+            strbuf_adds(out, ast_str(ast, ast->words[n->word0 + i]));
+        }
+        break;
+    case NODE_PIPE:
+        for (int32_t c = n->a; c >= 0; c = ast->nodes[c].next) {
+            ast_text(ast, c, out);
+            if (ast->nodes[c].next >= 0) {
+                strbuf_adds(out, " | ");
+            }
+        }
+        break;
+    case NODE_AND:
+    case NODE_OR:
+        ast_text(ast, n->a, out);
+        strbuf_adds(out, n->kind == NODE_AND ? " && " : " || ");
+        ast_text(ast, n->b, out);
+        break;
+    case NODE_LIST:
+        for (int32_t c = n->a; c >= 0; c = ast->nodes[c].next) {
+            ast_text(ast, c, out);
+            if (ast->nodes[c].flags & NODE_BG) {
+                strbuf_adds(out, " &");
+            }
+            if (ast->nodes[c].next >= 0) {
+                strbuf_adds(out, "; ");
+            }
+        }
+        break;
+    case NODE_GROUP:
+        strbuf_adds(out, "{ ");
+        ast_text(ast, n->a, out);
+        strbuf_adds(out, "; }");
+        break;
+    case NODE_COND:
+        strbuf_adds(out, "[[");
+        for (uint32_t i = 0; i < n->nwords; i++) {
+            strbuf_addc(out, ' ');
+            strbuf_adds(out, ast_str(ast, ast->words[n->word0 + i]));
+        }
+        strbuf_adds(out, " ]]");
+        break;
+    case NODE_ARITH:
+        strbuf_adds(out, "((");
+        strbuf_adds(out, ast_str(ast, ast->words[n->word0]));
+        strbuf_adds(out, "))");
+        break;
+    case NODE_FUNC:
+        strbuf_adds(out, ast_str(ast, ast->words[n->word0]));
+        strbuf_adds(out, "() ");
+        ast_text(ast, n->a, out);
+        break;
+    case NODE_IF:
+        strbuf_adds(out, "if ");
+        for (;;) {
+            ast_text(ast, n->a, out);
+            strbuf_adds(out, "; then ");
+            ast_text(ast, n->b, out);
+            if (n->c < 0 || ast->nodes[n->c].kind != NODE_IF) {
+                break;
+            }
+            strbuf_adds(out, "; elif ");
+            n = &ast->nodes[n->c];
+        }
+        if (n->c >= 0) {
+            strbuf_adds(out, "; else ");
+            ast_text(ast, n->c, out);
+        }
+        strbuf_adds(out, "; fi");
+        break;
+    case NODE_WHILE:
+        strbuf_adds(out, (n->flags & NODE_UNTIL) ? "until " : "while ");
+        ast_text(ast, n->a, out);
+        strbuf_adds(out, "; do ");
+        ast_text(ast, n->b, out);
+        strbuf_adds(out, "; done");
+        break;
+    case NODE_FOR:
+        strbuf_adds(out, "for ");
+        strbuf_adds(out, ast_str(ast, ast->words[n->word0]));
+        if (!(n->flags & NODE_FORALL)) {
+            strbuf_adds(out, " in");
+        }
+        for (uint32_t i = 1; i < n->nwords; i++) {
+            strbuf_addc(out, ' ');
+            strbuf_adds(out, ast_str(ast, ast->words[n->word0 + i]));
+        }
+        strbuf_adds(out, "; do ");
+        ast_text(ast, n->a, out);
+        strbuf_adds(out, "; done");
+        break;
+    case NODE_CASE:
+        strbuf_adds(out, "case ");
+        strbuf_adds(out, ast_str(ast, ast->words[n->word0]));
+        strbuf_adds(out, " in");
+        for (int32_t c = n->a; c >= 0; c = ast->nodes[c].next) {
+            strbuf_addc(out, ' ');
+            ast_text(ast, c, out);
+        }
+        strbuf_adds(out, " esac");
+        break;
+    case NODE_CASEITEM:
+        for (uint32_t i = 0; i < n->nwords; i++) {
+            strbuf_adds(out, i > 0 ? "|" : "");
+            strbuf_adds(out, ast_str(ast, ast->words[n->word0 + i]));
+        }
+        strbuf_adds(out, ") ");
+        ast_text(ast, n->a, out);
+        strbuf_adds(out, ";;");
+        break;
+    }
+    // The if case walked n down its elif chain
+    n = &ast->nodes[idx];
+    for (uint32_t i = 0; i < n->nredirs; i++) {
+        const struct redir *r = &ast->redirs[n->redir0 + i];
+        if (out->len > 0) {
+            strbuf_addc(out, ' ');
+        }
+        strbuf_adds(out, redir_ops[r->kind]);
+        strbuf_adds(out, r->kind == REDIR_HEREDOC ? "EOF" : ast_str(ast, r->arg));
+    }
+}
+
+
+/*Copy node idx of src into dst, along with its children and the chains
+* they start, but not the siblings that follow idx itself*/
+static int32_t node_copy(struct ast *dst, const struct ast *src, int32_t idx) {
+    if (idx < 0) {
+        return -1;
+    }
+    const struct node *s = &src->nodes[idx];
+    int32_t n = node_new(dst, s->kind);
+    dst->nodes[n].flags = s->flags;
+    dst->nodes[n].word0 = dst->nwords;
+    dst->nodes[n].nwords = s->nwords;
+    for (uint32_t i = 0; i < s->nwords; i++) {
+        struct word w = src->words[s->word0 + i];
+        word_push(dst, pool_add(dst, ast_str(src, w), w.len));
+    }
+    dst->nodes[n].redir0 = dst->nredirs;
+    dst->nodes[n].nredirs = s->nredirs;
+    for (uint32_t i = 0; i < s->nredirs; i++) {
+        struct redir r = src->redirs[s->redir0 + i];
+        r.arg = pool_add(dst, ast_str(src, r.arg), r.arg.len);
+        r.memfd = -1;
+        r.map = NULL;
+        r.maplen = 0;
+        redir_push(dst, &r);
+    }
+    int32_t kids[3] = { s->a, s->b, s->c };
+    for (int k = 0; k < 3; k++) {
+        int32_t first = -1, last = -1;
+        for (int32_t c = kids[k]; c >= 0; c = src->nodes[c].next) {
+            int32_t copy = node_copy(dst, src, c);
+            if (last < 0) {
+                first = copy;
+            } else {
+                dst->nodes[last].next = copy;
+            }
+            last = copy;
+        }
+        kids[k] = first;
+    }
+    dst->nodes[n].a = kids[0];
+    dst->nodes[n].b = kids[1];
+    dst->nodes[n].c = kids[2];
+    return n;
+}
+
+
+// Copy a node and everything below it into a tree of its own
+struct ast *ast_extract(const struct ast *ast, int32_t idx) {
+    struct ast *copy = xcalloc(1, sizeof(*copy));
+    copy->root = node_copy(copy, ast, idx);
+    return copy;
+}
+
+
+/*Parse a complete chunk of shell input into a flat syntax tree*/
+struct ast *ast_parse(const char *src, int *status) {
+    struct ast *ast = xcalloc(1, sizeof(*ast));
+    ast->root = -1;
+    struct parser p = {0};
+    p.ast = ast;
+    p.src = src;
+    p.len = strlen(src);
+    p.status = PARSE_OK;
+
+    ast->root = parse_list(&p);
+    if (p.status == PARSE_OK && p.nread < p.nheredocs) {
+        p.status = PARSE_INCOMPLETE;
+    }
+    free(p.heredocs);
+    *status = p.status;
+    return ast;
+}
+
+
+// Free a tree and any runtime resources cached on it
+void ast_free(struct ast *ast) {
+    if (ast == NULL) {
+        return;
+    }
+    for (uint32_t i = 0; i < ast->nredirs; i++) {
+        struct redir *r = &ast->redirs[i];
+        if (r->map != NULL) {
+            munmap((void *)r->map, r->maplen);
+        }
+        if (r->memfd >= 0) {
+            close(r->memfd);
+        }
+    }
+    free(ast->nodes);
+    free(ast->words);
+    free(ast->redirs);
+    free(ast->pool);
+    free(ast->error);
+    prog_free(ast->prog);
+    free(ast);
+}
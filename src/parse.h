@@ -0,0 +1,199 @@
+#ifndef PARSE_H
+#define PARSE_H
+#include <stddef.h>
+#include <stdint.h>
+#include "util.h"
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+struct prog;
+
+
+/* Result of parsing a chunk of input */
+#define PARSE_OK 0
+#define PARSE_INCOMPLETE 1
+#define PARSE_ERROR 2
+
+
+enum node_kind
+{
+NODE_CMD,       // simple command: words and redirections
+NODE_LIST,      // a = first item of a sequence linked through next
+NODE_PIPE,      // a = first stage of a pipeline linked through next
+NODE_AND,       // a && b
+NODE_OR,        // a || b
+NODE_GROUP,     // { a } where a is a list
+NODE_FUNC,      // name() a, the name is the only word and a is the body
+NODE_IF,        // if a; then b; else c, c is another if for elif
+NODE_WHILE,     // while a; do b
+NODE_FOR,       // for word0 in the other words; do a
+NODE_CASE,      // case word0 in, a = first item linked through next
+NODE_CASEITEM,  // the words are patterns, a is the list they run
+NODE_ARITH,     // (( expression )), the expression is the only word
+NODE_COND,      // [[ expression ]], the words of the expression
+};
+
+
+/* Node flags */
+#define NODE_BG 0x01        // item of a list followed by &
+#define NODE_NEGATE 0x02    // pipeline preceded by !
+#define NODE_UNTIL 0x04     // while loop written as until
+#define NODE_FORALL 0x08    // for loop without in, over "$@"
+
+
+enum redir_kind
+{
+REDIR_IN,       // n<file
+REDIR_OUT,      // n>file
+REDIR_APPEND,   // n>>file
+REDIR_DUP,      // n>&m and n<&m
+REDIR_HEREDOC,  // n<<delim
+REDIR_HERESTR,  // n<<<word
+};
+
+
+/* Redirection flags */
+#define REDIR_QUOTED 0x01   // heredoc delimiter was quoted, body is literal
+#define REDIR_STRIPTABS 0x02 // <<- strips leading tabs from the body
+
+
+/* A word is a NUL terminated string stored in the string pool of the ast */
+struct word
+{
+uint32_t off;
+uint32_t len;
+};
+
+
+struct redir
+{
+uint8_t kind;
+uint8_t flags;
+int16_t fd;
+struct word arg;     // file name, here-string word or heredoc body
+// Runtime cache of the sealed memfd holding the last heredoc body
+int memfd;
+const char *map;
+size_t maplen;
+};
+
+
+/* Every node lives in one flat array and refers to others by index */
+struct node
+{
+uint8_t kind;
+uint8_t flags;
+uint16_t pad;
+int32_t next;        // next sibling in a list, -1 when last
+int32_t a, b, c;     // kind specific children, -1 when unused
+uint32_t word0, nwords;
+uint32_t redir0, nredirs;
+};
+
+
+struct ast
+{
+struct node *nodes;
+uint32_t nnodes, capnodes;
+struct word *words;
+uint32_t nwords, capwords;
+struct redir *redirs;
+uint32_t nredirs, capredirs;
+char *pool;
+uint32_t poollen, poolcap;
+int32_t root;
+char *error;
+struct prog *prog;   // compiled on first run, see vm.h
+};
+
+
+/**
+* @brief Parse a complete chunk of shell input into a flat syntax tree.
+* If the input ends before a construct is complete, for example inside
+* a quoted string or before a heredoc delimiter has been seen, the status
+* is set to PARSE_INCOMPLETE so the caller can read more input and try
+* again. The tree must be released with ast_free.
+*
+* @param src The source text
+* @param status Set to one of PARSE_OK, PARSE_INCOMPLETE or PARSE_ERROR
+* @return struct ast* The tree, NULL only when out of memory
+*/
+struct ast *ast_parse(const char *src, int *status);
+
+
+/**
+* @brief Copy a node and everything below it into a tree of its own, whose
+* root is the copy. Used to keep function bodies after the tree that
+* defined them is gone.
+*
+* @param ast The tree
+* @param idx The node
+* @return struct ast* The new tree, free it with ast_free
+*/
+struct ast *ast_extract(const struct ast *ast, int32_t idx);
+
+
+/**
+* @brief Find the end of a parenthesized group such as $(...) or <(...).
+* Quotes inside the group are skipped.
+*
+* @param s The text
+* @param i Index just past the opening paren
+* @param len Length of the text
+* @return size_t Index just past the closing paren, 0 if the text ended first
+*/
+size_t parse_group_end(const char *s, size_t i, size_t len);
+
+
+/**
+* @brief Find the end of a shell word: quotes, expansions and the list
+* of a compound assignment name=(...) are part of it.
+*
+* @param s The text
+* @param i Index of the first character of the word
+* @param len Length of the text
+* @return size_t Index just past the word, the same as i when s[i] starts
+* an operator, 0 if the text ended inside a quote or group
+*/
+size_t parse_word_end(const char *s, size_t i, size_t len);
+
+
+/**
+* @brief Render a node back into shell syntax. The text is meant for
+* people, for example in the jobs listing, and heredoc bodies are left
+* out.
+*
+* @param ast The tree
+* @param idx The node to render
+* @param out The buffer to append to
+*/
+void ast_text(const struct ast *ast, int32_t idx, struct strbuf *out);
+
+
+/**
+* @brief Free a tree and any runtime resources cached on it
+*
+* @param ast The tree to free
+*/
+void ast_free(struct ast *ast);
+
+
+/**
+* @brief Get the text of a word stored in the tree
+*
+* @param ast The tree
+* @param w The word
+* @return const char* NUL terminated raw text of the word
+*/
+static inline const char *ast_str(const struct ast *ast, struct word w)
+{
+return ast->pool + w.off;
+}
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
@@ -0,0 +1,299 @@
+#include "pattern.h"
+#include "hmap.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+// Distinct patterns kept before the cache starts over
+#define PATTERN_CACHE_MAX 1024
+
+
+/* The byte set of one position */
+struct byteset
+{
+uint64_t bits[4];
+};
+
+
+static struct hmap cache;
+
+
+static void set_add(struct byteset *b, unsigned char c) {
+    b->bits[c >> 6] |= 1ULL << (c & 63);
+}
+
+
+static bool set_has(const struct byteset *b, unsigned char c) {
+    return (b->bits[c >> 6] >> (c & 63)) & 1;
+}
+
+
+static const struct
+{
+const char *name;
+int (*fn)(int);
+} classes[] = {
+    { "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank },
+    { "cntrl", iscntrl }, { "digit", isdigit }, { "graph", isgraph },
+    { "lower", islower }, { "print", isprint }, { "punct", ispunct },
+    { "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit },
+};
+
+
+/*Parse the bracket expression starting at pat[i] == '['. Returns the
+* index just past it, 0 when it is not closed and [ is a literal.*/
+static size_t bracket(const char *pat, size_t n, size_t i, struct byteset *set) {
+    memset(set, 0, sizeof(*set));
+    size_t j = i + 1;
+    bool negate = j < n && (pat[j] == '!' || pat[j] == '^');
+    if (negate) {
+        j++;
+    }
+    bool first = true;
+    while (j < n && (pat[j] != ']' || first)) {
+        first = false;
+        if (pat[j] == '[' && j + 1 < n && pat[j + 1] == ':') {
+            const char *end = memchr(pat + j + 2, ':', n - j - 2);
+            if (end != NULL && end + 1 < pat + n && end[1] == ']') {
+                size_t len = end - (pat + j + 2);
+                for (size_t k = 0; k < sizeof(classes) / sizeof(classes[0]); k++) {
+                    if (strlen(classes[k].name) == len && memcmp(classes[k].name, pat + j + 2, len) == 0) {
+                        for (int c = 1; c < 256; c++) {
+                            if (classes[k].fn(c)) {
+                                set_add(set, c);
+                            }
+                        }
+                    }
+                }
+                j = end + 2 - pat;
+                continue;
+            }
+        }
+        unsigned char lo = pat[j];
+        if (lo == '\\' && j + 1 < n) {
+            lo = pat[++j];
+        }
+        j++;
+        unsigned char hi = lo;
+        if (j + 1 < n && pat[j] == '-' && pat[j + 1] != ']') {
+            hi = pat[j + 1];
+            if (hi == '\\' && j + 2 < n) {
+                hi = pat[j + 2];
+                j++;
+            }
+            j += 2;
+        }
+        for (unsigned c = lo; c <= hi; c++) {
+            set_add(set, c);
+        }
+    }
+    if (j >= n) {
+        return 0;
+    }
+    if (negate) {
+        for (int k = 0; k < 4; k++) {
+            set->bits[k] = ~set->bits[k];
+        }
+    }
+    return j + 1;
+}
+
+
+// Check whether a pattern has any unquoted wildcard in it
+bool pattern_has_magic(const char *pat, size_t n) {
+    struct byteset unused;
+    for (size_t i = 0; i < n; i++) {
+        if (pat[i] == '\\') {
+            i++;
+        } else if (pat[i] == '*' || pat[i] == '?') {
+            return true;
+        } else if (pat[i] == '[' && bracket(pat, n, i, &unused) != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/*Compile a pattern. Each position becomes a state: a star loops on
+* every byte and is left without consuming one, any other position
+* moves to the next state on the bytes of its set.*/
+static struct pattern *pattern_compile(const char *pat, size_t n) {
+    struct pattern *p = xcalloc(1, sizeof(*p));
+    p->refs = 1;
+    if (!pattern_has_magic(pat, n)) {
+        // Only quoting to remove
+        p->literal = true;
+        p->text = xmalloc(n + 1);
+        for (size_t i = 0; i < n; i++) {
+            if (pat[i] == '\\' && i + 1 < n) {
+                i++;
+            }
+            p->text[p->len++] = pat[i];
+        }
+        p->text[p->len] = '\0';
+        return p;
+    }
+    p->text = xstrndup(pat, n);
+    p->len = n;
+
+    struct byteset *sets = xmalloc((n + 1) * sizeof(struct byteset));
+    bool *stars = xcalloc(n + 1, sizeof(bool));
+    uint32_t m = 0;
+    for (size_t i = 0; i < n;) {
+        if (pat[i] == '*') {
+            // Runs of stars are one star
+            if (m == 0 || !stars[m - 1]) {
+                stars[m++] = true;
+            }
+            i++;
+            continue;
+        }
+        struct byteset *set = &sets[m];
+        size_t end;
+        if (pat[i] == '?') {
+            memset(set, 0xff, sizeof(*set));
+            i++;
+        } else if (pat[i] == '[' && (end = bracket(pat, n, i, set)) != 0) {
+            i = end;
+        } else {
+            if (pat[i] == '\\' && i + 1 < n) {
+                i++;
+            }
+            memset(set, 0, sizeof(*set));
+            set_add(set, pat[i++]);
+        }
+        stars[m++] = false;
+    }
+
+    p->nstates = m + 1;
+    p->nw = (p->nstates + 63) / 64;
+    p->star = xcalloc(p->nw, sizeof(uint64_t));
+    p->mask = xcalloc(256 * (size_t)p->nw, sizeof(uint64_t));
+    for (uint32_t k = 0; k < m; k++) {
+        if (stars[k]) {
+            p->star[k / 64] |= 1ULL << (k % 64);
+            continue;
+        }
+        // Position k takes state k to state k + 1
+        uint32_t to = k + 1;
+        for (int c = 0; c < 256; c++) {
+            if (set_has(&sets[k], c)) {
+                p->mask[c * p->nw + to / 64] |= 1ULL << (to % 64);
+            }
+        }
+    }
+    free(sets);
+    free(stars);
+    return p;
+}
+
+
+// Get the compiled form of a pattern
+struct pattern *pattern_get(const char *pat, size_t n) {
+    struct hmap_entry *ent = hmap_findn(&cache, pat, n);
+    if (ent != NULL) {
+        struct pattern *p = ent->value;
+        p->refs++;
+        return p;
+    }
+    struct pattern *p = pattern_compile(pat, n);
+    if (cache.n >= PATTERN_CACHE_MAX) {
+        pattern_free();
+    }
+    bool added;
+    hmap_putn(&cache, pat, n, &added)->value = p;
+    p->refs++;
+    return p;
+}
+
+
+// Give back a pattern
+void pattern_put(struct pattern *p) {
+    if (p != NULL && --p->refs == 0) {
+        free(p->text);
+        free(p->star);
+        free(p->mask);
+        free(p);
+    }
+}
+
+
+static void pattern_unref(void *p) {
+    pattern_put(p);
+}
+
+
+// Forget every cached pattern
+void pattern_free(void) {
+    hmap_free(&cache, pattern_unref);
+}
+
+
+/*Follow the moves that consume nothing: a star state also activates the
+* state after it. Runs of stars were merged, so one pass is enough.*/
+static void closure(uint64_t *d, const uint64_t *star, uint32_t nw) {
+    uint64_t carry = 0;
+    for (uint32_t w = 0; w < nw; w++) {
+        uint64_t s = d[w] & star[w];
+        d[w] |= (s << 1) | carry;
+        carry = s >> 63;
+    }
+}
+
+
+// Match with the state set in a single word, the common case
+static bool match1(const struct pattern *p, const unsigned char *s, size_t n) {
+    uint64_t star = p->star[0];
+    uint64_t d = 1;
+    d |= (d & star) << 1;
+    for (size_t i = 0; i < n && d != 0; i++) {
+        d = ((d << 1) & p->mask[s[i]]) | (d & star);
+        d |= (d & star) << 1;
+    }
+    return (d >> (p->nstates - 1)) & 1;
+}
+
+
+// Match a whole string against a compiled pattern
+bool pattern_match(const struct pattern *p, const char *s, size_t n) {
+    if (p->literal) {
+        return n == p->len && memcmp(s, p->text, n) == 0;
+    }
+    if (p->nw == 1) {
+        return match1(p, (const unsigned char *)s, n);
+    }
+    uint32_t nw = p->nw;
+    uint64_t *d = xcalloc(nw, sizeof(uint64_t));
+    d[0] = 1;
+    closure(d, p->star, nw);
+    bool alive = true;
+    for (size_t i = 0; i < n && alive; i++) {
+        const uint64_t *m = &p->mask[(unsigned char)s[i] * (size_t)nw];
+        uint64_t carry = 0;
+        alive = false;
+        for (uint32_t w = 0; w < nw; w++) {
+            uint64_t next = (((d[w] << 1) | carry) & m[w]) | (d[w] & p->star[w]);
+            carry = d[w] >> 63;
+            d[w] = next;
+        }
+        closure(d, p->star, nw);
+        for (uint32_t w = 0; w < nw; w++) {
+            alive |= d[w] != 0;
+        }
+    }
+    uint32_t last = p->nstates - 1;
+    bool match = (d[last / 64] >> (last % 64)) & 1;
+    free(d);
+    return match;
+}
+
+
+// Match a string against a pattern given as text
+bool pattern_matches(const char *pat, const char *s) {
+    struct pattern *p = pattern_get(pat, strlen(pat));
+    bool match = pattern_match(p, s, strlen(s));
+    pattern_put(p);
+    return match;
+}
@@ -0,0 +1,93 @@
+#ifndef PATTERN_H
+#define PATTERN_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/* A compiled shell pattern. Every position of the pattern is a state of
+* an NFA, the set of active states is a bit vector that advances by a
+* shift and a mask per input byte, so matching is linear in the length
+* of the string whatever the pattern. */
+struct pattern
+{
+int refs;
+uint32_t nstates;    // positions + 1, the last state accepts
+uint32_t nw;         // 64-bit words in a state set
+bool literal;        // no wildcards, the text is compared as is
+char *text;          // the literal text, or the pattern it came from
+size_t len;
+uint64_t *star;      // nw words: states that loop on any byte
+uint64_t *mask;      // 256 * nw words: states entered on a byte
+};
+
+
+/**
+* @brief Get the compiled form of a pattern. Patterns are compiled once
+* and kept in a cache by their text. The pattern is the one case and
+* globbing use: *, ?, [...] with ranges, [!...] and [:class:], and
+* backslash to quote the next character.
+*
+* @param pat The pattern
+* @param n Its length
+* @return struct pattern* The compiled pattern, give it back with
+* pattern_put
+*/
+struct pattern *pattern_get(const char *pat, size_t n);
+
+
+/**
+* @brief Give back a pattern from pattern_get
+*
+* @param p The pattern, may be NULL
+*/
+void pattern_put(struct pattern *p);
+
+
+/**
+* @brief Match a whole string against a compiled pattern
+*
+* @param p The pattern
+* @param s The string
+* @param n Its length
+* @return true When the pattern matches all of s
+*/
+bool pattern_match(const struct pattern *p, const char *s, size_t n);
+
+
+/**
+* @brief Match a string against a pattern given as text, through the
+* cache
+*
+* @param pat The pattern
+* @param s The string
+* @return true When the pattern matches all of s
+*/
+bool pattern_matches(const char *pat, const char *s);
+
+
+/**
+* @brief Check whether a pattern has any unquoted wildcard in it
+*
+* @param pat The pattern
+* @param n Its length
+* @return true When it is more than literal text
+*/
+bool pattern_has_magic(const char *pat, size_t n);
+
+
+/**
+* @brief Forget every cached pattern. Patterns still held stay valid
+* until they are put back.
+*/
+void pattern_free(void);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
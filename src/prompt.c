@@ -0,0 +1,477 @@
+#define _GNU_SOURCE
+#include "prompt.h"
+#include "lab.h"
+#include "jobs.h"
+#include "util.h"
+#include "vars.h"
+#include "cmdhash.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
+#include <pwd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <time.h>
+#include <sys/wait.h>
+
+// How long the worker waits for git before giving up on \g
+#define PROMPT_ASYNC_TIMEOUT_MS 1000
+
+
+static void seg_add(struct prompt *p, int kind, unsigned inputs, char *text) {
+    p->segs = xrealloc(p->segs, (p->nsegs + 1) * sizeof(struct prompt_seg));
+    p->segs[p->nsegs].kind = kind;
+    p->segs[p->nsegs].inputs = inputs;
+    p->segs[p->nsegs].text = text;
+    p->segs[p->nsegs].result = NULL;
+    p->segs[p->nsegs].ready = false;
+    p->nsegs++;
+    p->inputs |= inputs;
+}
+
+
+static char *user_name(void) {
+    struct passwd *pw = getpwuid(getuid());
+    if (pw != NULL) {
+        return xstrdup(pw->pw_name);
+    }
+    const char *user = var_get("USER");
+    return xstrdup(user ? user : "?");
+}
+
+
+static char *host_name(bool full) {
+    char buf[HOST_NAME_MAX + 1];
+    if (gethostname(buf, sizeof(buf)) < 0) {
+        return xstrdup("?");
+    }
+    buf[HOST_NAME_MAX] = '\0';
+    if (!full) {
+        char *dot = strchr(buf, '.');
+        if (dot != NULL) {
+            *dot = '\0';
+        }
+    }
+    return xstrdup(buf);
+}
+
+
+// Compile a prompt template into a list of segments
+struct prompt *prompt_compile(const char *tmpl) {
+    struct prompt *p = xcalloc(1, sizeof(*p));
+    struct strbuf lit = {0};
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->cond, NULL);
+
+    for (const char *s = tmpl; *s; s++) {
+        if (*s != '\\' || s[1] == '\0') {
+            strbuf_addc(&lit, *s);
+            continue;
+        }
+        s++;
+        int kind = -1;
+        unsigned inputs = 0;
+        char *text = NULL;
+        switch (*s) {
+        case 'n': strbuf_addc(&lit, '\n'); break;
+        case 'e': strbuf_addc(&lit, '\033'); break;
+        case '\\': strbuf_addc(&lit, '\\'); break;
+        case '[': strbuf_addc(&lit, '\001'); break;
+        case ']': strbuf_addc(&lit, '\002'); break;
+        // Static segments are folded into the literal text right away
+        case 'u':
+            text = user_name();
+            strbuf_adds(&lit, text);
+            free(text);
+            break;
+        case 'h':
+        case 'H':
+            text = host_name(*s == 'H');
+            strbuf_adds(&lit, text);
+            free(text);
+            break;
+        case '$': strbuf_addc(&lit, geteuid() == 0 ? '#' : '$'); break;
+        case 'w': kind = SEG_CWD; inputs = PROMPT_IN_CWD; break;
+        case 'W': kind = SEG_CWD_BASE; inputs = PROMPT_IN_CWD; break;
+        case '?': kind = SEG_STATUS; inputs = PROMPT_IN_STATUS; break;
+        case 'D': kind = SEG_DURATION; inputs = PROMPT_IN_DURATION; break;
+        case 'j': kind = SEG_JOBS; inputs = PROMPT_IN_JOBS; break;
+        case 'g': kind = SEG_VCS; inputs = PROMPT_IN_ASYNC; break;
+        case 'l': kind = SEG_LOAD; inputs = PROMPT_IN_ASYNC; break;
+        default:
+            strbuf_addc(&lit, '\\');
+            strbuf_addc(&lit, *s);
+            break;
+        }
+        if (kind >= 0) {
+            if (lit.len > 0) {
+                seg_add(p, SEG_TEXT, 0, strbuf_steal(&lit));
+            }
+            seg_add(p, kind, inputs, NULL);
+        }
+    }
+    if (lit.len > 0 || p->nsegs == 0) {
+        seg_add(p, SEG_TEXT, 0, strbuf_steal(&lit));
+    }
+    return p;
+}
+
+
+static char *render_cwd(bool base) {
+    char *cwd = getcwd(NULL, 0);
+    if (cwd == NULL) {
+        return xstrdup("?");
+    }
+    if (base) {
+        char *slash = strrchr(cwd, '/');
+        if (slash != NULL && slash[1] != '\0') {
+            char *name = xstrdup(slash + 1);
+            free(cwd);
+            return name;
+        }
+        return cwd;
+    }
+    const char *home = var_get("HOME");
+    size_t n = home ? strlen(home) : 0;
+    if (n > 1 && strncmp(cwd, home, n) == 0 && (cwd[n] == '/' || cwd[n] == '\0')) {
+        char *short_cwd = xmalloc(strlen(cwd) - n + 2);
+        short_cwd[0] = '~';
+        strcpy(short_cwd + 1, cwd + n);
+        free(cwd);
+        return short_cwd;
+    }
+    return cwd;
+}
+
+
+static char *render_duration(long ms) {
+    char buf[32];
+    if (ms < 1000) {
+        snprintf(buf, sizeof(buf), "%ldms", ms);
+    } else if (ms < 60000) {
+        snprintf(buf, sizeof(buf), "%ld.%lds", ms / 1000, (ms % 1000) / 100);
+    } else {
+        snprintf(buf, sizeof(buf), "%ldm%02lds", ms / 60000, (ms / 1000) % 60);
+    }
+    return xstrdup(buf);
+}
+
+/*Run git status in the current directory and turn its output into the
+* branch name followed by * when tracked files changed. Gives up after
+* PROMPT_ASYNC_TIMEOUT_MS and returns NULL so a slow file system only
+* leaves the previous value of \g on the screen.*/
+static char *vcs_status(struct prompt *p, const char *git, char **envp) {
+    if (git == NULL) {
+        return xstrdup("");
+    }
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) < 0) {
+        return xstrdup("?");
+    }
+    posix_spawn_file_actions_t fa;
+    posix_spawn_file_actions_init(&fa);
+    posix_spawn_file_actions_addopen(&fa, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_adddup2(&fa, fds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addopen(&fa, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    char *argv[] = { "git", "--no-optional-locks", "status", "--porcelain=v2",
+                     "--branch", "--untracked-files=no", NULL };
+    pid_t pid;
+    int err = posix_spawn(&pid, git, &fa, NULL, argv, envp);
+    posix_spawn_file_actions_destroy(&fa);
+    close(fds[1]);
+    if (err != 0) {
+        close(fds[0]);
+        return xstrdup("");
+    }
+
+    struct strbuf out = {0};
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    bool timeout = false;
+    for (;;) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long elapsed = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+        if (elapsed >= PROMPT_ASYNC_TIMEOUT_MS || __atomic_load_n(&p->quit, __ATOMIC_RELAXED)) {
+            timeout = true;
+            break;
+        }
+        // Wake up now and then to notice prompt_free
+        struct pollfd pfd = { fds[0], POLLIN, 0 };
+        int wait = PROMPT_ASYNC_TIMEOUT_MS - elapsed;
+        if (poll(&pfd, 1, wait < 50 ? wait : 50) <= 0) {
+            continue;
+        }
+        char buf[4096];
+        ssize_t n = read(fds[0], buf, sizeof(buf));
+        if (n <= 0) {
+            break;
+        }
+        // Only the header and the first changed entry matter
+        if (out.len < 4096) {
+            strbuf_add(&out, buf, n);
+        }
+    }
+    close(fds[0]);
+    if (timeout) {
+        kill(pid, SIGKILL);
+    }
+    int status;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    if (timeout) {
+        strbuf_free(&out);
+        return NULL;
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || out.len == 0) {
+        // Not a repository
+        strbuf_free(&out);
+        return xstrdup("");
+    }
+
+    strbuf_addc(&out, '\0');
+    struct strbuf res = {0};
+    bool dirty = false;
+    for (char *line = out.s; line && *line;) {
+        char *nl = strchr(line, '\n');
+        size_t n = nl ? (size_t)(nl - line) : strlen(line);
+        if (n > 14 && strncmp(line, "# branch.head ", 14) == 0) {
+            strbuf_add(&res, line + 14, n - 14);
+        } else if (line[0] != '#') {
+            dirty = true;
+        }
+        line = nl ? nl + 1 : NULL;
+    }
+    if (dirty) {
+        strbuf_addc(&res, '*');
+    }
+    strbuf_free(&out);
+    return strbuf_steal(&res);
+}
+
+
+static char *load_average(void) {
+    double load;
+    char buf[32];
+    if (getloadavg(&load, 1) < 1) {
+        return xstrdup("?");
+    }
+    snprintf(buf, sizeof(buf), "%.2f", load);
+    return xstrdup(buf);
+}
+
+
+/*The worker thread. Waits for a request, computes every async segment
+* without holding the lock and hands the results back to the main
+* thread which picks them up in prompt_async_update.*/
+static void *prompt_worker(void *arg) {
+    struct prompt *p = arg;
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        while (!p->requested && !p->quit) {
+            pthread_cond_wait(&p->cond, &p->lock);
+        }
+        if (p->quit) {
+            break;
+        }
+        p->requested = false;
+        char *git = p->git;
+        char **envp = p->envp;
+        p->git = NULL;
+        p->envp = NULL;
+        pthread_mutex_unlock(&p->lock);
+
+        for (int i = 0; i < p->nsegs; i++) {
+            struct prompt_seg *seg = &p->segs[i];
+            if (!(seg->inputs & PROMPT_IN_ASYNC)) {
+                continue;
+            }
+            char *value = seg->kind == SEG_VCS ? vcs_status(p, git, envp) : load_average();
+            if (value == NULL) {
+                continue;
+            }
+            pthread_mutex_lock(&p->lock);
+            free(seg->result);
+            seg->result = value;
+            seg->ready = true;
+            pthread_mutex_unlock(&p->lock);
+        }
+        free(git);
+        vars_envp_release(envp);
+        pthread_mutex_lock(&p->lock);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+
+/*Ask the worker to compute the async segments again. git is looked up
+* and the environment taken here because neither the command hash nor
+* the variables may be touched from the worker.*/
+static void async_request(struct prompt *p) {
+    const char *git = cmdhash_find("git");
+    char *path = git ? xstrdup(git) : NULL;
+    char **envp = vars_envp_hold();
+    pthread_mutex_lock(&p->lock);
+    free(p->git);
+    vars_envp_release(p->envp);
+    p->git = path;
+    p->envp = envp;
+    if (!p->started) {
+        sigset_t all, old;
+        // Signals are for the main thread, the worker never handles them
+        sigfillset(&all);
+        pthread_sigmask(SIG_SETMASK, &all, &old);
+        p->started = pthread_create(&p->worker, NULL, prompt_worker, p) == 0;
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+    }
+    p->requested = true;
+    pthread_cond_signal(&p->cond);
+    pthread_mutex_unlock(&p->lock);
+}
+
+
+/*Move finished async values into the segments. A result is skipped while
+* a newer request is pending so an old directory never flashes by.
+* Returns true if any segment text changed.*/
+static bool async_merge(struct prompt *p) {
+    bool changed = false;
+    pthread_mutex_lock(&p->lock);
+    for (int i = 0; i < p->nsegs && !p->requested; i++) {
+        struct prompt_seg *seg = &p->segs[i];
+        if (!seg->ready) {
+            continue;
+        }
+        seg->ready = false;
+        if (seg->text == NULL || strcmp(seg->text, seg->result) != 0) {
+            free(seg->text);
+            seg->text = seg->result;
+            seg->result = NULL;
+            changed = true;
+        }
+    }
+    pthread_mutex_unlock(&p->lock);
+    return changed;
+}
+
+
+// Join the segment texts into p->rendered
+static void prompt_build(struct prompt *p) {
+    struct strbuf out = {0};
+    for (int i = 0; i < p->nsegs; i++) {
+        strbuf_adds(&out, p->segs[i].text ? p->segs[i].text : PROMPT_PLACEHOLDER);
+    }
+    free(p->rendered);
+    p->rendered = strbuf_steal(&out);
+}
+
+
+static char *render_seg(struct shell *sh, struct prompt_seg *seg, int jobs) {
+    char buf[32];
+    switch (seg->kind) {
+    case SEG_CWD:
+        return render_cwd(false);
+    case SEG_CWD_BASE:
+        return render_cwd(true);
+    case SEG_STATUS:
+        snprintf(buf, sizeof(buf), "%d", sh->status);
+        return xstrdup(buf);
+    case SEG_DURATION:
+        return render_duration(sh->duration_ms);
+    case SEG_JOBS:
+        snprintf(buf, sizeof(buf), "%d", jobs);
+        return xstrdup(buf);
+    }
+    return xstrdup("");
+}
+
+
+// Get the prompt string for the current state of the shell
+const char *prompt_render(struct shell *sh, struct prompt *p) {
+    // Find out which inputs changed, each check is a compare without syscalls
+    unsigned changed = 0;
+    unsigned long gen = cwd_generation();
+    int jobs = (p->inputs & PROMPT_IN_JOBS) ? jobs_count(sh) : 0;
+    if (p->rendered == NULL) {
+        changed = p->inputs;
+    }
+    if (gen != p->cwd_gen) {
+        changed |= PROMPT_IN_CWD;
+    }
+    if (sh->status != p->status) {
+        changed |= PROMPT_IN_STATUS;
+    }
+    if (sh->duration_ms != p->duration_ms) {
+        changed |= PROMPT_IN_DURATION;
+    }
+    if (jobs != p->jobs) {
+        changed |= PROMPT_IN_JOBS;
+    }
+    p->cwd_gen = gen;
+    p->status = sh->status;
+    p->duration_ms = sh->duration_ms;
+    p->jobs = jobs;
+
+    bool async = (p->inputs & PROMPT_IN_ASYNC) != 0;
+    bool merged = async && async_merge(p);
+    if (async) {
+        async_request(p);
+    }
+    if (p->rendered != NULL && (changed & p->inputs) == 0 && !merged) {
+        return p->rendered;
+    }
+
+    for (int i = 0; i < p->nsegs; i++) {
+        struct prompt_seg *seg = &p->segs[i];
+        if (seg->kind == SEG_TEXT || (seg->inputs & PROMPT_IN_ASYNC)) {
+            continue;
+        }
+        if (seg->text == NULL || (seg->inputs & changed)) {
+            free(seg->text);
+            seg->text = render_seg(sh, seg, jobs);
+        }
+    }
+    prompt_build(p);
+    return p->rendered;
+}
+
+
+// Pick up values the worker computed for async segments
+bool prompt_async_update(struct prompt *p) {
+    if (!(p->inputs & PROMPT_IN_ASYNC) || !async_merge(p)) {
+        return false;
+    }
+    prompt_build(p);
+    return true;
+}
+
+
+// Free a compiled prompt
+void prompt_free(struct prompt *p) {
+    if (p == NULL) {
+        return;
+    }
+    if (p->started) {
+        pthread_mutex_lock(&p->lock);
+        __atomic_store_n(&p->quit, true, __ATOMIC_RELAXED);
+        pthread_cond_signal(&p->cond);
+        pthread_mutex_unlock(&p->lock);
+        pthread_join(p->worker, NULL);
+    }
+    pthread_mutex_destroy(&p->lock);
+    pthread_cond_destroy(&p->cond);
+    free(p->git);
+    vars_envp_release(p->envp);
+    for (int i = 0; i < p->nsegs; i++) {
+        free(p->segs[i].text);
+        free(p->segs[i].result);
+    }
+    free(p->segs);
+    free(p->rendered);
+    free(p);
+}
@@ -0,0 +1,123 @@
+#ifndef PROMPT_H
+#define PROMPT_H
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+struct shell;
+
+
+enum prompt_seg_kind
+{
+SEG_TEXT,       // literal text, also \u \h \H and \$ which never change
+SEG_CWD,        // \w working directory with $HOME shown as ~
+SEG_CWD_BASE,   // \W last component of the working directory
+SEG_STATUS,     // \? exit status of the last command
+SEG_DURATION,   // \D run time of the last command
+SEG_JOBS,       // \j number of jobs
+SEG_VCS,        // \g git branch, with * when the work tree is dirty
+SEG_LOAD,       // \l one minute load average
+};
+
+
+/* Inputs a segment depends on, a segment is rendered again only when one
+* of its inputs has changed since the last prompt*/
+#define PROMPT_IN_CWD 0x01
+#define PROMPT_IN_STATUS 0x02
+#define PROMPT_IN_DURATION 0x04
+#define PROMPT_IN_JOBS 0x08
+#define PROMPT_IN_ASYNC 0x10  // computed by the worker thread on every prompt
+
+
+/* Shown until the worker has a value for an async segment */
+#define PROMPT_PLACEHOLDER "..."
+
+
+struct prompt_seg
+{
+int kind;
+unsigned inputs;     // PROMPT_IN_* flags
+char *text;          // literal text or the last rendered value
+char *result;        // async value from the worker, guarded by the lock
+bool ready;          // result is waiting to be picked up
+};
+
+
+struct prompt
+{
+struct prompt_seg *segs;
+int nsegs;
+unsigned inputs;     // union of the inputs of all segments
+// Inputs seen when the prompt was last rendered
+unsigned long cwd_gen;
+int status;
+long duration_ms;
+int jobs;
+char *rendered;      // cached result, NULL until the first render
+// Worker thread for async segments, started by the first render
+pthread_t worker;
+pthread_mutex_t lock;
+pthread_cond_t cond;
+bool started;
+bool quit;
+bool requested;      // a refresh is waiting for the worker
+char *git;           // path of git and the environment to run it with,
+char **envp;         // handed to the worker with each request
+};
+
+
+/**
+* @brief Compile a prompt template into a list of segments. Static
+* information such as the user and host name is looked up once here.
+* The template understands \u \h \H \w \W \$ \? \D \j \n \e \\ and
+* \[ \] to mark invisible text for readline. The async segments \g and
+* \l are computed on a worker thread, see prompt_async_update.
+*
+* @param tmpl The template
+* @return struct prompt* The compiled prompt, free it with prompt_free
+*/
+struct prompt *prompt_compile(const char *tmpl);
+
+
+/**
+* @brief Get the prompt string for the current state of the shell. Only
+* segments whose inputs changed since the last call are rendered again,
+* when nothing changed the cached string is returned as is. Async
+* segments show their last value, or a placeholder, and the worker is
+* asked to compute them again.
+*
+* @param sh The shell
+* @param p The compiled prompt
+* @return const char* The prompt, valid until the next call
+*/
+const char *prompt_render(struct shell *sh, struct prompt *p);
+
+
+/**
+* @brief Pick up values the worker computed for async segments. Never
+* blocks on the worker, so it is safe to call from a readline hook while
+* the user types.
+*
+* @param p The compiled prompt
+* @return bool True if the prompt text changed, the new text is in
+* p->rendered and should be redrawn
+*/
+bool prompt_async_update(struct prompt *p);
+
+
+/**
+* @brief Free a compiled prompt. Waits for the worker thread to stop.
+*
+* @param p The prompt
+*/
+void prompt_free(struct prompt *p);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
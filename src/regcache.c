@@ -0,0 +1,94 @@
+#include "regcache.h"
+#include "hmap.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+
+
+/* A compiled expression on the recently used list, most recent first */
+struct regent
+{
+struct regent *prev, *next;
+const char *key;     // owned by the map
+regex_t re;
+};
+
+
+static struct hmap regs;
+static struct regent *head, *tail;
+
+
+static void unlink_ent(struct regent *e) {
+    if (e->prev) {
+        e->prev->next = e->next;
+    } else {
+        head = e->next;
+    }
+    if (e->next) {
+        e->next->prev = e->prev;
+    } else {
+        tail = e->prev;
+    }
+}
+
+
+static void push_front(struct regent *e) {
+    e->prev = NULL;
+    e->next = head;
+    if (head) {
+        head->prev = e;
+    }
+    head = e;
+    if (tail == NULL) {
+        tail = e;
+    }
+}
+
+
+static void regent_free(void *p) {
+    struct regent *e = p;
+    regfree(&e->re);
+    free(e);
+}
+
+
+// Get a compiled regular expression
+const regex_t *regcache_get(const char *re, char **error) {
+    struct regent *e = hmap_get(&regs, re);
+    if (e != NULL) {
+        if (e != head) {
+            unlink_ent(e);
+            push_front(e);
+        }
+        return &e->re;
+    }
+    e = xmalloc(sizeof(*e));
+    int rc = regcomp(&e->re, re, REG_EXTENDED);
+    if (rc != 0) {
+        char buf[256];
+        regerror(rc, &e->re, buf, sizeof(buf));
+        *error = xstrdup(buf);
+        free(e);
+        return NULL;
+    }
+    if (regs.n >= REGCACHE_MAX) {
+        // Drop the least recently used
+        struct regent *old = tail;
+        unlink_ent(old);
+        hmap_del(&regs, old->key);
+        regent_free(old);
+    }
+    bool added;
+    struct hmap_entry *ent = hmap_putn(&regs, re, strlen(re), &added);
+    ent->value = e;
+    e->key = ent->key;
+    push_front(e);
+    return &e->re;
+}
+
+
+// Free every compiled expression
+void regcache_free(void) {
+    hmap_free(&regs, regent_free);
+    head = tail = NULL;
+}
@@ -0,0 +1,37 @@
+#ifndef REGCACHE_H
+#define REGCACHE_H
+#include <stddef.h>
+#include <regex.h>
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// Compiled regular expressions kept at most
+#define REGCACHE_MAX 64
+
+
+/**
+* @brief Get a compiled POSIX extended regular expression. The most
+* recently used expressions are kept, so a loop matching against the
+* same expression compiles it once.
+*
+* @param re The expression
+* @param error Set to a message to free when the expression is not
+* valid
+* @return const regex_t* The compiled expression, valid until the next
+* call, NULL on an error
+*/
+const regex_t *regcache_get(const char *re, char **error);
+
+
+/**
+* @brief Free every compiled expression
+*/
+void regcache_free(void);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
@@ -0,0 +1,265 @@
+#include "source.h"
+#include "exec.h"
+#include "func.h"
+#include "lab.h"
+#include "parse.h"
+#include "util.h"
+#include "vm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+// "LRC1" in the byte order of the machine that wrote the cache
+#define RC_MAGIC 0x3143524cu
+
+
+/* The header of a compiled rc file, followed by the arrays of the tree
+* and its program. The rc file it was made from is known by its size and
+* modification time, or by a hash of its text when only the time moved.
+* layout catches a cache written by a build with other structures. */
+struct rc_header
+{
+uint32_t magic;
+uint32_t layout;
+int64_t mtime_sec, mtime_nsec;
+uint64_t size;
+uint64_t hash;       // FNV-1a of the text
+uint32_t nnodes, nwords, nredirs, poollen;
+uint32_t ncode, nloops;
+int32_t root, maxdepth;
+};
+
+
+// Read a whole file, NULL with errno set on failure
+static char *read_file(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct strbuf text = {0};
+    char buf[8192];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        strbuf_add(&text, buf, n);
+    }
+    int err = errno;
+    close(fd);
+    if (n < 0) {
+        strbuf_free(&text);
+        errno = err;
+        return NULL;
+    }
+    return text.s ? strbuf_steal(&text) : xstrdup("");
+}
+
+
+// Run a file of commands in the current shell
+int source_file(struct shell *sh, const char *path, char **argv) {
+    char *text = read_file(path);
+    if (text == NULL) {
+        fprintf(stderr, "lab: %s: %s\n", path, strerror(errno));
+        sh->status = errno == ENOENT ? 127 : 126;
+        return sh->status;
+    }
+    int status;
+    struct ast *ast = ast_parse(text, &status);
+    free(text);
+    if (status == PARSE_OK) {
+        if (argv != NULL && argv[0] != NULL && argv[1] != NULL) {
+            status = func_run(sh, ast, argv);
+        } else {
+            status = exec_ast(sh, ast);
+        }
+    } else {
+        fprintf(stderr, "%s: %s\n", path, status == PARSE_ERROR ? ast->error : "syntax error: unexpected end of file");
+        sh->status = status = 2;
+    }
+    ast_free(ast);
+    return status;
+}
+
+
+// The source builtin
+int source_builtin(struct shell *sh, char **argv) {
+    if (argv[1] == NULL) {
+        fprintf(stderr, "%s: filename argument required\n", argv[0]);
+        return 2;
+    }
+    return source_file(sh, argv[1], argv + 1);
+}
+
+
+/*The sizes of the structures a cache holds, a build with other ones
+* reads none of it*/
+static uint32_t rc_layout(void) {
+    return (uint32_t)(sizeof(struct node) | sizeof(struct redir) << 8 | sizeof(struct insn) << 16 |
+                      sizeof(struct vm_loop) << 24);
+}
+
+
+/*FNV-1a over the text of an rc file*/
+static uint64_t text_hash(const char *s, size_t n) {
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < n; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+
+/*Point iov at the arrays of a tree and its program in the order the
+* cache stores them. Returns the number of entries used.*/
+static int rc_iov(struct ast *ast, struct iovec *iov) {
+    struct prog *pr = ast->prog;
+    iov[0] = (struct iovec){ ast->nodes, ast->nnodes * sizeof(struct node) };
+    iov[1] = (struct iovec){ ast->words, ast->nwords * sizeof(struct word) };
+    iov[2] = (struct iovec){ ast->redirs, ast->nredirs * sizeof(struct redir) };
+    iov[3] = (struct iovec){ ast->pool, ast->poollen };
+    iov[4] = (struct iovec){ pr->code, pr->ncode * sizeof(struct insn) };
+    iov[5] = (struct iovec){ pr->loops, pr->nloops * sizeof(struct vm_loop) };
+    return 6;
+}
+
+
+/*Load a compiled rc file. The cache stands when the rc file has the size
+* and time it was made from, or the same text after it was touched, then
+* the header takes the new time. Returns NULL when it is missing or
+* stale.*/
+static struct ast *rc_load(const char *cache, const char *path, const struct stat *st) {
+    int fd = open(cache, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct rc_header h;
+    struct stat cst;
+    if (read(fd, &h, sizeof(h)) != sizeof(h) || h.magic != RC_MAGIC || h.layout != rc_layout() ||
+        h.size != (uint64_t)st->st_size || fstat(fd, &cst) != 0) {
+        close(fd);
+        return NULL;
+    }
+    if (h.mtime_sec != st->st_mtim.tv_sec || h.mtime_nsec != st->st_mtim.tv_nsec) {
+        char *text = read_file(path);
+        bool same = text != NULL && text_hash(text, strlen(text)) == h.hash;
+        free(text);
+        h.mtime_sec = st->st_mtim.tv_sec;
+        h.mtime_nsec = st->st_mtim.tv_nsec;
+        if (!same || pwrite(fd, &h, sizeof(h), 0) != sizeof(h)) {
+            close(fd);
+            return NULL;
+        }
+    }
+    size_t bytes = h.nnodes * sizeof(struct node) + h.nwords * sizeof(struct word) +
+                   h.nredirs * sizeof(struct redir) + h.poollen + h.ncode * sizeof(struct insn) +
+                   h.nloops * sizeof(struct vm_loop);
+    if ((uint64_t)cst.st_size != sizeof(h) + bytes) {
+        close(fd);
+        return NULL;
+    }
+    struct ast *ast = xcalloc(1, sizeof(*ast));
+    struct prog *pr = xcalloc(1, sizeof(*pr));
+    ast->prog = pr;
+    pr->ast = ast;
+    ast->nnodes = ast->capnodes = h.nnodes;
+    ast->nodes = xmalloc(h.nnodes * sizeof(struct node) + 1);
+    ast->nwords = ast->capwords = h.nwords;
+    ast->words = xmalloc(h.nwords * sizeof(struct word) + 1);
+    ast->nredirs = ast->capredirs = h.nredirs;
+    ast->redirs = xmalloc(h.nredirs * sizeof(struct redir) + 1);
+    ast->poollen = ast->poolcap = h.poollen;
+    ast->pool = xmalloc(h.poollen + 1);
+    ast->root = h.root;
+    pr->ncode = pr->capcode = h.ncode;
+    pr->code = xmalloc(h.ncode * sizeof(struct insn) + 1);
+    pr->nloops = pr->caploops = h.nloops;
+    pr->loops = xmalloc(h.nloops * sizeof(struct vm_loop) + 1);
+    pr->maxdepth = h.maxdepth;
+    struct iovec iov[6];
+    int n = rc_iov(ast, iov);
+    ssize_t got = readv(fd, iov, n);
+    close(fd);
+    // The cached heredoc descriptors belonged to the shell that wrote it
+    for (uint32_t i = 0; i < ast->nredirs; i++) {
+        ast->redirs[i].memfd = -1;
+        ast->redirs[i].map = NULL;
+        ast->redirs[i].maplen = 0;
+    }
+    if (got != (ssize_t)bytes) {
+        ast->nredirs = 0;
+        ast_free(ast);
+        return NULL;
+    }
+    return ast;
+}
+
+
+/*Write the tree and program of an rc file next to it, through a
+* temporary file so a shell starting meanwhile never sees half of it. A
+* directory the shell cannot write to just means no cache.*/
+static void rc_store(const char *cache, const struct stat *st, uint64_t hash, struct ast *ast) {
+    struct prog *pr = ast->prog;
+    struct rc_header h = {
+        RC_MAGIC, rc_layout(), st->st_mtim.tv_sec, st->st_mtim.tv_nsec, (uint64_t)st->st_size, hash,
+        ast->nnodes, ast->nwords, ast->nredirs, ast->poollen, pr->ncode, pr->nloops, ast->root, pr->maxdepth,
+    };
+    struct strbuf tmp = {0};
+    strbuf_adds(&tmp, cache);
+    strbuf_adds(&tmp, ".XXXXXX");
+    int fd = mkstemp(tmp.s);
+    if (fd < 0) {
+        strbuf_free(&tmp);
+        return;
+    }
+    struct iovec iov[7] = { { &h, sizeof(h) } };
+    int n = rc_iov(ast, iov + 1) + 1;
+    bool ok = writev_all(fd, iov, n) == 0;
+    ok = close(fd) == 0 && ok;
+    if (!ok || rename(tmp.s, cache) != 0) {
+        unlink(tmp.s);
+    }
+    strbuf_free(&tmp);
+}
+
+
+// Run an rc file from its compiled cache
+int source_rc(struct shell *sh, const char *path) {
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return 0;
+    }
+    struct strbuf cache = {0};
+    strbuf_adds(&cache, path);
+    strbuf_adds(&cache, RC_CACHE_SUFFIX);
+    struct ast *ast = rc_load(cache.s, path, &st);
+    if (ast == NULL) {
+        char *text = read_file(path);
+        if (text == NULL) {
+            strbuf_free(&cache);
+            return 0;
+        }
+        int status;
+        ast = ast_parse(text, &status);
+        if (status != PARSE_OK) {
+            fprintf(stderr, "%s: %s\n", path, status == PARSE_ERROR ? ast->error : "syntax error: unexpected end of file");
+            ast_free(ast);
+            free(text);
+            strbuf_free(&cache);
+            sh->status = 2;
+            return 2;
+        }
+        // Compiled before anything runs, so the cache is the program as
+        // it came out of the parser
+        vm_program(ast);
+        rc_store(cache.s, &st, text_hash(text, strlen(text)), ast);
+        free(text);
+    }
+    strbuf_free(&cache);
+    int status = exec_ast(sh, ast);
+    ast_free(ast);
+    return status;
+}
@@ -0,0 +1,61 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+#include <stddef.h>
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+struct shell;
+
+// Appended to the path of an rc file to name its compiled cache
+#define RC_CACHE_SUFFIX ".cache"
+
+
+/**
+* @brief Read a file of commands and run it in the current shell. The
+* whole file is parsed before anything runs, so a syntax error anywhere
+* means nothing runs.
+*
+* @param sh The shell
+* @param path The file
+* @param argv The name and the positional parameters for the file, the
+* caller's parameters stay when there are no arguments
+* @return int The exit status of the last command, 2 for a syntax error,
+* 127 or 126 when the file cannot be read
+*/
+int source_file(struct shell *sh, const char *path, char **argv);
+
+
+/**
+* @brief The source builtin, also known as the dot builtin.
+*
+*   source file [arg ...]
+*
+* @param sh The shell
+* @param argv The arguments
+* @return int The exit status of the file
+*/
+int source_builtin(struct shell *sh, char **argv);
+
+
+/**
+* @brief Run an rc file such as ~/.labrc in the current shell. The file
+* is parsed and compiled once and the result kept next to it in a cache
+* named by RC_CACHE_SUFFIX, which later shells load instead of parsing
+* again as long as the file has the same size and modification time or,
+* after it was touched, the same text. The file still runs every time,
+* only its parsing is saved. A cache that cannot be written is skipped
+* without a word.
+*
+* @param sh The shell
+* @param path The rc file, nothing happens when it does not exist
+* @return int The exit status of the last command, 2 for a syntax error
+*/
+int source_rc(struct shell *sh, const char *path);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
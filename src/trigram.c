@@ -0,0 +1,153 @@
+#include "trigram.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+
+
+static uint32_t trigram_key(const char *s) {
+    const unsigned char *u = (const unsigned char *)s;
+    return ((uint32_t)u[0] << 16 | (uint32_t)u[1] << 8 | u[2]) + 1;
+}
+
+
+static size_t trigram_slot(const struct trigram_index *ix, uint32_t key) {
+    size_t mask = ix->cap - 1;
+    // Spread the keys, similar trigrams differ only in the low byte
+    size_t i = (key * 2654435761u) & mask;
+    while (ix->tab[i].key != 0 && ix->tab[i].key != key) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+
+static void trigram_grow(struct trigram_index *ix) {
+    struct trigram_list *old = ix->tab;
+    size_t oldcap = ix->cap;
+    ix->cap = oldcap ? oldcap * 2 : 1024;
+    ix->tab = xcalloc(ix->cap, sizeof(struct trigram_list));
+    for (size_t i = 0; i < oldcap; i++) {
+        if (old[i].key != 0) {
+            ix->tab[trigram_slot(ix, old[i].key)] = old[i];
+        }
+    }
+    free(old);
+}
+
+
+static const struct trigram_list *trigram_get(const struct trigram_index *ix, uint32_t key) {
+    if (ix->n == 0) {
+        return NULL;
+    }
+    const struct trigram_list *l = &ix->tab[trigram_slot(ix, key)];
+    return l->key ? l : NULL;
+}
+
+
+// Add a document to the index
+void trigram_add(struct trigram_index *ix, uint32_t doc, const char *s, size_t len) {
+    for (size_t i = 0; i + 3 <= len; i++) {
+        if ((ix->n + 1) * 2 > ix->cap) {
+            trigram_grow(ix);
+        }
+        uint32_t key = trigram_key(s + i);
+        struct trigram_list *l = &ix->tab[trigram_slot(ix, key)];
+        if (l->key == 0) {
+            l->key = key;
+            ix->n++;
+        }
+        // A trigram repeated in the same document is listed once
+        if (l->n > 0 && l->docs[l->n - 1] == doc) {
+            continue;
+        }
+        if (l->n == l->cap) {
+            l->cap = l->cap ? l->cap * 2 : 4;
+            l->docs = xrealloc(l->docs, l->cap * sizeof(uint32_t));
+        }
+        l->docs[l->n++] = doc;
+    }
+}
+
+
+static int list_cmp(const void *a, const void *b) {
+    const struct trigram_list *x = *(const struct trigram_list *const *)a;
+    const struct trigram_list *y = *(const struct trigram_list *const *)b;
+    return (x->n > y->n) - (x->n < y->n);
+}
+
+
+// Number of entries in docs[0, n) that are not greater than doc
+static uint32_t upper_bound(const uint32_t *docs, uint32_t n, uint32_t doc) {
+    uint32_t lo = 0;
+    while (lo < n) {
+        uint32_t mid = lo + (n - lo) / 2;
+        if (docs[mid] <= doc) {
+            lo = mid + 1;
+        } else {
+            n = mid;
+        }
+    }
+    return lo;
+}
+
+
+// Find the documents that contain every trigram of a query, newest first
+bool trigram_search(const struct trigram_index *ix, const char *q, size_t len,
+                    bool (*fn)(uint32_t doc, void *arg), void *arg) {
+    if (len < 3) {
+        return false;
+    }
+    size_t nlists = 0;
+    const struct trigram_list **lists = xmalloc((len - 2) * sizeof(*lists));
+    for (size_t i = 0; i + 3 <= len; i++) {
+        const struct trigram_list *l = trigram_get(ix, trigram_key(q + i));
+        if (l == NULL) {
+            // Some trigram never occurs so nothing can match
+            free(lists);
+            return true;
+        }
+        size_t k = 0;
+        while (k < nlists && lists[k] != l) {
+            k++;
+        }
+        if (k == nlists) {
+            lists[nlists++] = l;
+        }
+    }
+    qsort(lists, nlists, sizeof(*lists), list_cmp);
+
+    // Walk the shortest list backwards, each other list keeps a cursor that
+    // only moves down
+    uint32_t *ends = xmalloc(nlists * sizeof(uint32_t));
+    for (size_t k = 0; k < nlists; k++) {
+        ends[k] = lists[k]->n;
+    }
+    for (uint32_t i = lists[0]->n; i-- > 0;) {
+        uint32_t doc = lists[0]->docs[i];
+        bool all = true;
+        for (size_t k = 1; k < nlists && all; k++) {
+            ends[k] = upper_bound(lists[k]->docs, ends[k], doc);
+            all = ends[k] > 0 && lists[k]->docs[ends[k] - 1] == doc;
+            if (ends[k] == 0) {
+                i = 0;
+            }
+        }
+        if (all && !fn(doc, arg)) {
+            break;
+        }
+    }
+    free(ends);
+    free(lists);
+    return true;
+}
+
+
+// Free the index
+void trigram_free(struct trigram_index *ix) {
+    for (size_t i = 0; i < ix->cap; i++) {
+        free(ix->tab[i].docs);
+    }
+    free(ix->tab);
+    ix->tab = NULL;
+    ix->cap = ix->n = 0;
+}
@@ -0,0 +1,72 @@
+#ifndef TRIGRAM_H
+#define TRIGRAM_H
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/* Documents that contain one trigram, in increasing order */
+struct trigram_list
+{
+uint32_t key;        // the three bytes plus one, 0 for an empty slot
+uint32_t n;
+uint32_t cap;
+uint32_t *docs;
+};
+
+
+/* Maps every trigram seen so far to its posting list. Documents are
+* numbered by the caller and must be added in increasing order. */
+struct trigram_index
+{
+struct trigram_list *tab;
+size_t cap;
+size_t n;
+};
+
+
+/**
+* @brief Add a document to the index
+*
+* @param ix The index
+* @param doc The document number, not lower than any added before
+* @param s The text of the document
+* @param len The length of the text
+*/
+void trigram_add(struct trigram_index *ix, uint32_t doc, const char *s, size_t len);
+
+
+/**
+* @brief Find the documents that contain every trigram of a query, newest
+* first, by intersecting the posting lists starting from the shortest.
+* A document may still not contain the query as a whole so fn has to
+* check it.
+*
+* @param ix The index
+* @param q The query
+* @param len The length of the query
+* @param fn Called for every candidate, return false to stop the search
+* @param arg Passed to fn
+* @return bool False if the query is shorter than a trigram and the index
+* can not help, fn was not called in that case
+*/
+bool trigram_search(const struct trigram_index *ix, const char *q, size_t len,
+                    bool (*fn)(uint32_t doc, void *arg), void *arg);
+
+
+/**
+* @brief Free the index
+*
+* @param ix The index
+*/
+void trigram_free(struct trigram_index *ix);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
@@ -0,0 +1,170 @@
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/uio.h>
+
+
+void *xmalloc(size_t n) {
+    void *p = malloc(n ? n : 1);
+    if (p == NULL) {
+        perror("malloc");
+        abort();
+    }
+    return p;
+}
+
+
+void *xcalloc(size_t n, size_t size) {
+    void *p = calloc(n ? n : 1, size ? size : 1);
+    if (p == NULL) {
+        perror("calloc");
+        abort();
+    }
+    return p;
+}
+
+
+void *xrealloc(void *p, size_t n) {
+    p = realloc(p, n ? n : 1);
+    if (p == NULL) {
+        perror("realloc");
+        abort();
+    }
+    return p;
+}
+
+
+char *xstrdup(const char *s) {
+    return xstrndup(s, strlen(s));
+}
+
+
+char *xstrndup(const char *s, size_t n) {
+    char *p = xmalloc(n + 1);
+    memcpy(p, s, n);
+    p[n] = '\0';
+    return p;
+}
+
+
+// Append a string to the vector taking ownership of it
+void strvec_push(struct strvec *sv, char *s) {
+    // Always keep room for the NULL terminator
+    if (sv->n + 2 > sv->cap) {
+        sv->cap = sv->cap ? sv->cap * 2 : 8;
+        sv->v = xrealloc(sv->v, sv->cap * sizeof(char *));
+    }
+    sv->v[sv->n++] = s;
+    sv->v[sv->n] = NULL;
+}
+
+
+// Free every string in the vector and the vector storage
+void strvec_free(struct strvec *sv) {
+    for (size_t i = 0; i < sv->n; i++) {
+        free(sv->v[i]);
+    }
+    free(sv->v);
+    sv->v = NULL;
+    sv->n = sv->cap = 0;
+}
+
+
+// Take the NULL terminated array out of the vector
+char **strvec_steal(struct strvec *sv) {
+    if (sv->v == NULL) {
+        sv->v = xcalloc(1, sizeof(char *));
+    }
+    char **v = sv->v;
+    sv->v = NULL;
+    sv->n = sv->cap = 0;
+    return v;
+}
+
+
+// Append bytes to a buffer
+void strbuf_add(struct strbuf *sb, const char *s, size_t n) {
+    if (sb->len + n + 1 > sb->cap) {
+        size_t cap = sb->cap ? sb->cap * 2 : 64;
+        while (cap < sb->len + n + 1) {
+            cap *= 2;
+        }
+        sb->s = xrealloc(sb->s, cap);
+        sb->cap = cap;
+    }
+    memcpy(sb->s + sb->len, s, n);
+    sb->len += n;
+    sb->s[sb->len] = '\0';
+}
+
+
+void strbuf_addc(struct strbuf *sb, char c) {
+    strbuf_add(sb, &c, 1);
+}
+
+
+void strbuf_adds(struct strbuf *sb, const char *s) {
+    strbuf_add(sb, s, strlen(s));
+}
+
+
+// Take the string out of the buffer
+char *strbuf_steal(struct strbuf *sb) {
+    char *s = sb->s ? sb->s : xstrdup("");
+    sb->s = NULL;
+    sb->len = sb->cap = 0;
+    return s;
+}
+
+
+// Release the memory held by a buffer
+void strbuf_free(struct strbuf *sb) {
+    free(sb->s);
+    sb->s = NULL;
+    sb->len = sb->cap = 0;
+}
+
+
+// Write the whole buffer to a file descriptor
+int write_all(int fd, const char *s, size_t n) {
+    while (n > 0) {
+        ssize_t w = write(fd, s, n);
+        if (w < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        s += w;
+        n -= (size_t)w;
+    }
+    return 0;
+}
+
+
+// Write every buffer of an iovec array, retrying short writes and EINTR
+int writev_all(int fd, struct iovec *iov, int n) {
+    while (n > 0) {
+        ssize_t w = writev(fd, iov, n);
+        if (w < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        // Skip the buffers that were written completely
+        while (n > 0 && (size_t)w >= iov->iov_len) {
+            w -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0) {
+            iov->iov_base = (char *)iov->iov_base + w;
+            iov->iov_len -= w;
+        }
+    }
+    return 0;
+}
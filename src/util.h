@@ -0,0 +1,127 @@
+#ifndef UTIL_H
+#define UTIL_H
+#include <stddef.h>
+#include <stdbool.h>
+#include <sys/uio.h>
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+
+/* A growable NULL terminated array of malloced strings, usable as argv */
+struct strvec
+{
+char **v;
+size_t n;
+size_t cap;
+};
+
+
+/* A growable NUL terminated byte buffer */
+struct strbuf
+{
+char *s;
+size_t len;
+size_t cap;
+};
+
+
+/**
+* @brief Allocation helpers that print an error and abort when the system
+* is out of memory. The shell can not do anything useful in that case so
+* callers do not need to check the result.
+*/
+void *xmalloc(size_t n);
+void *xcalloc(size_t n, size_t size);
+void *xrealloc(void *p, size_t n);
+char *xstrdup(const char *s);
+char *xstrndup(const char *s, size_t n);
+
+
+/**
+* @brief Append a string to the vector taking ownership of it. The vector
+* stays NULL terminated after every push.
+*
+* @param sv The vector
+* @param s The string to append
+*/
+void strvec_push(struct strvec *sv, char *s);
+
+
+/**
+* @brief Free every string in the vector and the vector storage
+*
+* @param sv The vector
+*/
+void strvec_free(struct strvec *sv);
+
+
+/**
+* @brief Take the NULL terminated array out of the vector. The vector is
+* reset and the caller must free the result with cmd_free.
+*
+* @param sv The vector
+* @return char** The array
+*/
+char **strvec_steal(struct strvec *sv);
+
+
+/**
+* @brief Append bytes to a buffer
+*
+* @param sb The buffer
+* @param s The bytes to append
+* @param n The number of bytes
+*/
+void strbuf_add(struct strbuf *sb, const char *s, size_t n);
+void strbuf_addc(struct strbuf *sb, char c);
+void strbuf_adds(struct strbuf *sb, const char *s);
+
+
+/**
+* @brief Take the string out of the buffer, the buffer is reset and the
+* caller must free the result. Never returns NULL.
+*
+* @param sb The buffer
+* @return char* The string
+*/
+char *strbuf_steal(struct strbuf *sb);
+
+
+/**
+* @brief Release the memory held by a buffer
+*
+* @param sb The buffer
+*/
+void strbuf_free(struct strbuf *sb);
+
+
+/**
+* @brief Write the whole buffer to a file descriptor, retrying short
+* writes and EINTR
+*
+* @param fd The file descriptor
+* @param s The bytes to write
+* @param n The number of bytes
+* @return 0 on success, -1 with errno set on error
+*/
+int write_all(int fd, const char *s, size_t n);
+
+
+/**
+* @brief Write every buffer of an iovec array with as few writev calls as
+* possible, retrying short writes and EINTR. The array is modified.
+*
+* @param fd The file descriptor
+* @param iov The buffers
+* @param n The number of buffers, at most IOV_MAX
+* @return 0 on success, -1 with errno set on error
+*/
+int writev_all(int fd, struct iovec *iov, int n);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
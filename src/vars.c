@@ -0,0 +1,548 @@
+#include "vars.h"
+#include "arith.h"
+#include "array.h"
+#include "func.h"
+#include "hmap.h"
+#include "lab.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <ctype.h>
+#include <unistd.h>
+
+extern char **environ;
+
+
+struct var
+{
+char *value;         // NULL for a name that is only marked for export
+bool exported;
+struct array *array;  // elements of an indexed array, NULL otherwise
+struct hmap *assoc;   // elements of an associative array, NULL otherwise
+};
+
+
+/* A built environment, the pointers and the strings in one block. The
+* shell holds one reference to the current block, the prompt worker may
+* hold more while it spawns. */
+struct envp_block
+{
+int refs;
+char *v[];
+};
+
+
+static struct hmap vars;
+static bool loaded;
+static char **environ0;        // environ before we replaced it
+// Environment entries whose names are not identifiers, like "MY PROMPT",
+// passed on to children untouched
+static struct strvec passthrough;
+static unsigned long env_gen = 1;
+static struct envp_block *envp;
+static unsigned long envp_gen; // env_gen when envp was built
+
+
+static void var_free(void *p) {
+    struct var *v = p;
+    free(v->value);
+    if (v->array != NULL) {
+        array_clear(v->array);
+        free(v->array);
+    }
+    if (v->assoc != NULL) {
+        assoc_clear(v->assoc);
+        free(v->assoc);
+    }
+    free(v);
+}
+
+
+// Fill the table from the environment we were started with
+static void vars_load(void) {
+    if (loaded) {
+        return;
+    }
+    loaded = true;
+    environ0 = environ;
+    for (char **e = environ; e && *e; e++) {
+        char *eq = strchr(*e, '=');
+        if (eq == NULL) {
+            continue;
+        }
+        if (!var_name_valid(*e, eq - *e)) {
+            strvec_push(&passthrough, xstrdup(*e));
+            continue;
+        }
+        bool added;
+        struct hmap_entry *ent = hmap_putn(&vars, *e, eq - *e, &added);
+        if (added) {
+            struct var *v = xcalloc(1, sizeof(*v));
+            v->value = xstrdup(eq + 1);
+            v->exported = true;
+            ent->value = v;
+        }
+    }
+}
+
+
+// Check that a string is a valid variable name
+bool var_name_valid(const char *name, size_t n) {
+    if (n == 0 || isdigit((unsigned char)name[0])) {
+        return false;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (!isalnum((unsigned char)name[i]) && name[i] != '_') {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+// Look up a shell variable
+const char *var_get(const char *name) {
+    vars_load();
+    struct var *v = hmap_get(&vars, name);
+    if (v != NULL && v->array != NULL) {
+        return array_get(v->array, 0);
+    }
+    if (v != NULL && v->assoc != NULL) {
+        return assoc_get(v->assoc, "0");
+    }
+    return v ? v->value : NULL;
+}
+
+
+// Set a shell variable
+void var_set(const char *name, const char *value, bool exported) {
+    vars_load();
+    struct var *v = hmap_get(&vars, name);
+    if (v == NULL) {
+        v = xcalloc(1, sizeof(*v));
+        hmap_put(&vars, name, v);
+    }
+    if (v->array != NULL) {
+        // Assigning to an array sets its first element
+        if (value != NULL) {
+            array_set(v->array, 0, value);
+        }
+        return;
+    }
+    if (v->assoc != NULL) {
+        if (value != NULL) {
+            assoc_set(v->assoc, "0", value);
+        }
+        return;
+    }
+    bool changed = false;
+    if (value != NULL && (v->value == NULL || strcmp(v->value, value) != 0)) {
+        free(v->value);
+        v->value = xstrdup(value);
+        changed = v->exported;
+    }
+    if (exported && !v->exported) {
+        v->exported = true;
+        changed = v->value != NULL;
+    }
+    if (changed) {
+        env_gen++;
+    }
+}
+
+
+static struct var *var_lookup(const char *name) {
+    vars_load();
+    struct var *v = hmap_get(&vars, name);
+    if (v == NULL) {
+        v = xcalloc(1, sizeof(*v));
+        hmap_put(&vars, name, v);
+    }
+    return v;
+}
+
+
+/*Turn a variable into an array or map, dropping the string value and
+* whatever elements it had*/
+static void var_reset(struct var *v) {
+    if (v->exported && v->value != NULL) {
+        env_gen++;
+    }
+    free(v->value);
+    v->value = NULL;
+    if (v->array != NULL) {
+        array_clear(v->array);
+        free(v->array);
+        v->array = NULL;
+    }
+    if (v->assoc != NULL) {
+        assoc_clear(v->assoc);
+        free(v->assoc);
+        v->assoc = NULL;
+    }
+}
+
+
+// Make a shell variable an empty indexed array
+struct array *var_set_array(const char *name) {
+    struct var *v = var_lookup(name);
+    var_reset(v);
+    v->array = xcalloc(1, sizeof(struct array));
+    return v->array;
+}
+
+
+// Make a shell variable an empty associative array
+struct hmap *var_set_assoc(const char *name) {
+    struct var *v = var_lookup(name);
+    var_reset(v);
+    v->assoc = xcalloc(1, sizeof(struct hmap));
+    return v->assoc;
+}
+
+
+// The elements of an array variable
+struct array *var_array(const char *name) {
+    vars_load();
+    struct var *v = hmap_get(&vars, name);
+    return v ? v->array : NULL;
+}
+
+
+// The elements of an associative array variable
+struct hmap *var_assoc(const char *name) {
+    vars_load();
+    struct var *v = hmap_get(&vars, name);
+    return v ? v->assoc : NULL;
+}
+
+
+// The array of a variable, made from its string value when it has none
+struct array *var_as_array(const char *name) {
+    struct var *v = var_lookup(name);
+    if (v->array != NULL || v->assoc != NULL) {
+        return v->array;
+    }
+    char *value = v->value;
+    if (v->exported && value != NULL) {
+        env_gen++;
+    }
+    v->value = NULL;
+    v->array = xcalloc(1, sizeof(struct array));
+    if (value != NULL) {
+        array_set(v->array, 0, value);
+        free(value);
+    }
+    return v->array;
+}
+
+
+// Remove a shell variable
+void var_unset(const char *name) {
+    vars_load();
+    struct var *v = hmap_del(&vars, name);
+    if (v == NULL) {
+        return;
+    }
+    if (v->exported && v->value != NULL) {
+        env_gen++;
+    }
+    var_free(v);
+}
+
+
+// Counter that changes with the exported variables
+unsigned long vars_generation(void) {
+    return env_gen;
+}
+
+
+static void envp_unref(struct envp_block *b) {
+    if (b != NULL && __atomic_sub_fetch(&b->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        free(b);
+    }
+}
+
+
+/*Build the environment for the exported variables and the entries passed
+* through. The pointer array and the NAME=value strings go in a single
+* allocation.*/
+static struct envp_block *envp_build(void) {
+    size_t n = 0, bytes = 0;
+    for (size_t i = 0; i < vars.cap; i++) {
+        struct var *v = vars.tab[i].key ? vars.tab[i].value : NULL;
+        if (v != NULL && v->exported && v->value != NULL) {
+            n++;
+            bytes += vars.tab[i].keylen + strlen(v->value) + 2;
+        }
+    }
+    for (size_t i = 0; i < passthrough.n; i++) {
+        n++;
+        bytes += strlen(passthrough.v[i]) + 1;
+    }
+    size_t head = sizeof(struct envp_block) + (n + 1) * sizeof(char *);
+    struct envp_block *b = xmalloc(head + bytes);
+    b->refs = 1;
+    char *s = (char *)b + head;
+    n = 0;
+    for (size_t i = 0; i < vars.cap; i++) {
+        struct var *v = vars.tab[i].key ? vars.tab[i].value : NULL;
+        if (v == NULL || !v->exported || v->value == NULL) {
+            continue;
+        }
+        b->v[n++] = s;
+        memcpy(s, vars.tab[i].key, vars.tab[i].keylen);
+        s += vars.tab[i].keylen;
+        *s++ = '=';
+        size_t len = strlen(v->value) + 1;
+        memcpy(s, v->value, len);
+        s += len;
+    }
+    for (size_t i = 0; i < passthrough.n; i++) {
+        size_t len = strlen(passthrough.v[i]) + 1;
+        b->v[n++] = memcpy(s, passthrough.v[i], len);
+        s += len;
+    }
+    b->v[n] = NULL;
+    return b;
+}
+
+
+// The environment for a child, built again only when it changed
+char **vars_envp(void) {
+    vars_load();
+    if (envp == NULL || envp_gen != env_gen) {
+        struct envp_block *old = envp;
+        envp = envp_build();
+        envp_gen = env_gen;
+        environ = envp->v;
+        envp_unref(old);
+    }
+    return envp->v;
+}
+
+
+// Take a reference to the current environment
+char **vars_envp_hold(void) {
+    char **v = vars_envp();
+    __atomic_add_fetch(&envp->refs, 1, __ATOMIC_RELAXED);
+    return v;
+}
+
+
+// Drop a reference to an environment
+void vars_envp_release(char **v) {
+    if (v != NULL) {
+        envp_unref((struct envp_block *)((char *)v - offsetof(struct envp_block, v)));
+    }
+}
+
+
+// Forget every variable
+void vars_free(void) {
+    if (!loaded) {
+        return;
+    }
+    environ = environ0;
+    envp_unref(envp);
+    envp = NULL;
+    hmap_free(&vars, var_free);
+    strvec_free(&passthrough);
+    loaded = false;
+    env_gen++;
+}
+
+
+static int name_cmp(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+
+// List the exported variables in a form that can be read back
+static int export_list(void) {
+    struct strvec names = {0};
+    for (size_t i = 0; i < vars.cap; i++) {
+        struct var *v = vars.tab[i].key ? vars.tab[i].value : NULL;
+        if (v != NULL && v->exported) {
+            strvec_push(&names, vars.tab[i].key);
+        }
+    }
+    qsort(names.v, names.n, sizeof(char *), name_cmp);
+    struct strbuf out = {0};
+    for (size_t i = 0; i < names.n; i++) {
+        const char *value = ((struct var *)hmap_get(&vars, names.v[i]))->value;
+        strbuf_adds(&out, "export ");
+        strbuf_adds(&out, names.v[i]);
+        if (value != NULL) {
+            strbuf_adds(&out, "='");
+            for (const char *c = value; *c; c++) {
+                if (*c == '\'') {
+                    strbuf_adds(&out, "'\\''");
+                } else {
+                    strbuf_addc(&out, *c);
+                }
+            }
+            strbuf_addc(&out, '\'');
+        }
+        strbuf_addc(&out, '\n');
+    }
+    // The names belong to the map
+    free(names.v);
+    int rc = write_all(STDOUT_FILENO, out.s, out.len) < 0;
+    strbuf_free(&out);
+    return rc;
+}
+
+
+// The export builtin
+int export_builtin(struct shell *sh, char **argv) {
+    UNUSED(sh);
+    vars_load();
+    int i = 1;
+    if (argv[i] != NULL && strcmp(argv[i], "-p") == 0) {
+        i++;
+    }
+    if (argv[i] == NULL) {
+        return export_list();
+    }
+    int rc = 0;
+    for (; argv[i]; i++) {
+        char *eq = strchr(argv[i], '=');
+        size_t n = eq ? (size_t)(eq - argv[i]) : strlen(argv[i]);
+        if (!var_name_valid(argv[i], n)) {
+            fprintf(stderr, "export: `%s': not a valid identifier\n", argv[i]);
+            rc = 1;
+            continue;
+        }
+        char *name = xstrndup(argv[i], n);
+        var_set(name, eq ? eq + 1 : NULL, true);
+        free(name);
+    }
+    return rc;
+}
+
+
+/*Remove one element named by name[sub], the subscript is an arithmetic
+* expression for an indexed array and a key for an associative one*/
+static int unset_elem(struct shell *sh, const char *arg, const char *lb) {
+    char *name = xstrndup(arg, lb - arg);
+    const char *sub = lb + 1;
+    size_t nsub = strlen(sub) - 1;
+    struct var *v = var_name_valid(name, strlen(name)) ? hmap_get(&vars, name) : NULL;
+    int rc = 0;
+    if (v != NULL && v->assoc != NULL) {
+        char *key = xstrndup(sub, nsub);
+        assoc_unset(v->assoc, key);
+        free(key);
+    } else if (v != NULL && v->array != NULL) {
+        int64_t i;
+        if (arith_eval(sh, sub, nsub, &i) < 0) {
+            rc = 1;
+        } else if (i < 0 && (i += array_next(v->array)) < 0) {
+            fprintf(stderr, "unset: %s: bad array subscript\n", arg);
+            rc = 1;
+        } else {
+            array_unset(v->array, i);
+        }
+    } else if (v == NULL && !var_name_valid(name, strlen(name))) {
+        fprintf(stderr, "unset: `%s': not a valid identifier\n", arg);
+        rc = 1;
+    } else if (v != NULL && nsub == 1 && *sub == '0') {
+        // A string is element 0 of itself
+        var_unset(name);
+    }
+    free(name);
+    return rc;
+}
+
+
+// The unset builtin
+int unset_builtin(struct shell *sh, char **argv) {
+    vars_load();
+    int rc = 0;
+    bool funcs = false;
+    for (int i = 1; argv[i]; i++) {
+        if (strcmp(argv[i], "-v") == 0 || strcmp(argv[i], "-f") == 0) {
+            funcs = argv[i][1] == 'f';
+            continue;
+        }
+        if (funcs) {
+            func_unset(argv[i]);
+            continue;
+        }
+        const char *lb = strchr(argv[i], '[');
+        size_t len = strlen(argv[i]);
+        if (lb != NULL && argv[i][len - 1] == ']') {
+            rc |= unset_elem(sh, argv[i], lb);
+            continue;
+        }
+        if (!var_name_valid(argv[i], len)) {
+            fprintf(stderr, "unset: `%s': not a valid identifier\n", argv[i]);
+            rc = 1;
+            continue;
+        }
+        var_unset(argv[i]);
+    }
+    return rc;
+}
+
+
+// The declare builtin
+int declare_builtin(struct shell *sh, char **argv) {
+    UNUSED(sh);
+    vars_load();
+    bool indexed = false, assoc = false;
+    int i = 1;
+    for (; argv[i] && argv[i][0] == '-' && argv[i][1]; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            i++;
+            break;
+        }
+        for (const char *o = argv[i] + 1; *o; o++) {
+            if (*o != 'a' && *o != 'A') {
+                fprintf(stderr, "declare: -%c: invalid option\n", *o);
+                return 2;
+            }
+            indexed |= *o == 'a';
+            assoc |= *o == 'A';
+        }
+    }
+    if (indexed && assoc) {
+        fprintf(stderr, "declare: cannot use -a and -A together\n");
+        return 2;
+    }
+    int rc = 0;
+    for (; argv[i]; i++) {
+        char *eq = strchr(argv[i], '=');
+        char *name = xstrndup(argv[i], eq ? (size_t)(eq - argv[i]) : strlen(argv[i]));
+        struct var *v = var_name_valid(name, strlen(name)) ? var_lookup(name) : NULL;
+        if (v == NULL) {
+            fprintf(stderr, "declare: `%s': not a valid identifier\n", argv[i]);
+            rc = 1;
+        } else if ((indexed && v->assoc != NULL) || (assoc && v->array != NULL)) {
+            fprintf(stderr, "declare: %s: cannot convert %s to %s array\n", name,
+                    assoc ? "indexed" : "associative", assoc ? "associative" : "indexed");
+            rc = 1;
+        } else {
+            if (indexed) {
+                var_as_array(name);
+            } else if (assoc && v->assoc == NULL) {
+                // The string value becomes element "0" like it would
+                // for an indexed array
+                char *value = v->value ? xstrdup(v->value) : NULL;
+                struct hmap *m = var_set_assoc(name);
+                if (value != NULL) {
+                    assoc_set(m, "0", value);
+                    free(value);
+                }
+            }
+            if (eq != NULL) {
+                var_set(name, eq + 1, false);
+            }
+        }
+        free(name);
+    }
+    return rc;
+}
@@ -0,0 +1,203 @@
+#ifndef VARS_H
+#define VARS_H
+#include <stddef.h>
+#include <stdbool.h>
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+struct shell;
+struct array;
+struct hmap;
+
+
+/**
+* @brief Look up a shell variable. The table is filled from the
+* environment the first time any variable is used.
+*
+* @param name The name
+* @return const char* The value, valid until the variable changes, NULL
+* if it is unset
+*/
+const char *var_get(const char *name);
+
+
+/**
+* @brief Set a shell variable. A variable that is already exported stays
+* exported.
+*
+* @param name The name
+* @param value The value, NULL to only change the export flag
+* @param exported Mark the variable for export to children
+*/
+void var_set(const char *name, const char *value, bool exported);
+
+
+/**
+* @brief Make a shell variable an empty indexed array. Its value as a
+* string is the first element. Arrays are never exported.
+*
+* @param name The name
+* @return struct array* The elements, valid until the variable is unset
+* or made a different kind of array
+*/
+struct array *var_set_array(const char *name);
+
+
+/**
+* @brief Make a shell variable an empty associative array, a map from
+* strings to strings. Its value as a string is the element with key "0".
+*
+* @param name The name
+* @return struct hmap* The elements, valid until the variable is unset
+* or made a different kind of array
+*/
+struct hmap *var_set_assoc(const char *name);
+
+
+/**
+* @brief The elements of an indexed array variable
+*
+* @param name The name
+* @return struct array* The elements, valid until the variable is unset,
+* NULL if it is not an array
+*/
+struct array *var_array(const char *name);
+
+
+/**
+* @brief The elements of an associative array variable
+*
+* @param name The name
+* @return struct hmap* The elements, NULL if it is not an associative array
+*/
+struct hmap *var_assoc(const char *name);
+
+
+/**
+* @brief The elements of an indexed array variable, for assigning one.
+* An unset variable becomes an empty array and a string becomes an array
+* with the string as element 0.
+*
+* @param name The name
+* @return struct array* The elements, NULL if it is an associative array
+*/
+struct array *var_as_array(const char *name);
+
+
+/**
+* @brief Remove a shell variable
+*
+* @param name The name
+*/
+void var_unset(const char *name);
+
+
+/**
+* @brief Check that a string is a valid variable name
+*
+* @param name The string
+* @param n Its length
+* @return true When it is a name
+*/
+bool var_name_valid(const char *name, size_t n);
+
+
+/**
+* @brief Counter that changes whenever the set of exported variables or
+* one of their values changes
+*
+* @return unsigned long The current generation
+*/
+unsigned long vars_generation(void);
+
+
+/**
+* @brief The environment for a child. The array is only built again when
+* the exported variables changed since it was last built, otherwise the
+* same array is returned. environ is pointed at it as well so library
+* code sees the same variables.
+*
+* @return char** The NULL terminated array, valid until the exported
+* variables change
+*/
+char **vars_envp(void);
+
+
+/**
+* @brief Take a reference to the current environment array so another
+* thread can use it while the shell goes on changing variables
+*
+* @return char** The array, give it back with vars_envp_release
+*/
+char **vars_envp_hold(void);
+
+
+/**
+* @brief Drop a reference taken with vars_envp_hold. May be called from
+* any thread.
+*
+* @param envp The array, may be NULL
+*/
+void vars_envp_release(char **envp);
+
+
+/**
+* @brief Forget every variable and put the original environ back
+*/
+void vars_free(void);
+
+
+/**
+* @brief The export builtin.
+*
+*   export [name[=value] ...]
+*
+* Marks each name for export, assigning the value when one is given.
+* Without names the exported variables are listed.
+*
+* @param sh The shell
+* @param argv The arguments
+* @return int The exit status, 1 if a name is not valid
+*/
+int export_builtin(struct shell *sh, char **argv);
+
+
+/**
+* @brief The unset builtin.
+*
+*   unset [-v | -f] name ...
+*
+* Removes variables, or functions after -f. A name of the form name[sub]
+* removes one element of an array.
+*
+* @param sh The shell
+* @param argv The arguments
+* @return int The exit status
+*/
+int unset_builtin(struct shell *sh, char **argv);
+
+
+/**
+* @brief The declare builtin.
+*
+*   declare [-a | -A] name[=value] ...
+*
+* -a makes each name an indexed array, keeping a string value as element
+* 0, and -A makes it an associative array. The shell runs assignments
+* given to declare itself, so name=(...) arrives here as the bare name
+* and is assigned after the type is set.
+*
+* @param sh The shell
+* @param argv The arguments
+* @return int The exit status, 1 if a name is not valid or cannot be
+* converted, 2 for a usage error
+*/
+int declare_builtin(struct shell *sh, char **argv);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
@@ -0,0 +1,478 @@
+#include "vm.h"
+#include "exec.h"
+#include "expand.h"
+#include "func.h"
+#include "lab.h"
+#include "pattern.h"
+#include "vars.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Slots that fit on the C stack, deeper programs allocate
+#define VM_LOCAL_SLOTS 8
+
+
+/* State of one compound command while it runs: the status of a loop,
+* the words of a for loop or the word a case matches against */
+struct slot
+{
+int status;
+bool loop;           // counted in sh->loops while it exists
+size_t next;         // next word of a for loop
+struct strvec words;
+char *subject;
+};
+
+
+struct compiler
+{
+struct prog *pr;
+int32_t depth;       // slots in use at this point of the code
+int32_t loop;        // innermost loop, -1 outside of loops
+int32_t top;         // node compiled without its redirections and negation
+};
+
+
+static int32_t emit(struct compiler *c, int op, int32_t arg) {
+    struct prog *pr = c->pr;
+    if (pr->ncode == pr->capcode) {
+        pr->capcode = pr->capcode ? pr->capcode * 2 : 16;
+        pr->code = xrealloc(pr->code, pr->capcode * sizeof(struct insn));
+    }
+    struct insn *in = &pr->code[pr->ncode];
+    in->op = op;
+    in->arg = arg;
+    in->target = -1;
+    in->loop = c->loop;
+    return pr->ncode++;
+}
+
+
+// Make a jump go to the next instruction emitted
+static void patch(struct compiler *c, int32_t at) {
+    c->pr->code[at].target = c->pr->ncode;
+}
+
+
+static void slot_open(struct compiler *c) {
+    if (++c->depth > c->pr->maxdepth) {
+        c->pr->maxdepth = c->depth;
+    }
+}
+
+
+static int32_t loop_open(struct compiler *c) {
+    struct prog *pr = c->pr;
+    if (pr->nloops == pr->caploops) {
+        pr->caploops = pr->caploops ? pr->caploops * 2 : 4;
+        pr->loops = xrealloc(pr->loops, pr->caploops * sizeof(struct vm_loop));
+    }
+    struct vm_loop *l = &pr->loops[pr->nloops];
+    l->cont = l->brk = -1;
+    l->depth = c->depth;
+    l->parent = c->loop;
+    c->loop = pr->nloops;
+    return pr->nloops++;
+}
+
+
+static void compile(struct compiler *c, int32_t idx);
+
+
+static void compile_list(struct compiler *c, int32_t idx) {
+    struct ast *ast = c->pr->ast;
+    for (int32_t i = ast->nodes[idx].a; i >= 0; i = ast->nodes[i].next) {
+        if (ast->nodes[i].flags & NODE_BG) {
+            emit(c, OP_BG, i);
+        } else {
+            compile(c, i);
+        }
+    }
+}
+
+
+static void compile_if(struct compiler *c, int32_t idx) {
+    struct node n = c->pr->ast->nodes[idx];
+    compile(c, n.a);
+    int32_t skip = emit(c, OP_JNZ, 0);
+    compile(c, n.b);
+    int32_t end = emit(c, OP_JMP, 0);
+    patch(c, skip);
+    if (n.c >= 0) {
+        compile(c, n.c);
+    } else {
+        // No branch ran
+        emit(c, OP_ZERO, 0);
+    }
+    patch(c, end);
+}
+
+
+/*while cond; do body; done becomes
+*   LOOP; top: cond; JNZ out; body; SAVE; JMP top; out: POP*/
+static void compile_while(struct compiler *c, int32_t idx) {
+    struct node n = c->pr->ast->nodes[idx];
+    int32_t outer = c->loop;
+    emit(c, OP_LOOP, idx);
+    slot_open(c);
+    int32_t l = loop_open(c);
+    c->pr->loops[l].cont = c->pr->ncode;
+    compile(c, n.a);
+    int32_t out = emit(c, (n.flags & NODE_UNTIL) ? OP_JZ : OP_JNZ, 0);
+    compile(c, n.b);
+    emit(c, OP_SAVE, 0);
+    int32_t back = emit(c, OP_JMP, 0);
+    c->pr->code[back].target = c->pr->loops[l].cont;
+    patch(c, out);
+    c->pr->loops[l].brk = c->pr->ncode;
+    c->loop = outer;
+    emit(c, OP_POP, 0);
+    c->depth--;
+}
+
+
+/*for name in words; do body; done becomes
+*   FOR; top: NEXT out; body; SAVE; JMP top; out: POP*/
+static void compile_for(struct compiler *c, int32_t idx) {
+    struct node n = c->pr->ast->nodes[idx];
+    int32_t outer = c->loop;
+    emit(c, OP_FOR, idx);
+    slot_open(c);
+    int32_t l = loop_open(c);
+    int32_t top = emit(c, OP_NEXT, idx);
+    c->pr->loops[l].cont = top;
+    compile(c, n.a);
+    emit(c, OP_SAVE, 0);
+    int32_t back = emit(c, OP_JMP, 0);
+    c->pr->code[back].target = top;
+    patch(c, top);
+    c->pr->loops[l].brk = c->pr->ncode;
+    c->loop = outer;
+    emit(c, OP_POP, 0);
+    c->depth--;
+}
+
+
+/*Every item tests its patterns and falls through to its body, which
+* jumps past the rest*/
+static void compile_case(struct compiler *c, int32_t idx) {
+    struct ast *ast = c->pr->ast;
+    emit(c, OP_CASE, idx);
+    slot_open(c);
+    int32_t *ends = NULL;
+    size_t nends = 0;
+    for (int32_t i = ast->nodes[idx].a; i >= 0; i = ast->nodes[i].next) {
+        int32_t skip = emit(c, OP_MATCH, i);
+        int32_t body = ast->nodes[i].a;
+        if (ast->nodes[body].a >= 0) {
+            compile(c, body);
+        } else {
+            emit(c, OP_ZERO, 0);
+        }
+        ends = xrealloc(ends, (nends + 1) * sizeof(int32_t));
+        ends[nends++] = emit(c, OP_JMP, 0);
+        patch(c, skip);
+    }
+    // Nothing matched
+    emit(c, OP_ZERO, 0);
+    for (size_t i = 0; i < nends; i++) {
+        patch(c, ends[i]);
+    }
+    free(ends);
+    emit(c, OP_POP, 0);
+    c->depth--;
+}
+
+
+static void compile(struct compiler *c, int32_t idx) {
+    if (idx < 0) {
+        return;
+    }
+    struct node n = c->pr->ast->nodes[idx];
+    int32_t jump;
+    if (n.nredirs > 0 && idx != c->top) {
+        // exec applies the redirections around the whole command
+        emit(c, OP_RUN, idx);
+        return;
+    }
+    switch (n.kind) {
+    case NODE_LIST:
+        compile_list(c, idx);
+        break;
+    case NODE_GROUP:
+        compile(c, n.a);
+        break;
+    case NODE_AND:
+    case NODE_OR:
+        compile(c, n.a);
+        jump = emit(c, n.kind == NODE_AND ? OP_JNZ : OP_JZ, 0);
+        compile(c, n.b);
+        patch(c, jump);
+        break;
+    case NODE_IF:
+        compile_if(c, idx);
+        break;
+    case NODE_WHILE:
+        compile_while(c, idx);
+        break;
+    case NODE_FOR:
+        compile_for(c, idx);
+        break;
+    case NODE_CASE:
+        compile_case(c, idx);
+        break;
+    default:
+        // Commands, pipelines and definitions negate themselves
+        emit(c, OP_RUN, idx);
+        return;
+    }
+    if ((n.flags & NODE_NEGATE) && idx != c->top) {
+        emit(c, OP_NOT, 0);
+    }
+}
+
+
+static struct prog *prog_compile(struct ast *ast, int32_t idx, int32_t top) {
+    struct prog *pr = xcalloc(1, sizeof(*pr));
+    pr->ast = ast;
+    struct compiler c = { pr, 0, -1, top };
+    compile(&c, idx);
+    return pr;
+}
+
+
+// Compile one node of a tree into a program of its own
+struct prog *vm_compile(struct ast *ast, int32_t idx) {
+    return prog_compile(ast, idx, idx);
+}
+
+
+// Get the program of a tree, compiling it the first time
+struct prog *vm_program(struct ast *ast) {
+    if (ast->prog == NULL) {
+        // The root of a function body may have redirections of its own
+        ast->prog = prog_compile(ast, ast->root, -1);
+    }
+    return ast->prog;
+}
+
+
+// Free a program
+void prog_free(struct prog *pr) {
+    if (pr == NULL) {
+        return;
+    }
+    free(pr->code);
+    free(pr->loops);
+    free(pr);
+}
+
+
+static void slot_push(struct shell *sh, struct slot *s, bool loop) {
+    memset(s, 0, sizeof(*s));
+    s->loop = loop;
+    if (loop) {
+        sh->loops++;
+    }
+}
+
+
+static void slot_pop(struct shell *sh, struct slot *s) {
+    if (s->loop) {
+        sh->loops--;
+    }
+    strvec_free(&s->words);
+    free(s->subject);
+}
+
+
+static void for_words(struct shell *sh, struct ast *ast, int32_t idx, struct strvec *out) {
+    struct node *n = &ast->nodes[idx];
+    if (n->flags & NODE_FORALL) {
+        for (size_t i = 1; i <= func_nparams(sh); i++) {
+            strvec_push(out, xstrdup(func_param(sh, i)));
+        }
+        return;
+    }
+    for (uint32_t i = 1; i < n->nwords; i++) {
+        if (expand_word(sh, ast_str(ast, ast->words[n->word0 + i]), out) < 0) {
+            break;
+        }
+    }
+}
+
+
+static bool case_match(struct shell *sh, struct ast *ast, int32_t idx, const char *subject) {
+    struct node *n = &ast->nodes[idx];
+    for (uint32_t i = 0; i < n->nwords; i++) {
+        char *pat = expand_pattern(sh, ast_str(ast, ast->words[n->word0 + i]));
+        bool match = pat != NULL && pattern_matches(pat, subject);
+        free(pat);
+        if (match) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/*Carry out a pending break or continue after a command inside loop.
+* Returns where to go on, the end of the program when the loop to leave
+* belongs to a caller.*/
+static uint32_t loop_jump(struct shell *sh, struct prog *pr, int32_t loop, struct slot *stack, int *sp) {
+    if (loop < 0) {
+        return pr->ncode;
+    }
+    int n = sh->loopjump > 0 ? sh->loopjump : -sh->loopjump;
+    bool cont = sh->loopjump < 0;
+    int32_t l = loop;
+    while (n > 1 && pr->loops[l].parent >= 0) {
+        l = pr->loops[l].parent;
+        n--;
+    }
+    if (n > 1) {
+        // Leave every loop here, the rest is up to the caller
+        sh->loopjump = cont ? -(n - 1) : n - 1;
+        return pr->ncode;
+    }
+    sh->loopjump = 0;
+    while (*sp > pr->loops[l].depth) {
+        slot_pop(sh, &stack[--*sp]);
+    }
+    return cont ? pr->loops[l].cont : pr->loops[l].brk;
+}
+
+
+// Run a program
+int vm_run(struct shell *sh, struct prog *pr) {
+    struct slot local[VM_LOCAL_SLOTS];
+    struct slot *stack = pr->maxdepth <= VM_LOCAL_SLOTS ? local : xmalloc(pr->maxdepth * sizeof(struct slot));
+    int sp = 0;
+    struct ast *ast = pr->ast;
+    uint32_t pc = 0;
+    while (pc < pr->ncode) {
+        struct insn *in = &pr->code[pc++];
+        struct slot *top = sp > 0 ? &stack[sp - 1] : NULL;
+        switch (in->op) {
+        case OP_RUN:
+        case OP_BG:
+            sh->status = in->op == OP_RUN ? exec_run(sh, ast, in->arg) : exec_background(sh, ast, in->arg);
+            if (sh->frame != NULL && sh->frame->returning) {
+                pc = pr->ncode;
+            } else if (sh->loopjump != 0) {
+                pc = loop_jump(sh, pr, in->loop, stack, &sp);
+            }
+            break;
+        case OP_JMP:
+            pc = in->target;
+            break;
+        case OP_JZ:
+            if (sh->status == 0) {
+                pc = in->target;
+            }
+            break;
+        case OP_JNZ:
+            if (sh->status != 0) {
+                pc = in->target;
+            }
+            break;
+        case OP_NOT:
+            sh->status = !sh->status;
+            break;
+        case OP_ZERO:
+            sh->status = 0;
+            break;
+        case OP_LOOP:
+            slot_push(sh, &stack[sp++], true);
+            break;
+        case OP_SAVE:
+            top->status = sh->status;
+            break;
+        case OP_POP:
+            if (top->loop) {
+                // A loop has the status of the last body that ran
+                sh->status = top->status;
+            }
+            slot_pop(sh, top);
+            sp--;
+            break;
+        case OP_FOR:
+            slot_push(sh, &stack[sp], true);
+            for_words(sh, ast, in->arg, &stack[sp++].words);
+            break;
+        case OP_NEXT:
+            if (top->next < top->words.n) {
+                const char *name = ast_str(ast, ast->words[ast->nodes[in->arg].word0]);
+                var_set(name, top->words.v[top->next++], false);
+            } else {
+                pc = in->target;
+            }
+            break;
+        case OP_CASE: {
+            struct node *n = &ast->nodes[in->arg];
+            slot_push(sh, &stack[sp], false);
+            char *subject = expand_string(sh, ast_str(ast, ast->words[n->word0]));
+            stack[sp++].subject = subject ? subject : xstrdup("");
+            break;
+        }
+        case OP_MATCH:
+            if (!case_match(sh, ast, in->arg, top->subject)) {
+                pc = in->target;
+            }
+            break;
+        }
+    }
+    while (sp > 0) {
+        slot_pop(sh, &stack[--sp]);
+    }
+    if (stack != local) {
+        free(stack);
+    }
+    return sh->status;
+}
+
+
+// Compile and run one compound command
+int vm_exec_node(struct shell *sh, struct ast *ast, int32_t idx) {
+    struct prog *pr = vm_compile(ast, idx);
+    int status = vm_run(sh, pr);
+    prog_free(pr);
+    return status;
+}
+
+
+// Record a break or continue for the loop that runs the command
+static int loop_builtin(struct shell *sh, char **argv, int sign) {
+    long n = 1;
+    if (argv[1] != NULL) {
+        char *end;
+        n = strtol(argv[1], &end, 10);
+        if (*argv[1] == '\0' || *end != '\0' || n < 1) {
+            fprintf(stderr, "%s: %s: loop count out of range\n", argv[0], argv[1]);
+            return 1;
+        }
+    }
+    if (sh->loops == 0) {
+        fprintf(stderr, "%s: only meaningful in a `for', `while', or `until' loop\n", argv[0]);
+        return 0;
+    }
+    if (n > sh->loops) {
+        n = sh->loops;
+    }
+    sh->loopjump = sign * (int)n;
+    return 0;
+}
+
+
+// The break builtin
+int break_builtin(struct shell *sh, char **argv) {
+    return loop_builtin(sh, argv, 1);
+}
+
+
+// The continue builtin
+int continue_builtin(struct shell *sh, char **argv) {
+    return loop_builtin(sh, argv, -1);
+}
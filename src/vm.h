@@ -0,0 +1,150 @@
+#ifndef VM_H
+#define VM_H
+#include <stddef.h>
+#include <stdint.h>
+#include "parse.h"
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+struct shell;
+
+
+enum vm_op
+{
+OP_RUN,         // run node arg the tree-walking way: commands, pipelines
+OP_BG,          // start node arg in the background
+OP_JMP,         // go to target
+OP_JZ,          // go to target when the status is 0
+OP_JNZ,         // go to target when the status is not 0
+OP_NOT,         // negate the status
+OP_ZERO,        // set the status to 0
+OP_LOOP,        // push the status slot of a while loop
+OP_SAVE,        // remember the status of a loop body in its slot
+OP_POP,         // pop a slot, a loop slot gives the status back
+OP_FOR,         // expand the words of for node arg into a loop slot
+OP_NEXT,        // assign the next word of the for loop, at the end go to target
+OP_CASE,        // expand the word of case node arg into a slot
+OP_MATCH,       // go to target unless a pattern of item arg matches
+};
+
+
+/* One instruction. Nodes are referred to by their index in the tree. */
+struct insn
+{
+uint8_t op;
+int32_t arg;
+int32_t target;
+int32_t loop;        // innermost loop around a command, -1 for none
+};
+
+
+/* Where break and continue go for one loop of a program */
+struct vm_loop
+{
+int32_t cont;        // the test of the loop
+int32_t brk;         // the pop of its slot
+int32_t depth;       // slots in use inside the body
+int32_t parent;      // enclosing loop, -1 for none
+};
+
+
+/* A compiled tree. Compound commands become jumps, everything else is
+* run by exec one node at a time. */
+struct prog
+{
+struct ast *ast;
+struct insn *code;
+uint32_t ncode, capcode;
+struct vm_loop *loops;
+uint32_t nloops, caploops;
+int32_t maxdepth;    // most slots in use at once
+};
+
+
+/**
+* @brief Get the program of a tree, compiling it the first time. The
+* program is kept on the tree and freed with it.
+*
+* @param ast The tree
+* @return struct prog* The program
+*/
+struct prog *vm_program(struct ast *ast);
+
+
+/**
+* @brief Compile one node of a tree into a program of its own. The
+* redirections and the negation of the node itself are left to the
+* caller.
+*
+* @param ast The tree
+* @param idx The node
+* @return struct prog* The program, free it with prog_free
+*/
+struct prog *vm_compile(struct ast *ast, int32_t idx);
+
+
+/**
+* @brief Run a program. A return or a break out of loops the program
+* does not own ends it early, leaving the request to the caller.
+*
+* @param sh The shell
+* @param pr The program
+* @return int The exit status
+*/
+int vm_run(struct shell *sh, struct prog *pr);
+
+
+/**
+* @brief Compile and run one compound command, used when one shows up
+* in a pipeline, in the background or with redirections
+*
+* @param sh The shell
+* @param ast The tree
+* @param idx The node
+* @return int The exit status
+*/
+int vm_exec_node(struct shell *sh, struct ast *ast, int32_t idx);
+
+
+/**
+* @brief Free a program
+*
+* @param pr The program, may be NULL
+*/
+void prog_free(struct prog *pr);
+
+
+/**
+* @brief The break builtin.
+*
+*   break [n]
+*
+* Leaves the n innermost loops, one by default.
+*
+* @param sh The shell
+* @param argv The arguments
+* @return int The exit status
+*/
+int break_builtin(struct shell *sh, char **argv);
+
+
+/**
+* @brief The continue builtin.
+*
+*   continue [n]
+*
+* Goes on with the next iteration of the n-th innermost loop.
+*
+* @param sh The shell
+* @param argv The arguments
+* @return int The exit status
+*/
+int continue_builtin(struct shell *sh, char **argv);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+#endif
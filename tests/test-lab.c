@@ -1,6 +1,30 @@
 #include <string.h>
 #include "harness/unity.h"
 #include "../src/lab.h"
+#include "../src/parse.h"
+#include "../src/exec.h"
+#include "../src/jobs.h"
+#include "../src/prompt.h"
+#include "../src/histlog.h"
+#include "../src/histsearch.h"
+#include "../src/histshare.h"
+#include "../src/histcmd.h"
+#include "../src/cmdhash.h"
+#include "../src/complete.h"
+#include "../src/dirdb.h"
+#include "../src/dirstack.h"
+#include "../src/vars.h"
+#include "../src/arena.h"
+#include "../src/func.h"
+#include "../src/pattern.h"
+#include "../src/regcache.h"
+#include "../src/array.h"
+#include "../src/hmap.h"
+#include "../src/alias.h"
+#include "../src/source.h"
+#include <readline/history.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 void setUp(void) {
 // set stuff up here
 }
@@ -139,6 +163,989 @@ free(line);
 free(actual);
 cmd_free(cmd);
 }
+void test_parse_heredoc_body(void)
+{
+int status;
+struct ast *ast = ast_parse("cat <<EOF\nhello\n  world\nEOF\n", &status);
+TEST_ASSERT_EQUAL_INT(PARSE_OK, status);
+TEST_ASSERT_EQUAL_INT(1, ast->nredirs);
+TEST_ASSERT_EQUAL_INT(REDIR_HEREDOC, ast->redirs[0].kind);
+TEST_ASSERT_EQUAL_STRING("hello\n  world\n", ast_str(ast, ast->redirs[0].arg));
+ast_free(ast);
+}
+void test_parse_heredoc_incomplete(void)
+{
+int status;
+struct ast *ast = ast_parse("cat <<EOF\nhello", &status);
+TEST_ASSERT_EQUAL_INT(PARSE_INCOMPLETE, status);
+ast_free(ast);
+ast = ast_parse("echo 'open", &status);
+TEST_ASSERT_EQUAL_INT(PARSE_INCOMPLETE, status);
+ast_free(ast);
+}
+static char *read_file(const char *path)
+{
+static char buf[256];
+memset(buf, 0, sizeof(buf));
+FILE *f = fopen(path, "r");
+if (f) {
+fread(buf, 1, sizeof(buf) - 1, f);
+fclose(f);
+}
+return buf;
+}
+void test_heredoc_memfd_reused(void)
+{
+struct shell sh = {0};
+int status;
+struct ast *ast = ast_parse("cat <<'EOF' >/tmp/lab-test-heredoc\nsame $body\nEOF\n", &status);
+TEST_ASSERT_EQUAL_INT(PARSE_OK, status);
+TEST_ASSERT_EQUAL_INT(0, exec_ast(&sh, ast));
+int memfd = ast->redirs[0].memfd;
+TEST_ASSERT_TRUE(memfd >= 0);
+TEST_ASSERT_EQUAL_INT(0, exec_ast(&sh, ast));
+TEST_ASSERT_EQUAL_INT(memfd, ast->redirs[0].memfd);
+TEST_ASSERT_EQUAL_STRING("same $body\n", read_file("/tmp/lab-test-heredoc"));
+ast_free(ast);
+sh_destroy(&sh);
+unlink("/tmp/lab-test-heredoc");
+}
+void test_herestring(void)
+{
+struct shell sh = {0};
+var_set("LAB_TEST_VAR", "value", false);
+exec_string(&sh, "cat <<< \"got $LAB_TEST_VAR\" >/tmp/lab-test-herestr");
+TEST_ASSERT_EQUAL_STRING("got value\n", read_file("/tmp/lab-test-herestr"));
+sh_destroy(&sh);
+unlink("/tmp/lab-test-herestr");
+var_unset("LAB_TEST_VAR");
+}
+void test_process_substitution(void)
+{
+struct shell sh = {0};
+exec_string(&sh, "cat <(echo one) <(echo two) >/tmp/lab-test-procsubst");
+TEST_ASSERT_EQUAL_STRING("one\ntwo\n", read_file("/tmp/lab-test-procsubst"));
+TEST_ASSERT_EQUAL_INT(0, sh.npsfds);
+// The producers are reaped through the job table
+for (int i = 0; i < 100 && sh.njobs > 0; i++) {
+usleep(10000);
+jobs_reap(&sh);
+}
+TEST_ASSERT_EQUAL_INT(0, sh.njobs);
+sh_destroy(&sh);
+unlink("/tmp/lab-test-procsubst");
+}
+void test_parse_pipeline(void)
+{
+int status;
+struct ast *ast = ast_parse("! a | b | c && d || e &", &status);
+TEST_ASSERT_EQUAL_INT(PARSE_OK, status);
+struct node *list = &ast->nodes[ast->root];
+struct node *orn = &ast->nodes[list->a];
+TEST_ASSERT_EQUAL_INT(NODE_OR, orn->kind);
+TEST_ASSERT_TRUE(orn->flags & NODE_BG);
+struct node *andn = &ast->nodes[orn->a];
+TEST_ASSERT_EQUAL_INT(NODE_AND, andn->kind);
+struct node *pipe = &ast->nodes[andn->a];
+TEST_ASSERT_EQUAL_INT(NODE_PIPE, pipe->kind);
+TEST_ASSERT_TRUE(pipe->flags & NODE_NEGATE);
+int stages = 0;
+for (int32_t c = pipe->a; c >= 0; c = ast->nodes[c].next) {
+stages++;
+}
+TEST_ASSERT_EQUAL_INT(3, stages);
+ast_free(ast);
+ast = ast_parse("ls |", &status);
+TEST_ASSERT_EQUAL_INT(PARSE_INCOMPLETE, status);
+ast_free(ast);
+}
+void test_pipeline_status(void)
+{
+struct shell sh = {0};
+exec_string(&sh, "printf 'b\\na\\n' | sort | tr a-z A-Z >/tmp/lab-test-pipe");
+TEST_ASSERT_EQUAL_STRING("A\nB\n", read_file("/tmp/lab-test-pipe"));
+TEST_ASSERT_EQUAL_INT(0, exec_string(&sh, "sh -c 'exit 3' | false | true"));
+TEST_ASSERT_EQUAL_INT(3, sh.npipestatus);
+TEST_ASSERT_EQUAL_INT(3, sh.pipestatus[0]);
+TEST_ASSERT_EQUAL_INT(1, sh.pipestatus[1]);
+TEST_ASSERT_EQUAL_INT(0, sh.pipestatus[2]);
+exec_string(&sh, "echo ${PIPESTATUS[@]} >/tmp/lab-test-pipe");
+TEST_ASSERT_EQUAL_STRING("3 1 0\n", read_file("/tmp/lab-test-pipe"));
+exec_string(&sh, "set -o pipefail");
+TEST_ASSERT_EQUAL_INT(1, exec_string(&sh, "sh -c 'exit 3' | false | true"));
+exec_string(&sh, "set +o pipefail");
+TEST_ASSERT_EQUAL_INT(0, exec_string(&sh, "false || true && ! false"));
+TEST_ASSERT_EQUAL_INT(0, sh.njobs);
+sh_destroy(&sh);
+unlink("/tmp/lab-test-pipe");
+}
+void test_background_job(void)
+{
+struct shell sh = {0};
+TEST_ASSERT_EQUAL_INT(0, exec_string(&sh, "sleep 0.05 &"));
+TEST_ASSERT_EQUAL_INT(1, jobs_count(&sh));
+TEST_ASSERT_NOT_NULL(job_find(&sh, "%1"));
+for (int i = 0; i < 100 && sh.njobs > 0; i++) {
+usleep(10000);
+jobs_notify(&sh);
+}
+TEST_ASSERT_EQUAL_INT(0, jobs_count(&sh));
+sh_destroy(&sh);
+}
+void test_prompt_render(void)
+{
+struct shell sh = {0};
+struct prompt *p = prompt_compile("[\\W \\?] \\\\\\$ ");
+char *dir[] = {"cd", "/tmp", NULL};
+change_dir(dir);
+const char *first = prompt_render(&sh, p);
+TEST_ASSERT_EQUAL_STRING(geteuid() == 0 ? "[tmp 0] \\# " : "[tmp 0] \\$ ", first);
+// Nothing changed, the cached string comes back
+TEST_ASSERT_EQUAL_PTR(first, prompt_render(&sh, p));
+sh.status = 7;
+dir[1] = "/";
+change_dir(dir);
+TEST_ASSERT_EQUAL_STRING(geteuid() == 0 ? "[/ 7] \\# " : "[/ 7] \\$ ", prompt_render(&sh, p));
+prompt_free(p);
+p = prompt_compile("\\j jobs, took \\D");
+sh.duration_ms = 1500;
+TEST_ASSERT_EQUAL_STRING("0 jobs, took 1.5s", prompt_render(&sh, p));
+prompt_free(p);
+}
+void test_prompt_async_vcs(void)
+{
+if (system("rm -rf /tmp/lab-test-git && git init -q -b lab /tmp/lab-test-git 2>/dev/null") != 0) {
+TEST_IGNORE_MESSAGE("git is not available");
+}
+struct shell sh = {0};
+char *dir[] = {"cd", "/tmp/lab-test-git", NULL};
+change_dir(dir);
+struct prompt *p = prompt_compile("(\\g)> ");
+// Drawn right away with a placeholder, the worker fills it in later
+TEST_ASSERT_EQUAL_STRING("(" PROMPT_PLACEHOLDER ")> ", prompt_render(&sh, p));
+for (int i = 0; i < 200 && !prompt_async_update(p); i++) {
+usleep(10000);
+}
+TEST_ASSERT_EQUAL_STRING("(lab)> ", p->rendered);
+prompt_free(p);
+dir[1] = "/";
+change_dir(dir);
+TEST_ASSERT_EQUAL_INT(0, system("rm -rf /tmp/lab-test-git"));
+}
+static void collect_cmd(const struct hist_entry *e, void *arg)
+{
+strbuf_add(arg, e->cmd, e->cmdlen);
+strbuf_addc(arg, ';');
+}
+void test_histlog(void)
+{
+const char *path = "/tmp/lab-test-history";
+unlink(path);
+struct histlog *h = histlog_open(path);
+TEST_ASSERT_NOT_NULL(h);
+TEST_ASSERT_EQUAL_INT(0, histlog_add(h, "ls", 0, 5));
+TEST_ASSERT_EQUAL_INT(0, histlog_add(h, "false", 1, 1));
+TEST_ASSERT_EQUAL_INT(0, histlog_add(h, "ls", 0, 7));
+histlog_close(h, 100);
+
+h = histlog_open(path);
+TEST_ASSERT_EQUAL_size_t(3, histlog_count(h));
+struct hist_entry e;
+TEST_ASSERT_TRUE(histlog_get(h, 1, &e));
+TEST_ASSERT_EQUAL_INT(1, e.status);
+TEST_ASSERT_EQUAL_STRING_LEN("false", e.cmd, e.cmdlen);
+TEST_ASSERT_EQUAL_INT(0, histlog_add(h, "echo hi", 0, 0));
+TEST_ASSERT_EQUAL_size_t(4, histlog_count(h));
+struct strbuf sb = {0};
+TEST_ASSERT_EQUAL_size_t(2, histlog_recent(h, 2, collect_cmd, &sb));
+TEST_ASSERT_EQUAL_STRING("ls;echo hi;", sb.s);
+histlog_close(h, 100);
+
+// Duplicates collapse to the newest one and only the last two are kept
+TEST_ASSERT_EQUAL_INT(0, histlog_compact(path, 2));
+h = histlog_open(path);
+sb.len = 0;
+TEST_ASSERT_EQUAL_size_t(2, histlog_recent(h, 10, collect_cmd, &sb));
+TEST_ASSERT_EQUAL_STRING("ls;echo hi;", sb.s);
+TEST_ASSERT_TRUE(histlog_get(h, 0, &e));
+TEST_ASSERT_EQUAL_UINT32(7, e.duration_ms);
+histlog_close(h, 100);
+strbuf_free(&sb);
+unlink(path);
+}
+void test_histsearch(void)
+{
+struct hist_search hs = {0};
+const char *cmds[] = {"make check", "git status", "make", "git stash", "git status", "ls", "git status"};
+for (size_t i = 0; i < sizeof(cmds) / sizeof(cmds[0]); i++) {
+histsearch_add(&hs, cmds[i], strlen(cmds[i]));
+}
+const char *res[8];
+// Run three times it beats the more recent git stash
+TEST_ASSERT_EQUAL_size_t(2, histsearch_find(&hs, "git st", res, 8));
+TEST_ASSERT_EQUAL_STRING("git status", res[0]);
+TEST_ASSERT_EQUAL_STRING("git stash", res[1]);
+TEST_ASSERT_EQUAL_size_t(1, histsearch_find(&hs, "stas", res, 8));
+TEST_ASSERT_EQUAL_size_t(0, histsearch_find(&hs, "gits", res, 8));
+// Too short for a trigram, the newest commands are scanned
+TEST_ASSERT_EQUAL_size_t(2, histsearch_find(&hs, "ma", res, 8));
+TEST_ASSERT_EQUAL_STRING("make", res[0]);
+hmap_free(&hs.cmds, NULL);
+trigram_free(&hs.ix);
+free(hs.docs);
+}
+static void collect_shared(const char *cmd, size_t len, void *arg)
+{
+strbuf_add(arg, cmd, len);
+strbuf_addc(arg, ';');
+}
+void test_histshare(void)
+{
+const char *path = "/tmp/lab-test-histshare";
+unlink(path);
+struct histshare *a = histshare_open(path);
+struct histshare *b = histshare_open(path);
+TEST_ASSERT_NOT_NULL(a);
+TEST_ASSERT_NOT_NULL(b);
+histshare_publish(a, "make");
+histshare_publish(b, "ls");
+histshare_publish(a, "make check");
+struct strbuf sb = {0};
+TEST_ASSERT_EQUAL_size_t(2, histshare_pull(b, collect_shared, &sb));
+TEST_ASSERT_EQUAL_STRING("make;make check;", sb.s);
+sb.len = 0;
+TEST_ASSERT_EQUAL_size_t(1, histshare_pull(a, collect_shared, &sb));
+TEST_ASSERT_EQUAL_STRING("ls;", sb.s);
+TEST_ASSERT_EQUAL_size_t(0, histshare_pull(b, collect_shared, &sb));
+// A reader that fell behind by more than the ring only sees the newest
+char cmd[32];
+for (int i = 0; i < HISTSHARE_SLOTS + 10; i++) {
+snprintf(cmd, sizeof(cmd), "cmd %d", i);
+histshare_publish(a, cmd);
+}
+TEST_ASSERT_EQUAL_size_t(HISTSHARE_SLOTS, histshare_pull(b, collect_shared, &sb));
+histshare_close(a);
+histshare_close(b);
+strbuf_free(&sb);
+unlink(path);
+}
+void test_history_builtin(void)
+{
+struct shell sh = {0};
+clear_history();
+add_history("echo one");
+add_history("ls -l /tmp");
+add_history("echo two");
+exec_string(&sh, "history >/tmp/lab-test-hist");
+TEST_ASSERT_EQUAL_STRING("    1  echo one\n    2  ls -l /tmp\n    3  echo two\n", read_file("/tmp/lab-test-hist"));
+exec_string(&sh, "history 2-3 -g echo >/tmp/lab-test-hist");
+TEST_ASSERT_EQUAL_STRING("    3  echo two\n", read_file("/tmp/lab-test-hist"));
+exec_string(&sh, "history 1 >/tmp/lab-test-hist");
+TEST_ASSERT_EQUAL_STRING("    3  echo two\n", read_file("/tmp/lab-test-hist"));
+TEST_ASSERT_EQUAL_INT(2, exec_string(&sh, "history x 2>/dev/null"));
+clear_history();
+sh_destroy(&sh);
+unlink("/tmp/lab-test-hist");
+}
+void test_history_expansion(void)
+{
+struct shell sh = {0};
+char *out;
+clear_history();
+add_history("echo one");
+add_history("ls -l /tmp");
+add_history("echo two");
+TEST_ASSERT_EQUAL_INT(1, hist_expand_line(&sh, "!!", &out));
+TEST_ASSERT_EQUAL_STRING("echo two", out);
+free(out);
+TEST_ASSERT_EQUAL_INT(1, hist_expand_line(&sh, "!2 | wc -l", &out));
+TEST_ASSERT_EQUAL_STRING("ls -l /tmp | wc -l", out);
+free(out);
+TEST_ASSERT_EQUAL_INT(1, hist_expand_line(&sh, "!-3; cat !$", &out));
+TEST_ASSERT_EQUAL_STRING("echo one; cat two", out);
+free(out);
+TEST_ASSERT_EQUAL_INT(1, hist_expand_line(&sh, "!l", &out));
+TEST_ASSERT_EQUAL_STRING("ls -l /tmp", out);
+free(out);
+add_history("echo three");
+TEST_ASSERT_EQUAL_INT(1, hist_expand_line(&sh, "!ec", &out));
+TEST_ASSERT_EQUAL_STRING("echo three", out);
+free(out);
+TEST_ASSERT_EQUAL_INT(0, hist_expand_line(&sh, "echo '!!' \\!! a != b !", &out));
+TEST_ASSERT_NULL(out);
+TEST_ASSERT_EQUAL_INT(-1, hist_expand_line(&sh, "!nosuch", &out));
+// A cleared list with as many entries is indexed again
+clear_history();
+add_history("pwd");
+add_history("cd /");
+add_history("make all");
+add_history("printf x");
+TEST_ASSERT_EQUAL_INT(-1, hist_expand_line(&sh, "!ec", &out));
+TEST_ASSERT_EQUAL_INT(1, hist_expand_line(&sh, "!ma", &out));
+TEST_ASSERT_EQUAL_STRING("make all", out);
+free(out);
+// A line that ran before comes back without being parsed
+int status;
+struct ast *ast = ast_parse("echo three", &status);
+hist_ast_keep(&sh, "echo three", ast);
+TEST_ASSERT_EQUAL_PTR(ast, hist_ast_take(&sh, "echo three"));
+TEST_ASSERT_NULL(hist_ast_take(&sh, "echo three"));
+ast_free(ast);
+clear_history();
+sh_destroy(&sh);
+}
+void test_trie_complete(void)
+{
+struct trie t = {0};
+const char *words[] = {"git", "gitk", "grep", "gzip", "g", "git", "zsh", "gunzip"};
+for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+trie_insert(&t, words[i], strlen(words[i]));
+}
+TEST_ASSERT_EQUAL_size_t(7, t.nwords);
+struct strvec out = {0};
+TEST_ASSERT_EQUAL_size_t(2, trie_complete(&t, "gi", 2, &out));
+TEST_ASSERT_EQUAL_STRING("git", out.v[0]);
+TEST_ASSERT_EQUAL_STRING("gitk", out.v[1]);
+strvec_free(&out);
+TEST_ASSERT_EQUAL_size_t(6, trie_complete(&t, "g", 1, &out));
+TEST_ASSERT_EQUAL_STRING("g", out.v[0]);
+TEST_ASSERT_EQUAL_STRING("gunzip", out.v[4]);
+TEST_ASSERT_EQUAL_STRING("gzip", out.v[5]);
+strvec_free(&out);
+TEST_ASSERT_EQUAL_size_t(1, trie_complete(&t, "gre", 3, &out));
+TEST_ASSERT_EQUAL_STRING("grep", out.v[0]);
+strvec_free(&out);
+TEST_ASSERT_EQUAL_size_t(0, trie_complete(&t, "gitx", 4, &out));
+TEST_ASSERT_EQUAL_size_t(0, trie_complete(&t, "x", 1, &out));
+TEST_ASSERT_EQUAL_size_t(7, trie_complete(&t, "", 0, &out));
+strvec_free(&out);
+trie_free(&t);
+}
+void test_command_hash(void)
+{
+struct shell sh = {0};
+char *old = xstrdup(var_get("PATH"));
+system("mkdir -p /tmp/lab-test-path && printf '#!/bin/sh\\n' > /tmp/lab-test-path/labcmd && chmod +x /tmp/lab-test-path/labcmd");
+var_set("PATH", "/tmp/lab-test-path:/tmp/lab-test-path2:/bin", true);
+unsigned long gen = cmdhash_generation();
+TEST_ASSERT_EQUAL_STRING("/tmp/lab-test-path/labcmd", cmdhash_find("labcmd"));
+TEST_ASSERT_EQUAL_STRING("./labcmd", cmdhash_find("./labcmd"));
+TEST_ASSERT_NULL(cmdhash_find("no-such-command-here"));
+// A program that moved is looked up again without forgetting the rest
+system("mkdir -p /tmp/lab-test-path2 && mv /tmp/lab-test-path/labcmd /tmp/lab-test-path2/");
+TEST_ASSERT_EQUAL_STRING("/tmp/lab-test-path/labcmd", cmdhash_find("labcmd"));
+TEST_ASSERT_EQUAL_STRING("/tmp/lab-test-path2/labcmd", cmdhash_check("labcmd"));
+TEST_ASSERT_EQUAL_STRING("/tmp/lab-test-path2/labcmd", cmdhash_find("labcmd"));
+system("mv /tmp/lab-test-path2/labcmd /tmp/lab-test-path/ && rmdir /tmp/lab-test-path2");
+TEST_ASSERT_EQUAL_UINT(gen, cmdhash_generation());
+char *argv[] = {"hash", "-r", NULL};
+TEST_ASSERT_EQUAL_INT(0, hash_builtin(&sh, argv));
+TEST_ASSERT_NOT_EQUAL(gen, cmdhash_generation());
+gen = cmdhash_generation();
+var_set("PATH", "/bin", true);
+TEST_ASSERT_NOT_EQUAL(gen, cmdhash_generation());
+// Builtins are offered right away, commands once the worker is done
+var_set("PATH", "/tmp/lab-test-path", true);
+struct strvec out = {0};
+complete_commands("hi", &out);
+TEST_ASSERT_EQUAL_STRING("history", out.v[0]);
+for (int i = 0; i < 200; i++) {
+strvec_free(&out);
+if (complete_commands("lab", &out) > 0) {
+break;
+}
+usleep(10000);
+}
+TEST_ASSERT_EQUAL_size_t(1, out.n);
+TEST_ASSERT_EQUAL_STRING("labcmd", out.v[0]);
+// A new alias makes the trie out of date as well
+char *def[] = {"alias", "labalias=labcmd", NULL};
+TEST_ASSERT_EQUAL_INT(0, alias_builtin(&sh, def));
+for (int i = 0; i < 200; i++) {
+strvec_free(&out);
+if (complete_commands("lab", &out) > 1) {
+break;
+}
+usleep(10000);
+}
+TEST_ASSERT_EQUAL_size_t(2, out.n);
+char *undef[] = {"unalias", "labalias", NULL};
+TEST_ASSERT_EQUAL_INT(0, unalias_builtin(&sh, undef));
+for (int i = 0; i < 200; i++) {
+strvec_free(&out);
+if (complete_commands("lab", &out) == 1) {
+break;
+}
+usleep(10000);
+}
+TEST_ASSERT_EQUAL_size_t(1, out.n);
+strvec_free(&out);
+complete_shutdown();
+var_set("PATH", old, true);
+free(old);
+system("rm -rf /tmp/lab-test-path");
+}
+void test_complete_files(void)
+{
+struct strvec out = {0};
+system("rm -rf /tmp/lab-test-files && mkdir -p /tmp/lab-test-files/sub && touch /tmp/lab-test-files/beta /tmp/lab-test-files/alpha /tmp/lab-test-files/alps");
+TEST_ASSERT_EQUAL_size_t(2, complete_files("/tmp/lab-test-files/al", &out));
+TEST_ASSERT_EQUAL_STRING("/tmp/lab-test-files/alpha", out.v[0]);
+TEST_ASSERT_EQUAL_STRING("/tmp/lab-test-files/alps", out.v[1]);
+strvec_free(&out);
+TEST_ASSERT_EQUAL_size_t(4, complete_files("/tmp/lab-test-files/", &out));
+TEST_ASSERT_EQUAL_STRING("/tmp/lab-test-files/sub", out.v[3]);
+strvec_free(&out);
+// A new file changes the directory's mtime and the listing is read again
+system("touch /tmp/lab-test-files/alto");
+TEST_ASSERT_EQUAL_size_t(3, complete_files("/tmp/lab-test-files/al", &out));
+TEST_ASSERT_EQUAL_STRING("/tmp/lab-test-files/alto", out.v[2]);
+strvec_free(&out);
+TEST_ASSERT_EQUAL_size_t(0, complete_files("/tmp/lab-test-files/nothing/x", &out));
+complete_shutdown();
+system("rm -rf /tmp/lab-test-files");
+}
+static int edit_distance(const char *a, const char *b)
+{
+int d[32][32];
+int n = strlen(a), m = strlen(b);
+for (int i = 0; i <= n; i++) d[i][0] = i;
+for (int j = 0; j <= m; j++) d[0][j] = j;
+for (int i = 1; i <= n; i++) {
+for (int j = 1; j <= m; j++) {
+int best = d[i - 1][j - 1] + (a[i - 1] != b[j - 1]);
+if (d[i - 1][j] + 1 < best) best = d[i - 1][j] + 1;
+if (d[i][j - 1] + 1 < best) best = d[i][j - 1] + 1;
+if (i > 1 && j > 1 && a[i - 1] == b[j - 2] && a[i - 2] == b[j - 1] && d[i - 2][j - 2] + 1 < best) best = d[i - 2][j - 2] + 1;
+d[i][j] = best;
+}
+}
+return d[n][m];
+}
+void test_fuzzy_suggest(void)
+{
+const char *words[] = {"git", "grep", "gzip", "python3", "ls", "less", "ssh", "sh", "systemctl", "gti", "", "kitten", "gerp", "abcd", "badc", "ca", "abc"};
+size_t nwords = sizeof(words) / sizeof(words[0]);
+struct fuzzy f;
+for (size_t i = 0; i < nwords; i++) {
+fuzzy_init(&f, words[i], strlen(words[i]));
+for (size_t j = 0; j < nwords; j++) {
+TEST_ASSERT_EQUAL_INT(edit_distance(words[i], words[j]), fuzzy_distance(&f, words[j], strlen(words[j])));
+}
+}
+struct trie t = {0};
+for (size_t i = 0; i < nwords - 8; i++) {
+trie_insert(&t, words[i], strlen(words[i]));
+}
+struct strvec out = {0};
+TEST_ASSERT_EQUAL_size_t(2, trie_suggest(&t, "gerp", 2, &out));
+TEST_ASSERT_EQUAL_STRING("grep", out.v[0]);
+TEST_ASSERT_EQUAL_STRING("gzip", out.v[1]);
+strvec_free(&out);
+TEST_ASSERT_EQUAL_size_t(2, trie_suggest(&t, "gti", 3, &out));
+TEST_ASSERT_EQUAL_STRING("git", out.v[0]);
+strvec_free(&out);
+TEST_ASSERT_EQUAL_size_t(1, trie_suggest(&t, "pyhton3", 3, &out));
+TEST_ASSERT_EQUAL_STRING("python3", out.v[0]);
+strvec_free(&out);
+TEST_ASSERT_EQUAL_size_t(0, trie_suggest(&t, "xyzzy", 3, &out));
+trie_free(&t);
+}
+void test_dirdb(void)
+{
+unlink("/tmp/lab-test-dirs");
+struct dirdb *db = dirdb_open("/tmp/lab-test-dirs");
+struct dirdb *other = dirdb_open("/tmp/lab-test-dirs");
+TEST_ASSERT_NOT_NULL(db);
+TEST_ASSERT_EQUAL_INT(0, dirdb_visit(db, "/usr/lib"));
+TEST_ASSERT_EQUAL_INT(0, dirdb_visit(db, "/usr/bin"));
+TEST_ASSERT_EQUAL_INT(0, dirdb_visit(db, "/usr/bin"));
+TEST_ASSERT_EQUAL_INT(0, dirdb_visit(db, "/tmp"));
+// Another shell sees the new directories and adds to the same ranks
+TEST_ASSERT_EQUAL_INT(0, dirdb_visit(other, "/usr/lib"));
+TEST_ASSERT_EQUAL_INT(0, dirdb_visit(other, "/usr/lib"));
+struct strvec out = {0};
+char *usr[] = {"usr", NULL};
+TEST_ASSERT_EQUAL_size_t(2, dirdb_find(db, usr, time(NULL), &out));
+TEST_ASSERT_EQUAL_STRING("/usr/lib", out.v[0]);
+TEST_ASSERT_EQUAL_STRING("/usr/bin", out.v[1]);
+strvec_free(&out);
+// Recent visits weigh more
+TEST_ASSERT_EQUAL_size_t(2, dirdb_find(db, usr, time(NULL) + 7200, &out));
+TEST_ASSERT_EQUAL_STRING("/usr/lib", out.v[0]);
+strvec_free(&out);
+char *words[] = {"us", "bi", NULL};
+TEST_ASSERT_EQUAL_size_t(1, dirdb_find(db, words, time(NULL), &out));
+TEST_ASSERT_EQUAL_STRING("/usr/bin", out.v[0]);
+strvec_free(&out);
+char *none[] = {"bin", "usr", NULL};
+TEST_ASSERT_EQUAL_size_t(0, dirdb_find(other, none, time(NULL), &out));
+// z jumps to the best match and counts the visit
+struct shell sh = {0};
+sh.dirs = db;
+char *cwd = getcwd(NULL, 0);
+char *z[] = {"z", "tm", NULL};
+TEST_ASSERT_EQUAL_INT(0, z_builtin(&sh, z));
+char *now = getcwd(NULL, 0);
+TEST_ASSERT_EQUAL_STRING("/tmp", now);
+free(now);
+char *nomatch[] = {"z", "nothing-like-this", NULL};
+TEST_ASSERT_EQUAL_INT(1, z_builtin(&sh, nomatch));
+TEST_ASSERT_EQUAL_INT(0, chdir(cwd));
+free(cwd);
+// Aging forgets directories visited only once
+TEST_ASSERT_EQUAL_INT(0, dirdb_visit(db, "/var"));
+for (int i = 0; i < 9000; i++) {
+TEST_ASSERT_EQUAL_INT(0, dirdb_visit(db, "/usr"));
+}
+TEST_ASSERT_TRUE(db->total <= DIRDB_MAXRANK);
+char *slash[] = {"/", NULL};
+TEST_ASSERT_EQUAL_size_t(4, dirdb_find(other, slash, time(NULL), &out));
+TEST_ASSERT_EQUAL_STRING("/usr", out.v[0]);
+for (size_t i = 0; i < out.n; i++) {
+TEST_ASSERT_NOT_EQUAL(0, strcmp(out.v[i], "/var"));
+}
+strvec_free(&out);
+dirdb_close(db);
+dirdb_close(other);
+unlink("/tmp/lab-test-dirs");
+}
+void test_dir_stack(void)
+{
+struct shell sh = {0};
+char *start = getcwd(NULL, 0);
+system("rm -rf /tmp/lab-test-a /tmp/lab-test-c && mkdir -p /tmp/lab-test-a/b");
+char *cd_tmp[] = {"cd", "/tmp", NULL};
+char *cd_root[] = {"cd", "/", NULL};
+char *cd_back[] = {"cd", "-", NULL};
+TEST_ASSERT_EQUAL_INT(0, change_dir(cd_tmp));
+TEST_ASSERT_EQUAL_INT(0, change_dir(cd_root));
+TEST_ASSERT_EQUAL_STRING("/tmp", var_get("OLDPWD"));
+TEST_ASSERT_EQUAL_INT(0, change_dir(cd_back));
+TEST_ASSERT_EQUAL_STRING("/tmp", var_get("PWD"));
+TEST_ASSERT_EQUAL_STRING("/", var_get("OLDPWD"));
+char *push[] = {"pushd", "/tmp/lab-test-a/b", NULL};
+char *push_root[] = {"pushd", "/", NULL};
+char *swap[] = {"pushd", NULL};
+char *pop[] = {"popd", NULL};
+TEST_ASSERT_EQUAL_INT(0, pushd_builtin(&sh, push));
+TEST_ASSERT_EQUAL_INT(0, pushd_builtin(&sh, push_root));
+TEST_ASSERT_EQUAL_INT(2, sh.ndirstack);
+TEST_ASSERT_EQUAL_STRING("/tmp/lab-test-a/b", sh.dirstack[1].path);
+TEST_ASSERT_EQUAL_INT(0, pushd_builtin(&sh, swap));
+TEST_ASSERT_EQUAL_STRING("/tmp/lab-test-a/b", var_get("PWD"));
+TEST_ASSERT_EQUAL_STRING("/", sh.dirstack[1].path);
+TEST_ASSERT_EQUAL_INT(0, pushd_builtin(&sh, swap));
+// The descriptor still finds the directory after its parent was renamed
+TEST_ASSERT_EQUAL_INT(0, rename("/tmp/lab-test-a", "/tmp/lab-test-c"));
+TEST_ASSERT_EQUAL_INT(0, popd_builtin(&sh, pop));
+TEST_ASSERT_EQUAL_STRING("/tmp/lab-test-c/b", var_get("PWD"));
+TEST_ASSERT_EQUAL_INT(0, popd_builtin(&sh, pop));
+TEST_ASSERT_EQUAL_STRING("/tmp", var_get("PWD"));
+TEST_ASSERT_EQUAL_INT(1, popd_builtin(&sh, pop));
+TEST_ASSERT_EQUAL_INT(0, chdir(start));
+free(start);
+dirstack_free(&sh);
+system("rm -rf /tmp/lab-test-c");
+}
+void test_shell_vars(void)
+{
+struct shell sh = {0};
+vars_envp();
+unsigned long gen = vars_generation();
+// Shell variables stay out of the environment until exported
+exec_string(&sh, "LAB_TEST_LOCAL=one");
+TEST_ASSERT_EQUAL_STRING("one", var_get("LAB_TEST_LOCAL"));
+TEST_ASSERT_EQUAL_UINT(gen, vars_generation());
+char **held = vars_envp_hold();
+exec_string(&sh, "export LAB_TEST_LOCAL");
+TEST_ASSERT_NOT_EQUAL(gen, vars_generation());
+char **envp = vars_envp();
+bool found = false;
+for (char **e = envp; *e; e++) {
+found |= strcmp(*e, "LAB_TEST_LOCAL=one") == 0;
+}
+TEST_ASSERT_TRUE(found);
+// A held array outlives the one that replaced it
+for (char **e = held; *e; e++) {
+TEST_ASSERT_NOT_EQUAL(0, strcmp(*e, "LAB_TEST_LOCAL=one"));
+}
+vars_envp_release(held);
+// Assignments in front of a program only reach that program
+gen = vars_generation();
+exec_string(&sh, "LAB_TEST_ONCE=two sh -c 'echo $LAB_TEST_ONCE $LAB_TEST_LOCAL' >/tmp/lab-test-vars");
+TEST_ASSERT_EQUAL_STRING("two one\n", read_file("/tmp/lab-test-vars"));
+TEST_ASSERT_NULL(var_get("LAB_TEST_ONCE"));
+TEST_ASSERT_EQUAL_UINT(gen, vars_generation());
+TEST_ASSERT_EQUAL_PTR(envp, vars_envp());
+exec_string(&sh, "unset LAB_TEST_LOCAL");
+TEST_ASSERT_NULL(var_get("LAB_TEST_LOCAL"));
+TEST_ASSERT_NOT_EQUAL(gen, vars_generation());
+sh_destroy(&sh);
+unlink("/tmp/lab-test-vars");
+}
+void test_arena(void)
+{
+struct arena a = {0};
+char *first = arena_strdup(&a, "first");
+struct arena_mark m = arena_mark(&a);
+void *small = arena_alloc(&a, 24);
+void *big = arena_alloc(&a, 3 * ARENA_CHUNK);
+TEST_ASSERT_EQUAL_INT(0, (uintptr_t)small % 16);
+memset(big, 1, 3 * ARENA_CHUNK);
+arena_release(&a, m);
+// Released memory, even a whole chunk, is handed out again
+TEST_ASSERT_EQUAL_PTR(small, arena_alloc(&a, 24));
+TEST_ASSERT_EQUAL_PTR(big, arena_alloc(&a, 2 * ARENA_CHUNK));
+TEST_ASSERT_EQUAL_STRING("first", first);
+arena_free(&a);
+}
+void test_functions(void)
+{
+struct shell sh = {0};
+exec_string(&sh, "f() {\n echo \"$# $1 $2\" $$; shift; echo \"[$@]\"\n}");
+TEST_ASSERT_NOT_NULL(func_find("f"));
+// The call runs in the shell itself, $$ is our pid
+exec_string(&sh, "f one 'two words' three >/tmp/lab-test-func");
+char expected[64];
+snprintf(expected, sizeof(expected), "3 one two words %d\n[two words three]\n", (int)getpid());
+TEST_ASSERT_EQUAL_STRING(expected, read_file("/tmp/lab-test-func"));
+TEST_ASSERT_NULL(sh.frame);
+exec_string(&sh, "r() { return 7; echo no; }; r >/tmp/lab-test-func");
+TEST_ASSERT_EQUAL_INT(7, sh.status);
+TEST_ASSERT_EQUAL_STRING("", read_file("/tmp/lab-test-func"));
+// Without a status return keeps the last one
+exec_string(&sh, "q() { false; return; }; q");
+TEST_ASSERT_EQUAL_INT(1, sh.status);
+// Redefining a function while it runs keeps the running body alive
+exec_string(&sh, "g() { g() { echo new; }; echo old; }; g >/tmp/lab-test-func; g >>/tmp/lab-test-func");
+TEST_ASSERT_EQUAL_STRING("old\nnew\n", read_file("/tmp/lab-test-func"));
+exec_string(&sh, "{ echo a; echo b; } | cat >/tmp/lab-test-func");
+TEST_ASSERT_EQUAL_STRING("a\nb\n", read_file("/tmp/lab-test-func"));
+int status;
+struct ast *ast = ast_parse("h() { echo", &status);
+TEST_ASSERT_EQUAL_INT(PARSE_INCOMPLETE, status);
+ast_free(ast);
+ast = ast_parse("{ }", &status);
+TEST_ASSERT_EQUAL_INT(PARSE_ERROR, status);
+ast_free(ast);
+exec_string(&sh, "unset -f f");
+TEST_ASSERT_NULL(func_find("f"));
+sh_destroy(&sh);
+unlink("/tmp/lab-test-func");
+}
+void test_control_flow(void)
+{
+struct shell sh = {0};
+exec_string(&sh, "for i in a b c; do if false; then echo no; elif case $i in b) false;; esac; then echo $i; else echo not-$i; fi; done | cat >/tmp/lab-test-vm");
+TEST_ASSERT_EQUAL_STRING("a\nnot-b\nc\n", read_file("/tmp/lab-test-vm"));
+exec_string(&sh, "for i in 1 2 3; do for j in x y z; do case $j in y) continue 2;; esac; case $i in 3) break 2;; esac; echo $i$j; done; done | cat >/tmp/lab-test-vm");
+TEST_ASSERT_EQUAL_STRING("1x\n2x\n", read_file("/tmp/lab-test-vm"));
+TEST_ASSERT_EQUAL_INT(0, sh.loops);
+TEST_ASSERT_EQUAL_INT(0, sh.loopjump);
+exec_string(&sh, "s=; while case $s in xxx) false;; *) true;; esac; do s=x$s; done; until true; do s=no; done");
+TEST_ASSERT_EQUAL_STRING("xxx", var_get("s"));
+TEST_ASSERT_EQUAL_INT(0, sh.status);
+// Quoted glob characters in a pattern match literally
+exec_string(&sh, "case abc in \"a*\") r=quoted;; a*) r=glob;; esac");
+TEST_ASSERT_EQUAL_STRING("glob", var_get("r"));
+exec_string(&sh, "f() { for a; do if true; then return 4; fi; done; }; f x y");
+TEST_ASSERT_EQUAL_INT(4, sh.status);
+TEST_ASSERT_EQUAL_INT(0, sh.loops);
+exec_string(&sh, "for w in 1 2; do echo $w; done | cat >/tmp/lab-test-vm");
+TEST_ASSERT_EQUAL_STRING("1\n2\n", read_file("/tmp/lab-test-vm"));
+// A sourced file sees the shell and leaves its variables behind
+FILE *f = fopen("/tmp/lab-test-vm.sh", "w");
+fputs("v=$1$#\nif true; then\n  false\nfi\n", f);
+fclose(f);
+exec_string(&sh, ". /tmp/lab-test-vm.sh one two");
+TEST_ASSERT_EQUAL_STRING("one2", var_get("v"));
+TEST_ASSERT_EQUAL_INT(1, sh.status);
+int status;
+struct ast *ast = ast_parse("while true; do", &status);
+TEST_ASSERT_EQUAL_INT(PARSE_INCOMPLETE, status);
+ast_free(ast);
+ast = ast_parse("fi", &status);
+TEST_ASSERT_EQUAL_INT(PARSE_ERROR, status);
+ast_free(ast);
+sh_destroy(&sh);
+unlink("/tmp/lab-test-vm");
+unlink("/tmp/lab-test-vm.sh");
+}
+void test_arithmetic(void)
+{
+struct shell sh = {0};
+exec_string(&sh, "a=$((1 + 2 * 3)) b=$(( (1+2) << 2 )) c=$((-7 % 3)) d=$((0x10 | 010)) e=$((1 ? 0 ? 2 : 3 : 4))");
+TEST_ASSERT_EQUAL_STRING("7", var_get("a"));
+TEST_ASSERT_EQUAL_STRING("12", var_get("b"));
+TEST_ASSERT_EQUAL_STRING("-1", var_get("c"));
+TEST_ASSERT_EQUAL_STRING("24", var_get("d"));
+TEST_ASSERT_EQUAL_STRING("3", var_get("e"));
+// 64-bit wrap around instead of undefined behavior
+exec_string(&sh, "m=$(( 9223372036854775807 + 1 ))");
+TEST_ASSERT_EQUAL_STRING("-9223372036854775808", var_get("m"));
+exec_string(&sh, "i=0; while ((i < 10)); do ((i++, n += i)); done");
+TEST_ASSERT_EQUAL_STRING("10", var_get("i"));
+TEST_ASSERT_EQUAL_STRING("55", var_get("n"));
+TEST_ASSERT_EQUAL_INT(0, sh.status);
+exec_string(&sh, "((n - 55))");
+TEST_ASSERT_EQUAL_INT(1, sh.status);
+// A variable holding an expression is evaluated, $x is expanded first
+exec_string(&sh, "x='i+1'; y=$((x * 2)) z=\"$(($i$i))\"");
+TEST_ASSERT_EQUAL_STRING("22", var_get("y"));
+TEST_ASSERT_EQUAL_STRING("1010", var_get("z"));
+exec_string(&sh, "q=$((1/0))");
+TEST_ASSERT_EQUAL_INT(1, sh.status);
+exec_string(&sh, "q=$((1 +))");
+TEST_ASSERT_EQUAL_INT(1, sh.status);
+TEST_ASSERT_NULL(var_get("q"));
+sh_destroy(&sh);
+}
+void test_patterns(void)
+{
+TEST_ASSERT_TRUE(pattern_matches("*.c", "lab.c"));
+TEST_ASSERT_FALSE(pattern_matches("*.c", "lab.h"));
+TEST_ASSERT_TRUE(pattern_matches("a?c", "abc"));
+TEST_ASSERT_TRUE(pattern_matches("[a-c]x[!0-9]", "bxy"));
+TEST_ASSERT_FALSE(pattern_matches("[a-c]x[!0-9]", "bx1"));
+TEST_ASSERT_TRUE(pattern_matches("[]]", "]"));
+TEST_ASSERT_TRUE(pattern_matches("[[:upper:]]*", "Makefile"));
+TEST_ASSERT_TRUE(pattern_matches("a\\*", "a*"));
+TEST_ASSERT_FALSE(pattern_matches("a\\*", "ab"));
+TEST_ASSERT_TRUE(pattern_matches("[ab", "[ab"));
+TEST_ASSERT_TRUE(pattern_matches("*a*b*c*", "xxaxxbxxcxx"));
+TEST_ASSERT_TRUE(pattern_matches("", ""));
+// More positions than fit in one word
+char pat[200], str[200];
+memset(pat, '?', 150);
+strcpy(pat + 150, "*z");
+memset(str, 'y', 170);
+strcpy(str + 170, "z");
+TEST_ASSERT_TRUE(pattern_matches(pat, str));
+str[170] = 'y';
+TEST_ASSERT_FALSE(pattern_matches(pat, str));
+// The compiled pattern comes from the cache the second time
+struct pattern *p = pattern_get("*.c", 3);
+struct pattern *q = pattern_get("*.c", 3);
+TEST_ASSERT_EQUAL_PTR(p, q);
+pattern_put(p);
+pattern_put(q);
+
+struct shell sh = {0};
+mkdir("/tmp/lab-test-glob", 0755);
+mkdir("/tmp/lab-test-glob/d", 0755);
+close(open("/tmp/lab-test-glob/b.c", O_CREAT | O_WRONLY, 0644));
+close(open("/tmp/lab-test-glob/a.c", O_CREAT | O_WRONLY, 0644));
+close(open("/tmp/lab-test-glob/.h.c", O_CREAT | O_WRONLY, 0644));
+close(open("/tmp/lab-test-glob/d/e.c", O_CREAT | O_WRONLY, 0644));
+exec_string(&sh, "g=; for f in /tmp/lab-test-glob/*.c /tmp/lab-test-glob/*/*.c '/tmp/lab-test-glob/*.c' /tmp/lab-test-glob/*.x; do g=\"$g $f\"; done");
+TEST_ASSERT_EQUAL_STRING(" /tmp/lab-test-glob/a.c /tmp/lab-test-glob/b.c /tmp/lab-test-glob/d/e.c /tmp/lab-test-glob/*.c /tmp/lab-test-glob/*.x", var_get("g"));
+exec_string(&sh, "[[ a.c == *.[ch] && ! abc == \"a*\" && ( -d /tmp/lab-test-glob/d || x == y ) ]]");
+TEST_ASSERT_EQUAL_INT(0, sh.status);
+exec_string(&sh, "[[ 3 -lt 2 || -z x ]]");
+TEST_ASSERT_EQUAL_INT(1, sh.status);
+exec_string(&sh, "[[ a == ]]");
+TEST_ASSERT_EQUAL_INT(2, sh.status);
+sh_destroy(&sh);
+unlink("/tmp/lab-test-glob/a.c");
+unlink("/tmp/lab-test-glob/b.c");
+unlink("/tmp/lab-test-glob/.h.c");
+unlink("/tmp/lab-test-glob/d/e.c");
+rmdir("/tmp/lab-test-glob/d");
+rmdir("/tmp/lab-test-glob");
+}
+void test_regex_match(void)
+{
+struct shell sh = {0};
+exec_string(&sh, "l='2024-05-01 ERROR disk full'; [[ $l =~ ^([0-9]+)-[0-9-]+\\ (ERROR|WARN)\\ (.*)$ ]]");
+TEST_ASSERT_EQUAL_INT(0, sh.status);
+TEST_ASSERT_EQUAL_INT(4, sh.nmatch);
+TEST_ASSERT_EQUAL_STRING("2024", sh.match[1]);
+TEST_ASSERT_EQUAL_STRING("ERROR", sh.match[2]);
+TEST_ASSERT_EQUAL_STRING("disk full", sh.match[3]);
+exec_string(&sh, "m=\"$MATCH ${MATCH[2]} ${#MATCH[@]}\"");
+TEST_ASSERT_EQUAL_STRING("2024-05-01 ERROR disk full ERROR 4", var_get("m"));
+// Quoted text matches literally, a failed match empties MATCH
+exec_string(&sh, "[[ abc =~ \"a.c\" ]]");
+TEST_ASSERT_EQUAL_INT(1, sh.status);
+TEST_ASSERT_EQUAL_INT(0, sh.nmatch);
+exec_string(&sh, "[[ x =~ a{ ]]");
+TEST_ASSERT_EQUAL_INT(2, sh.status);
+// The compiled expression is kept while it is in use, the oldest goes
+char *error = NULL;
+const regex_t *re = regcache_get("^a+$", &error);
+TEST_ASSERT_NOT_NULL(re);
+TEST_ASSERT_EQUAL_PTR(re, regcache_get("^a+$", &error));
+char buf[16];
+for (int i = 0; i < REGCACHE_MAX; i++) {
+snprintf(buf, sizeof(buf), "x%d", i);
+regcache_get(buf, &error);
+regcache_get("^a+$", &error);
+}
+TEST_ASSERT_EQUAL_PTR(re, regcache_get("^a+$", &error));
+TEST_ASSERT_NULL(error);
+sh_destroy(&sh);
+}
+void test_read_builtin(void)
+{
+struct shell sh = {0};
+FILE *f = fopen("/tmp/lab-test-read", "w");
+fputs("one two three\n  a\\ b  c  \nx\\\ny\nlast", f);
+fclose(f);
+exec_string(&sh, "s=; while read -r first rest; do s=\"$s[$first|$rest]\"; done < /tmp/lab-test-read");
+TEST_ASSERT_EQUAL_STRING("[one|two three][a\\|b  c][x\\|][y|]", var_get("s"));
+TEST_ASSERT_EQUAL_STRING("last", var_get("first"));
+// Without -r a backslash quotes and joins lines, IFS= only lasts for read
+exec_string(&sh, "s=; while IFS= read l; do s=\"$s[$l]\"; done < /tmp/lab-test-read");
+TEST_ASSERT_EQUAL_STRING("[one two three][  a b  c  ][xy]", var_get("s"));
+TEST_ASSERT_NULL(var_get("IFS"));
+TEST_ASSERT_EQUAL_INT(0, sh.status);
+exec_string(&sh, "{ read -a words; read -d r; } < /tmp/lab-test-read");
+TEST_ASSERT_EQUAL_INT(1, sh.status);
+exec_string(&sh, "n=${#words[@]} w=${words[2]}");
+TEST_ASSERT_EQUAL_STRING("3", var_get("n"));
+TEST_ASSERT_EQUAL_STRING("three", var_get("w"));
+TEST_ASSERT_EQUAL_STRING("  a b  c  \nxy\nlast", var_get("REPLY"));
+// The next command finds the input right after the line, from a file
+// that was read ahead and from a pipe
+exec_string(&sh, "{ read a; cat >/tmp/lab-test-read.out; } < /tmp/lab-test-read");
+TEST_ASSERT_EQUAL_STRING("  a\\ b  c  \nx\\\ny\nlast", read_file("/tmp/lab-test-read.out"));
+exec_string(&sh, "printf 'h\\nb\\nc\\n' | { read a; read b; cat >/tmp/lab-test-read.out; }");
+TEST_ASSERT_EQUAL_STRING("c\n", read_file("/tmp/lab-test-read.out"));
+exec_string(&sh, "IFS=: read u v < /tmp/lab-test-read.out; read 1x < /tmp/lab-test-read.out");
+TEST_ASSERT_EQUAL_INT(1, sh.status);
+sh_destroy(&sh);
+unlink("/tmp/lab-test-read");
+unlink("/tmp/lab-test-read.out");
+}
+void test_mapfile(void)
+{
+struct shell sh = {0};
+FILE *f = fopen("/tmp/lab-test-mapfile", "w");
+fputs("l1\nl2\n\nl4\nl5", f);
+fclose(f);
+exec_string(&sh, "mapfile -t a < /tmp/lab-test-mapfile");
+struct array *a = var_array("a");
+TEST_ASSERT_NOT_NULL(a);
+TEST_ASSERT_EQUAL_UINT(5, a->n);
+TEST_ASSERT_EQUAL_STRING("l1", array_get(a, 0));
+TEST_ASSERT_EQUAL_STRING("", array_get(a, 2));
+TEST_ASSERT_EQUAL_STRING("l5", array_get(a, 4));
+// The lines share one block instead of an allocation each
+TEST_ASSERT_EQUAL_UINT(1, a->nblobs);
+exec_string(&sh, "mapfile a < /tmp/lab-test-mapfile; x=${a[1]}; n=${#a[@]}");
+TEST_ASSERT_EQUAL_STRING("l2\n", var_get("x"));
+TEST_ASSERT_EQUAL_STRING("5", var_get("n"));
+// -n leaves the rest of the input for the next command
+exec_string(&sh, "{ readarray -t -s 1 -n 2 b; read c; } < /tmp/lab-test-mapfile; r=\"${b[@]}|$c\"");
+TEST_ASSERT_EQUAL_STRING("l2 |l4", var_get("r"));
+exec_string(&sh, "{ read first; mapfile -t; } < /tmp/lab-test-mapfile; r=\"$first ${#MAPFILE[@]} ${MAPFILE[3]}\"");
+TEST_ASSERT_EQUAL_STRING("l1 4 l5", var_get("r"));
+exec_string(&sh, "printf 'x,y,z' | { mapfile -d , -t c; test \"${c[2]}\" = z; }");
+TEST_ASSERT_EQUAL_INT(0, sh.status);
+// -O keeps the elements it does not write and piles up no blocks
+exec_string(&sh, "a=(x y z w q r s); mapfile -t -O 1 a < /tmp/lab-test-mapfile; mapfile -t -O 1 a < /tmp/lab-test-mapfile");
+a = var_array("a");
+TEST_ASSERT_EQUAL_UINT(7, a->n);
+TEST_ASSERT_EQUAL_STRING("x", array_get(a, 0));
+TEST_ASSERT_EQUAL_STRING("l1", array_get(a, 1));
+TEST_ASSERT_EQUAL_STRING("l5", array_get(a, 5));
+TEST_ASSERT_EQUAL_STRING("s", array_get(a, 6));
+TEST_ASSERT_EQUAL_UINT(0, a->nblobs);
+exec_string(&sh, "mapfile -n x a");
+TEST_ASSERT_EQUAL_INT(2, sh.status);
+sh_destroy(&sh);
+unlink("/tmp/lab-test-mapfile");
+}
+void test_arrays(void)
+{
+struct shell sh = {0};
+exec_string(&sh, "declare -A m; m[x]=1; m[\"a b\"]=2; k=x; m[$k]+=0; r=\"${m[x]} ${m[a b]} ${#m[@]}\"");
+TEST_ASSERT_EQUAL_STRING("10 2 2", var_get("r"));
+exec_string(&sh, "unset 'm[x]'; declare -A c=([p]=1 [q]=\"two words\"); r=\"${#m[@]} ${c[q]} ${!c[@]}\"");
+TEST_ASSERT_EQUAL_UINT(1, var_assoc("m")->n);
+TEST_ASSERT_TRUE(strcmp(var_get("r"), "1 two words p q") == 0 || strcmp(var_get("r"), "1 two words q p") == 0);
+// A gap makes the array sparse instead of filling it
+exec_string(&sh, "a=(one \"two three\" four); a[1000000]=big; unset 'a[1]'; r=\"${#a[@]} ${!a[@]} ${a[-1]}\"");
+TEST_ASSERT_EQUAL_STRING("3 0 2 1000000 big", var_get("r"));
+struct array *a = var_array("a");
+TEST_ASSERT_NOT_NULL(a->idx);
+TEST_ASSERT_EQUAL_UINT(3, a->n);
+TEST_ASSERT_NULL(array_get(a, 1));
+exec_string(&sh, "a+=(x); s=str; s+=ing; s[1]=two; r=\"${a[1000001]} ${s[@]}\"");
+TEST_ASSERT_EQUAL_STRING("x string two", var_get("r"));
+exec_string(&sh, "declare -a m");
+TEST_ASSERT_EQUAL_INT(1, sh.status);
+exec_string(&sh, "a=(1 2) cat");
+TEST_ASSERT_EQUAL_INT(1, sh.status);
+sh_destroy(&sh);
+}
+void test_alias(void)
+{
+struct shell sh = {0};
+exec_string(&sh, "alias setx='x=\"a  b\"; declare' d=declare; d -a arr; arr[2]=two; setx y=1");
+const struct alias *a = alias_find("d");
+TEST_ASSERT_NOT_NULL(a);
+TEST_ASSERT_EQUAL_UINT(1, a->nwords);
+// A body with operators is kept as text for the parser
+TEST_ASSERT_NULL(alias_find("setx")->words);
+TEST_ASSERT_EQUAL_STRING("two", array_get(var_array("arr"), 2));
+TEST_ASSERT_EQUAL_STRING("a  b", var_get("x"));
+TEST_ASSERT_EQUAL_STRING("1", var_get("y"));
+exec_string(&sh, "alias s='d ' v=r=3; s v; 'd' z=4");
+TEST_ASSERT_EQUAL_STRING("3", var_get("r"));
+TEST_ASSERT_EQUAL_INT(127, sh.status);
+exec_string(&sh, "alias ls='ls -l -a'");
+char **argv = cmd_parse("ls /tmp");
+TEST_ASSERT_EQUAL_STRING("ls", argv[0]);
+TEST_ASSERT_EQUAL_STRING("-a", argv[2]);
+TEST_ASSERT_EQUAL_STRING("/tmp", argv[3]);
+TEST_ASSERT_NULL(argv[4]);
+cmd_free(argv);
+exec_string(&sh, "unalias ls nope");
+TEST_ASSERT_EQUAL_INT(1, sh.status);
+TEST_ASSERT_NULL(alias_find("ls"));
+// A body removed while it runs lives until the command is done
+exec_string(&sh, "alias rr='unalias rr; alias rr=x; echo a >/tmp/lab-test-alias'; rr");
+TEST_ASSERT_EQUAL_STRING("a\n", read_file("/tmp/lab-test-alias"));
+TEST_ASSERT_EQUAL_STRING("x", alias_find("rr")->text);
+unlink("/tmp/lab-test-alias");
+sh_destroy(&sh);
+}
+void test_rc_cache(void)
+{
+const char *rc = "/tmp/lab-test-rc";
+const char *cache = "/tmp/lab-test-rc" RC_CACHE_SUFFIX;
+unlink(cache);
+FILE *f = fopen(rc, "w");
+fputs("alias rcl='echo 1'\nrcf() { rcv=$1; }\nfor i in 1 2 3; do rcf $i; done\ncat <<EOF >/tmp/lab-test-rc-out\nhere $i\nEOF\n", f);
+fclose(f);
+struct shell sh = {0};
+source_rc(&sh, rc);
+struct stat st;
+TEST_ASSERT_EQUAL_INT(0, stat(cache, &st));
+var_set("rcv", "", false);
+unlink("/tmp/lab-test-rc-out");
+exec_string(&sh, "unalias rcl");
+// The second time the program comes from the cache
+source_rc(&sh, rc);
+TEST_ASSERT_EQUAL_STRING("3", var_get("rcv"));
+TEST_ASSERT_EQUAL_STRING("here 3\n", read_file("/tmp/lab-test-rc-out"));
+TEST_ASSERT_EQUAL_STRING("echo 1", alias_find("rcl")->text);
+// Text of the same size with a new time is parsed again
+f = fopen(rc, "w");
+fputs("alias rcl='echo 2'\nrcf() { rcv=$1; }\nfor i in 4 5 6; do rcf $i; done\ncat <<EOF >/tmp/lab-test-rc-out\nhere $i\nEOF\n", f);
+fclose(f);
+struct timespec times[2] = { { 0, UTIME_NOW }, { st.st_mtim.tv_sec + 1, 0 } };
+utimensat(AT_FDCWD, rc, times, 0);
+source_rc(&sh, rc);
+TEST_ASSERT_EQUAL_STRING("6", var_get("rcv"));
+TEST_ASSERT_EQUAL_STRING("echo 2", alias_find("rcl")->text);
+sh_destroy(&sh);
+unlink(rc);
+unlink(cache);
+unlink("/tmp/lab-test-rc-out");
+}
 int main(void) {
 UNITY_BEGIN();
 RUN_TEST(test_cmd_parse);
@@ -153,5 +1160,38 @@ RUN_TEST(test_get_prompt_default);
 RUN_TEST(test_get_prompt_custom);
 RUN_TEST(test_ch_dir_home);
 RUN_TEST(test_ch_dir_root);
+RUN_TEST(test_parse_heredoc_body);
+RUN_TEST(test_parse_heredoc_incomplete);
+RUN_TEST(test_heredoc_memfd_reused);
+RUN_TEST(test_herestring);
+RUN_TEST(test_process_substitution);
+RUN_TEST(test_parse_pipeline);
+RUN_TEST(test_pipeline_status);
+RUN_TEST(test_background_job);
+RUN_TEST(test_prompt_render);
+RUN_TEST(test_prompt_async_vcs);
+RUN_TEST(test_histlog);
+RUN_TEST(test_histsearch);
+RUN_TEST(test_histshare);
+RUN_TEST(test_history_builtin);
+RUN_TEST(test_history_expansion);
+RUN_TEST(test_trie_complete);
+RUN_TEST(test_command_hash);
+RUN_TEST(test_complete_files);
+RUN_TEST(test_fuzzy_suggest);
+RUN_TEST(test_dirdb);
+RUN_TEST(test_dir_stack);
+RUN_TEST(test_shell_vars);
+RUN_TEST(test_arena);
+RUN_TEST(test_functions);
+RUN_TEST(test_control_flow);
+RUN_TEST(test_arithmetic);
+RUN_TEST(test_patterns);
+RUN_TEST(test_regex_match);
+RUN_TEST(test_read_builtin);
+RUN_TEST(test_mapfile);
+RUN_TEST(test_arrays);
+RUN_TEST(test_alias);
+RUN_TEST(test_rc_cache);
 return UNITY_END();
 }
\ No newline at end of file